@@ -0,0 +1,145 @@
+//
+//  ColorBenchmark.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// Compares the batch kernels of DPHueColor with the usual scalar conversion,
+// one light at a time with powf per channel, on random colors for lamps of
+// mixed gamuts. Reports nanoseconds per color and the largest difference
+// between the two.
+//
+// Usage: ColorBenchmark [count ...]
+
+#import <Foundation/Foundation.h>
+#import "DPHueColor.h"
+
+#pragma mark - Scalar reference
+
+static float _ScalarLinearize(float aValue) {
+    aValue = MAX(0, MIN(1, aValue));
+    return aValue > 0.04045f ? powf((aValue + 0.055f) / 1.055f, 2.4f) : aValue / 12.92f;
+}
+
+static void _ScalarClosestOnSegment(float aPX, float aPY, float anAX, float anAY, float aBX, float aBY,
+                                    float* aQX, float* aQY, float* aDistance) {
+    float anABX = aBX - anAX, anABY = aBY - anAY;
+    float aLength = anABX * anABX + anABY * anABY;
+    float aT = aLength > 0 ? ((aPX - anAX) * anABX + (aPY - anAY) * anABY) / aLength : 0;
+    aT = MAX(0, MIN(1, aT));
+    *aQX = anAX + aT * anABX;
+    *aQY = anAY + aT * anABY;
+    *aDistance = (aPX - *aQX) * (aPX - *aQX) + (aPY - *aQY) * (aPY - *aQY);
+}
+
+static void _ScalarRGBToXY(float aRed, float aGreen, float aBlue, DPHueGamut aGamut, float* anX, float* aY) {
+    float aR = _ScalarLinearize(aRed), aG = _ScalarLinearize(aGreen), aB = _ScalarLinearize(aBlue);
+    float aX = aR * 0.664511f + aG * 0.154324f + aB * 0.162028f;
+    float aYY = aR * 0.283881f + aG * 0.668433f + aB * 0.047685f;
+    float aZ = aR * 0.000088f + aG * 0.072310f + aB * 0.986039f;
+    float aSum = aX + aYY + aZ;
+    if (aSum <= 0) {
+        *anX = 0.3227f;
+        *aY = 0.329f;
+        return;
+    }
+    float aPX = aX / aSum, aPY = aYY / aSum;
+    float aD1 = (aPX - aGamut.redX) * (aGamut.greenY - aGamut.redY) - (aPY - aGamut.redY) * (aGamut.greenX - aGamut.redX);
+    float aD2 = (aPX - aGamut.greenX) * (aGamut.blueY - aGamut.greenY) - (aPY - aGamut.greenY) * (aGamut.blueX - aGamut.greenX);
+    float aD3 = (aPX - aGamut.blueX) * (aGamut.redY - aGamut.blueY) - (aPY - aGamut.blueY) * (aGamut.redX - aGamut.blueX);
+    BOOL aNegative = aD1 < 0 || aD2 < 0 || aD3 < 0;
+    BOOL aPositive = aD1 > 0 || aD2 > 0 || aD3 > 0;
+    if (!(aNegative && aPositive)) {
+        *anX = aPX;
+        *aY = aPY;
+        return;
+    }
+    float aQX, aQY, aDistance, aBestX, aBestY, aBest;
+    _ScalarClosestOnSegment(aPX, aPY, aGamut.redX, aGamut.redY, aGamut.greenX, aGamut.greenY, &aBestX, &aBestY, &aBest);
+    _ScalarClosestOnSegment(aPX, aPY, aGamut.greenX, aGamut.greenY, aGamut.blueX, aGamut.blueY, &aQX, &aQY, &aDistance);
+    if (aDistance < aBest) {
+        aBestX = aQX; aBestY = aQY; aBest = aDistance;
+    }
+    _ScalarClosestOnSegment(aPX, aPY, aGamut.blueX, aGamut.blueY, aGamut.redX, aGamut.redY, &aQX, &aQY, &aDistance);
+    if (aDistance < aBest) {
+        aBestX = aQX; aBestY = aQY;
+    }
+    *anX = aBestX;
+    *aY = aBestY;
+}
+
+#pragma mark - C functions
+
+static NSTimeInterval _Now(void) {
+    return [NSProcessInfo processInfo].systemUptime;
+}
+
+static void _Run(NSUInteger aCount) {
+    float* aRed = malloc(aCount * sizeof(float));
+    float* aGreen = malloc(aCount * sizeof(float));
+    float* aBlue = malloc(aCount * sizeof(float));
+    float* aKelvin = malloc(aCount * sizeof(float));
+    float* anX = malloc(aCount * sizeof(float));
+    float* aY = malloc(aCount * sizeof(float));
+    float* aScalarX = malloc(aCount * sizeof(float));
+    float* aScalarY = malloc(aCount * sizeof(float));
+    float* aMired = malloc(aCount * sizeof(float));
+    DPHueGamut* aGamuts = malloc(aCount * sizeof(DPHueGamut));
+    NSArray<NSString*>* aModels = @[@"LCT001", @"LCT015", @"LST001", @"unknown"];
+    for (NSUInteger i = 0; i < aCount; i++) {
+        aRed[i] = arc4random_uniform(1001) / 1000.0f;
+        aGreen[i] = arc4random_uniform(1001) / 1000.0f;
+        aBlue[i] = arc4random_uniform(1001) / 1000.0f;
+        aKelvin[i] = 1500 + arc4random_uniform(6000);
+        aGamuts[i] = [DPHueColor gamutForModelId:aModels[i % aModels.count]];
+    }
+    NSUInteger anIterations = MAX(1, 10000000 / aCount);
+
+    NSTimeInterval aStartedAt = _Now();
+    for (NSUInteger anIteration = 0; anIteration < anIterations; anIteration++)
+        for (NSUInteger i = 0; i < aCount; i++)
+            _ScalarRGBToXY(aRed[i], aGreen[i], aBlue[i], aGamuts[i], &aScalarX[i], &aScalarY[i]);
+    NSTimeInterval aScalar = (_Now() - aStartedAt) / anIterations / aCount;
+
+    aStartedAt = _Now();
+    for (NSUInteger anIteration = 0; anIteration < anIterations; anIteration++)
+        [DPHueColor convertRed:aRed green:aGreen blue:aBlue toX:anX y:aY brightness:NULL count:aCount gamuts:aGamuts];
+    NSTimeInterval aBatch = (_Now() - aStartedAt) / anIterations / aCount;
+
+    aStartedAt = _Now();
+    for (NSUInteger anIteration = 0; anIteration < anIterations; anIteration++)
+        for (NSUInteger i = 0; i < aCount; i++)
+            aMired[i] = MAX(154, MIN(500, 1000000 / aKelvin[i]));
+    NSTimeInterval aScalarMired = (_Now() - aStartedAt) / anIterations / aCount;
+
+    aStartedAt = _Now();
+    for (NSUInteger anIteration = 0; anIteration < anIterations; anIteration++)
+        [DPHueColor convertKelvin:aKelvin toMired:aMired count:aCount];
+    NSTimeInterval aBatchMired = (_Now() - aStartedAt) / anIterations / aCount;
+
+    float aDifference = 0;
+    for (NSUInteger i = 0; i < aCount; i++)
+        aDifference = MAX(aDifference, MAX(fabsf(anX[i] - aScalarX[i]), fabsf(aY[i] - aScalarY[i])));
+
+    printf("%8lu colors  rgb->xy scalar %6.1f ns  batch %6.1f ns  x%4.1f  max diff %.2g  |  K->mired scalar %5.2f ns  batch %5.2f ns  x%4.1f\n",
+           (unsigned long)aCount, aScalar * 1e9, aBatch * 1e9, aScalar / aBatch, aDifference,
+           aScalarMired * 1e9, aBatchMired * 1e9, aScalarMired / aBatchMired);
+
+    free(aRed); free(aGreen); free(aBlue); free(aKelvin);
+    free(anX); free(aY); free(aScalarX); free(aScalarY); free(aMired); free(aGamuts);
+}
+
+int main(int argc, const char* argv[]) {
+    @autoreleasepool {
+        NSMutableArray<NSNumber*>* aCounts = [NSMutableArray new];
+        for (int i = 1; i < argc; i++)
+            [aCounts addObject:@(strtoul(argv[i], NULL, 10))];
+        if (!aCounts.count)
+            [aCounts addObjectsFromArray:@[@50, @1000, @100000]];
+        for (NSNumber* aCount in aCounts)
+            _Run(aCount.unsignedIntegerValue);
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+//
+//  DPHueBenchmarkPayloads.h
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// Synthetic controller responses shaped like those of a real Hue bridge,
+// for benchmarks that must not depend on the hardware at hand.
+
+#import <Foundation/Foundation.h>
+
+@interface DPHueBenchmarkPayloads : NSObject
+
+/// GET /api/{username}/lights with @p aLightCount lights.
++ (NSDictionary *)lightsWithCount:(NSUInteger)aLightCount;
+
+/// GET /api/{username}/groups, one room of up to 10 lights per 10 lights.
++ (NSDictionary *)groupsWithLightCount:(NSUInteger)aLightCount;
+
+/// GET /api/{username}/config
++ (NSDictionary *)config;
+
+/**
+ GET /api/{username}: lights, groups and config as above, plus the schedules, scenes,
+ rules, sensors and resource links a busy installation of that size would have.
+ */
++ (NSDictionary *)fullStateWithLightCount:(NSUInteger)aLightCount;
+
+/// @p anObject serialized the way the controller sends it.
++ (NSData *)dataWithJSONObject:(id)anObject;
+
+@end
@@ -0,0 +1,113 @@
+//
+//  DPHueBenchmarkPayloads.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueBenchmarkPayloads.h"
+
+@implementation DPHueBenchmarkPayloads
+
++ (NSDictionary *)lightsWithCount:(NSUInteger)aLightCount {
+    NSMutableDictionary* aLights = [NSMutableDictionary dictionaryWithCapacity:aLightCount];
+    for (NSUInteger i = 1; i <= aLightCount; i++) {
+        aLights[[@(i) stringValue]] = @{
+            @"state": @{@"on": @(i % 2 == 0), @"bri": @(i % 254 + 1), @"hue": @((i * 997) % 65536), @"sat": @(i % 255),
+                        @"effect": @"none", @"xy": @[@0.4573, @0.41], @"ct": @(153 + i % 347), @"alert": @"none",
+                        @"colormode": @"xy", @"mode": @"homeautomation", @"reachable": @YES},
+            @"swupdate": @{@"state": @"noupdates", @"lastinstall": @"2018-01-02T19:24:20"},
+            @"type": @"Extended color light",
+            @"name": [NSString stringWithFormat:@"Hue color lamp %lu", (unsigned long)i],
+            @"modelid": @"LCT016",
+            @"manufacturername": @"Philips",
+            @"productname": @"Hue color lamp",
+            @"capabilities": @{@"certified": @YES,
+                               @"control": @{@"mindimlevel": @1000, @"maxlumen": @800, @"colorgamuttype": @"C",
+                                             @"colorgamut": @[@[@0.6915, @0.3083], @[@0.17, @0.7], @[@0.1532, @0.0475]],
+                                             @"ct": @{@"min": @153, @"max": @500}},
+                               @"streaming": @{@"renderer": @YES, @"proxy": @YES}},
+            @"config": @{@"archetype": @"sultanbulb", @"function": @"mixed", @"direction": @"omnidirectional"},
+            @"uniqueid": [NSString stringWithFormat:@"00:17:88:01:03:%02lx:%02lx:%02lx-0b", (unsigned long)(i >> 16 & 0xff), (unsigned long)(i >> 8 & 0xff), (unsigned long)(i & 0xff)],
+            @"swversion": @"1.46.13_r26312",
+        };
+    }
+    return aLights;
+}
+
++ (NSDictionary *)groupsWithLightCount:(NSUInteger)aLightCount {
+    NSMutableDictionary* aGroups = [NSMutableDictionary new];
+    for (NSUInteger aFirst = 1, aGroup = 1; aFirst <= aLightCount; aFirst += 10, aGroup++) {
+        NSMutableArray* aLightIds = [NSMutableArray new];
+        for (NSUInteger i = aFirst; i < aFirst + 10 && i <= aLightCount; i++)
+            [aLightIds addObject:[@(i) stringValue]];
+        aGroups[[@(aGroup) stringValue]] = @{
+            @"name": [NSString stringWithFormat:@"Room %lu", (unsigned long)aGroup],
+            @"lights": aLightIds,
+            @"sensors": @[],
+            @"type": @"Room",
+            @"state": @{@"all_on": @NO, @"any_on": @YES},
+            @"recycle": @NO,
+            @"class": @"Living room",
+            @"action": @{@"on": @YES, @"bri": @254, @"hue": @8402, @"sat": @140, @"effect": @"none",
+                         @"xy": @[@0.4573, @0.41], @"ct": @366, @"alert": @"none", @"colormode": @"ct"},
+        };
+    }
+    return aGroups;
+}
+
++ (NSDictionary *)config {
+    NSMutableDictionary* aWhitelist = [NSMutableDictionary new];
+    for (NSUInteger i = 0; i < 20; i++)
+        aWhitelist[[NSString stringWithFormat:@"%040lu", (unsigned long)i]] = @{@"last use date": @"2020-03-01T10:00:00", @"create date": @"2018-01-01T10:00:00", @"name": @"QuickHue#mac"};
+    return @{@"name": @"Philips hue", @"zigbeechannel": @15, @"bridgeid": @"001788FFFE23BFC2", @"mac": @"00:17:88:23:bf:c2",
+             @"dhcp": @YES, @"ipaddress": @"192.168.1.7", @"netmask": @"255.255.255.0", @"gateway": @"192.168.1.1",
+             @"proxyaddress": @"none", @"proxyport": @0, @"UTC": @"2020-03-01T10:00:00", @"localtime": @"2020-03-01T11:00:00",
+             @"timezone": @"Europe/Amsterdam", @"modelid": @"BSB002", @"datastoreversion": @"98", @"swversion": @"1941132080",
+             @"apiversion": @"1.41.0", @"linkbutton": @NO, @"portalservices": @YES, @"whitelist": aWhitelist};
+}
+
++ (NSDictionary *)fullStateWithLightCount:(NSUInteger)aLightCount {
+    NSMutableDictionary* aSchedules = [NSMutableDictionary new];
+    NSMutableDictionary* aScenes = [NSMutableDictionary new];
+    NSMutableDictionary* aRules = [NSMutableDictionary new];
+    NSMutableDictionary* aSensors = [NSMutableDictionary new];
+    NSMutableDictionary* aResourceLinks = [NSMutableDictionary new];
+    for (NSUInteger i = 1; i <= MAX(1, aLightCount / 5); i++)
+        aSchedules[[@(i) stringValue]] = @{@"name": @"Wake up", @"description": @"Wake up routine", @"status": @"enabled",
+                                          @"command": @{@"address": @"/api/user/groups/1/action", @"method": @"PUT", @"body": @{@"scene": @"abcdefgh12345678"}},
+                                          @"localtime": @"W124/T06:30:00", @"created": @"2018-01-01T10:00:00", @"autodelete": @NO};
+    for (NSUInteger i = 1; i <= aLightCount / 2 + 1; i++) {
+        NSMutableArray* aLightIds = [NSMutableArray new];
+        for (NSUInteger j = 0; j < 10 && j < aLightCount; j++)
+            [aLightIds addObject:[@((i + j) % aLightCount + 1) stringValue]];
+        aScenes[[NSString stringWithFormat:@"scene%011lu", (unsigned long)i]] = @{@"name": @"Relax", @"type": @"GroupScene", @"group": @"1", @"lights": aLightIds,
+                                                                                  @"owner": @"0000000000000000000000000000000000000000", @"recycle": @NO, @"locked": @NO,
+                                                                                  @"appdata": @{@"version": @1, @"data": @"abc_r01_d01"}, @"picture": @"",
+                                                                                  @"lastupdated": @"2020-03-01T10:00:00", @"version": @2};
+    }
+    for (NSUInteger i = 1; i <= aLightCount / 4 + 1; i++)
+        aRules[[@(i) stringValue]] = @{@"name": @"Switch on", @"owner": @"0000000000000000000000000000000000000000", @"created": @"2018-01-01T10:00:00",
+                                      @"lasttriggered": @"none", @"timestriggered": @0, @"status": @"enabled", @"recycle": @NO,
+                                      @"conditions": @[@{@"address": @"/sensors/2/state/buttonevent", @"operator": @"eq", @"value": @"1002"},
+                                                       @{@"address": @"/sensors/2/state/lastupdated", @"operator": @"dx"}],
+                                      @"actions": @[@{@"address": @"/groups/1/action", @"method": @"PUT", @"body": @{@"on": @YES}}]};
+    for (NSUInteger i = 1; i <= aLightCount / 2 + 1; i++)
+        aSensors[[@(i) stringValue]] = @{@"state": @{@"buttonevent": @1002, @"lastupdated": @"2020-03-01T10:00:00"},
+                                        @"config": @{@"on": @YES, @"battery": @100, @"reachable": @YES, @"pending": @[]},
+                                        @"name": @"Dimmer switch", @"type": @"ZLLSwitch", @"modelid": @"RWL021",
+                                        @"manufacturername": @"Philips", @"swversion": @"5.45.1.17846", @"uniqueid": @"00:17:88:01:10:3e:3f:ba-02-fc00"};
+    for (NSUInteger i = 1; i <= aLightCount / 10 + 1; i++)
+        aResourceLinks[[@(i) stringValue]] = @{@"name": @"Dimmer switch", @"description": @"Dimmer switch setup", @"type": @"Link", @"classid": @10020,
+                                              @"owner": @"0000000000000000000000000000000000000000", @"recycle": @NO,
+                                              @"links": @[@"/sensors/2", @"/rules/1", @"/scenes/scene00000000001", @"/groups/1"]};
+    return @{@"lights": [self lightsWithCount:aLightCount], @"groups": [self groupsWithLightCount:aLightCount], @"config": [self config],
+             @"schedules": aSchedules, @"scenes": aScenes, @"rules": aRules, @"sensors": aSensors, @"resourcelinks": aResourceLinks};
+}
+
++ (NSData *)dataWithJSONObject:(id)anObject {
+    return [NSJSONSerialization dataWithJSONObject:anObject options:0 error:nil];
+}
+
+@end
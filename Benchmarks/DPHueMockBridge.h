@@ -0,0 +1,75 @@
+//
+//  DPHueMockBridge.h
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueMockBridge is an in-process stand-in for a Hue bridge, served over
+// HTTP/1.1 on a loopback port. It keeps the state of its lights, groups and
+// schedules, answers with the JSON the real bridge sends, delays responses
+// by a configurable latency, and like the real one answers HTTP 503 when
+// requests arrive faster than it can handle them. Like bridges with API v2
+// it serves an event stream, which tells about every change of a light or
+// group as it happens.
+
+#import <Foundation/Foundation.h>
+
+@interface DPHueMockBridge : NSObject
+
+- (instancetype)initWithLightCount:(NSUInteger)aLightCount;
+
+/// The username the mock accepts, and hands out on registration. Defaults to "benchmark".
+@property (nonatomic, copy) NSString *username;
+
+/// Median response latency in seconds. Defaults to 0.03.
+@property (atomic, assign) NSTimeInterval latency;
+
+/**
+ Spread of the response latency: latencies are log-normally distributed around
+ @p latency with this sigma. Defaults to 0.5, i.e. the slowest 1% take about 3x the median.
+ */
+@property (atomic, assign) double latencySpread;
+
+/// Requests per second the mock handles in the long run; 0 disables rate limiting. Defaults to 25.
+@property (atomic, assign) double maximumRequestsPerSecond;
+
+/// Requests beyond @p maximumRequestsPerSecond accepted in a burst before answering HTTP 503. Defaults to 30.
+@property (atomic, assign) double burstSize;
+
+/// Serve the event stream at /eventstream/clip/v2; if NO, it answers HTTP 404 like older bridges. Defaults to YES.
+@property (atomic, assign) BOOL eventStreamEnabled;
+
+/// Start listening on the loopback interface; a port of 0 picks a free one.
+- (BOOL)startOnPort:(uint16_t)aPort error:(NSError **)anError;
+- (void)stop;
+
+/// The port listened on, once started.
+@property (nonatomic, readonly) uint16_t port;
+
+/// "127.0.0.1:<port>", to pass to DPHueBridge as its host.
+@property (nonatomic, readonly) NSString *host;
+
+/// http://127.0.0.1:<port>/eventstream/clip/v2, to pass to DPHueEventStream as its URL.
+@property (nonatomic, readonly) NSURL *eventStreamURL;
+
+/**
+ Change the state of a light as if a switch or another app had, e.g. to
+ @p {"bri": 127}, and send an event about it.
+ */
+- (void)changeLightWithId:(NSString *)aLightId state:(NSDictionary *)aState;
+
+#pragma mark - Statistics
+
+@property (atomic, readonly) NSUInteger requestCount;
+@property (atomic, readonly) NSUInteger serviceUnavailableCount;
+@property (atomic, readonly) NSUInteger connectionCount;
+@property (atomic, readonly) NSUInteger eventCount;
+
+/// Number of requests per method and path pattern, e.g. "PUT /lights/N/state".
+- (NSDictionary<NSString *, NSNumber *> *)requestCountsByEndpoint;
+
+- (void)resetStatistics;
+
+@end
@@ -0,0 +1,458 @@
+//
+//  DPHueMockBridge.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueMockBridge.h"
+#import "DPHueBenchmarkPayloads.h"
+#import <CocoaAsyncSocket/GCDAsyncSocket.h>
+
+enum {
+    DPHueMockReadHead = 1,
+    DPHueMockReadBody = 2,
+    // Subscribers of the event stream send nothing more; reading only notices when they leave
+    DPHueMockReadStream = 3,
+};
+
+// Events kept for subscribers that reconnect with Last-Event-ID
+static const NSUInteger kDPHueMockEventHistoryLength = 256;
+
+static NSData* _HeadTerminator(void) {
+    static NSData* aTerminator;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        aTerminator = [NSData dataWithBytes:"\r\n\r\n" length:4];
+    });
+    return aTerminator;
+}
+
+@interface DPHueMockBridge () <GCDAsyncSocketDelegate>
+
+@property (atomic, readwrite) NSUInteger requestCount;
+@property (atomic, readwrite) NSUInteger serviceUnavailableCount;
+@property (atomic, readwrite) NSUInteger connectionCount;
+@property (atomic, readwrite) NSUInteger eventCount;
+
+@end
+
+@implementation DPHueMockBridge {
+    dispatch_queue_t queue;
+    GCDAsyncSocket* listener;
+    NSMutableSet<GCDAsyncSocket*>* connections;
+    NSMutableSet<GCDAsyncSocket*>* subscribers;
+    // Events sent, oldest first, as {"number": ..., "data": ...}
+    NSMutableArray<NSDictionary*>* eventHistory;
+    NSUInteger nextEventNumber;
+    // Bridge state, only accessed on queue
+    NSMutableDictionary* lights;
+    NSMutableDictionary* groups;
+    NSMutableDictionary* config;
+    NSMutableDictionary* schedules;
+    NSDictionary* otherResources;
+    NSUInteger nextId;
+    NSMutableDictionary<NSString*, NSNumber*>* endpointCounts;
+    double tokens;
+    NSTimeInterval refilledAt;
+}
+
+- (instancetype)initWithLightCount:(NSUInteger)aLightCount {
+    self = [super init];
+    if (self) {
+        queue = dispatch_queue_create("DPHueMockBridge", DISPATCH_QUEUE_SERIAL);
+        connections = [NSMutableSet new];
+        subscribers = [NSMutableSet new];
+        eventHistory = [NSMutableArray new];
+        nextEventNumber = 1;
+        _eventStreamEnabled = YES;
+        endpointCounts = [NSMutableDictionary new];
+        _username = @"benchmark";
+        _latency = 0.03;
+        _latencySpread = 0.5;
+        _maximumRequestsPerSecond = 25;
+        _burstSize = 30;
+        tokens = _burstSize;
+        refilledAt = [NSProcessInfo processInfo].systemUptime;
+        nextId = 1000;
+
+        NSMutableDictionary* aState = [NSJSONSerialization JSONObjectWithData:[DPHueBenchmarkPayloads dataWithJSONObject:[DPHueBenchmarkPayloads fullStateWithLightCount:aLightCount]]
+                                                                      options:NSJSONReadingMutableContainers error:nil];
+        lights = aState[@"lights"];
+        groups = aState[@"groups"];
+        config = aState[@"config"];
+        schedules = aState[@"schedules"];
+        [aState removeObjectsForKeys:@[@"lights", @"groups", @"config", @"schedules"]];
+        otherResources = aState;
+    }
+    return self;
+}
+
+- (BOOL)startOnPort:(uint16_t)aPort error:(NSError **)anError {
+    listener = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:queue];
+    if (![listener acceptOnInterface:@"127.0.0.1" port:aPort error:anError])
+        return NO;
+    _port = listener.localPort;
+    return YES;
+}
+
+- (void)stop {
+    [listener disconnect];
+    dispatch_sync(queue, ^{
+        for (GCDAsyncSocket* aSocket in connections)
+            [aSocket disconnect];
+        [connections removeAllObjects];
+    });
+}
+
+- (NSString *)host {
+    return [NSString stringWithFormat:@"127.0.0.1:%u", _port];
+}
+
+- (NSURL *)eventStreamURL {
+    return [NSURL URLWithString:[NSString stringWithFormat:@"http://%@/eventstream/clip/v2", self.host]];
+}
+
+- (void)changeLightWithId:(NSString *)aLightId state:(NSDictionary *)aState {
+    dispatch_async(queue, ^{
+        if (!lights[aLightId])
+            return;
+        [lights[aLightId][@"state"] addEntriesFromDictionary:aState];
+        [self publishChanges:aState ofLights:@[aLightId] group:nil];
+    });
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)requestCountsByEndpoint {
+    __block NSDictionary* aCounts;
+    dispatch_sync(queue, ^{
+        aCounts = [endpointCounts copy];
+    });
+    return aCounts;
+}
+
+- (void)resetStatistics {
+    dispatch_sync(queue, ^{
+        [endpointCounts removeAllObjects];
+        self.requestCount = 0;
+        self.serviceUnavailableCount = 0;
+        self.connectionCount = 0;
+        self.eventCount = 0;
+    });
+}
+
+#pragma mark - GCDAsyncSocketDelegate, called on queue
+
+- (void)socket:(GCDAsyncSocket *)aSocket didAcceptNewSocket:(GCDAsyncSocket *)aNewSocket {
+    [connections addObject:aNewSocket];
+    self.connectionCount++;
+    [aNewSocket readDataToData:_HeadTerminator() withTimeout:-1 tag:DPHueMockReadHead];
+}
+
+- (void)socketDidDisconnect:(GCDAsyncSocket *)aSocket withError:(NSError *)anError {
+    [connections removeObject:aSocket];
+    [subscribers removeObject:aSocket];
+}
+
+- (void)socket:(GCDAsyncSocket *)aSocket didReadData:(NSData *)aData withTag:(long)aTag {
+    if (aTag == DPHueMockReadStream) {
+        [aSocket readDataWithTimeout:-1 tag:DPHueMockReadStream];
+        return;
+    }
+    if (aTag == DPHueMockReadHead) {
+        NSString* aHead = [[NSString alloc] initWithData:aData encoding:NSUTF8StringEncoding];
+        NSArray<NSString*>* aLines = [aHead componentsSeparatedByString:@"\r\n"];
+        NSArray<NSString*>* aRequestLine = [aLines.firstObject componentsSeparatedByString:@" "];
+        if (aRequestLine.count < 2) {
+            [aSocket disconnect];
+            return;
+        }
+        NSMutableDictionary* aRequest = [@{@"method": aRequestLine[0], @"path": aRequestLine[1]} mutableCopy];
+        NSUInteger aContentLength = 0;
+        for (NSString* aLine in aLines) {
+            NSRange aColon = [aLine rangeOfString:@":"];
+            if (aColon.location == NSNotFound)
+                continue;
+            NSString* aName = [aLine substringToIndex:aColon.location].lowercaseString;
+            NSString* aValue = [[aLine substringFromIndex:aColon.location + 1] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+            if ([aName isEqualToString:@"content-length"])
+                aContentLength = (NSUInteger)aValue.integerValue;
+            else if ([aName isEqualToString:@"connection"] && [aValue.lowercaseString isEqualToString:@"close"])
+                aRequest[@"close"] = @YES;
+            else if ([aName isEqualToString:@"hue-application-key"])
+                aRequest[@"applicationKey"] = aValue;
+            else if ([aName isEqualToString:@"last-event-id"])
+                aRequest[@"lastEventId"] = aValue;
+        }
+        aSocket.userData = aRequest;
+        if (aContentLength) {
+            [aSocket readDataToLength:aContentLength withTimeout:-1 tag:DPHueMockReadBody];
+            return;
+        }
+        [self handleRequest:aRequest body:nil onSocket:aSocket];
+        return;
+    }
+    [self handleRequest:aSocket.userData body:aData onSocket:aSocket];
+}
+
+#pragma mark - Private, called on queue
+
+- (void)handleRequest:(NSDictionary*)aRequest body:(NSData*)aBody onSocket:(GCDAsyncSocket*)aSocket {
+    self.requestCount++;
+    if ([aRequest[@"method"] isEqualToString:@"GET"] && [aRequest[@"path"] isEqualToString:@"/eventstream/clip/v2"]) {
+        [self subscribe:aSocket request:aRequest];
+        return;
+    }
+    NSInteger aStatus = 200;
+    id aResponse;
+    if ([self takeToken]) {
+        id aJson = aBody.length ? [NSJSONSerialization JSONObjectWithData:aBody options:NSJSONReadingMutableContainers error:nil] : nil;
+        aResponse = [self responseToMethod:aRequest[@"method"] path:aRequest[@"path"] body:aJson];
+    } else {
+        self.serviceUnavailableCount++;
+        aStatus = 503;
+        aResponse = @[@{@"error": @{@"type": @901, @"address": aRequest[@"path"], @"description": @"Internal error, 503"}}];
+    }
+
+    NSData* aResponseBody = [NSJSONSerialization dataWithJSONObject:aResponse options:0 error:nil];
+    NSString* aHead = [NSString stringWithFormat:@"HTTP/1.1 %ld %@\r\nContent-Type: application/json\r\nContent-Length: %lu\r\nConnection: %@\r\n\r\n",
+                       (long)aStatus, aStatus == 200 ? @"OK" : @"Service Unavailable", (unsigned long)aResponseBody.length,
+                       aRequest[@"close"] ? @"close" : @"keep-alive"];
+    NSMutableData* aData = [[aHead dataUsingEncoding:NSASCIIStringEncoding] mutableCopy];
+    [aData appendData:aResponseBody];
+
+    BOOL aClose = [aRequest[@"close"] boolValue];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)([self sampleLatency] * NSEC_PER_SEC)), queue, ^{
+        [aSocket writeData:aData withTimeout:-1 tag:0];
+        if (aClose)
+            [aSocket disconnectAfterWriting];
+        else
+            [aSocket readDataToData:_HeadTerminator() withTimeout:-1 tag:DPHueMockReadHead];
+    });
+}
+
+// The real bridge buffers a few dozen requests and rejects the rest with 503
+- (BOOL)takeToken {
+    if (self.maximumRequestsPerSecond <= 0)
+        return YES;
+    NSTimeInterval aNow = [NSProcessInfo processInfo].systemUptime;
+    tokens = MIN(self.burstSize, tokens + (aNow - refilledAt) * self.maximumRequestsPerSecond);
+    refilledAt = aNow;
+    if (tokens < 1)
+        return NO;
+    tokens -= 1;
+    return YES;
+}
+
+- (NSTimeInterval)sampleLatency {
+    // Box-Muller
+    double u1 = (arc4random_uniform(UINT32_MAX - 1) + 1.0) / UINT32_MAX;
+    double u2 = arc4random_uniform(UINT32_MAX) / (double)UINT32_MAX;
+    double aNormal = sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+    return self.latency * exp(self.latencySpread * aNormal);
+}
+
+- (id)responseToMethod:(NSString*)aMethod path:(NSString*)aPath body:(id)aBody {
+    NSRange aQuery = [aPath rangeOfString:@"?"];
+    if (aQuery.location != NSNotFound)
+        aPath = [aPath substringToIndex:aQuery.location];
+    NSMutableArray<NSString*>* aParts = [[aPath componentsSeparatedByString:@"/"] mutableCopy];
+    [aParts removeObject:@""];
+    if (!aParts.count || ![aParts[0] isEqualToString:@"api"])
+        return [self errorWithType:4 address:aPath description:@"method, GET, not available for resource"];
+
+    if (aParts.count == 1) {
+        [self countEndpoint:[NSString stringWithFormat:@"%@ /api", aMethod]];
+        if ([aMethod isEqualToString:@"POST"])
+            return @[@{@"success": @{@"username": self.username}}];
+        return [self errorWithType:4 address:@"/" description:@"method, GET, not available for resource, /"];
+    }
+    if (![aParts[1] isEqualToString:self.username])
+        return [self errorWithType:1 address:@"/" description:@"unauthorized user"];
+
+    // Path within the API of the user, with ids replaced by N
+    NSArray<NSString*>* aResource = [aParts subarrayWithRange:NSMakeRange(2, aParts.count - 2)];
+    NSMutableArray<NSString*>* aPattern = [NSMutableArray new];
+    for (NSString* aPart in aResource)
+        [aPattern addObject:aPart.integerValue || [aPart isEqualToString:@"0"] ? @"N" : aPart];
+    [self countEndpoint:[NSString stringWithFormat:@"%@ /%@", aMethod, [aPattern componentsJoinedByString:@"/"]]];
+
+    NSString* aKey = [NSString stringWithFormat:@"%@ %@", aMethod, [aPattern componentsJoinedByString:@"/"]];
+    NSString* anId = aResource.count > 1 ? aResource[1] : nil;
+    if ([aKey isEqualToString:@"GET "]) {
+        NSMutableDictionary* aState = [otherResources mutableCopy];
+        aState[@"lights"] = lights;
+        aState[@"groups"] = groups;
+        aState[@"config"] = config;
+        aState[@"schedules"] = schedules;
+        return aState;
+    }
+    if ([aKey isEqualToString:@"GET lights"])
+        return lights;
+    if ([aKey isEqualToString:@"GET groups"])
+        return groups;
+    if ([aKey isEqualToString:@"GET config"])
+        return config;
+    if ([aKey isEqualToString:@"GET schedules"])
+        return schedules;
+    if ([aKey isEqualToString:@"GET lights/N"] && lights[anId])
+        return lights[anId];
+    if ([aKey isEqualToString:@"GET groups/N"] && [self groupWithId:anId])
+        return [self groupWithId:anId];
+    if ([aKey isEqualToString:@"GET schedules/N"] && schedules[anId])
+        return schedules[anId];
+    if ([aKey isEqualToString:@"PUT lights/N/state"] && lights[anId] && [aBody isKindOfClass:[NSDictionary class]]) {
+        [lights[anId][@"state"] addEntriesFromDictionary:aBody];
+        [self publishChanges:aBody ofLights:@[anId] group:nil];
+        return [self successesForBody:aBody address:[NSString stringWithFormat:@"/lights/%@/state", anId]];
+    }
+    if ([aKey isEqualToString:@"PUT groups/N/action"] && [self groupWithId:anId] && [aBody isKindOfClass:[NSDictionary class]]) {
+        NSDictionary* aGroup = [self groupWithId:anId];
+        [aGroup[@"action"] addEntriesFromDictionary:aBody];
+        for (NSString* aLightId in aGroup[@"lights"])
+            [lights[aLightId][@"state"] addEntriesFromDictionary:aBody];
+        [self publishChanges:aBody ofLights:aGroup[@"lights"] group:anId];
+        return [self successesForBody:aBody address:[NSString stringWithFormat:@"/groups/%@/action", anId]];
+    }
+    if ([aKey isEqualToString:@"PUT groups/N"] && groups[anId] && [aBody isKindOfClass:[NSDictionary class]]) {
+        [groups[anId] addEntriesFromDictionary:aBody];
+        return [self successesForBody:aBody address:[NSString stringWithFormat:@"/groups/%@", anId]];
+    }
+    if ([aKey isEqualToString:@"POST groups"] && [aBody isKindOfClass:[NSDictionary class]]) {
+        NSString* aNewId = [@(nextId++) stringValue];
+        groups[aNewId] = [@{@"name": aBody[@"name"] ?: @"Group", @"lights": aBody[@"lights"] ?: @[], @"type": @"LightGroup",
+                            @"action": [NSMutableDictionary dictionaryWithDictionary:@{@"on": @NO, @"bri": @254, @"alert": @"none", @"colormode": @"ct", @"ct": @366}]} mutableCopy];
+        return @[@{@"success": @{@"id": aNewId}}];
+    }
+    if ([aKey isEqualToString:@"POST schedules"] && [aBody isKindOfClass:[NSDictionary class]]) {
+        NSString* aNewId = [@(nextId++) stringValue];
+        schedules[aNewId] = aBody;
+        return @[@{@"success": @{@"id": aNewId}}];
+    }
+    if ([aKey isEqualToString:@"PUT schedules/N"] && schedules[anId] && [aBody isKindOfClass:[NSDictionary class]]) {
+        [schedules[anId] addEntriesFromDictionary:aBody];
+        return [self successesForBody:aBody address:[NSString stringWithFormat:@"/schedules/%@", anId]];
+    }
+    if ([aKey isEqualToString:@"DELETE schedules/N"] && schedules[anId]) {
+        [schedules removeObjectForKey:anId];
+        return @[@{@"success": [NSString stringWithFormat:@"/schedules/%@ deleted", anId]}];
+    }
+    return [self errorWithType:3 address:[@"/" stringByAppendingString:[aResource componentsJoinedByString:@"/"]] description:@"resource not available"];
+}
+
+#pragma mark - Event stream, called on queue
+
+- (void)subscribe:(GCDAsyncSocket*)aSocket request:(NSDictionary*)aRequest {
+    [self countEndpoint:@"GET /eventstream/clip/v2"];
+    NSInteger aStatus = 200;
+    if (!self.eventStreamEnabled)
+        aStatus = 404;
+    else if (![aRequest[@"applicationKey"] isEqualToString:self.username])
+        aStatus = 403;
+    if (aStatus != 200) {
+        NSString* aHead = [NSString stringWithFormat:@"HTTP/1.1 %ld %@\r\nContent-Length: 0\r\nConnection: keep-alive\r\n\r\n",
+                           (long)aStatus, aStatus == 404 ? @"Not Found" : @"Forbidden"];
+        [aSocket writeData:[aHead dataUsingEncoding:NSASCIIStringEncoding] withTimeout:-1 tag:0];
+        [aSocket readDataToData:_HeadTerminator() withTimeout:-1 tag:DPHueMockReadHead];
+        return;
+    }
+
+    // The stream has no end, so it is sent in chunks, one per event
+    NSString* aHead = @"HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nTransfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\n";
+    [aSocket writeData:[aHead dataUsingEncoding:NSASCIIStringEncoding] withTimeout:-1 tag:0];
+    [self sendEventData:[@": hi\n\n" dataUsingEncoding:NSUTF8StringEncoding] toSocket:aSocket];
+    // Events after the last one received, if still known
+    NSUInteger aLastNumber = (NSUInteger)[aRequest[@"lastEventId"] integerValue];
+    if (aLastNumber)
+        for (NSDictionary* anEvent in eventHistory)
+            if ([anEvent[@"number"] unsignedIntegerValue] > aLastNumber)
+                [self sendEventData:anEvent[@"data"] toSocket:aSocket];
+    [subscribers addObject:aSocket];
+    [aSocket readDataWithTimeout:-1 tag:DPHueMockReadStream];
+}
+
+// An update event of each light in aLightIds, and of the group, in the shape of API v2
+- (void)publishChanges:(NSDictionary*)aState ofLights:(NSArray<NSString*>*)aLightIds group:(NSString*)aGroupId {
+    NSMutableDictionary* aChanges = [NSMutableDictionary new];
+    if (aState[@"on"])
+        aChanges[@"on"] = @{@"on": aState[@"on"]};
+    if (aState[@"bri"])
+        aChanges[@"dimming"] = @{@"brightness": @([aState[@"bri"] doubleValue] * 100.0 / 254.0)};
+    if ([aState[@"xy"] count] == 2)
+        aChanges[@"color"] = @{@"xy": @{@"x": aState[@"xy"][0], @"y": aState[@"xy"][1]}};
+    if (aState[@"ct"])
+        aChanges[@"color_temperature"] = @{@"mirek": aState[@"ct"], @"mirek_valid": @YES};
+    if (!aChanges.count)
+        return;
+
+    NSMutableArray* anItems = [NSMutableArray new];
+    for (NSString* aLightId in aLightIds) {
+        NSMutableDictionary* anItem = [aChanges mutableCopy];
+        anItem[@"id"] = [NSString stringWithFormat:@"00000000-0000-4000-8000-%012lu", (unsigned long)aLightId.integerValue];
+        anItem[@"id_v1"] = [@"/lights/" stringByAppendingString:aLightId];
+        anItem[@"type"] = @"light";
+        [anItems addObject:anItem];
+    }
+    if (aGroupId) {
+        NSMutableDictionary* anItem = [NSMutableDictionary new];
+        anItem[@"on"] = aChanges[@"on"];
+        anItem[@"dimming"] = aChanges[@"dimming"];
+        anItem[@"id"] = [NSString stringWithFormat:@"00000000-0000-4000-9000-%012lu", (unsigned long)aGroupId.integerValue];
+        anItem[@"id_v1"] = [@"/groups/" stringByAppendingString:aGroupId];
+        anItem[@"type"] = @"grouped_light";
+        [anItems addObject:anItem];
+    }
+
+    NSUInteger aNumber = nextEventNumber++;
+    NSArray* anEvent = @[@{@"creationtime": @"2023-01-01T00:00:00Z", @"data": anItems,
+                           @"id": [NSString stringWithFormat:@"00000000-0000-4000-a000-%012lu", (unsigned long)aNumber], @"type": @"update"}];
+    NSMutableData* aData = [[[NSString stringWithFormat:@"id: %lu:0\ndata: ", (unsigned long)aNumber] dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    [aData appendData:[NSJSONSerialization dataWithJSONObject:anEvent options:0 error:nil]];
+    [aData appendBytes:"\n\n" length:2];
+    [eventHistory addObject:@{@"number": @(aNumber), @"data": aData}];
+    if (eventHistory.count > kDPHueMockEventHistoryLength)
+        [eventHistory removeObjectAtIndex:0];
+    self.eventCount++;
+
+    // Events take as long as responses
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)([self sampleLatency] * NSEC_PER_SEC)), queue, ^{
+        for (GCDAsyncSocket* aSocket in subscribers)
+            [self sendEventData:aData toSocket:aSocket];
+    });
+}
+
+- (void)sendEventData:(NSData*)aData toSocket:(GCDAsyncSocket*)aSocket {
+    NSMutableData* aChunk = [[[NSString stringWithFormat:@"%lx\r\n", (unsigned long)aData.length] dataUsingEncoding:NSASCIIStringEncoding] mutableCopy];
+    [aChunk appendData:aData];
+    [aChunk appendBytes:"\r\n" length:2];
+    [aSocket writeData:aChunk withTimeout:-1 tag:0];
+}
+
+// Group 0 is the implicit group of all lights
+- (NSMutableDictionary*)groupWithId:(NSString*)anId {
+    if (![anId isEqualToString:@"0"])
+        return groups[anId];
+    NSMutableDictionary* aGroup = groups[@"0"];
+    if (!aGroup)
+        groups[@"0"] = aGroup = [@{@"name": @"Lightset 0", @"type": @"LightGroup", @"action": [NSMutableDictionary new]} mutableCopy];
+    aGroup[@"lights"] = lights.allKeys;
+    return aGroup;
+}
+
+- (NSArray*)successesForBody:(NSDictionary*)aBody address:(NSString*)anAddress {
+    NSMutableArray* aResults = [NSMutableArray new];
+    [aBody enumerateKeysAndObjectsUsingBlock:^(NSString* aKey, id aValue, BOOL* aStop) {
+        [aResults addObject:@{@"success": @{[NSString stringWithFormat:@"%@/%@", anAddress, aKey]: aValue}}];
+    }];
+    return aResults;
+}
+
+- (NSArray*)errorWithType:(NSInteger)aType address:(NSString*)anAddress description:(NSString*)aDescription {
+    return @[@{@"error": @{@"type": @(aType), @"address": anAddress, @"description": aDescription}}];
+}
+
+- (void)countEndpoint:(NSString*)anEndpoint {
+    endpointCounts[anEndpoint] = @(endpointCounts[anEndpoint].unsignedIntegerValue + 1);
+}
+
+@end
@@ -0,0 +1,134 @@
+//
+//  EncodeBenchmark.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// Compares building the request of a light state write the way DPHue did
+// before DPHueStateEncoder (URL formatted on every write, body written by
+// NSJSONSerialization, request copied) with requestForSettingLightState:
+// and coalescingKeyForSettingLightState as they are now. For each it
+// reports the time and the number of heap allocations per write.
+//
+// Usage: EncodeBenchmark [-writes N] [-iterations N]
+
+#import <Foundation/Foundation.h>
+#import <malloc/malloc.h>
+#import <stdatomic.h>
+#import <sys/mman.h>
+#import "DPHueBridge.h"
+#import "DPHueLight.h"
+
+static malloc_zone_t* defaultZone;
+static void* (*zoneMalloc)(malloc_zone_t*, size_t);
+static void* (*zoneCalloc)(malloc_zone_t*, size_t, size_t);
+static atomic_ullong allocationCount;
+
+#pragma mark - C functions
+
+static NSTimeInterval _Now(void) {
+    return [NSProcessInfo processInfo].systemUptime;
+}
+
+static NSTimeInterval _Median(NSMutableArray<NSNumber*>* aTimes) {
+    [aTimes sortUsingSelector:@selector(compare:)];
+    return aTimes[aTimes.count / 2].doubleValue;
+}
+
+static void* _CountingMalloc(malloc_zone_t* aZone, size_t aSize) {
+    atomic_fetch_add_explicit(&allocationCount, 1, memory_order_relaxed);
+    return zoneMalloc(aZone, aSize);
+}
+
+static void* _CountingCalloc(malloc_zone_t* aZone, size_t aCount, size_t aSize) {
+    atomic_fetch_add_explicit(&allocationCount, 1, memory_order_relaxed);
+    return zoneCalloc(aZone, aCount, aSize);
+}
+
+// Objects and CF buffers come from the default zone, which is read-only once set up
+static void _CountAllocations(void) {
+    defaultZone = malloc_default_zone();
+    uintptr_t aPageSize = (uintptr_t)getpagesize();
+    void* aPage = (void*)((uintptr_t)defaultZone & ~(aPageSize - 1));
+    if (mprotect(aPage, aPageSize, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(stderr, "Could not count allocations, reporting time only\n");
+        return;
+    }
+    zoneMalloc = defaultZone->malloc;
+    zoneCalloc = defaultZone->calloc;
+    defaultZone->malloc = _CountingMalloc;
+    defaultZone->calloc = _CountingCalloc;
+}
+
+// The request and coalescing key as DPHueLight built them before
+static NSURLRequest* _OldRequest(DPHueLight* aLight, NSDictionary* aState, NSString** aCoalescingKey) {
+    NSString* aBasePath = [NSString stringWithFormat:@"http://%@/api/%@/lights/%@", aLight.host, aLight.username, aLight.number];
+    NSURL* aURL = [[NSURL URLWithString:aBasePath] URLByAppendingPathComponent:@"state"];
+    NSData* aJSON = [NSJSONSerialization dataWithJSONObject:aState options:0 error:nil];
+    NSMutableURLRequest* aRequest = [NSMutableURLRequest new];
+    aRequest.URL = aURL;
+    aRequest.HTTPMethod = @"PUT";
+    aRequest.HTTPBody = aJSON;
+    NSURLRequest* aCopy = [aRequest copy];
+    *aCoalescingKey = [NSString stringWithFormat:@"%@ %@", aCopy.HTTPMethod, aCopy.URL.path];
+    return aCopy;
+}
+
+static NSURLRequest* _NewRequest(DPHueLight* aLight, NSDictionary* aState, NSString** aCoalescingKey) {
+    *aCoalescingKey = [aLight coalescingKeyForSettingLightState];
+    return [aLight requestForSettingLightState:aState];
+}
+
+static void _Run(NSString* aName, NSURLRequest* (*aBuild)(DPHueLight*, NSDictionary*, NSString**), NSArray<DPHueLight*>* aLights, NSArray<NSDictionary*>* aStates, NSUInteger aWrites, NSUInteger anIterations) {
+    NSMutableArray<NSNumber*>* aTimes = [NSMutableArray new];
+    NSMutableArray<NSNumber*>* anAllocations = [NSMutableArray new];
+    NSUInteger aBytes = 0;
+    for (NSUInteger i = 0; i < anIterations; i++) {
+        @autoreleasepool {
+            unsigned long long anAllocatedBefore = atomic_load(&allocationCount);
+            NSTimeInterval aStartedAt = _Now();
+            for (NSUInteger w = 0; w < aWrites; w++) {
+                @autoreleasepool {
+                    NSString* aCoalescingKey;
+                    NSURLRequest* aRequest = aBuild(aLights[w % aLights.count], aStates[w % aStates.count], &aCoalescingKey);
+                    aBytes += aRequest.HTTPBody.length + aCoalescingKey.length;
+                }
+            }
+            [aTimes addObject:@((_Now() - aStartedAt) / aWrites)];
+            [anAllocations addObject:@((double)(atomic_load(&allocationCount) - anAllocatedBefore) / aWrites)];
+        }
+    }
+    printf("%-7s  %8.0f ns/write  %6.1f allocations/write  (%lu bytes)\n", aName.UTF8String,
+           _Median(aTimes) * 1e9, _Median(anAllocations), (unsigned long)aBytes);
+}
+
+int main(int argc, const char* argv[]) {
+    @autoreleasepool {
+        NSUserDefaults* aDefaults = [NSUserDefaults standardUserDefaults];
+        NSUInteger aWrites = [aDefaults integerForKey:@"writes"] ?: 100000;
+        NSUInteger anIterations = [aDefaults integerForKey:@"iterations"] ?: 10;
+
+        DPHueBridge* aBridge = [[DPHueBridge alloc] initWithHueHost:@"192.168.1.2" generatedUsername:@"benchmark"];
+        NSMutableArray<DPHueLight*>* aLights = [NSMutableArray new];
+        for (NSUInteger i = 1; i <= 50; i++) {
+            DPHueLight* aLight = [[DPHueLight alloc] initWithBridge:aBridge];
+            aLight.number = @(i);
+            aLight.host = aBridge.host;
+            aLight.username = aBridge.generatedUsername;
+            [aLights addObject:aLight];
+        }
+        // What animations and scenes typically write
+        NSArray<NSDictionary*>* aStates = @[@{@"on": @YES, @"bri": @254},
+                                            @{@"xy": @[@0.3127, @0.329], @"transitiontime": @4},
+                                            @{@"hue": @46920, @"sat": @254, @"bri": @127},
+                                            @{@"on": @NO, @"transitiontime": @0},
+                                            @{@"ct": @366, @"alert": @"select"}];
+
+        _CountAllocations();
+        _Run(@"before", _OldRequest, aLights, aStates, aWrites, anIterations);
+        _Run(@"after", _NewRequest, aLights, aStates, aWrites, anIterations);
+    }
+    return 0;
+}
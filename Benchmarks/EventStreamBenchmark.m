@@ -0,0 +1,153 @@
+//
+//  EventStreamBenchmark.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// Changes lights of a DPHueMockBridge behind the back of a DPHueBridge, as a
+// wall switch or another app would, and measures how long the bridge takes
+// to notice: with its DPHueEventStream, with its DPHueBridgePoller, and with
+// the event stream falling back to polling because the mock serves none.
+// For each it reports the latency of single changes, how many changes a
+// burst delivers per second, and how many requests the mock answered.
+//
+// Usage: EventStreamBenchmark [stream|poll|fallback ...] [-lights N] [-changes N] [-rate N] [-burst N]
+
+#import <Foundation/Foundation.h>
+#import "DPHueBridge.h"
+#import "DPHueBridgeChanges.h"
+#import "DPHueBridgePoller.h"
+#import "DPHueEventStream.h"
+#import "DPHueLight.h"
+#import "DPHueMockBridge.h"
+
+#pragma mark - C functions
+
+static NSTimeInterval _Now(void) {
+    return [NSProcessInfo processInfo].systemUptime;
+}
+
+// DPHue calls back on the main queue, so keep it running while waiting
+static BOOL _RunUntil(BOOL (^aDone)(void), NSTimeInterval aTimeout) {
+    NSTimeInterval aDeadline = _Now() + aTimeout;
+    while (!aDone() && _Now() < aDeadline)
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.001]];
+    return aDone();
+}
+
+static NSTimeInterval _Percentile(NSMutableArray<NSNumber*>* aTimes, double aPercentile) {
+    if (!aTimes.count)
+        return 0;
+    [aTimes sortUsingSelector:@selector(compare:)];
+    return aTimes[MIN(aTimes.count - 1, (NSUInteger)(aTimes.count * aPercentile))].doubleValue;
+}
+
+static void _Run(NSString* aMode, NSUInteger aLightCount, NSUInteger aChangeCount, double aRate, NSUInteger aBurstSize) {
+    DPHueMockBridge* aMock = [[DPHueMockBridge alloc] initWithLightCount:aLightCount];
+    aMock.eventStreamEnabled = ![aMode isEqualToString:@"fallback"];
+    NSError* anError = nil;
+    if (![aMock startOnPort:0 error:&anError]) {
+        fprintf(stderr, "Could not start the mock bridge: %s\n", anError.localizedDescription.UTF8String);
+        exit(1);
+    }
+    DPHueBridge* aBridge = [[DPHueBridge alloc] initWithHueHost:aMock.host generatedUsername:aMock.username];
+    __block BOOL aRead = NO;
+    [aBridge readWithCompletion:^(DPHueBridge* aHue, NSError* aReadError) {
+        aRead = YES;
+    }];
+    _RunUntil(^BOOL{ return aRead; }, 10);
+
+    if ([aMode isEqualToString:@"poll"]) {
+        [aBridge.poller start];
+    } else {
+        aBridge.eventStream.URL = aMock.eventStreamURL;
+        aBridge.eventStream.minimumReconnectDelay = 0.2;
+        [aBridge.eventStream start];
+        BOOL aFallback = [aMode isEqualToString:@"fallback"];
+        if (!_RunUntil(^BOOL{ return aFallback ? aBridge.eventStream.polling : aBridge.eventStream.connected; }, 10)) {
+            fprintf(stderr, "The event stream did not %s\n", aFallback ? "fall back to polling" : "connect");
+            exit(1);
+        }
+    }
+    // Let the reads of starting up settle
+    _RunUntil(^BOOL{ return NO; }, 1.5);
+
+    // Brightness each light is expected to get, and when it was changed
+    NSMutableDictionary<NSNumber*, NSNumber*>* anExpected = [NSMutableDictionary new];
+    NSMutableDictionary<NSNumber*, NSNumber*>* aChangedAt = [NSMutableDictionary new];
+    NSMutableArray<NSNumber*>* aLatencies = [NSMutableArray new];
+    id anObserver = [aBridge addObserverUsingBlock:^(DPHueBridgeChanges* aChanges) {
+        NSTimeInterval aNow = _Now();
+        for (NSNumber* aNumber in aChanges.changedLights) {
+            if (!anExpected[aNumber] || ![[aBridge lightWithId:aNumber].brightness isEqualToNumber:anExpected[aNumber]])
+                continue;
+            [aLatencies addObject:@(aNow - aChangedAt[aNumber].doubleValue)];
+            [anExpected removeObjectForKey:aNumber];
+        }
+    }];
+    __block NSUInteger aNextBrightness = 1;
+    void (^aChange)(NSUInteger) = ^(NSUInteger aLight) {
+        NSNumber* aNumber = @(aLight % aLightCount + 1);
+        aNextBrightness = aNextBrightness % 253 + 1;
+        anExpected[aNumber] = @(aNextBrightness);
+        aChangedAt[aNumber] = @(_Now());
+        [aMock changeLightWithId:aNumber.stringValue state:@{@"bri": @(aNextBrightness)}];
+    };
+
+    // Single changes, spread out
+    [aMock resetStatistics];
+    NSTimeInterval aStartedAt = _Now();
+    for (NSUInteger i = 0; i < aChangeCount; i++) {
+        aChange(i);
+        NSTimeInterval aDueAt = aStartedAt + (i + 1) / aRate;
+        _RunUntil(^BOOL{ return _Now() >= aDueAt; }, 1 / aRate + 1);
+    }
+    _RunUntil(^BOOL{ return !anExpected.count; }, 5);
+    NSTimeInterval aDuration = _Now() - aStartedAt;
+    NSUInteger aMissed = aChangeCount - aLatencies.count;
+    printf("%-8s  %4lu changes  latency p50 %7.1f ms  p95 %7.1f ms  %3lu missed  %5.1f requests/s\n",
+           aMode.UTF8String, (unsigned long)aChangeCount, _Percentile(aLatencies, 0.5) * 1000.0, _Percentile(aLatencies, 0.95) * 1000.0,
+           (unsigned long)aMissed, aMock.requestCount / aDuration);
+
+    // A burst; each light only needs to end up with its last brightness
+    [anExpected removeAllObjects];
+    [aLatencies removeAllObjects];
+    aStartedAt = _Now();
+    for (NSUInteger i = 0; i < aBurstSize; i++)
+        aChange(i);
+    BOOL aDone = _RunUntil(^BOOL{ return !anExpected.count; }, 30);
+    aDuration = _Now() - aStartedAt;
+    printf("%-8s  %4lu burst    %s in %7.1f ms  %8.0f changes/s  %lu events\n",
+           aMode.UTF8String, (unsigned long)aBurstSize, aDone ? "applied" : "TIMEOUT", aDuration * 1000.0,
+           aBurstSize / aDuration, (unsigned long)aBridge.eventStream.eventCount);
+
+    [aBridge removeObserver:anObserver];
+    [aBridge.eventStream stop];
+    [aBridge.poller stop];
+    [aMock stop];
+}
+
+int main(int argc, const char* argv[]) {
+    @autoreleasepool {
+        NSUserDefaults* aDefaults = [NSUserDefaults standardUserDefaults];
+        NSUInteger aLightCount = [aDefaults integerForKey:@"lights"] ?: 20;
+        NSUInteger aChangeCount = [aDefaults integerForKey:@"changes"] ?: 100;
+        double aRate = [aDefaults doubleForKey:@"rate"] ?: 10;
+        NSUInteger aBurstSize = [aDefaults integerForKey:@"burst"] ?: 1000;
+        NSMutableArray<NSString*>* aModes = [NSMutableArray new];
+        for (int i = 1; i < argc; i++) {
+            if (argv[i][0] == '-') {
+                i++;
+                continue;
+            }
+            [aModes addObject:@(argv[i])];
+        }
+        if (!aModes.count)
+            [aModes addObjectsFromArray:@[@"stream", @"poll", @"fallback"]];
+        for (NSString* aMode in aModes)
+            _Run(aMode, aLightCount, aChangeCount, aRate, aBurstSize);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+//
+//  FleetBenchmark.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// Runs fleet-wide operations of DPHueFleet against growing numbers of
+// DPHueMockBridges, one of which answers slowly. Reports how long the
+// aggregated result took, and how long the fast bridges took, which should
+// not depend on the slow one or on the number of bridges.
+//
+// Usage: FleetBenchmark [bridges ...] [-lights N] [-slow seconds]
+
+#import <Foundation/Foundation.h>
+#import "DPHueFleet.h"
+#import "DPHueMockBridge.h"
+
+#pragma mark - C functions
+
+static NSTimeInterval _Now(void) {
+    return [NSProcessInfo processInfo].systemUptime;
+}
+
+// DPHue calls back on the main queue, so keep it running while waiting
+static BOOL _RunUntil(BOOL (^aDone)(void), NSTimeInterval aTimeout) {
+    NSTimeInterval aDeadline = _Now() + aTimeout;
+    while (!aDone() && _Now() < aDeadline)
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    return aDone();
+}
+
+static void _Report(NSString* anOperation, NSUInteger aBridgeCount, DPHueFleetResult* aResult, NSString* aSlowMAC) {
+    NSMutableArray<NSNumber*>* aFast = [NSMutableArray new];
+    [aResult.durationsByMAC enumerateKeysAndObjectsUsingBlock:^(NSString* aMAC, NSNumber* aDuration, BOOL* aStop) {
+        if (![aMAC isEqualToString:aSlowMAC])
+            [aFast addObject:aDuration];
+    }];
+    [aFast sortUsingSelector:@selector(compare:)];
+    double aMedian = aFast.count ? aFast[aFast.count / 2].doubleValue : 0;
+    double aWorst = aFast.lastObject.doubleValue;
+    printf("%3lu bridges  %-8s  all %7.1f ms  fast bridges p50 %6.1f ms  max %6.1f ms  slow bridge %7.1f ms  %lu failed\n",
+           (unsigned long)aBridgeCount, anOperation.UTF8String, aResult.duration * 1000.0, aMedian * 1000.0, aWorst * 1000.0,
+           [aResult.durationsByMAC[aSlowMAC] doubleValue] * 1000.0, (unsigned long)aResult.errorsByMAC.count);
+}
+
+static void _Run(NSUInteger aBridgeCount, NSUInteger aLightCount, NSTimeInterval aSlowLatency) {
+    NSMutableArray<DPHueMockBridge*>* aMocks = [NSMutableArray new];
+    DPHueFleet* aFleet = [DPHueFleet new];
+    aFleet.operationTimeout = 30;
+    NSString* aSlowMAC = nil;
+    for (NSUInteger i = 0; i < aBridgeCount; i++) {
+        DPHueMockBridge* aMock = [[DPHueMockBridge alloc] initWithLightCount:aLightCount];
+        if (i == 0)
+            aMock.latency = aSlowLatency;
+        NSError* anError = nil;
+        if (![aMock startOnPort:0 error:&anError]) {
+            fprintf(stderr, "Could not start a mock bridge: %s\n", anError.localizedDescription.UTF8String);
+            exit(1);
+        }
+        [aMocks addObject:aMock];
+        NSString* aMAC = [NSString stringWithFormat:@"00:17:88:00:%02lx:%02lx", (unsigned long)(i >> 8), (unsigned long)(i & 0xff)];
+        [aFleet addBridgeWithMAC:aMAC host:aMock.host generatedUsername:aMock.username];
+        if (i == 0)
+            aSlowMAC = [aFleet.bridges.allKeys firstObject];
+    }
+
+    for (NSString* anOperation in @[@"read", @"off", @"on"]) {
+        __block DPHueFleetResult* aResult = nil;
+        void (^aCompletion)(DPHueFleetResult*) = ^(DPHueFleetResult* aFleetResult) {
+            aResult = aFleetResult;
+        };
+        if ([anOperation isEqualToString:@"read"])
+            [aFleet readAllWithCompletion:aCompletion];
+        else
+            [aFleet setAllLightsOn:[anOperation isEqualToString:@"on"] completion:aCompletion];
+        _RunUntil(^BOOL{ return aResult != nil; }, 60);
+        _Report(anOperation, aBridgeCount, aResult, aSlowMAC);
+    }
+    for (DPHueMockBridge* aMock in aMocks)
+        [aMock stop];
+}
+
+int main(int argc, const char* argv[]) {
+    @autoreleasepool {
+        NSUserDefaults* aDefaults = [NSUserDefaults standardUserDefaults];
+        NSUInteger aLightCount = [aDefaults integerForKey:@"lights"] ?: 20;
+        NSTimeInterval aSlowLatency = [aDefaults objectForKey:@"slow"] ? [aDefaults doubleForKey:@"slow"] : 2.0;
+        NSMutableArray<NSNumber*>* aCounts = [NSMutableArray new];
+        for (int i = 1; i < argc; i++) {
+            if (argv[i][0] == '-') {
+                i++;
+                continue;
+            }
+            [aCounts addObject:@(strtoul(argv[i], NULL, 10))];
+        }
+        if (!aCounts.count)
+            [aCounts addObjectsFromArray:@[@1, @8, @32, @64]];
+        for (NSNumber* aCount in aCounts)
+            _Run(aCount.unsignedIntegerValue, aLightCount, aSlowLatency);
+    }
+    return 0;
+}
@@ -0,0 +1,278 @@
+//
+//  LoadBenchmark.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// Drives DPHueBridge, DPHueLight and DPHueLightGroup against a
+// DPHueMockBridge through scripted scenarios, and reports the request rate
+// seen by the mock, end-to-end latency percentiles and HTTP 503 counts.
+//
+// Usage: LoadBenchmark [scenario ...] [-lights N] [-latency seconds] [-limit requests/s]
+//
+//   scene          every light of a 100-light scene gets its own color
+//   scene-uniform  every light of a 100-light scene gets the same color
+//   slider         one light dragged through brightness at 60Hz for 3s
+//   polling        20 lights written round-robin at 20/s for 10s while polling
+//   session        200 sequential reads, reusing connections or not
+//   animation      a 30 fps color wave across 20 lights for 5s through DPHueAnimator
+//
+// Without a scenario, all of them are run.
+
+#import <Foundation/Foundation.h>
+#import "DPHueAnimator.h"
+#import "DPHueBridge.h"
+#import "DPHueBridgePoller.h"
+#import "DPHueLight.h"
+#import "DPHueMockBridge.h"
+#import "DPJSONConnection.h"
+
+#pragma mark - DPHueLatencySamples
+
+@interface DPHueLatencySamples : NSObject
+
+- (void)addSample:(NSTimeInterval)aSample;
+- (NSTimeInterval)percentile:(double)aPercentile;
+@property (nonatomic, readonly) NSUInteger count;
+
+@end
+
+@implementation DPHueLatencySamples {
+    NSMutableArray<NSNumber*>* samples;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self)
+        samples = [NSMutableArray new];
+    return self;
+}
+
+- (void)addSample:(NSTimeInterval)aSample {
+    [samples addObject:@(aSample)];
+}
+
+- (NSUInteger)count {
+    return samples.count;
+}
+
+- (NSTimeInterval)percentile:(double)aPercentile {
+    if (!samples.count)
+        return 0;
+    NSArray<NSNumber*>* aSorted = [samples sortedArrayUsingSelector:@selector(compare:)];
+    NSUInteger anIndex = MIN(aSorted.count - 1, (NSUInteger)(aPercentile / 100.0 * aSorted.count));
+    return aSorted[anIndex].doubleValue;
+}
+
+@end
+
+#pragma mark - C functions
+
+static NSTimeInterval _Now(void) {
+    return [NSProcessInfo processInfo].systemUptime;
+}
+
+// DPHue calls back on the main queue, so keep it running while waiting
+static BOOL _RunUntil(BOOL (^aDone)(void), NSTimeInterval aTimeout) {
+    NSTimeInterval aDeadline = _Now() + aTimeout;
+    while (!aDone() && _Now() < aDeadline)
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    return aDone();
+}
+
+static void _Report(NSString* aScenario, DPHueMockBridge* aMock, NSTimeInterval aDuration, DPHueLatencySamples* aSamples) {
+    printf("%-14s %7.1f req/s  p50 %7.1f ms  p99 %7.1f ms  %5lu requests  %4lu x 503  %3lu connections  %5lu samples\n",
+           aScenario.UTF8String, aMock.requestCount / aDuration,
+           [aSamples percentile:50] * 1000.0, [aSamples percentile:99] * 1000.0,
+           (unsigned long)aMock.requestCount, (unsigned long)aMock.serviceUnavailableCount,
+           (unsigned long)aMock.connectionCount, (unsigned long)aSamples.count);
+}
+
+#pragma mark - Scenarios
+
+static void _RunScene(DPHueBridge* aBridge, DPHueMockBridge* aMock, BOOL aUniform) {
+    NSArray<DPHueLight*>* aLights = [aBridge.lights subarrayWithRange:NSMakeRange(0, MIN(100, aBridge.lights.count))];
+    DPHueLatencySamples* aSamples = [DPHueLatencySamples new];
+    __block NSUInteger aPending = aLights.count;
+    [aMock resetStatistics];
+    NSTimeInterval aStartedAt = _Now();
+    [aLights enumerateObjectsUsingBlock:^(DPHueLight* aLight, NSUInteger anIndex, BOOL* aStop) {
+        aLight.on = YES;
+        aLight.hue = aUniform ? @8000 : @((anIndex * 6553) % 65536);
+        aLight.saturation = @200;
+        NSTimeInterval aWrittenAt = _Now();
+        [aLight writeWithCompletionHandler:^(NSError* anError) {
+            [aSamples addSample:_Now() - aWrittenAt];
+            aPending--;
+        }];
+    }];
+    _RunUntil(^BOOL{ return aPending == 0; }, 120);
+    _Report(aUniform ? @"scene-uniform" : @"scene", aMock, _Now() - aStartedAt, aSamples);
+}
+
+static void _RunSlider(DPHueBridge* aBridge, DPHueMockBridge* aMock) {
+    DPHueLight* aLight = aBridge.lights.firstObject;
+    DPHueLatencySamples* aSamples = [DPHueLatencySamples new];
+    __block NSUInteger aPending = 0;
+    [aMock resetStatistics];
+    NSTimeInterval aStartedAt = _Now();
+    for (NSUInteger aFrame = 0; aFrame < 180; aFrame++) {
+        aLight.brightness = @(aFrame % 255);
+        NSTimeInterval aWrittenAt = _Now();
+        aPending++;
+        [aLight writeWithCompletionHandler:^(NSError* anError) {
+            [aSamples addSample:_Now() - aWrittenAt];
+            aPending--;
+        }];
+        _RunUntil(^BOOL{ return NO; }, 1.0 / 60);
+    }
+    _RunUntil(^BOOL{ return aPending == 0; }, 30);
+    _Report(@"slider", aMock, _Now() - aStartedAt, aSamples);
+}
+
+static void _RunPolling(DPHueBridge* aBridge, DPHueMockBridge* aMock) {
+    NSArray<DPHueLight*>* aLights = [aBridge.lights subarrayWithRange:NSMakeRange(0, MIN(20, aBridge.lights.count))];
+    DPHueLatencySamples* aSamples = [DPHueLatencySamples new];
+    __block NSUInteger aPending = 0;
+    aBridge.poller.minimumInterval = 0.25;
+    [aBridge.poller start];
+    [aMock resetStatistics];
+    NSTimeInterval aStartedAt = _Now();
+    for (NSUInteger aWrite = 0; aWrite < 200; aWrite++) {
+        DPHueLight* aLight = aLights[aWrite % aLights.count];
+        aLight.brightness = @(aWrite % 255);
+        NSTimeInterval aWrittenAt = _Now();
+        aPending++;
+        [aLight writeWithCompletionHandler:^(NSError* anError) {
+            [aSamples addSample:_Now() - aWrittenAt];
+            aPending--;
+        }];
+        _RunUntil(^BOOL{ return NO; }, 1.0 / 20);
+    }
+    _RunUntil(^BOOL{ return aPending == 0; }, 30);
+    [aBridge.poller stop];
+    _Report(@"polling", aMock, _Now() - aStartedAt, aSamples);
+    NSDictionary* aCounts = [aMock requestCountsByEndpoint];
+    printf("%-14s %lu polls, %lu light writes\n", "", (unsigned long)[aCounts[@"GET /"] unsignedIntegerValue],
+           (unsigned long)[aCounts[@"PUT /lights/N/state"] unsignedIntegerValue]);
+}
+
+// Sequential reads through the bridge session, which keeps connections
+// alive, against a new session for every request
+static void _RunSession(DPHueBridge* aBridge, DPHueMockBridge* aMock) {
+    NSURLRequest* aRequest = [aBridge requestForReadingConfig];
+    for (NSString* aVariant in @[@"session-reuse", @"session-new"]) {
+        DPHueLatencySamples* aSamples = [DPHueLatencySamples new];
+        [aMock resetStatistics];
+        NSTimeInterval aStartedAt = _Now();
+        for (NSUInteger i = 0; i < 200; i++) {
+            __block BOOL aDone = NO;
+            NSURLSession* aSession = [aVariant isEqualToString:@"session-reuse"] ? aBridge.session
+                : [NSURLSession sessionWithConfiguration:[NSURLSessionConfiguration ephemeralSessionConfiguration]];
+            DPJSONConnection* aConnection = [[DPJSONConnection alloc] initWithRequest:aRequest sender:nil];
+            aConnection.session = aSession;
+            NSTimeInterval aSentAt = _Now();
+            aConnection.completionBlock = ^(id aSender, id aJson, NSError* anError) {
+                [aSamples addSample:_Now() - aSentAt];
+                aDone = YES;
+            };
+            [aConnection start];
+            _RunUntil(^BOOL{ return aDone; }, 10);
+            if (aSession != aBridge.session)
+                [aSession finishTasksAndInvalidate];
+        }
+        _Report(aVariant, aMock, _Now() - aStartedAt, aSamples);
+    }
+}
+
+// Far more frames than the bridge can take; only the newest state per light
+// should be sent, so lag stays bounded
+static void _RunAnimation(DPHueBridge* aBridge, DPHueMockBridge* aMock) {
+    NSArray<DPHueLight*>* aLights = [aBridge.lights subarrayWithRange:NSMakeRange(0, MIN(20, aBridge.lights.count))];
+    DPHueAnimator* anAnimator = [[DPHueAnimator alloc] initWithBridge:aBridge];
+    anAnimator.framesPerSecond = 30;
+    anAnimator.frameBlock = ^NSDictionary<NSNumber*, NSDictionary*>*(NSTimeInterval aTime) {
+        NSMutableDictionary* aFrame = [NSMutableDictionary new];
+        [aLights enumerateObjectsUsingBlock:^(DPHueLight* aLight, NSUInteger anIndex, BOOL* aStop) {
+            double aPhase = aTime + anIndex * 0.1;
+            aFrame[aLight.number] = @{@"xy": @[@(0.3 + 0.1 * sin(aPhase)), @(0.3 + 0.1 * cos(aPhase))]};
+        }];
+        return aFrame;
+    };
+    [aMock resetStatistics];
+    NSTimeInterval aStartedAt = _Now();
+    [anAnimator start];
+    _RunUntil(^BOOL{ return NO; }, 5);
+    [anAnimator stop];
+    _RunUntil(^BOOL{ return NO; }, 1);
+    _Report(@"animation", aMock, _Now() - aStartedAt, [DPHueLatencySamples new]);
+    printf("%-14s %lu frames, %lu states sent, %lu dropped, lag mean %.1f ms, max %.1f ms\n", "",
+           (unsigned long)anAnimator.producedFrameCount, (unsigned long)anAnimator.sentStateCount,
+           (unsigned long)anAnimator.droppedStateCount, anAnimator.meanLag * 1000.0, anAnimator.maximumLag * 1000.0);
+}
+
+int main(int argc, const char* argv[]) {
+    @autoreleasepool {
+        NSUserDefaults* aDefaults = [NSUserDefaults standardUserDefaults];
+        NSUInteger aLightCount = [aDefaults integerForKey:@"lights"] ?: 100;
+        NSMutableArray<NSString*>* aScenarios = [NSMutableArray new];
+        for (int i = 1; i < argc; i++) {
+            if (argv[i][0] == '-') {
+                i++;
+                continue;
+            }
+            [aScenarios addObject:@(argv[i])];
+        }
+        if (!aScenarios.count)
+            [aScenarios addObjectsFromArray:@[@"scene", @"scene-uniform", @"slider", @"polling", @"session", @"animation"]];
+
+        DPHueMockBridge* aMock = [[DPHueMockBridge alloc] initWithLightCount:aLightCount];
+        if ([aDefaults objectForKey:@"latency"])
+            aMock.latency = [aDefaults doubleForKey:@"latency"];
+        if ([aDefaults objectForKey:@"limit"])
+            aMock.maximumRequestsPerSecond = [aDefaults doubleForKey:@"limit"];
+        NSError* anError = nil;
+        if (![aMock startOnPort:0 error:&anError]) {
+            fprintf(stderr, "Could not start the mock bridge: %s\n", anError.localizedDescription.UTF8String);
+            return 1;
+        }
+        printf("Mock bridge on %s with %lu lights, %.0f ms median latency, %.0f requests/s limit\n",
+               aMock.host.UTF8String, (unsigned long)aLightCount, aMock.latency * 1000.0, aMock.maximumRequestsPerSecond);
+
+        for (NSString* aScenario in aScenarios) {
+            // A fresh bridge per scenario, so learned rates do not carry over
+            DPHueBridge* aBridge = [[DPHueBridge alloc] initWithHueHost:aMock.host generatedUsername:aMock.username];
+            __block BOOL aRead = NO;
+            [aBridge readWithCompletion:^(DPHueBridge* aHue, NSError* anError) {
+                aRead = YES;
+            }];
+            if (!_RunUntil(^BOOL{ return aRead; }, 10) || !aBridge.lights.count) {
+                fprintf(stderr, "Could not read the mock bridge\n");
+                return 1;
+            }
+            // Let the rate limits of both sides refill
+            _RunUntil(^BOOL{ return NO; }, 2);
+
+            if ([aScenario isEqualToString:@"scene"])
+                _RunScene(aBridge, aMock, NO);
+            else if ([aScenario isEqualToString:@"scene-uniform"])
+                _RunScene(aBridge, aMock, YES);
+            else if ([aScenario isEqualToString:@"slider"])
+                _RunSlider(aBridge, aMock);
+            else if ([aScenario isEqualToString:@"polling"])
+                _RunPolling(aBridge, aMock);
+            else if ([aScenario isEqualToString:@"session"])
+                _RunSession(aBridge, aMock);
+            else if ([aScenario isEqualToString:@"animation"])
+                _RunAnimation(aBridge, aMock);
+            else
+                fprintf(stderr, "Unknown scenario %s\n", aScenario.UTF8String);
+            printf("%-14s learned light rate %.1f/s, group rate %.1f/s, %lu writes coalesced\n", "",
+                   aBridge.lightCommandRate, aBridge.groupCommandRate, (unsigned long)aBridge.coalescedCommandCount);
+        }
+        [aMock stop];
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+//
+//  ParseBenchmark.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// Measures how long it takes to turn a controller state response into
+// DPHueLight and DPHueLightGroup objects, and how much memory it takes.
+//
+// Usage: ParseBenchmark <foundation|skipping|selective> <light count> [iterations]
+//
+//   foundation  GET /api/{username}, decoded whole with NSJSONSerialization
+//               (how DPHueBridge decoded it before DPHueJSONScanner)
+//   skipping    GET /api/{username}, decoded with DPHueJSONScanner
+//               (DPHueBridgeRefreshModeFull)
+//   selective   GET /lights, /groups and /config, decoded with NSJSONSerialization
+//               (DPHueBridgeRefreshModeSelective)
+//
+// Peak memory is process wide, so run one mode per process; see
+// run_parse_benchmark.sh.
+
+#import <Foundation/Foundation.h>
+#import <sys/resource.h>
+#import "DPHueBenchmarkPayloads.h"
+#import "DPHueBridge.h"
+#import "DPHueJSONScanner.h"
+
+static size_t _PeakResidentBytes(void) {
+    struct rusage aUsage;
+    getrusage(RUSAGE_SELF, &aUsage);
+    // Bytes on Darwin
+    return (size_t)aUsage.ru_maxrss;
+}
+
+int main(int argc, const char* argv[]) {
+    @autoreleasepool {
+        if (argc < 3) {
+            fprintf(stderr, "usage: %s <foundation|skipping|selective> <light count> [iterations]\n", argv[0]);
+            return 1;
+        }
+        NSString* aMode = @(argv[1]);
+        NSUInteger aLightCount = (NSUInteger)atol(argv[2]);
+        NSUInteger anIterations = argc > 3 ? (NSUInteger)atol(argv[3]) : 20;
+
+        NSData* aFull = [DPHueBenchmarkPayloads dataWithJSONObject:[DPHueBenchmarkPayloads fullStateWithLightCount:aLightCount]];
+        NSData* aLights = [DPHueBenchmarkPayloads dataWithJSONObject:[DPHueBenchmarkPayloads lightsWithCount:aLightCount]];
+        NSData* aGroups = [DPHueBenchmarkPayloads dataWithJSONObject:[DPHueBenchmarkPayloads groupsWithLightCount:aLightCount]];
+        NSData* aConfig = [DPHueBenchmarkPayloads dataWithJSONObject:[DPHueBenchmarkPayloads config]];
+        NSSet* aKeys = [NSSet setWithObjects:@"config", @"lights", @"groups", nil];
+
+        size_t aBaseline = _PeakResidentBytes();
+        NSTimeInterval aTotal = 0;
+        NSUInteger aParsedLights = 0;
+        for (NSUInteger i = 0; i < anIterations; i++) {
+            @autoreleasepool {
+                NSTimeInterval aStartedAt = [NSProcessInfo processInfo].systemUptime;
+                id aJson = nil;
+                NSUInteger aBytes = 0;
+                if ([aMode isEqualToString:@"foundation"]) {
+                    aJson = [NSJSONSerialization JSONObjectWithData:aFull options:0 error:nil];
+                    aBytes = aFull.length;
+                } else if ([aMode isEqualToString:@"skipping"]) {
+                    aJson = [DPHueJSONScanner JSONObjectWithData:aFull keys:aKeys error:nil];
+                    aBytes = aFull.length;
+                } else if ([aMode isEqualToString:@"selective"]) {
+                    aJson = @{@"lights": [NSJSONSerialization JSONObjectWithData:aLights options:0 error:nil],
+                              @"groups": [NSJSONSerialization JSONObjectWithData:aGroups options:0 error:nil],
+                              @"config": [NSJSONSerialization JSONObjectWithData:aConfig options:0 error:nil]};
+                    aBytes = aLights.length + aGroups.length + aConfig.length;
+                } else {
+                    fprintf(stderr, "unknown mode %s\n", argv[1]);
+                    return 1;
+                }
+                // A fresh bridge each time, i.e. the first read of an app launch
+                DPHueBridge* aBridge = [[DPHueBridge alloc] initWithHueHost:@"127.0.0.1" generatedUsername:@"benchmark"];
+                [aBridge updateWithControllerState:aJson];
+                aTotal += [NSProcessInfo processInfo].systemUptime - aStartedAt;
+                aParsedLights = aBridge.lights.count;
+                if (i == 0)
+                    printf("%-10s %5lu lights  %8.1f KB received\n", argv[1], (unsigned long)aLightCount, aBytes / 1024.0);
+            }
+        }
+        printf("%-10s %5lu lights  %8.3f ms/parse  %8.1f MB peak growth  (%lu lights parsed, %lu iterations)\n",
+               argv[1], (unsigned long)aLightCount, aTotal / anIterations * 1000.0,
+               (_PeakResidentBytes() - aBaseline) / (1024.0 * 1024.0), (unsigned long)aParsedLights, (unsigned long)anIterations);
+    }
+    return 0;
+}
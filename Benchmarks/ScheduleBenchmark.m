@@ -0,0 +1,113 @@
+//
+//  ScheduleBenchmark.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// Provisions a set of schedules on a DPHueMockBridge the way a deploy
+// would: first by writing each DPHueSchedule, as before there was a way to
+// compare with the bridge, then with synchronizeSchedules:deletingOthers:
+// completion: for a new bridge, for one already provisioned, and for one
+// where a few schedules changed. For each it reports the time taken and the
+// requests the mock answered.
+//
+// Usage: ScheduleBenchmark [-schedules N] [-changed N]
+
+#import <Foundation/Foundation.h>
+#import "DPHueBridge.h"
+#import "DPHueMockBridge.h"
+#import "DPHueSchedule.h"
+
+#pragma mark - C functions
+
+static NSTimeInterval _Now(void) {
+    return [NSProcessInfo processInfo].systemUptime;
+}
+
+// DPHue calls back on the main queue, so keep it running while waiting
+static BOOL _RunUntil(BOOL (^aDone)(void), NSTimeInterval aTimeout) {
+    NSTimeInterval aDeadline = _Now() + aTimeout;
+    while (!aDone() && _Now() < aDeadline)
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    return aDone();
+}
+
+static NSArray<DPHueSchedule*>* _Schedules(DPHueBridge* aBridge, NSUInteger aCount, NSUInteger aChangedCount) {
+    NSMutableArray<DPHueSchedule*>* aSchedules = [NSMutableArray new];
+    for (NSUInteger i = 0; i < aCount; i++) {
+        DPHueSchedule* aSchedule = [[DPHueSchedule alloc] initWithBridge:aBridge];
+        aSchedule.name = [NSString stringWithFormat:@"Site schedule %lu", (unsigned long)i];
+        aSchedule.scheduleDescription = i < aChangedCount ? @"Changed on this deploy" : @"Provisioned";
+        aSchedule.command = @{@"address": [NSString stringWithFormat:@"/api/%@/groups/%lu/action", aBridge.generatedUsername, (unsigned long)(i % 10 + 1)],
+                              @"method": @"PUT", @"body": @{@"on": @(i % 2 == 0)}};
+        aSchedule.date = [NSDate dateWithTimeIntervalSince1970:1900000000 + i * 3600];
+        [aSchedules addObject:aSchedule];
+    }
+    return aSchedules;
+}
+
+static void _Report(NSString* aName, NSTimeInterval aDuration, DPHueMockBridge* aMock, DPHueScheduleSyncResult* aResult) {
+    NSDictionary<NSString*, NSNumber*>* aCounts = [aMock requestCountsByEndpoint];
+    printf("%-16s  %8.1f ms  %4lu requests  (GET %lu, POST %lu, PUT %lu, DELETE %lu)%s\n", aName.UTF8String, aDuration * 1000.0,
+           (unsigned long)aMock.requestCount, [aCounts[@"GET /schedules"] unsignedLongValue], [aCounts[@"POST /schedules"] unsignedLongValue],
+           [aCounts[@"PUT /schedules/N"] unsignedLongValue], [aCounts[@"DELETE /schedules/N"] unsignedLongValue],
+           aResult && !aResult.succeeded ? "  FAILED" : "");
+}
+
+static DPHueScheduleSyncResult* _Synchronize(DPHueBridge* aBridge, NSArray<DPHueSchedule*>* aSchedules) {
+    __block DPHueScheduleSyncResult* aResult = nil;
+    __block BOOL aDone = NO;
+    [aBridge synchronizeSchedules:aSchedules deletingOthers:YES completion:^(DPHueScheduleSyncResult* aSyncResult, NSError* anError) {
+        if (anError)
+            fprintf(stderr, "Could not read schedules: %s\n", anError.localizedDescription.UTF8String);
+        aResult = aSyncResult;
+        aDone = YES;
+    }];
+    _RunUntil(^BOOL{ return aDone; }, 120);
+    return aResult;
+}
+
+static DPHueMockBridge* _StartMock(void) {
+    DPHueMockBridge* aMock = [[DPHueMockBridge alloc] initWithLightCount:20];
+    NSError* anError = nil;
+    if (![aMock startOnPort:0 error:&anError]) {
+        fprintf(stderr, "Could not start the mock bridge: %s\n", anError.localizedDescription.UTF8String);
+        exit(1);
+    }
+    return aMock;
+}
+
+int main(int argc, const char* argv[]) {
+    @autoreleasepool {
+        NSUserDefaults* aDefaults = [NSUserDefaults standardUserDefaults];
+        NSUInteger aCount = [aDefaults integerForKey:@"schedules"] ?: 100;
+        NSUInteger aChangedCount = [aDefaults objectForKey:@"changed"] ? [aDefaults integerForKey:@"changed"] : 10;
+
+        // One write per schedule, whatever the bridge has
+        DPHueMockBridge* aMock = _StartMock();
+        DPHueBridge* aBridge = [[DPHueBridge alloc] initWithHueHost:aMock.host generatedUsername:aMock.username];
+        __block NSUInteger aWrittenCount = 0;
+        NSTimeInterval aStartedAt = _Now();
+        for (DPHueSchedule* aSchedule in _Schedules(aBridge, aCount, 0))
+            [aSchedule writeWithCompletion:^(DPHueSchedule* aWritten, NSError* anError) {
+                aWrittenCount++;
+            }];
+        _RunUntil(^BOOL{ return aWrittenCount == aCount; }, 120);
+        _Report(@"write each", _Now() - aStartedAt, aMock, nil);
+        [aMock stop];
+
+        aMock = _StartMock();
+        aBridge = [[DPHueBridge alloc] initWithHueHost:aMock.host generatedUsername:aMock.username];
+        NSArray<NSString*>* aNames = @[@"sync new bridge", @"sync unchanged", @"sync changed"];
+        for (NSUInteger i = 0; i < aNames.count; i++) {
+            [aMock resetStatistics];
+            aStartedAt = _Now();
+            DPHueScheduleSyncResult* aResult = _Synchronize(aBridge, _Schedules(aBridge, aCount, i == 2 ? aChangedCount : 0));
+            _Report(aNames[i], _Now() - aStartedAt, aMock, aResult);
+        }
+        [aMock stop];
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+//
+//  SnapshotBenchmark.m
+//  DPHue Benchmarks
+//
+//  This is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// Compares restoring a bridge from an NSKeyedArchiver archive, as DPHue apps
+// have done so far, with restoring it from a memory-mapped DPHueSnapshot.
+// For each it reports the file size, the time to save, the time until the
+// first light can be written, and the time until all lights are built.
+//
+// Usage: SnapshotBenchmark [light count ...] [-iterations N]
+
+#import <Foundation/Foundation.h>
+#import "DPHueBenchmarkPayloads.h"
+#import "DPHueBridge.h"
+#import "DPHueLight.h"
+
+#pragma mark - C functions
+
+static NSTimeInterval _Now(void) {
+    return [NSProcessInfo processInfo].systemUptime;
+}
+
+static NSTimeInterval _Median(NSMutableArray<NSNumber*>* aTimes) {
+    [aTimes sortUsingSelector:@selector(compare:)];
+    return aTimes[aTimes.count / 2].doubleValue;
+}
+
+static void _Report(NSString* aFormat, NSUInteger aLightCount, unsigned long long aBytes, NSMutableArray<NSNumber*>* aSaves, NSMutableArray<NSNumber*>* aFirsts, NSMutableArray<NSNumber*>* anAlls) {
+    printf("%5lu lights  %-8s  %8llu bytes  save %8.3f ms  first write %8.3f ms  all lights %8.3f ms\n",
+           (unsigned long)aLightCount, aFormat.UTF8String, aBytes,
+           _Median(aSaves) * 1000.0, _Median(aFirsts) * 1000.0, _Median(anAlls) * 1000.0);
+}
+
+// Whatever the app does with the first light, e.g. turn it on
+static void _WriteFirstLight(DPHueBridge* aBridge) {
+    DPHueLight* aLight = [aBridge lightWithId:@1];
+    if (![aLight requestForSettingLightState:@{@"on": @YES}]) {
+        fprintf(stderr, "Restored bridge has no light 1\n");
+        exit(1);
+    }
+}
+
+static void _Run(NSUInteger aLightCount, NSUInteger anIterations) {
+    DPHueBridge* aBridge = [[DPHueBridge alloc] initWithHueHost:@"127.0.0.1" generatedUsername:@"benchmark"];
+    [aBridge updateWithControllerState:@{@"config": [DPHueBenchmarkPayloads config],
+                                         @"lights": [DPHueBenchmarkPayloads lightsWithCount:aLightCount],
+                                         @"groups": [DPHueBenchmarkPayloads groupsWithLightCount:aLightCount]}];
+    NSURL* aDirectory = [NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES];
+    NSURL* anArchiveURL = [aDirectory URLByAppendingPathComponent:@"DPHueBridge.archive"];
+    NSURL* aSnapshotURL = [aDirectory URLByAppendingPathComponent:@"DPHueBridge.snapshot"];
+
+    NSMutableArray<NSNumber*>* aSaves = [NSMutableArray new];
+    NSMutableArray<NSNumber*>* aFirsts = [NSMutableArray new];
+    NSMutableArray<NSNumber*>* anAlls = [NSMutableArray new];
+    for (NSUInteger i = 0; i < anIterations; i++) {
+        @autoreleasepool {
+            NSTimeInterval aStartedAt = _Now();
+            [[NSKeyedArchiver archivedDataWithRootObject:aBridge] writeToURL:anArchiveURL atomically:YES];
+            [aSaves addObject:@(_Now() - aStartedAt)];
+
+            aStartedAt = _Now();
+            DPHueBridge* aRestored = [NSKeyedUnarchiver unarchiveObjectWithData:[NSData dataWithContentsOfURL:anArchiveURL]];
+            _WriteFirstLight(aRestored);
+            NSTimeInterval aFirst = _Now() - aStartedAt;
+            [aRestored.lights valueForKey:@"name"];
+            [aFirsts addObject:@(aFirst)];
+            [anAlls addObject:@(_Now() - aStartedAt)];
+        }
+    }
+    unsigned long long anArchiveBytes = [[NSFileManager defaultManager] attributesOfItemAtPath:anArchiveURL.path error:nil].fileSize;
+    _Report(@"archive", aLightCount, anArchiveBytes, aSaves, aFirsts, anAlls);
+
+    [aSaves removeAllObjects];
+    [aFirsts removeAllObjects];
+    [anAlls removeAllObjects];
+    for (NSUInteger i = 0; i < anIterations; i++) {
+        @autoreleasepool {
+            NSTimeInterval aStartedAt = _Now();
+            [aBridge writeSnapshotToURL:aSnapshotURL error:nil];
+            [aSaves addObject:@(_Now() - aStartedAt)];
+
+            aStartedAt = _Now();
+            NSError* anError = nil;
+            DPHueBridge* aRestored = [[DPHueBridge alloc] initWithSnapshotAtURL:aSnapshotURL error:&anError];
+            if (!aRestored) {
+                fprintf(stderr, "Could not restore the snapshot: %s\n", anError.localizedDescription.UTF8String);
+                exit(1);
+            }
+            _WriteFirstLight(aRestored);
+            NSTimeInterval aFirst = _Now() - aStartedAt;
+            [aRestored.lights valueForKey:@"name"];
+            [aFirsts addObject:@(aFirst)];
+            [anAlls addObject:@(_Now() - aStartedAt)];
+        }
+    }
+    unsigned long long aSnapshotBytes = [[NSFileManager defaultManager] attributesOfItemAtPath:aSnapshotURL.path error:nil].fileSize;
+    _Report(@"snapshot", aLightCount, aSnapshotBytes, aSaves, aFirsts, anAlls);
+
+    [[NSFileManager defaultManager] removeItemAtURL:anArchiveURL error:nil];
+    [[NSFileManager defaultManager] removeItemAtURL:aSnapshotURL error:nil];
+}
+
+int main(int argc, const char* argv[]) {
+    @autoreleasepool {
+        NSUserDefaults* aDefaults = [NSUserDefaults standardUserDefaults];
+        NSUInteger anIterations = [aDefaults integerForKey:@"iterations"] ?: 20;
+        NSMutableArray<NSNumber*>* aCounts = [NSMutableArray new];
+        for (int i = 1; i < argc; i++) {
+            if (argv[i][0] == '-') {
+                i++;
+                continue;
+            }
+            [aCounts addObject:@(strtoul(argv[i], NULL, 10))];
+        }
+        if (!aCounts.count)
+            [aCounts addObjectsFromArray:@[@50, @200, @1000]];
+        for (NSNumber* aCount in aCounts)
+            _Run(aCount.unsignedIntegerValue, anIterations);
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# Builds every benchmark into $BUILD_DIR (default /tmp/dphue-benchmarks), for
+# $MACOSX_DEPLOYMENT_TARGET (default the one of DPHue.podspec). The library
+# keeps APIs that later OS X versions deprecate, such as CC_SHA1 and
+# SecTrustEvaluate, so deprecation warnings are off for newer targets.
+#
+# Usage: Benchmarks/build.sh <path to CocoaAsyncSocket checkout>
+
+set -e
+
+cd "$(dirname "$0")/.."
+SOCKET_DIR="${1:?usage: $0 <path to CocoaAsyncSocket checkout>}"
+BUILD_DIR="${BUILD_DIR:-/tmp/dphue-benchmarks}"
+MACOSX_DEPLOYMENT_TARGET="${MACOSX_DEPLOYMENT_TARGET:-$(sed -n "s/.*osx.deployment_target *= *'\(.*\)'.*/\1/p" DPHue.podspec)}"
+mkdir -p "$BUILD_DIR/include"
+ln -sfn "$SOCKET_DIR/Source/GCD" "$BUILD_DIR/include/CocoaAsyncSocket"
+
+SOURCES="DPHue/*.m $SOCKET_DIR/Source/GCD/*.m Benchmarks/DPHueBenchmarkPayloads.m Benchmarks/DPHueMockBridge.m"
+for BENCHMARK in ParseBenchmark LoadBenchmark ColorBenchmark FleetBenchmark SnapshotBenchmark EncodeBenchmark EventStreamBenchmark ScheduleBenchmark; do
+    clang -fobjc-arc -O2 -mmacosx-version-min="$MACOSX_DEPLOYMENT_TARGET" -Wno-deprecated-declarations -framework Foundation -framework Security -framework CFNetwork -framework Accelerate \
+        -I DPHue -I Benchmarks -I "$BUILD_DIR/include" \
+        $SOURCES "Benchmarks/$BENCHMARK.m" \
+        -o "$BUILD_DIR/$BENCHMARK"
+done
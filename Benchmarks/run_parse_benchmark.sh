@@ -0,0 +1,18 @@
+#!/bin/sh
+#
+# Builds the benchmarks and runs every ParseBenchmark mode on 50, 200 and 1000
+# lights, one process per run so that peak memory is measured per mode.
+#
+# Usage: Benchmarks/run_parse_benchmark.sh <path to CocoaAsyncSocket checkout>
+
+set -e
+
+BUILD_DIR="${BUILD_DIR:-/tmp/dphue-benchmarks}"
+export BUILD_DIR
+"$(dirname "$0")/build.sh" "$1"
+
+for LIGHTS in 50 200 1000; do
+    for MODE in foundation skipping selective; do
+        "$BUILD_DIR/ParseBenchmark" "$MODE" "$LIGHTS"
+    done
+done
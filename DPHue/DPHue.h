@@ -5,6 +5,20 @@
 //  Created by Niclas Flysjo on 2016-03-24.
 //
 
+#import <DPHue/DPHueAnimator.h>
 #import <DPHue/DPHueBridge.h>
+#import <DPHue/DPHueBridgeChanges.h>
+#import <DPHue/DPHueBridgeMetrics.h>
+#import <DPHue/DPHueBridgePoller.h>
+#import <DPHue/DPHueColor.h>
 #import <DPHue/DPHueDiscover.h>
-#import <DPHue/DPHueLight.h>
\ No newline at end of file
+#import <DPHue/DPHueFleet.h>
+#import <DPHue/DPHueKeyframeAnimation.h>
+#import <DPHue/DPHueLight.h>
+#import <DPHue/DPHueRequest.h>
+#import <DPHue/DPHueSnapshot.h>
+#import <DPHue/DPHueStateStore.h>
+#import <DPHue/DPHueStateEncoder.h>
+#import <DPHue/DPHueEventStream.h>
+#import <DPHue/DPHueEventStreamParser.h>
+#import <DPHue/DPHueSchedule.h>
\ No newline at end of file
@@ -0,0 +1,66 @@
+//
+//  DPHueAnimator.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueAnimator drives effects on the lights of a DPHueBridge from frames
+// computed by a producer block at a target frame rate. Only the newest unsent
+// state of each light is kept: a frame that arrives before the previous one
+// was sent replaces it, so effects never fall behind real time. Lights with
+// a new state are sent in turn, at most as fast as the bridge accepts light
+// commands, so that one busy light cannot starve the others.
+
+#import <Foundation/Foundation.h>
+
+@class DPHueBridge;
+
+@interface DPHueAnimator : NSObject
+
+- (instancetype)initWithBridge:(DPHueBridge *)aBridge;
+
+/// Frames produced per second. Defaults to 25.
+@property (nonatomic, assign) double framesPerSecond;
+
+/**
+ Requests sent and not yet answered, across all lights, beyond which new states
+ wait here rather than in the bridge queue. Defaults to 4.
+ */
+@property (nonatomic, assign) NSUInteger maximumInFlight;
+
+/**
+ Called on the @p callbackQueue of the bridge for every frame, with the seconds since
+ @p start; frames that fall due while it runs are skipped. Returns the new state per
+ light number, as bodies of PUT /lights/{id}/state, e.g.
+ @p @{@1: @{@"xy": @[@0.3, @0.3], @"bri": @200}}. Lights that are left out, or
+ whose state did not change, are not sent anything.
+ */
+@property (nonatomic, copy) NSDictionary<NSNumber *, NSDictionary *> *(^frameBlock)(NSTimeInterval time);
+
+@property (nonatomic, readonly, getter=isRunning) BOOL running;
+
+- (void)start;
+- (void)stop;
+
+#pragma mark - Statistics, updated on a private queue
+
+/// Number of times @p frameBlock was called.
+@property (nonatomic, readonly) NSUInteger producedFrameCount;
+
+/// Number of light states sent to the bridge.
+@property (nonatomic, readonly) NSUInteger sentStateCount;
+
+/// Number of light states replaced by a newer one before they could be sent.
+@property (nonatomic, readonly) NSUInteger droppedStateCount;
+
+/// Mean time from producing a light state until the bridge confirmed it, in seconds.
+@property (nonatomic, readonly) NSTimeInterval meanLag;
+
+/// Longest time from producing a light state until the bridge confirmed it, in seconds.
+@property (nonatomic, readonly) NSTimeInterval maximumLag;
+
+- (void)resetStatistics;
+
+@end
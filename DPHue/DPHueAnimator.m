@@ -0,0 +1,237 @@
+//
+//  DPHueAnimator.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueAnimator.h"
+#import "DPHueBridge.h"
+#import "DPHueLight.h"
+#import "DPJSONConnection.h"
+
+#pragma mark - DPHueAnimatorSlot
+
+// The delivery state of one light
+@interface DPHueAnimatorSlot : NSObject
+
+@property (nonatomic, strong) NSNumber* lightId;
+/// Newest state not sent yet, if any
+@property (nonatomic, copy) NSDictionary* pendingState;
+@property (nonatomic, assign) NSTimeInterval pendingProducedAt;
+/// Last state sent, to skip frames that change nothing
+@property (nonatomic, copy) NSDictionary* sentState;
+@property (nonatomic, assign) BOOL inFlight;
+
+@end
+
+@implementation DPHueAnimatorSlot
+@end
+
+#pragma mark - DPHueAnimator
+
+@implementation DPHueAnimator {
+    __weak DPHueBridge* bridge;
+    // Delivery state is only used on this queue
+    dispatch_queue_t queue;
+    dispatch_source_t timer;
+    NSTimeInterval startedAt;
+    // A frame is being produced on the callbackQueue of the bridge
+    BOOL producing;
+    NSMutableDictionary<NSNumber*, DPHueAnimatorSlot*>* slots;
+    // Slots in the order they are served, and where the next turn starts
+    NSMutableArray<DPHueAnimatorSlot*>* order;
+    NSUInteger cursor;
+    NSUInteger inFlight;
+    double tokens;
+    NSTimeInterval refilledAt;
+    NSTimeInterval lagSum;
+    NSUInteger lagCount;
+}
+
+- (instancetype)initWithBridge:(DPHueBridge *)aBridge {
+    self = [super init];
+    if (self) {
+        bridge = aBridge;
+        _framesPerSecond = 25;
+        _maximumInFlight = 4;
+        slots = [NSMutableDictionary new];
+        order = [NSMutableArray new];
+        queue = dispatch_queue_create("DPHueAnimator", DISPATCH_QUEUE_SERIAL);
+        timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+        __weak typeof(self) wkSelf = self;
+        dispatch_source_set_event_handler(timer, ^{
+            [wkSelf produceFrame];
+        });
+        dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(timer);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    dispatch_source_cancel(timer);
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(timer);
+    dispatch_release(queue);
+#endif
+}
+
+- (void)start {
+    dispatch_async(queue, ^{
+        if (_running)
+            return;
+        _running = YES;
+        startedAt = refilledAt = [NSProcessInfo processInfo].systemUptime;
+        tokens = 1;
+        uint64_t aFrameInterval = (uint64_t)(NSEC_PER_SEC / MAX(1.0, _framesPerSecond));
+        dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, 0), aFrameInterval, aFrameInterval / 20);
+    });
+}
+
+- (void)stop {
+    dispatch_async(queue, ^{
+        _running = NO;
+        dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        // States produced so far are obsolete once the effect has stopped
+        for (DPHueAnimatorSlot* aSlot in order)
+            aSlot.pendingState = nil;
+    });
+}
+
+- (NSTimeInterval)meanLag {
+    return lagCount ? lagSum / lagCount : 0;
+}
+
+- (void)resetStatistics {
+    dispatch_async(queue, ^{
+        _producedFrameCount = 0;
+        _sentStateCount = 0;
+        _droppedStateCount = 0;
+        _maximumLag = 0;
+        lagSum = 0;
+        lagCount = 0;
+    });
+}
+
+#pragma mark - Private, called on queue
+
+// Frames are the app's code, so they are produced on the callbackQueue of the
+// bridge; ticks that come while one is being produced are skipped
+- (void)produceFrame {
+    DPHueBridge* aBridge = bridge;
+    NSDictionary<NSNumber*, NSDictionary*>* (^aFrameBlock)(NSTimeInterval) = self.frameBlock;
+    if (!_running || !aFrameBlock || !aBridge || producing)
+        return;
+    producing = YES;
+    NSTimeInterval aTime = [NSProcessInfo processInfo].systemUptime - startedAt;
+    [aBridge performCallback:^{
+        NSDictionary<NSNumber*, NSDictionary*>* aFrame = aFrameBlock(aTime);
+        dispatch_async(queue, ^{
+            producing = NO;
+            [self applyFrame:aFrame];
+        });
+    }];
+}
+
+- (void)applyFrame:(NSDictionary<NSNumber*, NSDictionary*>*)aFrame {
+    if (!_running)
+        return;
+    NSTimeInterval aNow = [NSProcessInfo processInfo].systemUptime;
+    _producedFrameCount++;
+    [aFrame enumerateKeysAndObjectsUsingBlock:^(NSNumber* aLightId, NSDictionary* aState, BOOL* aStop) {
+        DPHueAnimatorSlot* aSlot = slots[aLightId];
+        if (!aSlot) {
+            aSlot = [DPHueAnimatorSlot new];
+            aSlot.lightId = aLightId;
+            slots[aLightId] = aSlot;
+            [order addObject:aSlot];
+        }
+        if (aSlot.pendingState)
+            _droppedStateCount++;
+        else if (!aSlot.inFlight && [aSlot.sentState isEqualToDictionary:aState])
+            return;
+        aSlot.pendingState = aState;
+        aSlot.pendingProducedAt = aNow;
+    }];
+    [self sendPendingStatesAt:aNow];
+}
+
+// Send pending states in turn, starting after the light served last, for as
+// long as the light command rate of the bridge allows
+- (void)sendPendingStatesAt:(NSTimeInterval)aNow {
+    DPHueBridge* aBridge = bridge;
+    if (!aBridge || !order.count)
+        return;
+    double aRate = aBridge.lightCommandRate;
+    // Allow a burst of one frame worth of commands at most
+    tokens = MIN(MAX(1.0, aRate / MAX(1.0, _framesPerSecond)), tokens + (aNow - refilledAt) * aRate);
+    refilledAt = aNow;
+    NSMutableDictionary<NSNumber*, DPHueLight*>* aLights = nil;
+    NSUInteger aVisited = 0;
+    while (tokens >= 1.0 && inFlight < _maximumInFlight && aVisited < order.count) {
+        DPHueAnimatorSlot* aSlot = order[cursor % order.count];
+        cursor = (cursor + 1) % order.count;
+        aVisited++;
+        if (!aSlot.pendingState || aSlot.inFlight)
+            continue;
+        if (!aLights) {
+            aLights = [NSMutableDictionary new];
+            for (DPHueLight* aLight in aBridge.lights)
+                aLights[aLight.number] = aLight;
+        }
+        DPHueLight* aLight = aLights[aSlot.lightId];
+        if (!aLight) {
+            aSlot.pendingState = nil;
+            _droppedStateCount++;
+            continue;
+        }
+        [self sendSlot:aSlot toLight:aLight ofBridge:aBridge];
+        tokens -= 1.0;
+        aVisited = 0;
+    }
+}
+
+- (void)sendSlot:(DPHueAnimatorSlot*)aSlot toLight:(DPHueLight*)aLight ofBridge:(DPHueBridge*)aBridge {
+    NSDictionary* aState = aSlot.pendingState;
+    NSTimeInterval aProducedAt = aSlot.pendingProducedAt;
+    aSlot.pendingState = nil;
+    aSlot.sentState = aState;
+    aSlot.inFlight = YES;
+    inFlight++;
+    _sentStateCount++;
+
+    NSURLRequest* aRequest = [aLight requestForSettingLightState:aState];
+    DPJSONConnection* aConnection = [[DPJSONConnection alloc] initWithRequest:aRequest sender:aLight];
+    aConnection.coalescingKey = [aLight coalescingKeyForSettingLightState];
+    __weak typeof(self) wkSelf = self;
+    aConnection.completionBlock = ^(DPHueLight* aSender, id aJson, NSError* anError) {
+        if (!anError)
+            [aSender parseLightStateSet:aJson];
+        // Completions run on the private queue of the bridge
+        dispatch_async(queue, ^{
+            [wkSelf slot:aSlot finishedStateProducedAt:aProducedAt error:anError];
+        });
+    };
+    [aBridge queueCommand:aConnection maxPerSecond:DPHueLightCommandsPerSecond];
+}
+
+- (void)slot:(DPHueAnimatorSlot*)aSlot finishedStateProducedAt:(NSTimeInterval)aProducedAt error:(NSError*)anError {
+    NSTimeInterval aNow = [NSProcessInfo processInfo].systemUptime;
+    aSlot.inFlight = NO;
+    inFlight--;
+    if (anError) {
+        // Not known to have arrived, so do not skip the same state next time
+        aSlot.sentState = nil;
+    } else {
+        NSTimeInterval aLag = aNow - aProducedAt;
+        lagSum += aLag;
+        lagCount++;
+        _maximumLag = MAX(_maximumLag, aLag);
+    }
+    if (_running)
+        [self sendPendingStatesAt:aNow];
+}
+
+@end
@@ -9,10 +9,33 @@
 
 #import <Foundation/Foundation.h>
 
+@class DPHueBridgeChanges;
+@class DPHueBridgeMetrics;
+@class DPHueBridgePoller;
+@class DPHueEventStream;
 @class DPHueLight;
 @class DPHueLightGroup;
+@class DPHueRequest;
+@class DPHueSchedule;
+@class DPHueScheduleSyncResult;
+@class DPHueSnapshot;
+@class DPHueStateStore;
 @class DPJSONConnection;
 
+/// How @p readWithCompletion: downloads the state of the controller.
+typedef NS_ENUM(NSInteger, DPHueBridgeRefreshMode) {
+    /// A single GET /api/{username}; only config, lights and groups are decoded, the rest is skipped.
+    DPHueBridgeRefreshModeFull,
+    /// GET /lights, /groups and /config in parallel, so the controller does not send anything else.
+    DPHueBridgeRefreshModeSelective,
+};
+
+/// Nominal number of DPHueLight commands per second a bridge can handle.
+extern const double DPHueLightCommandsPerSecond;
+
+/// Nominal number of DPHueLightGroup commands per second a bridge can handle.
+extern const double DPHueGroupCommandsPerSecond;
+
 @interface DPHueBridge : NSObject <NSCoding>
 
 
@@ -32,6 +55,80 @@
 /// The hostname (or IP address) that DPHueBridge will talk to.
 @property (nonatomic, copy) NSString *host;
 
+/**
+ If set to YES, a burst of identical state writes to several lights is sent as a
+ single group action instead. The group used is group 0 when all lights are
+ written, an existing group with exactly the same lights, or one of a few scratch
+ groups named "DPHue fan-in" that are created on the controller as needed.
+ Light writes are held back for 20ms to detect such bursts.
+
+ @note Set to YES by default.
+ */
+@property (nonatomic, assign) BOOL automaticFanIn;
+
+/**
+ How the state of the controller is downloaded. The full state includes schedules,
+ scenes, rules, sensors and resource links, which can dwarf lights and groups on a
+ busy controller; the selective mode avoids transferring them at the cost of three
+ requests instead of one.
+
+ @note Defaults to DPHueBridgeRefreshModeFull.
+ */
+@property (nonatomic, assign) DPHueBridgeRefreshMode refreshMode;
+
+/**
+ Timeout, in seconds, for a request to the controller to receive data before
+ it fails. Applies to requests started after it is set.
+
+ @note Defaults to 8 seconds.
+ */
+@property (nonatomic, assign) NSTimeInterval requestTimeout;
+
+/**
+ Timeout, in seconds, for a request to the controller to complete as a whole,
+ including time spent waiting for a connection. Applies to requests started
+ after it is set.
+
+ @note Defaults to 30 seconds.
+ */
+@property (nonatomic, assign) NSTimeInterval resourceTimeout;
+
+/**
+ The maximum number of simultaneous connections to the controller. Connections
+ are kept alive and reused between requests, so this also bounds how many
+ requests run at once.
+
+ @note Defaults to 2.
+ */
+@property (nonatomic, assign) NSInteger maximumConnectionsPerHost;
+
+/**
+ The queue completion handlers and observers of this bridge, its lights and groups
+ are called on, as are @p metrics reports. Responses are decoded and lights and groups
+ updated on a private serial queue of the bridge, and the poller, event stream and
+ fan-in of writes keep their state on private queues too, so only your own code runs
+ on this queue and nothing of DPHue waits for it. Set it to a background queue when
+ there is no UI to update.
+
+ @note Defaults to the main queue.
+ */
+#if OS_OBJECT_USE_OBJC
+@property (strong) dispatch_queue_t callbackQueue;
+#else
+@property (assign) dispatch_queue_t callbackQueue;
+#endif
+
+/**
+ How long, in seconds, a completed read of the bridge, a light or a group is
+ answered from memory instead of being sent again. Any write ends it early.
+ Identical reads that are queued or in flight at the same time always share one
+ request, and a read of the bridge answers the reads of single lights and groups
+ still waiting. Cancelling one of them does not cancel the others.
+
+ @note Defaults to 0, i.e. only reads that overlap are shared.
+ */
+@property (nonatomic, assign) NSTimeInterval readFreshness;
+
 
 #pragma mark - Properties you may be interested in reading
 
@@ -53,17 +150,78 @@
  An array of DPHueLight objects representing all the lights
  that the controller is aware of.
  */
-@property (nonatomic, readonly, copy) NSArray *lights;
+@property (readonly, copy) NSArray *lights;
 
 /**
  An array of DPHueLightGroup objects representing all the groups
  that the controller is aware of.
  */
-@property (nonatomic, readonly, copy) NSArray *groups;
+@property (readonly, copy) NSArray *groups;
+
+/**
+ Indexes of @p lights and @p groups by number and name, the groups of each light, and the
+ state of all lights column by column for fast scans. Reflects the last read of the
+ controller, successful light writes, and groups created or updated through this bridge;
+ values set on a light but not yet written are not included. State changes of lights
+ update their rows in place. Adding, removing or renaming lights or groups, or changing
+ membership, builds a new store when next used, so keep a reference for a series of
+ lookups that must agree.
+ */
+@property (readonly, strong) DPHueStateStore *stateStore;
+
+/**
+ Keeps lights and groups up to date by polling the controller; call @p start on it to
+ begin. Observers registered with @p addObserverForLightWithId:usingBlock: and
+ @p addObserverUsingBlock: are told about whatever a poll changes.
+ */
+@property (nonatomic, readonly, strong) DPHueBridgePoller *poller;
+
+/**
+ Keeps lights and groups up to date from the event stream of the controller, which
+ tells about changes as they happen; call @p start on it to begin. Falls back to
+ @p poller while the stream is not available. Observers are told about each change.
+ */
+@property (nonatomic, readonly, strong) DPHueEventStream *eventStream;
+
+/**
+ The session all requests of this bridge, its lights, groups and schedules are
+ sent through. It does not share connections, caches or cookies with the rest of
+ the app, and is recreated when one of the settings above changes.
+ */
+@property (nonatomic, readonly, strong) NSURLSession *session;
 
 /// Whether or not we have been fully registered with the controller.
 @property (nonatomic, readonly, assign) BOOL authenticated;
 
+/**
+ The number of light and group writes that were merged into a write for the
+ same target that was still waiting in the queue, i.e. requests saved by coalescing.
+ */
+@property (nonatomic, readonly, assign) NSUInteger coalescedCommandCount;
+
+/**
+ The number of reads that were answered by an identical read or from memory,
+ see @p readFreshness, i.e. requests saved by sharing reads.
+ */
+@property (nonatomic, readonly, assign) NSUInteger sharedReadCount;
+
+/**
+ The number of DPHueLight commands per second currently sent to the controller.
+ Starts at @p DPHueLightCommandsPerSecond and adapts to how the controller copes:
+ it rises while requests succeed, and drops on HTTP 503 or rising latency.
+ */
+@property (nonatomic, readonly, assign) double lightCommandRate;
+
+/// Like @p lightCommandRate, for DPHueLightGroup commands.
+@property (nonatomic, readonly, assign) double groupCommandRate;
+
+/**
+ Queue, latency and error numbers of all requests of this bridge. Take a
+ @p snapshot at any time, or have one reported periodically with
+ @p reportEvery:reset:usingBlock:.
+ */
+@property (nonatomic, readonly, strong) DPHueBridgeMetrics *metrics;
+
 
 #pragma mark - Methods
 
@@ -91,12 +249,69 @@
  */
 - (id)initWithHueHost:(NSString *)aHost generatedUsername:(NSString * _Nullable)aGeneratedUsername deviceType:(NSString * _Nullable)aDeviceType;
 
+/**
+ Restore a bridge from a snapshot written by @p writeSnapshotToURL:error:. The file is
+ memory-mapped and each light and group is built the first time it is accessed, so this
+ is much faster than unarchiving a large installation. Lights and groups can be written
+ at once; call @p readWithDiffCompletion: to bring them up to date with the controller,
+ which updates them in place.
+
+ @return nil, and the error in @p anError, if the file cannot be read or is not a snapshot
+         of this version of DPHue.
+ */
+- (id)initWithSnapshotAtURL:(NSURL *)aURL error:(NSError **)anError;
+
+/// Like @p initWithSnapshotAtURL:error:, from a snapshot already loaded.
+- (id)initWithSnapshot:(DPHueSnapshot *)aSnapshot;
+
+/// A compact binary snapshot of the bridge, its lights and groups; see @p DPHueSnapshot.
+- (NSData *)snapshotData;
+
+/// Write @p snapshotData to @p aURL atomically.
+- (BOOL)writeSnapshotToURL:(NSURL *)aURL error:(NSError **)anError;
+
 /**
  Download the complete state of the Hue controller, including the state
  of all lights and groups. @p block is called when the operation is complete.
  This normally takes only 1 to 3 seconds.
+
+ @return A handle to cancel the read with, or give it a deadline.
  */
-- (void)readWithCompletion:(void (^)(DPHueBridge *hue, NSError *err))block;
+- (DPHueRequest *)readWithCompletion:(void (^)(DPHueBridge *hue, NSError *err))block;
+
+/**
+ Like @p readWithCompletion:, but also reports what the download changed.
+ Existing DPHueLight and DPHueLightGroup objects are updated in place, keeping
+ their pending changes, and only lights and groups new to the controller are
+ allocated. @p changes is nil if an error occurred.
+ */
+- (DPHueRequest *)readWithDiffCompletion:(void (^)(DPHueBridge *hue, DPHueBridgeChanges *changes, NSError *err))block;
+
+/**
+ Like @p readWithDiffCompletion:, or @p pollWithCompletion: if @p poll is YES, but calls
+ back on @p queue instead of @p callbackQueue. DPHue's own objects read this way, so
+ that they keep working when nobody services @p callbackQueue.
+ */
+- (DPHueRequest *)readControllerStateForPoll:(BOOL)poll callbackQueue:(dispatch_queue_t _Nullable)queue completion:(void (^)(DPHueBridge *hue, DPHueBridgeChanges *changes, NSError *err))block;
+
+/**
+ Call @p aBlock on @p callbackQueue whenever a read or poll of the controller changes the
+ light with number @p aLightId. @p changedKeys holds the names of the changed DPHueLight
+ properties, or is nil when the light was added to or removed from the controller.
+
+ @return An opaque object to pass to @p removeObserver:
+ */
+- (id)addObserverForLightWithId:(NSNumber *)aLightId usingBlock:(void (^)(DPHueLight *light, NSSet<NSString *> *changedKeys))aBlock;
+
+/**
+ Call @p aBlock on @p callbackQueue whenever a read or poll of the controller changes anything.
+
+ @return An opaque object to pass to @p removeObserver:
+ */
+- (id)addObserverUsingBlock:(void (^)(DPHueBridgeChanges *changes))aBlock;
+
+/// Stop calling the block of an observer returned by one of the addObserver methods.
+- (void)removeObserver:(id)anObserver;
 
 /**
  * This will attempt to register @p self.deviceType with the Hue controller.
@@ -138,6 +353,13 @@
  */
 - (DPHueLight *)lightWithName:(NSString *)lightName;
 
+/**
+ The groups in @p self.groups that contain the light with @p lightId
+
+ @return The groups, sorted by number; empty if there are none
+ */
+- (NSArray<DPHueLightGroup *> *)groupsContainingLightWithId:(NSNumber *)lightId;
+
 /**
  Search for the group with given @p groupId in @p self.groups
  
@@ -178,6 +400,9 @@
  */
 - (void)createGroupWithName:(NSString *)name lightIds:(NSArray *)lightIds onCompletion:(void (^ _Nullable)(DPHueLightGroup* _Nullable group, NSError* _Nullable error))onCompletionBlock;
 
+/// Like @p createGroupWithName:lightIds:onCompletion:, calling back on @p queue instead of @p callbackQueue.
+- (void)createGroupWithName:(NSString *)name lightIds:(NSArray *)lightIds callbackQueue:(dispatch_queue_t _Nullable)queue onCompletion:(void (^ _Nullable)(DPHueLightGroup* _Nullable group, NSError* _Nullable error))onCompletionBlock;
+
 /**
  Update the given group on the controller.
  @param name
@@ -201,15 +426,91 @@
  */
 - (void)updateGroup:(DPHueLightGroup *)group withName:(NSString *)name lightIds:(NSArray *)lightIds onCompletion:(void (^ _Nullable)(DPHueLightGroup* _Nullable group, NSError* _Nullable error))onCompletionBlock;
 
+/// Like @p updateGroup:withName:lightIds:onCompletion:, calling back on @p queue instead of @p callbackQueue.
+- (void)updateGroup:(DPHueLightGroup *)group withName:(NSString *)name lightIds:(NSArray *)lightIds callbackQueue:(dispatch_queue_t _Nullable)queue onCompletion:(void (^ _Nullable)(DPHueLightGroup* _Nullable group, NSError* _Nullable error))onCompletionBlock;
+
+/**
+ Read all schedules of the controller with one request, sorted by identifier.
+ Calls back on @p callbackQueue.
+ */
+- (void)readSchedulesWithCompletion:(void (^)(NSArray<DPHueSchedule *> * _Nullable schedules, NSError * _Nullable error))block;
+
+/**
+ Make the schedules of the controller match @p schedules, e.g. the same set provisioned
+ on every deploy. Reads the controller's schedules once, and matches each of @p schedules
+ by @p identifier, or else by name. It then sends only what is needed, through the
+ command queue at maintenance priority:
+ <ul>
+ <li>a create for each schedule without a match, which sets its identifier</li>
+ <li>an update of only the differing attributes for each schedule with a match</li>
+ <li>nothing for schedules that are already as wanted</li>
+ <li>if @p deleteOthers, a delete for each schedule of the controller left unmatched</li>
+ </ul>
+ Works on copies of @p schedules, taken when called, and leaves them as they are. The
+ result holds the copies, bound to this bridge and with the identifiers the controller
+ has for them.
+
+ Calls back on @p callbackQueue, with an error only if the schedules could not be read;
+ see @p DPHueScheduleSyncResult for the outcome of each schedule.
+ */
+- (void)synchronizeSchedules:(NSArray<DPHueSchedule *> *)schedules deletingOthers:(BOOL)deleteOthers completion:(void (^ _Nullable)(DPHueScheduleSyncResult * _Nullable result, NSError * _Nullable error))block;
+
 /**
  Queues commands to the bridge; ensures that commands are not delivered too fast to the hue bridge. A bridge can handle about 10 @p DPHueLight commands per second, and about 1 @p DPHueLightGroup command per second.
+
+ Each distinct @p aMaxPerSecond is paced by its own token bucket, which allows a burst of one second worth of commands. Queue bookkeeping runs on a private serial queue, not on the main thread. The rate actually used adapts to HTTP 503 responses and latency, and commands rejected with 503 are retried automatically.
+
+ Within each rate, commands wait in the lane given by their @p priority: the most urgent waiting command is sent next, while less urgent lanes still get a guaranteed share (at least every 4th, 8th or 16th command for normal, background and maintenance commands), so they cannot starve. @p metrics reports the queue wait per lane. Unless @p completionQueue of @p aCommand is set, its @p completionBlock is called on the private queue lights and groups are updated on.
  @param aCommand
         @p DPJSONConnection containing the command request that should be sent to the bridge.
  @param aMaxPerSecond
-        The number of commands per second (of the same kind as @p aCommand), that the bridge can handle according to specifications.
+        The number of commands per second (of the same kind as @p aCommand), that the bridge can handle according to specifications; normally @p DPHueLightCommandsPerSecond or @p DPHueGroupCommandsPerSecond.
  */
 - (void)queueCommand:(DPJSONConnection*)aCommand maxPerSecond:(double)aMaxPerSecond;
 
+/**
+ Call @p aBlock asynchronously on @p callbackQueue. Completion blocks of connections
+ sent through the bridge run on its private queue; use this to hand results to the
+ code that asked for them.
+ */
+- (void)performCallback:(dispatch_block_t)aBlock;
+
+/// Rebuild @p stateStore when it is next used; called when lights or groups were added or removed.
+- (void)invalidateStateStore;
+
+/**
+ Bring @p stateStore up to date with lights and groups that a read or write changed,
+ given as the names of their changed properties by number, as in @p DPHueBridgeChanges.
+ Only the rows of the changed lights are read again, unless a light or group was
+ renamed or a group changed membership, in which case the store is rebuilt.
+ */
+- (void)updateStateStoreWithChangedLights:(NSDictionary<NSNumber *, NSSet<NSString *> *> * _Nullable)changedLights changedGroups:(NSDictionary<NSNumber *, NSSet<NSString *> *> * _Nullable)changedGroups;
+
+/**
+ Make the next poll decode its response even if it is identical to the last one polled;
+ lights and groups call this when a read or write changed them, as the model then no
+ longer matches that response.
+ */
+- (void)forgetPolledResponses;
+
+/**
+ Apply @p action, keys of the "action" object the controller confirmed for @p group, to
+ the lights of the group, and tell observers what changed; groups call this after a
+ write. See @p DPHueLight updateWithGroupAction:ambiguous: for when lights are marked
+ @p needsVerification.
+ */
+- (void)updateLightsOfGroup:(DPHueLightGroup *)group withAction:(NSDictionary *)action ambiguous:(BOOL)ambiguous;
+
+/**
+ Cancel every request of this bridge, its lights, groups and schedules that is
+ waiting in the queue or in flight. Their completion handlers are called with
+ @p NSURLErrorCancelled.
+ */
+- (void)cancelAllRequests;
+
+/// Number of requests of this bridge that are waiting in the queue or in flight.
+@property (readonly) NSUInteger pendingRequestCount;
+
 @end
 
 
@@ -217,6 +518,10 @@
 
 - (NSURLRequest *)requestForRegisteringDevice:(NSString *)deviceType;
 - (NSURLRequest *)requestForReadingControllerState;
+- (NSURLRequest *)requestForReadingLights;
+- (NSURLRequest *)requestForReadingGroups;
+- (NSURLRequest *)requestForReadingConfig;
+- (NSURLRequest *)requestForReadingSchedules;
 
 @end
 
@@ -228,4 +533,7 @@
 // GET /{username}
 - (instancetype)parseControllerState:(id)json;
 
+/// GET /{username}, updating lights and groups in place; see @p readWithDiffCompletion:
+- (DPHueBridgeChanges *)updateWithControllerState:(id)json;
+
 @end
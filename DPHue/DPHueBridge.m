@@ -8,19 +8,25 @@
 //  https://github.com/danparsons/DPHue
 
 #import "DPHueBridge.h"
+#import "DPHueBridgeChanges.h"
+#import "DPHueBridgeMetrics.h"
+#import "DPHueBridgePoller.h"
+#import "DPHueCommandScheduler.h"
+#import "DPHueEventStream.h"
+#import "DPHueReadCoalescer.h"
+#import "DPHueFanInOptimizer.h"
+#import "DPHueJSONScanner.h"
 #import "DPHueLight.h"
 #import "DPHueLightGroup.h"
+#import "DPHueRequest.h"
+#import "DPHueSchedule.h"
+#import "DPHueSnapshot.h"
+#import "DPHueStateStore.h"
 #import "DPJSONConnection.h"
 #import "NSString+MD5.h"
 #import "WSLog.h"
 #import <CocoaAsyncSocket/GCDAsyncSocket.h>
-
-typedef NSString DPHueCommandQueueKey;
-
-const DPHueCommandQueueKey* DPHueCommandQueueKeyCommand = @"DPHueCommandQueueKeyCommand";
-const DPHueCommandQueueKey* DPHueCommandQueueKeyMaxPerSecond = @"DPHueCommandQueueKeyMaxPerSecond";
-const DPHueCommandQueueKey* DPHueCommandQueueKeyTTL = @"DPHueCommandQueueKeyTTL";
-const DPHueCommandQueueKey* DPHueCommandQueueKeyExpire = @"DPHueCommandQueueKeyExpire";
+#import <CommonCrypto/CommonDigest.h>
 
 @interface DPHueBridge () <GCDAsyncSocketDelegate>
 
@@ -28,20 +34,56 @@ const DPHueCommandQueueKey* DPHueCommandQueueKeyExpire = @"DPHueCommandQueueKeyE
 @property (nonatomic, strong) NSString *deviceType;
 @property (nonatomic, strong) GCDAsyncSocket *socket;
 @property (nonatomic, copy) void (^touchLightCompletionBlock)(BOOL success, NSString *result);
+@property (readwrite, copy) NSArray *lights;
+@property (readwrite, copy) NSArray *groups;
+
+@end
+
+
+// A block registered with one of the addObserver methods
+@interface DPHueBridgeObservation : NSObject
+
+@property (nonatomic, strong) NSNumber *lightId;
+@property (nonatomic, copy) void (^lightBlock)(DPHueLight *light, NSSet<NSString *> *changedKeys);
+@property (nonatomic, copy) void (^changesBlock)(DPHueBridgeChanges *changes);
+
+@end
 
+@implementation DPHueBridgeObservation
 @end
 
 
+const double DPHueLightCommandsPerSecond = 10;
+const double DPHueGroupCommandsPerSecond = 1;
+
+// How long light writes are held back so that bursts can be fanned in
+static const NSTimeInterval kDPHueFanInBatchingDelay = 0.02;
+
 @implementation DPHueBridge {
-    NSArray* commandQueue;
+    DPHueCommandScheduler* commandScheduler;
+    DPHueFanInOptimizer* fanInOptimizer;
+    DPHueReadCoalescer* readCoalescer;
+    NSURLSession* session;
+    // Responses are decoded and lights and groups updated here, one at a time
+    dispatch_queue_t modelQueue;
+    // All connections of the bridge that are waiting or in flight
+    DPJSONConnectionRegistry* registry;
+    // Digest of the last body read per URL path, see connectionForReading:keys:poll:
+    NSMutableDictionary<NSString*, NSData*>* bodyDigests;
+    NSMutableArray<DPHueBridgeObservation*>* observations;
+    // Built on demand, dropped when lights or groups change
+    DPHueStateStore* stateStore;
 }
 
+@synthesize callbackQueue = _callbackQueue;
+
 - (id)initWithHueHost:(NSString *)host generatedUsername:(NSString * _Nullable)generatedUsername {
     return [self initWithHueHost:host generatedUsername:generatedUsername deviceType:nil];
 }
 
 - (id)initWithHueHost:(NSString *)aHost generatedUsername:(NSString * _Nullable)aGeneratedUsername deviceType:(NSString * _Nullable)aDeviceType {
   if (self = [super init]) {
+    [self performCommonInit];
     _deviceType = aDeviceType ?: @"QuickHue";
     _authenticated = NO;
     _host = aHost;
@@ -50,11 +92,40 @@ const DPHueCommandQueueKey* DPHueCommandQueueKeyExpire = @"DPHueCommandQueueKeyE
   return self;
 }
 
+- (void)performCommonInit {
+    _metrics = [DPHueBridgeMetrics new];
+    modelQueue = dispatch_queue_create("DPHueBridge.model", DISPATCH_QUEUE_SERIAL);
+    registry = [DPJSONConnectionRegistry new];
+    _callbackQueue = dispatch_get_main_queue();
+    commandScheduler = [[DPHueCommandScheduler alloc] initWithLabel:@"DPHueBridge.commandScheduler"];
+    commandScheduler.metrics = _metrics;
+    fanInOptimizer = [[DPHueFanInOptimizer alloc] initWithBridge:self];
+    readCoalescer = [DPHueReadCoalescer new];
+    _poller = [[DPHueBridgePoller alloc] initWithBridge:self];
+    _eventStream = [[DPHueEventStream alloc] initWithBridge:self];
+    bodyDigests = [NSMutableDictionary new];
+    observations = [NSMutableArray new];
+    self.automaticFanIn = YES;
+    _requestTimeout = 8;
+    _resourceTimeout = 30;
+    _maximumConnectionsPerHost = 2;
+    commandScheduler.session = self.session;
+}
+
+- (void)dealloc {
+    // A session keeps running until it is invalidated
+    [session finishTasksAndInvalidate];
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(modelQueue);
+#endif
+}
+
 #pragma mark - NSCoding
 
 - (id)initWithCoder:(NSCoder *)a {
     self = [super init];
     if (self) {
+        [self performCommonInit];
         _deviceType = [a decodeObjectForKey:@"deviceType"] ?: @"QuickHue";
         _legacyUsername = [a decodeObjectForKey:@"username"];
         _generatedUsername = [a decodeObjectForKey:@"generatedUsername"];
@@ -82,6 +153,41 @@ const DPHueCommandQueueKey* DPHueCommandQueueKeyExpire = @"DPHueCommandQueueKeyE
     [a encodeObject:_deviceType forKey:@"deviceType"];
 }
 
+#pragma mark - Snapshot
+
+- (id)initWithSnapshotAtURL:(NSURL *)aURL error:(NSError **)anError {
+    DPHueSnapshot* aSnapshot = [[DPHueSnapshot alloc] initWithContentsOfURL:aURL error:anError];
+    if (!aSnapshot)
+        return nil;
+    return [self initWithSnapshot:aSnapshot];
+}
+
+- (id)initWithSnapshot:(DPHueSnapshot *)aSnapshot {
+    self = [super init];
+    if (self) {
+        [self performCommonInit];
+        _deviceType = aSnapshot.deviceType ?: @"QuickHue";
+        _legacyUsername = aSnapshot.legacyUsername;
+        _generatedUsername = aSnapshot.generatedUsername;
+        _host = aSnapshot.host;
+        _mac = aSnapshot.mac;
+        _name = aSnapshot.name;
+        _swversion = aSnapshot.swversion;
+        // Built on first access, already connected to self
+        _lights = [aSnapshot lightsForBridge:self];
+        _groups = [aSnapshot groupsForBridge:self];
+    }
+    return self;
+}
+
+- (NSData *)snapshotData {
+    return [DPHueSnapshot dataWithBridge:self];
+}
+
+- (BOOL)writeSnapshotToURL:(NSURL *)aURL error:(NSError **)anError {
+    return [[self snapshotData] writeToURL:aURL options:NSDataWritingAtomic error:anError];
+}
+
 - (void)setGeneratedUsername:(NSString *)generatedUsername
 {
   _generatedUsername = generatedUsername;
@@ -108,27 +214,145 @@ const DPHueCommandQueueKey* DPHueCommandQueueKeyExpire = @"DPHueCommandQueueKeyE
     group.host = host;
 }
 
-- (void)readWithCompletion:(void (^)(DPHueBridge *, NSError *))block {
+- (DPHueRequest *)readWithCompletion:(void (^)(DPHueBridge *, NSError *))block {
+  return [self readWithDiffCompletion:^(DPHueBridge *hue, DPHueBridgeChanges *changes, NSError *err) {
+    if ( block )
+      block(hue, err);
+  }];
+}
+
+- (DPHueRequest *)readWithDiffCompletion:(void (^)(DPHueBridge *, DPHueBridgeChanges *, NSError *))block {
+  return [self readControllerStateForPoll:NO callbackQueue:nil completion:block];
+}
+
+- (void)pollWithCompletion:(void (^)(DPHueBridgeChanges *, NSError *))block {
+  [self readControllerStateForPoll:YES callbackQueue:nil completion:^(DPHueBridge *hue, DPHueBridgeChanges *changes, NSError *err) {
+    if ( block )
+      block(changes, err);
+  }];
+}
+
+- (DPHueRequest *)readControllerStateForPoll:(BOOL)poll callbackQueue:(dispatch_queue_t)queue completion:(void (^)(DPHueBridge *, DPHueBridgeChanges *, NSError *))block {
   // Cut down on if-checks within completionBlock
-  void (^innerBlock)(DPHueBridge *, NSError *) = ^(DPHueBridge *hue, NSError *error) {
+  void (^innerBlock)(DPHueBridge *, DPHueBridgeChanges *, NSError *) = ^(DPHueBridge *hue, DPHueBridgeChanges *changes, NSError *error) {
     if ( block )
-      block(hue, error);
+      [self performCallback:^{
+        block(hue, changes, error);
+      } onQueue:queue];
+  };
+  void (^parseBlock)(id, NSError *) = ^(id json, NSError *err) {
+    if ( err ) {
+      innerBlock( nil, nil, err );
+      return;
+    }
+    
+    DPHueBridgeChanges *changes = [self updateWithControllerState:json];
+    [self notifyObserversOfChanges:changes];
+    // Reads of single lights and groups still waiting need not be sent anymore
+    if ( [json isKindOfClass:[NSDictionary class]] )
+      [readCoalescer answerReadsBelowPath:[self requestForReadingControllerState].URL.path withControllerState:json];
+    innerBlock( self, changes, nil );
   };
   
-  NSURLRequest *request = [self requestForReadingControllerState];
+  if ( self.refreshMode == DPHueBridgeRefreshModeSelective )
+    return [self readControllerStateSelectivelyForPoll:poll completion:parseBlock];
   
-  DPJSONConnection *connection = [[DPJSONConnection alloc] initWithRequest:request sender:self];
+  static NSSet *keys = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    keys = [NSSet setWithObjects:@"config", @"lights", @"groups", nil];
+  });
+  
+  DPJSONConnection *connection = [self connectionForReading:[self requestForReadingControllerState] keys:keys poll:poll];
   connection.completionBlock = ^(DPHueBridge *sender, id json, NSError *err) {
-    if ( err ) {
-      innerBlock( nil, err );
-      return;
+    parseBlock( json, err );
+  };
+  
+  [self startReadConnection:connection poll:poll];
+  return [[DPHueRequest alloc] initWithConnections:@[connection]];
+}
+
+// Assemble the same JSON as GET /{username} would return, from its three parts
+- (DPHueRequest *)readControllerStateSelectivelyForPoll:(BOOL)poll completion:(void (^)(id json, NSError *err))block {
+  NSDictionary *requests = @{@"config": [self requestForReadingConfig],
+                             @"lights": [self requestForReadingLights],
+                             @"groups": [self requestForReadingGroups]};
+  NSMutableDictionary *json = [NSMutableDictionary new];
+  __block NSUInteger remaining = requests.count;
+  __block NSError *error = nil;
+  __block id errorResult = nil;
+  NSMutableArray<DPJSONConnection *> *connections = [NSMutableArray new];
+  
+  [requests enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSURLRequest *request, BOOL *stop) {
+    DPJSONConnection *connection = [self connectionForReading:request keys:nil poll:poll];
+    // Completion blocks are called on the model queue, one at a time
+    connection.completionBlock = ^(DPHueBridge *sender, id part, NSError *err) {
+      if ( err )
+        error = error ?: err;
+      else if ( [part isKindOfClass:[NSDictionary class]] )
+        json[key] = part;
+      else if ( part != [NSNull null] )
+        // The result array of the controller, e.g. not authenticated
+        errorResult = errorResult ?: part;
+      
+      if ( --remaining )
+        return;
+      block( error ? nil : (errorResult ?: json), error );
+    };
+    [connections addObject:connection];
+    [self startReadConnection:connection poll:poll];
+  }];
+  return [[DPHueRequest alloc] initWithConnections:connections];
+}
+
+/*
+ A connection that decodes only @p keys of the response, or all of it if @p keys is nil.
+ The digest of each body read is remembered per URL, and for a poll a body identical to
+ the previous one is not decoded at all but reported as NSNull: its state is already
+ in the model. Anything else that changes the model calls forgetPolledResponses.
+ */
+- (DPJSONConnection *)connectionForReading:(NSURLRequest *)request keys:(NSSet *)keys poll:(BOOL)poll {
+  DPJSONConnection *connection = [[DPJSONConnection alloc] initWithRequest:request sender:self];
+  connection.completionQueue = modelQueue;
+  connection.registry = registry;
+  NSMutableDictionary *digests = bodyDigests;
+  NSString *path = request.URL.path;
+  connection.dataDecoder = ^id(NSData *data, NSError **error) {
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(data.bytes, (CC_LONG)data.length, digest);
+    NSData *digestData = [NSData dataWithBytes:digest length:sizeof(digest)];
+    @synchronized(digests) {
+      if ( poll && [digests[path] isEqualToData:digestData] )
+        return [NSNull null];
     }
     
-    [sender parseControllerState:json];
-    innerBlock( sender, nil );
+    id json = keys ? [DPHueJSONScanner JSONObjectWithData:data keys:keys error:error]
+                   : [NSJSONSerialization JSONObjectWithData:data options:0 error:error];
+    if ( json ) {
+      @synchronized(digests) {
+        digests[path] = digestData;
+      }
+    }
+    return json;
   };
+  return connection;
+}
+
+// Polls wait until the queue has nothing else to send
+- (void)startReadConnection:(DPJSONConnection *)connection poll:(BOOL)poll {
+  if ( poll ) {
+    connection.priority = DPHueCommandPriorityBackground;
+    [registry addConnection:connection];
+    [commandScheduler enqueueIdleCommand:connection maxPerSecond:DPHueLightCommandsPerSecond];
+    return;
+  }
   
-  [connection start];
+  // An identical read already on its way answers this one too
+  connection.completionQueue = modelQueue;
+  connection.registry = registry;
+  [registry addConnection:connection];
+  if ( ![readCoalescer shareRead:connection] )
+    [self startConnection:connection];
 }
 
 - (void)registerDevice {
@@ -141,9 +365,11 @@ const DPHueCommandQueueKey* DPHueCommandQueueKeyExpire = @"DPHueCommandQueueKeyE
         if (!err)
             [sender parseDeviceRegistration:json];
         if (completion)
-            completion(sender, json, err);
+            [sender performCallback:^{
+                completion(sender, json, err);
+            }];
     };
-    [connection start];
+    [self startConnection:connection];
 }
 
 - (NSString *)description {
@@ -182,162 +408,589 @@ const DPHueCommandQueueKey* DPHueCommandQueueKeyExpire = @"DPHueCommandQueueKeyE
 }
 
 - (DPHueLight *)lightWithId:(NSNumber *)lightId {
-  for ( DPHueLight *light in self.lights )
-    if ( [light.number isEqualToNumber:lightId] )
-      return light;
-  return nil;
+  NSArray *lights = self.lights;
+  // Do not build every light of a snapshot to find one
+  if ( [lights isKindOfClass:[DPHueSnapshotArray class]] )
+    return [(DPHueSnapshotArray *)lights objectWithNumber:lightId];
+  return [self.stateStore lightWithId:lightId];
 }
 
 - (DPHueLight *)lightWithName:(NSString *)lightName {
-  for ( DPHueLight *light in self.lights )
-    if ( [light.name isEqualToString:lightName] )
-      return light;
-  return nil;
+  return [self.stateStore lightWithName:lightName];
 }
 
 - (DPHueLightGroup *)groupWithId:(NSNumber *)groupId {
-  for ( DPHueLightGroup *group in self.groups )
-    if ( [group.number isEqualToNumber:groupId] )
-      return group;
-  
-  return nil;
+  NSArray *groups = self.groups;
+  if ( [groups isKindOfClass:[DPHueSnapshotArray class]] )
+    return [(DPHueSnapshotArray *)groups objectWithNumber:groupId];
+  return [self.stateStore groupWithId:groupId];
 }
 
 - (DPHueLightGroup *)groupWithName:(NSString *)groupName {
-  for ( DPHueLightGroup *group in self.groups )
-    if ( [group.name isEqualToString:groupName] )
-      return group;
- 
-  return nil;
+  return [self.stateStore groupWithName:groupName];
+}
+
+- (NSArray<DPHueLightGroup *> *)groupsContainingLightWithId:(NSNumber *)lightId {
+  return [self.stateStore groupsContainingLightWithId:lightId];
+}
+
+- (DPHueStateStore *)stateStore {
+  @synchronized(self) {
+    if ( !stateStore )
+      stateStore = [[DPHueStateStore alloc] initWithLights:self.lights groups:self.groups];
+    return stateStore;
+  }
+}
+
+- (void)invalidateStateStore {
+  @synchronized(self) {
+    stateStore = nil;
+  }
+}
+
+- (void)updateStateStoreWithChangedLights:(NSDictionary<NSNumber *, NSSet<NSString *> *> *)changedLights changedGroups:(NSDictionary<NSNumber *, NSSet<NSString *> *> *)changedGroups {
+  // Names and membership are indexed, so changing them takes a new store
+  for ( NSSet *changed in changedLights.objectEnumerator )
+    if ( [changed containsObject:@"name"] ) {
+      [self invalidateStateStore];
+      return;
+    }
+  for ( NSSet *changed in changedGroups.objectEnumerator )
+    if ( [changed containsObject:@"name"] || [changed containsObject:@"lightIds"] ) {
+      [self invalidateStateStore];
+      return;
+    }
+  
+  if ( !changedLights.count )
+    return;
+  DPHueStateStore *store;
+  @synchronized(self) {
+    store = stateStore;
+  }
+  // Without a store, the next one is built from the lights as they are now
+  [store updateLightsWithIds:changedLights.allKeys];
+}
+
+// The model changed other than by a poll, so a body equal to the last one polled is news again
+- (void)forgetPolledResponses {
+  NSArray *paths = @[[self requestForReadingControllerState].URL.path,
+                     [self requestForReadingLights].URL.path,
+                     [self requestForReadingGroups].URL.path];
+  @synchronized(bodyDigests) {
+    [bodyDigests removeObjectsForKeys:paths];
+  }
+}
+
+// Called on the model queue, like updateWithControllerState:
+- (void)addGroup:(DPHueLightGroup *)group {
+  if ( ![self groupWithId:group.number] )
+    self.groups = [[(self.groups ?: @[]) arrayByAddingObject:group] sortedArrayUsingComparator:^NSComparisonResult(DPHueLightGroup *a, DPHueLightGroup *b) {
+      return [a.number compare:b.number];
+    }];
+  [self invalidateStateStore];
+  [self forgetPolledResponses];
 }
 
 - (void)createGroupWithName:(NSString *)name lightIds:(NSArray *)lightIds onCompletion:(void (^)(DPHueLightGroup* _Nullable group, NSError* _Nullable error))onCompletionBlock
+{
+  [self createGroupWithName:name lightIds:lightIds callbackQueue:nil onCompletion:onCompletionBlock];
+}
+
+- (void)createGroupWithName:(NSString *)name lightIds:(NSArray *)lightIds callbackQueue:(dispatch_queue_t)queue onCompletion:(void (^)(DPHueLightGroup* _Nullable group, NSError* _Nullable error))onCompletionBlock
 {
   // JPR TODO: handle lights being off during creation
   
+  onCompletionBlock = [self callbackBlockForGroupCompletion:onCompletionBlock queue:queue];
   DPHueLightGroup *group = [[DPHueLightGroup alloc] initWithBridge:self];
   group.username = self.generatedUsername;
   group.host = self.host;
   NSURLRequest *request = [group requestForCreatingWithName:name lightIds:lightIds];
   DPJSONConnection *conn = [[DPJSONConnection alloc] initWithRequest:request sender:self];
-  if ( onCompletionBlock ) {
-    conn.completionBlock = ^(DPHueBridge *sender, id json, NSError *err) {
-      if ( err ) {
+  // Set even without onCompletionBlock, so that the group is added to self.groups
+  conn.completionBlock = ^(DPHueBridge *sender, id json, NSError *err) {
+    if ( err ) {
+      if ( onCompletionBlock )
         onCompletionBlock(nil, err);
-        return;
-      }
+      return;
+    }
 
-      NSString *errorDescription = ((NSDictionary *)[json firstObject])[@"error"][@"description"];
-      if (errorDescription) {
+    NSString *errorDescription = ((NSDictionary *)[json firstObject])[@"error"][@"description"];
+    if (errorDescription) {
+      if ( onCompletionBlock )
         onCompletionBlock(nil, [NSError errorWithDomain:@"DPHue" code:3 userInfo:@{NSLocalizedDescriptionKey: errorDescription}]);
-        return;
-      }
-      
-      [group parseGroupCreation:json];
-      if (group.number) {
-        group.lightIds = lightIds;
+      return;
+    }
+    
+    [group parseGroupCreation:json];
+    if (group.number) {
+      // Named as requested; should the controller have appended a number, the next read corrects it
+      NSMutableArray *stringifiedLightIds = [NSMutableArray array];
+      for (id lightId in lightIds)
+        [stringifiedLightIds addObject:[NSString stringWithFormat:@"%@", lightId]];
+      [group updateWithGroupStateGet:@{@"name": name, @"lights": stringifiedLightIds}];
+      [self addGroup:group];
+      if ( onCompletionBlock )
         onCompletionBlock(group, nil);
-      } else {
-        onCompletionBlock(nil, [NSError errorWithDomain:@"DPHue" code:4 userInfo:@{NSLocalizedDescriptionKey: @"Could not find group id in response"}]);
-      }
-    };
-  }
+    } else if ( onCompletionBlock ) {
+      onCompletionBlock(nil, [NSError errorWithDomain:@"DPHue" code:4 userInfo:@{NSLocalizedDescriptionKey: @"Could not find group id in response"}]);
+    }
+  };
   
-  [conn start];
+  [self startConnection:conn];
 }
 
 - (void)updateGroup:(DPHueLightGroup *)group withName:(NSString *)name lightIds:(NSArray *)lightIds onCompletion:(void (^ _Nullable)(DPHueLightGroup* _Nullable group, NSError* _Nullable error))onCompletionBlock {
+  [self updateGroup:group withName:name lightIds:lightIds callbackQueue:nil onCompletion:onCompletionBlock];
+}
+
+- (void)updateGroup:(DPHueLightGroup *)group withName:(NSString *)name lightIds:(NSArray *)lightIds callbackQueue:(dispatch_queue_t)queue onCompletion:(void (^ _Nullable)(DPHueLightGroup* _Nullable group, NSError* _Nullable error))onCompletionBlock {
   // JPR TODO: handle lights being off during creation
   
   if ( !name )
     name = group.name;
   
+  onCompletionBlock = [self callbackBlockForGroupCompletion:onCompletionBlock queue:queue];
   NSURLRequest *request = [group requestForUpdatingWithName:name lightIds:lightIds];
   DPJSONConnection *conn = [[DPJSONConnection alloc] initWithRequest:request sender:self];
-  if ( onCompletionBlock ) {
-    conn.completionBlock = ^(DPHueBridge *sender, id json, NSError *err) {
-      if ( err ) {
+  // Set even without onCompletionBlock, so that the membership index follows the update
+  conn.completionBlock = ^(DPHueBridge *sender, id json, NSError *err) {
+    if ( err ) {
+      if ( onCompletionBlock )
         onCompletionBlock(nil, err);
-        return;
+      return;
+    }
+    
+    [group parseGroupUpdate:json];
+    BOOL failed = NO;
+    for ( id result in [json isKindOfClass:[NSArray class]] ? json : nil )
+      if ( [result isKindOfClass:[NSDictionary class]] && result[@"error"] )
+        failed = YES;
+    if ( !failed ) {
+      // As NSNumbers, however given, like updateWithGroupStateGet: does for createGroupWithName:
+      NSMutableArray *numberedLightIds = [NSMutableArray array];
+      for (id lightId in lightIds)
+        [numberedLightIds addObject:@([[NSString stringWithFormat:@"%@", lightId] integerValue])];
+      @synchronized(group) {
+        group.lightIds = numberedLightIds;
       }
-      
-      [group parseGroupUpdate:json];
+      [self invalidateStateStore];
+      [self forgetPolledResponses];
+    }
+    if ( onCompletionBlock )
       onCompletionBlock(group, nil);
-    };
-  }
+  };
   
-  [conn start];
+  [self startConnection:conn];
 }
 
-- (void)queueCommand:(DPJSONConnection*)aCommand maxPerSecond:(double)aMaxPerSecond {
-    [self queueCommand:@{DPHueCommandQueueKeyCommand: aCommand,
-                         DPHueCommandQueueKeyMaxPerSecond: @(aMaxPerSecond)}];
-}
-
-- (void)queueCommand:(NSDictionary<DPHueCommandQueueKey*, id>*)aCommandData {
-    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(queueCommand:) object:nil];
-    // Initiate state...
-    commandQueue = commandQueue ?: @[];
-    NSDate* aCurrent = [NSDate date];
-    CGFloat aCongestion = 0;
-    NSInteger aExpired = 0;
-    NSInteger aCompleted = 0;
-    NSDate* aLastExpired;
-    // Get number of expired and completed commands in the command queue, also evaluate congestion value on the completed commands that have not yet expired, and keep track of the expiration time of the last non expired command...
-    for (NSDictionary<DPHueCommandQueueKey*, id>* aDict in commandQueue) {
-        NSDate* aExpire = aDict[DPHueCommandQueueKeyExpire];
-        if (!aExpire)
-            break;
-        if ((aCompleted == 0) && ([aExpire compare:aCurrent] == NSOrderedAscending)) {
-            aExpired++;
-        } else {
-            aCompleted++;
-            aLastExpired = aExpire;
-            aCongestion += [aDict[DPHueCommandQueueKeyTTL] doubleValue];
+- (void)updateLightsOfGroup:(DPHueLightGroup *)aGroup withAction:(NSDictionary *)anAction ambiguous:(BOOL)anAmbiguous {
+    if (!anAction.count && !anAmbiguous)
+        return;
+    dispatch_async(modelQueue, ^{
+        // Group 0 is the implicit group of all lights
+        NSArray<NSNumber*>* aLightIds = aGroup.number && aGroup.number.integerValue == 0 ? [self.lights valueForKey:@"number"] : aGroup.lightIds;
+        NSMutableDictionary<NSNumber*, NSSet<NSString*>*>* aChangedLights = [NSMutableDictionary new];
+        for (NSNumber* aLightId in aLightIds) {
+            NSSet<NSString*>* aChanged = [[self lightWithId:aLightId] updateWithGroupAction:anAction ambiguous:anAmbiguous];
+            if (aChanged.count)
+                aChangedLights[aLightId] = aChanged;
         }
-    }
-    // Setup aProcessedCommands & aWaiting; aProcessedCommands holds data about commands that have been sent to the hue, aWaiting holds data for commands that is waiting to be sent...
-    NSMutableArray* aProcessedCommands = [[commandQueue subarrayWithRange:NSMakeRange(aExpired, aCompleted)] mutableCopy];
-    NSMutableArray* aWaiting = [[commandQueue subarrayWithRange:NSMakeRange(aExpired + aCompleted, commandQueue.count - aExpired - aCompleted)] mutableCopy];
-    // If aCommandData is set, add it to the aWaiting queue...
-    if (aCommandData)
-        [aWaiting addObject:aCommandData];
-    // While aCongestion is less than one, the bridge should be able to accept additional commands...
-    if (aCongestion < 1.0f) {
-        for (NSDictionary<DPHueCommandQueueKey*, id>* aDict in aWaiting) {
-            // Calculate TTL (seconds) from MPS...
-            CGFloat aMPS = [aDict[DPHueCommandQueueKeyMaxPerSecond] doubleValue];
-            CGFloat aTTL = aMPS ? 1 / aMPS : 0;
-            // Add command data to the processed list, also update aLastExpired with the current expiration time, which is set to previously set aLastExpired + TTL...
-            [aProcessedCommands addObject:@{DPHueCommandQueueKeyTTL: @(aTTL),
-                                            DPHueCommandQueueKeyExpire: (aLastExpired = [(aLastExpired ?: aCurrent) dateByAddingTimeInterval:(NSTimeInterval)aTTL])}];
-            // Send the command...
-            [(DPJSONConnection*)(aDict[DPHueCommandQueueKeyCommand]) start];
-            // Update congestion value based on the TTL value...
-            if ((aCongestion += aTTL) >= 1.0f)
-                break;
+        if (!aChangedLights.count)
+            return;
+        [self updateStateStoreWithChangedLights:aChangedLights changedGroups:nil];
+        [self forgetPolledResponses];
+        [self notifyObserversOfChanges:[[DPHueBridgeChanges alloc] initWithAddedLights:@[]
+                                                                        removedLights:@[]
+                                                                        changedLights:aChangedLights
+                                                                          addedGroups:@[]
+                                                                        removedGroups:@[]
+                                                                        changedGroups:@{}]];
+    });
+}
+
+#pragma mark - Schedules
+
+- (void)readSchedulesWithCompletion:(void (^)(NSArray<DPHueSchedule *> *, NSError *))block {
+    [self readSchedulesOnModelQueue:^(NSArray<DPHueSchedule*>* aSchedules, NSError* anError) {
+        if (block)
+            [self performCallback:^{
+                block(aSchedules, anError);
+            }];
+    }];
+}
+
+- (void)synchronizeSchedules:(NSArray<DPHueSchedule *> *)aSchedules deletingOthers:(BOOL)aDeleteOthers completion:(void (^)(DPHueScheduleSyncResult *, NSError *))block {
+    // Bound to this bridge below, which must not change the caller's schedules
+    NSArray<DPHueSchedule*>* aWanted = [[NSArray alloc] initWithArray:aSchedules copyItems:YES];
+    [self readSchedulesOnModelQueue:^(NSArray<DPHueSchedule*>* anExisting, NSError* anError) {
+        if (anError) {
+            if (block)
+                [self performCallback:^{
+                    block(nil, anError);
+                }];
+            return;
         }
+
+        NSMutableArray<DPHueSchedule*>* aRemaining = [anExisting mutableCopy];
+        NSMutableArray<DPHueSchedule*>* aCreates = [NSMutableArray new];
+        NSMutableArray<DPHueSchedule*>* anUpdates = [NSMutableArray new];
+        NSMutableArray<NSDictionary*>* anUpdatedAttributes = [NSMutableArray new];
+        NSMutableArray<DPHueSchedule*>* anUnchanged = [NSMutableArray new];
+        for (DPHueSchedule* aSchedule in aWanted) {
+            aSchedule.bridge = self;
+            aSchedule.host = self.host;
+            aSchedule.username = self.generatedUsername;
+            DPHueSchedule* aMatch = [self scheduleMatching:aSchedule in:aRemaining];
+            if (!aMatch) {
+                aSchedule.identifier = nil;
+                [aCreates addObject:aSchedule];
+                continue;
+            }
+            [aRemaining removeObjectIdenticalTo:aMatch];
+            aSchedule.identifier = aMatch.identifier;
+            NSDictionary* aDifferences = [aSchedule attributesDifferingFrom:aMatch];
+            if (aDifferences.count) {
+                [anUpdates addObject:aSchedule];
+                [anUpdatedAttributes addObject:aDifferences];
+            } else {
+                [anUnchanged addObject:aSchedule];
+            }
+        }
+
+        // Completions run on modelQueue, one at a time
+        NSMutableArray<DPHueSchedule*>* aCreated = [NSMutableArray new];
+        NSMutableArray<DPHueSchedule*>* anUpdated = [NSMutableArray new];
+        NSMutableArray<DPHueSchedule*>* aDeleted = [NSMutableArray new];
+        NSMapTable<DPHueSchedule*, NSError*>* anErrors = [NSMapTable strongToStrongObjectsMapTable];
+        // One for sending, so that the result is not reported before everything was sent
+        __block NSUInteger aPendingCount = 1;
+        void (^aDone)(void) = ^{
+            if (--aPendingCount || !block)
+                return;
+            DPHueScheduleSyncResult* aResult = [[DPHueScheduleSyncResult alloc] initWithCreated:aCreated updated:anUpdated unchanged:anUnchanged
+                                                                                        deleted:aDeleted errors:anErrors];
+            [self performCallback:^{
+                block(aResult, nil);
+            }];
+        };
+        void (^aSend)(DPHueSchedule*, NSURLRequest*, NSMutableArray*) = ^(DPHueSchedule* aSchedule, NSURLRequest* aRequest, NSMutableArray* aSucceeded) {
+            aPendingCount++;
+            DPJSONConnection* aConnection = [[DPJSONConnection alloc] initWithRequest:aRequest sender:aSchedule];
+            aConnection.priority = DPHueCommandPriorityMaintenance;
+            aConnection.completionQueue = modelQueue;
+            aConnection.completionBlock = ^(DPHueSchedule* aSender, id aJson, NSError* aConnectionError) {
+                NSError* aFailure = aConnectionError ?: [aSender parseScheduleSet:aJson];
+                if (aFailure)
+                    [anErrors setObject:aFailure forKey:aSender];
+                else
+                    [aSucceeded addObject:aSender];
+                aDone();
+            };
+            [self queueCommand:aConnection maxPerSecond:DPHueLightCommandsPerSecond];
+        };
+
+        // Deletes first, as a controller holds at most 100 schedules
+        for (DPHueSchedule* aSchedule in aDeleteOthers ? aRemaining : nil)
+            aSend(aSchedule, [aSchedule requestForDeleting], aDeleted);
+        for (NSUInteger i = 0; i < anUpdates.count; i++)
+            aSend(anUpdates[i], [anUpdates[i] requestForSettingAttributes:anUpdatedAttributes[i]], anUpdated);
+        for (DPHueSchedule* aSchedule in aCreates)
+            aSend(aSchedule, [aSchedule requestForSettingAttributes:aSchedule.attributes], aCreated);
+        aDone();
+    }];
+}
+
+// Calls back on modelQueue
+- (void)readSchedulesOnModelQueue:(void (^)(NSArray<DPHueSchedule*>*, NSError*))aCompletion {
+    DPJSONConnection* aConnection = [[DPJSONConnection alloc] initWithRequest:[self requestForReadingSchedules] sender:self];
+    aConnection.completionBlock = ^(DPHueBridge* aSender, id aJson, NSError* anError) {
+        if (anError) {
+            aCompletion(nil, anError);
+            return;
+        }
+        // An array is an error result, e.g. not authenticated
+        if (![aJson isKindOfClass:[NSDictionary class]]) {
+            id aResult = [aJson isKindOfClass:[NSArray class]] ? [aJson firstObject] : nil;
+            id aDescription = [aResult isKindOfClass:[NSDictionary class]] ? aResult[@"error"][@"description"] : nil;
+            aCompletion(nil, [NSError errorWithDomain:@"DPHue" code:5 userInfo:@{NSLocalizedDescriptionKey: aDescription ?: @"Could not read schedules"}]);
+            return;
+        }
+        NSMutableArray<DPHueSchedule*>* aSchedules = [NSMutableArray new];
+        [(NSDictionary*)aJson enumerateKeysAndObjectsUsingBlock:^(NSString* anId, id aScheduleJson, BOOL* aStop) {
+            DPHueSchedule* aSchedule = [[DPHueSchedule alloc] initWithBridge:self];
+            aSchedule.identifier = anId;
+            [aSchedule parseScheduleGet:aScheduleJson];
+            [aSchedules addObject:aSchedule];
+        }];
+        [aSchedules sortUsingComparator:^NSComparisonResult(DPHueSchedule* a, DPHueSchedule* b) {
+            return [a.identifier compare:b.identifier options:NSNumericSearch];
+        }];
+        aCompletion(aSchedules, nil);
+    };
+    [self startReadConnection:aConnection poll:NO];
+}
+
+// The schedule of aSchedules with the identifier of aSchedule, or else with its name
+- (DPHueSchedule*)scheduleMatching:(DPHueSchedule*)aSchedule in:(NSArray<DPHueSchedule*>*)aSchedules {
+    if (aSchedule.identifier.length)
+        for (DPHueSchedule* aCandidate in aSchedules)
+            if ([aCandidate.identifier isEqualToString:aSchedule.identifier])
+                return aCandidate;
+    if (aSchedule.name.length)
+        for (DPHueSchedule* aCandidate in aSchedules)
+            if ([aCandidate.name isEqualToString:aSchedule.name])
+                return aCandidate;
+    return nil;
+}
+
+- (void)queueCommand:(DPJSONConnection*)aCommand maxPerSecond:(double)aMaxPerSecond {
+    if (!aCommand.completionQueue)
+        aCommand.completionQueue = modelQueue;
+    // Registered while waiting too, so that cancelAllRequests finds it
+    aCommand.registry = registry;
+    [registry addConnection:aCommand];
+    // Writes make changes likely, so look again soon
+    if (aCommand.coalescingKey)
+        [_poller noteActivity];
+    if ([self shareReadOrForgetReads:aCommand])
+        return;
+    [commandScheduler enqueueCommand:aCommand maxPerSecond:aMaxPerSecond];
+}
+
+// YES if aCommand is a GET that an identical read answers; any other request makes remembered reads stale
+- (BOOL)shareReadOrForgetReads:(DPJSONConnection*)aCommand {
+    if ([aCommand.request.HTTPMethod isEqualToString:@"GET"])
+        return [readCoalescer shareRead:aCommand];
+    [readCoalescer forgetReads];
+    // Lights and groups were changed before the write was queued
+    [self forgetPolledResponses];
+    return NO;
+}
+
+- (void)startConnection:(DPJSONConnection*)aConnection {
+    if (![aConnection.request.HTTPMethod isEqualToString:@"GET"]) {
+        [readCoalescer forgetReads];
+        [self forgetPolledResponses];
+    }
+    aConnection.session = self.session;
+    aConnection.metrics = _metrics;
+    if (!aConnection.completionQueue)
+        aConnection.completionQueue = modelQueue;
+    aConnection.registry = registry;
+    [aConnection start];
+}
+
+- (void)cancelAllRequests {
+    [registry cancelAllConnections];
+}
+
+- (NSUInteger)pendingRequestCount {
+    return registry.count;
+}
+
+- (void)performCallback:(dispatch_block_t)aBlock {
+    [self performCallback:aBlock onQueue:nil];
+}
+
+// On aQueue, or on callbackQueue without one
+- (void)performCallback:(dispatch_block_t)aBlock onQueue:(dispatch_queue_t)aQueue {
+    dispatch_async(aQueue ?: self.callbackQueue ?: dispatch_get_main_queue(), aBlock);
+}
+
+// Wraps a group completion so that it is called on aQueue, or on callbackQueue without one
+- (void (^)(DPHueLightGroup*, NSError*))callbackBlockForGroupCompletion:(void (^)(DPHueLightGroup*, NSError*))aCompletion queue:(dispatch_queue_t)aQueue {
+    if (!aCompletion)
+        return nil;
+    return ^(DPHueLightGroup* aGroup, NSError* anError) {
+        [self performCallback:^{
+            aCompletion(aGroup, anError);
+        } onQueue:aQueue];
+    };
+}
+
+- (dispatch_queue_t)callbackQueue {
+    @synchronized(self) {
+        return _callbackQueue;
+    }
+}
+
+- (void)setCallbackQueue:(dispatch_queue_t)aCallbackQueue {
+    @synchronized(self) {
+        _callbackQueue = aCallbackQueue;
+    }
+    // Metrics reports are callbacks too
+    _metrics.callbackQueue = aCallbackQueue;
+}
+
+- (void)setAutomaticFanIn:(BOOL)automaticFanIn {
+    _automaticFanIn = automaticFanIn;
+    commandScheduler.delegate = automaticFanIn ? fanInOptimizer : nil;
+    commandScheduler.batchingDelay = automaticFanIn ? kDPHueFanInBatchingDelay : 0;
+}
+
+- (NSUInteger)coalescedCommandCount {
+    return commandScheduler.coalescedCount;
+}
+
+- (NSTimeInterval)readFreshness {
+    return readCoalescer.freshness;
+}
+
+- (void)setReadFreshness:(NSTimeInterval)readFreshness {
+    readCoalescer.freshness = readFreshness;
+}
+
+- (NSUInteger)sharedReadCount {
+    return readCoalescer.sharedCount;
+}
+
+- (double)lightCommandRate {
+    return [commandScheduler learnedRateForMaxPerSecond:DPHueLightCommandsPerSecond];
+}
+
+- (double)groupCommandRate {
+    return [commandScheduler learnedRateForMaxPerSecond:DPHueGroupCommandsPerSecond];
+}
+
+#pragma mark - Observers
+
+- (id)addObserverForLightWithId:(NSNumber *)aLightId usingBlock:(void (^)(DPHueLight *, NSSet<NSString *> *))aBlock {
+    DPHueBridgeObservation* anObservation = [DPHueBridgeObservation new];
+    anObservation.lightId = aLightId;
+    anObservation.lightBlock = aBlock;
+    @synchronized(observations) {
+        [observations addObject:anObservation];
+    }
+    return anObservation;
+}
+
+- (id)addObserverUsingBlock:(void (^)(DPHueBridgeChanges *))aBlock {
+    DPHueBridgeObservation* anObservation = [DPHueBridgeObservation new];
+    anObservation.changesBlock = aBlock;
+    @synchronized(observations) {
+        [observations addObject:anObservation];
+    }
+    return anObservation;
+}
+
+- (void)removeObserver:(id)anObserver {
+    @synchronized(observations) {
+        [observations removeObjectIdenticalTo:anObserver];
+    }
+}
+
+- (void)notifyObserversOfChanges:(DPHueBridgeChanges *)aChanges {
+    if (!aChanges.hasChanges)
+        return;
+    NSArray<DPHueBridgeObservation*>* anObservations;
+    @synchronized(observations) {
+        anObservations = [observations copy];
     }
-    // aSendCount contains the number of commands that was sent...
-    NSInteger aSendCount = aProcessedCommands.count - aCompleted;
-    // Are there any changes that requires the commandQueue to be updated?
-    if (aExpired || aSendCount || aCommandData) {
-        [aProcessedCommands addObjectsFromArray:[aWaiting subarrayWithRange:NSMakeRange(aSendCount, aWaiting.count-aSendCount)]];
-        commandQueue = [NSArray arrayWithArray:aProcessedCommands];
+    if (anObservations.count)
+        [self performCallback:^{
+            [self callObservations:anObservations withChanges:aChanges];
+        }];
+}
+
+- (void)callObservations:(NSArray<DPHueBridgeObservation*>*)anObservations withChanges:(DPHueBridgeChanges *)aChanges {
+    for (DPHueBridgeObservation* anObservation in anObservations) {
+        if (anObservation.changesBlock) {
+            anObservation.changesBlock(aChanges);
+            continue;
+        }
+        NSSet<NSString*>* aChangedKeys = aChanges.changedLights[anObservation.lightId];
+        if (aChangedKeys) {
+            anObservation.lightBlock([self lightWithId:anObservation.lightId], aChangedKeys);
+            continue;
+        }
+        for (NSArray<DPHueLight*>* aLights in @[aChanges.addedLights, aChanges.removedLights])
+            for (DPHueLight* aLight in aLights)
+                if ([aLight.number isEqualToNumber:anObservation.lightId])
+                    anObservation.lightBlock(aLight, nil);
     }
-    // If the bridge is considered to be congested and there are commands waiting to be sent, we should evaluate when we expect the congestion to drop below 1, and then trigger this function at that time...
-    if (aCongestion >= 1.0f && (aWaiting.count > aSendCount)) {
-        aLastExpired = nil;
-        for (NSDictionary<DPHueCommandQueueKey*, id>* aDict in commandQueue) {
-            aLastExpired = aDict[DPHueCommandQueueKeyExpire];
-            if ((aCongestion -= [aDict[DPHueCommandQueueKeyTTL] doubleValue]) < 1.0)
-                break;
+}
+
+#pragma mark - DPHueEventStreaming
+
+- (void)updateWithLightStates:(NSDictionary<NSNumber *, NSDictionary *> *)aLightStates
+                  groupStates:(NSDictionary<NSNumber *, NSDictionary *> *)aGroupStates {
+    dispatch_async(modelQueue, ^{
+        NSMutableDictionary<NSNumber*, NSSet<NSString*>*>* aChangedLights = [NSMutableDictionary new];
+        [aLightStates enumerateKeysAndObjectsUsingBlock:^(NSNumber* aNumber, NSDictionary* aState, BOOL* aStop) {
+            NSSet<NSString*>* aChanged = [[self lightWithId:aNumber] updateWithLightStateChanges:aState];
+            if (aChanged.count)
+                aChangedLights[aNumber] = aChanged;
+        }];
+        NSMutableDictionary<NSNumber*, NSSet<NSString*>*>* aChangedGroups = [NSMutableDictionary new];
+        [aGroupStates enumerateKeysAndObjectsUsingBlock:^(NSNumber* aNumber, NSDictionary* anAction, BOOL* aStop) {
+            NSSet<NSString*>* aChanged = [[self groupWithId:aNumber] updateWithGroupActionChanges:anAction];
+            if (aChanged.count)
+                aChangedGroups[aNumber] = aChanged;
+        }];
+        DPHueBridgeChanges* aChanges = [[DPHueBridgeChanges alloc] initWithAddedLights:@[]
+                                                                        removedLights:@[]
+                                                                        changedLights:aChangedLights
+                                                                          addedGroups:@[]
+                                                                        removedGroups:@[]
+                                                                        changedGroups:aChangedGroups];
+        if (!aChanges.hasChanges)
+            return;
+        [self updateStateStoreWithChangedLights:aChangedLights changedGroups:aChangedGroups];
+        // Reads answered from memory would undo the changes
+        [readCoalescer forgetReads];
+        [self forgetPolledResponses];
+        [self notifyObserversOfChanges:aChanges];
+    });
+}
+
+#pragma mark - Session
+
+- (NSURLSession *)session {
+    @synchronized(self) {
+        if (!session) {
+            NSURLSessionConfiguration* aConfiguration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+            // Connections are persistent by default; bound how many are opened,
+            // the bridge only copes with a few at a time
+            aConfiguration.HTTPMaximumConnectionsPerHost = _maximumConnectionsPerHost;
+            aConfiguration.HTTPShouldUsePipelining = NO;
+            aConfiguration.timeoutIntervalForRequest = _requestTimeout;
+            aConfiguration.timeoutIntervalForResource = _resourceTimeout;
+            // Bridge state must always be read fresh, and it sets no cookies
+            aConfiguration.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+            aConfiguration.URLCache = nil;
+            aConfiguration.HTTPCookieStorage = nil;
+            aConfiguration.HTTPCookieAcceptPolicy = NSHTTPCookieAcceptPolicyNever;
+            aConfiguration.HTTPShouldSetCookies = NO;
+            session = [NSURLSession sessionWithConfiguration:aConfiguration];
         }
-        if (aLastExpired)
-            [self performSelector:@selector(queueCommand:) withObject:nil afterDelay:[aLastExpired timeIntervalSinceDate:aCurrent]];
+        return session;
     }
 }
 
+// Requests already started keep the old session until they complete
+- (void)invalidateSession {
+    @synchronized(self) {
+        [session finishTasksAndInvalidate];
+        session = nil;
+    }
+    commandScheduler.session = self.session;
+}
+
+- (void)setRequestTimeout:(NSTimeInterval)requestTimeout {
+    _requestTimeout = requestTimeout;
+    [self invalidateSession];
+}
+
+- (void)setResourceTimeout:(NSTimeInterval)resourceTimeout {
+    _resourceTimeout = resourceTimeout;
+    [self invalidateSession];
+}
+
+- (void)setMaximumConnectionsPerHost:(NSInteger)maximumConnectionsPerHost {
+    _maximumConnectionsPerHost = maximumConnectionsPerHost;
+    [self invalidateSession];
+}
+
 #pragma mark - GCDAsyncSocketDelegate
 
 - (void)socket:(GCDAsyncSocket *)sock didConnectToHost:(NSString *)host port:(uint16_t)port {
@@ -401,6 +1054,38 @@ const DPHueCommandQueueKey* DPHueCommandQueueKeyExpire = @"DPHueCommandQueueKeyE
   return request;
 }
 
+- (NSURLRequest *)requestForReadingLights
+{
+  return [self requestForReadingResource:@"lights"];
+}
+
+- (NSURLRequest *)requestForReadingGroups
+{
+  return [self requestForReadingResource:@"groups"];
+}
+
+- (NSURLRequest *)requestForReadingConfig
+{
+  return [self requestForReadingResource:@"config"];
+}
+
+- (NSURLRequest *)requestForReadingSchedules
+{
+  return [self requestForReadingResource:@"schedules"];
+}
+
+- (NSURLRequest *)requestForReadingResource:(NSString *)resource
+{
+  NSAssert([self.host length], @"No host set");
+  
+  NSString *urlPath = [NSString stringWithFormat:@"http://%@/api/%@/%@",
+                       self.host, self.generatedUsername ?: @"", resource];
+  NSURL *url = [NSURL URLWithString:urlPath];
+  
+  NSURLRequest *request = [NSURLRequest requestWithURL:url];
+  return request;
+}
+
 
 #pragma mark - HueAPIJsonParsing
 
@@ -426,52 +1111,129 @@ const DPHueCommandQueueKey* DPHueCommandQueueKeyExpire = @"DPHueCommandQueueKeyE
 // GET /{username}
 - (instancetype)parseControllerState:(id)json
 {
+  [self updateWithControllerState:json];
+  return self;
+}
+
+- (DPHueBridgeChanges *)updateWithControllerState:(id)json
+{
+  if ( json == [NSNull null] )
+  {
+    // A poll found the response unchanged
+    return [DPHueBridgeChanges new];
+  }
+  
   if ( ![json respondsToSelector:@selector(objectForKeyedSubscript:)] )
   {
     // We were given an array, not a dict, which means
     // Hue is giving us a result array, which (in this case)
     // means error: not authenticated
     _authenticated = NO;
-    return self;
+    return nil;
   }
   
-  _name = json[@"config"][@"name"];
-  if ( _name )
+  // Sections a poll found unchanged are missing
+  if ( json[@"config"] )
   {
-    _authenticated = YES;
+    _name = json[@"config"][@"name"];
+    if ( _name )
+    {
+      _authenticated = YES;
+    }
+    
+    _swversion = json[@"config"][@"swversion"];
+    _mac = json[@"config"][@"mac"];
   }
   
-  _swversion = json[@"config"][@"swversion"];
-  _mac = json[@"config"][@"mac"];
-  
   NSNumberFormatter *f = [NSNumberFormatter new];
   f.numberStyle = NSNumberFormatterDecimalStyle;
   
+  // Lights and groups are matched by number, so references to them stay valid
+  NSMutableDictionary<NSNumber *, DPHueLight *> *oldLights = [NSMutableDictionary new];
+  for ( DPHueLight *light in json[@"lights"] ? _lights : nil )
+    if ( light.number )
+      oldLights[light.number] = light;
+  
   NSMutableArray *tmpLights = [NSMutableArray new];
+  NSMutableArray *addedLights = [NSMutableArray new];
+  NSMutableDictionary *changedLights = [NSMutableDictionary new];
   for ( NSString *lightItem in json[@"lights"] )
   {
-    DPHueLight *light = [[DPHueLight alloc] initWithBridge:self];
-    [light parseLightStateGet:json[@"lights"][lightItem]];
-    light.number = [f numberFromString:lightItem];
-    light.username = self.generatedUsername;
-    light.host = self.host;
+    NSNumber *number = [f numberFromString:lightItem];
+    if ( !number )
+      continue;
+    DPHueLight *light = oldLights[number];
+    if ( light )
+    {
+      [oldLights removeObjectForKey:number];
+      NSSet *changed = [light updateWithLightStateGet:json[@"lights"][lightItem]];
+      if ( changed.count )
+        changedLights[number] = changed;
+    }
+    else
+    {
+      light = [[DPHueLight alloc] initWithBridge:self];
+      [light parseLightStateGet:json[@"lights"][lightItem]];
+      light.number = number;
+      light.username = self.generatedUsername;
+      light.host = self.host;
+      [addedLights addObject:light];
+    }
     [tmpLights addObject:light];
   }
-  _lights = [NSArray arrayWithArray:tmpLights];
+  if ( addedLights.count || oldLights.count )
+    self.lights = [tmpLights sortedArrayUsingComparator:^NSComparisonResult(DPHueLight *a, DPHueLight *b) {
+      return [a.number compare:b.number];
+    }];
+  
+  NSMutableDictionary<NSNumber *, DPHueLightGroup *> *oldGroups = [NSMutableDictionary new];
+  for ( DPHueLightGroup *group in json[@"groups"] ? _groups : nil )
+    if ( group.number )
+      oldGroups[group.number] = group;
   
   NSMutableArray *tmpGroups = [NSMutableArray new];
+  NSMutableArray *addedGroups = [NSMutableArray new];
+  NSMutableDictionary *changedGroups = [NSMutableDictionary new];
   for ( NSString *groupItem in json[@"groups"] )
   {
-    DPHueLightGroup *group = [[DPHueLightGroup alloc] initWithBridge:self];
-    [group parseGroupStateGet:json[@"groups"][groupItem]];
-    group.number = [f numberFromString:groupItem];
-    group.username = self.generatedUsername;
-    group.host = self.host;
+    NSNumber *number = [f numberFromString:groupItem];
+    if ( !number )
+      continue;
+    DPHueLightGroup *group = oldGroups[number];
+    if ( group )
+    {
+      [oldGroups removeObjectForKey:number];
+      NSSet *changed = [group updateWithGroupStateGet:json[@"groups"][groupItem]];
+      if ( changed.count )
+        changedGroups[number] = changed;
+    }
+    else
+    {
+      group = [[DPHueLightGroup alloc] initWithBridge:self];
+      [group parseGroupStateGet:json[@"groups"][groupItem]];
+      group.number = number;
+      group.username = self.generatedUsername;
+      group.host = self.host;
+      [addedGroups addObject:group];
+    }
     [tmpGroups addObject:group];
   }
-  _groups = [NSArray arrayWithArray:tmpGroups];
+  if ( addedGroups.count || oldGroups.count )
+    self.groups = [tmpGroups sortedArrayUsingComparator:^NSComparisonResult(DPHueLightGroup *a, DPHueLightGroup *b) {
+      return [a.number compare:b.number];
+    }];
   
-  return self;
+  DPHueBridgeChanges *changes = [[DPHueBridgeChanges alloc] initWithAddedLights:addedLights
+                                                                  removedLights:oldLights.allValues
+                                                                  changedLights:changedLights
+                                                                    addedGroups:addedGroups
+                                                                  removedGroups:oldGroups.allValues
+                                                                  changedGroups:changedGroups];
+  if ( addedLights.count || oldLights.count || addedGroups.count || oldGroups.count )
+    [self invalidateStateStore];
+  else
+    [self updateStateStoreWithChangedLights:changedLights changedGroups:changedGroups];
+  return changes;
 }
 
 @end
@@ -0,0 +1,52 @@
+//
+//  DPHueBridgeChanges.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueBridgeChanges describes what a refresh of a DPHueBridge changed:
+// lights and groups that appeared or disappeared on the controller, and
+// per light or group the names of the properties that were updated, so
+// a UI can redraw only what changed.
+
+#import <Foundation/Foundation.h>
+
+@class DPHueLight;
+@class DPHueLightGroup;
+
+@interface DPHueBridgeChanges : NSObject
+
+- (instancetype)initWithAddedLights:(NSArray<DPHueLight *> *)anAddedLights
+                      removedLights:(NSArray<DPHueLight *> *)aRemovedLights
+                      changedLights:(NSDictionary<NSNumber *, NSSet<NSString *> *> *)aChangedLights
+                        addedGroups:(NSArray<DPHueLightGroup *> *)anAddedGroups
+                      removedGroups:(NSArray<DPHueLightGroup *> *)aRemovedGroups
+                      changedGroups:(NSDictionary<NSNumber *, NSSet<NSString *> *> *)aChangedGroups;
+
+/// Lights that are new on the controller.
+@property (nonatomic, readonly, copy) NSArray<DPHueLight *> *addedLights;
+
+/// Lights that no longer exist on the controller.
+@property (nonatomic, readonly, copy) NSArray<DPHueLight *> *removedLights;
+
+/**
+ Names of the DPHueLight properties that changed, e.g. @p "brightness" or @p "reachable",
+ keyed by light number. Added lights are not included.
+ */
+@property (nonatomic, readonly, copy) NSDictionary<NSNumber *, NSSet<NSString *> *> *changedLights;
+
+/// Groups that are new on the controller.
+@property (nonatomic, readonly, copy) NSArray<DPHueLightGroup *> *addedGroups;
+
+/// Groups that no longer exist on the controller.
+@property (nonatomic, readonly, copy) NSArray<DPHueLightGroup *> *removedGroups;
+
+/// Like @p changedLights, for DPHueLightGroup properties keyed by group number.
+@property (nonatomic, readonly, copy) NSDictionary<NSNumber *, NSSet<NSString *> *> *changedGroups;
+
+/// NO if the refresh did not change anything.
+@property (nonatomic, readonly) BOOL hasChanges;
+
+@end
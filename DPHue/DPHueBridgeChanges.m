@@ -0,0 +1,47 @@
+//
+//  DPHueBridgeChanges.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueBridgeChanges.h"
+
+@implementation DPHueBridgeChanges
+
+- (instancetype)initWithAddedLights:(NSArray<DPHueLight *> *)anAddedLights
+                      removedLights:(NSArray<DPHueLight *> *)aRemovedLights
+                      changedLights:(NSDictionary<NSNumber *, NSSet<NSString *> *> *)aChangedLights
+                        addedGroups:(NSArray<DPHueLightGroup *> *)anAddedGroups
+                      removedGroups:(NSArray<DPHueLightGroup *> *)aRemovedGroups
+                      changedGroups:(NSDictionary<NSNumber *, NSSet<NSString *> *> *)aChangedGroups {
+    self = [super init];
+    if (self) {
+        _addedLights = [anAddedLights copy] ?: @[];
+        _removedLights = [aRemovedLights copy] ?: @[];
+        _changedLights = [aChangedLights copy] ?: @{};
+        _addedGroups = [anAddedGroups copy] ?: @[];
+        _removedGroups = [aRemovedGroups copy] ?: @[];
+        _changedGroups = [aChangedGroups copy] ?: @{};
+    }
+    return self;
+}
+
+- (BOOL)hasChanges {
+    return _addedLights.count || _removedLights.count || _changedLights.count
+        || _addedGroups.count || _removedGroups.count || _changedGroups.count;
+}
+
+- (NSString *)description {
+    NSMutableString *descr = [[NSMutableString alloc] init];
+    [descr appendFormat:@"Added lights: [%@]\n", [[_addedLights valueForKey:@"number"] componentsJoinedByString:@","]];
+    [descr appendFormat:@"Removed lights: [%@]\n", [[_removedLights valueForKey:@"number"] componentsJoinedByString:@","]];
+    [descr appendFormat:@"Changed lights: %@\n", _changedLights];
+    [descr appendFormat:@"Added groups: [%@]\n", [[_addedGroups valueForKey:@"number"] componentsJoinedByString:@","]];
+    [descr appendFormat:@"Removed groups: [%@]\n", [[_removedGroups valueForKey:@"number"] componentsJoinedByString:@","]];
+    [descr appendFormat:@"Changed groups: %@\n", _changedGroups];
+    return descr;
+}
+
+@end
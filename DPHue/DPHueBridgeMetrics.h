@@ -0,0 +1,113 @@
+//
+//  DPHueBridgeMetrics.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueBridgeMetrics collects numbers about the requests of a DPHueBridge:
+// how long commands wait in its queue, in total and per priority lane,
+// network round trip and JSON parse
+// times, responses by HTTP status and bridge error type, and the number of
+// queued and in-flight requests. Recording only does relaxed atomic
+// increments, so it is cheap enough to stay enabled under load.
+
+#import <Foundation/Foundation.h>
+#import "DPJSONConnection.h"
+
+/// An immutable copy of a histogram of durations, with power-of-two microsecond buckets.
+@interface DPHueMetricsHistogram : NSObject
+
+@property (nonatomic, readonly) uint64_t count;
+/// In seconds; 0 if empty.
+@property (nonatomic, readonly) NSTimeInterval mean;
+/// In seconds; 0 if empty.
+@property (nonatomic, readonly) NSTimeInterval maximum;
+
+/**
+ Bucket @p i counts durations from 2^i up to 2^(i+1) microseconds; bucket 0 also
+ counts durations below one microsecond.
+ */
+@property (nonatomic, readonly, copy) NSArray<NSNumber *> *bucketCounts;
+
+/// An upper bound of the @p aPercentile (0-100) percentile, in seconds; 0 if empty.
+- (NSTimeInterval)percentile:(double)aPercentile;
+
+@end
+
+
+@interface DPHueBridgeMetricsSnapshot : NSObject
+
+/// When the snapshot was taken, as @p [NSProcessInfo processInfo].systemUptime.
+@property (nonatomic, readonly) NSTimeInterval takenAt;
+
+/// Commands waiting in the queue of the bridge.
+@property (nonatomic, readonly) NSInteger queueDepth;
+
+/// Requests sent and not yet answered.
+@property (nonatomic, readonly) NSInteger inFlight;
+
+/// Time from @p queueCommand:maxPerSecond: until the command was sent.
+@property (nonatomic, readonly, strong) DPHueMetricsHistogram *queueWait;
+
+/// Like @p queueWait, for the commands of one priority lane only.
+- (DPHueMetricsHistogram *)queueWaitForPriority:(DPHueCommandPriority)aPriority;
+
+/// Time from sending a request until its response was received.
+@property (nonatomic, readonly, strong) DPHueMetricsHistogram *roundTrip;
+
+/// Time spent decoding response bodies.
+@property (nonatomic, readonly, strong) DPHueMetricsHistogram *parse;
+
+/// Number of responses per HTTP status code.
+@property (nonatomic, readonly, copy) NSDictionary<NSNumber *, NSNumber *> *statusCodeCounts;
+
+/// Number of error results per bridge error type, e.g. 201 "parameter not modifiable".
+@property (nonatomic, readonly, copy) NSDictionary<NSNumber *, NSNumber *> *bridgeErrorTypeCounts;
+
+/// Requests that failed without a response, e.g. timeouts.
+@property (nonatomic, readonly) uint64_t transportErrorCount;
+
+@end
+
+
+@interface DPHueBridgeMetrics : NSObject
+
+/// Take a consistent-enough copy of all numbers; safe to call from any thread.
+- (DPHueBridgeMetricsSnapshot *)snapshot;
+
+/// Zero all histograms and counters; the queue depth and in-flight gauges are kept.
+- (void)reset;
+
+/**
+ The queue report blocks are called on. DPHueBridge sets its own @p callbackQueue.
+
+ @note Defaults to the main queue.
+ */
+#if OS_OBJECT_USE_OBJC
+@property (strong) dispatch_queue_t callbackQueue;
+#else
+@property (assign) dispatch_queue_t callbackQueue;
+#endif
+
+/**
+ Call @p aBlock on @p callbackQueue with a snapshot every @p anInterval seconds, and
+ reset afterwards if @p aReset is YES. Pass a nil block to stop. The snapshot is taken
+ on a private queue when it is due, however long @p callbackQueue takes to run it.
+ */
+- (void)reportEvery:(NSTimeInterval)anInterval reset:(BOOL)aReset usingBlock:(void (^)(DPHueBridgeMetricsSnapshot *snapshot))aBlock;
+
+#pragma mark - Recording, called by DPHue itself
+
+- (void)recordQueueWait:(NSTimeInterval)aDuration priority:(DPHueCommandPriority)aPriority;
+- (void)recordRoundTrip:(NSTimeInterval)aDuration;
+- (void)recordParse:(NSTimeInterval)aDuration;
+- (void)recordStatusCode:(NSInteger)aStatusCode;
+- (void)recordBridgeErrorType:(NSInteger)aType;
+- (void)recordTransportError;
+- (void)requestStarted;
+- (void)requestFinished;
+- (void)setQueueDepth:(NSInteger)aDepth;
+
+@end
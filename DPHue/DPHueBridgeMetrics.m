@@ -0,0 +1,299 @@
+//
+//  DPHueBridgeMetrics.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueBridgeMetrics.h"
+
+#define kDPHueHistogramBuckets 32
+#define kDPHueStatusCodeLimit 600
+#define kDPHueBridgeErrorTypeLimit 1024
+
+typedef struct {
+    uint64_t buckets[kDPHueHistogramBuckets];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t maximum;
+} DPHueHistogramCounters;
+
+// Lanes as in DPHueCommandPriority, for the description
+static NSString* const kDPHuePriorityNames[DPHueCommandPriorityCount] = {@"interactive", @"normal", @"background", @"maintenance"};
+
+#pragma mark - C functions
+
+static inline void _Increment(uint64_t* aCounter, uint64_t anAmount) {
+    __atomic_fetch_add(aCounter, anAmount, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t _Load(const uint64_t* aCounter) {
+    return __atomic_load_n(aCounter, __ATOMIC_RELAXED);
+}
+
+static inline void _Clear(uint64_t* aCounter) {
+    __atomic_store_n(aCounter, 0, __ATOMIC_RELAXED);
+}
+
+static void _HistogramRecord(DPHueHistogramCounters* aHistogram, NSTimeInterval aDuration) {
+    uint64_t aMicroseconds = aDuration > 0 ? (uint64_t)(aDuration * USEC_PER_SEC) : 0;
+    unsigned aBucket = aMicroseconds ? MIN(kDPHueHistogramBuckets - 1, 63 - __builtin_clzll(aMicroseconds)) : 0;
+    _Increment(&aHistogram->buckets[aBucket], 1);
+    _Increment(&aHistogram->count, 1);
+    _Increment(&aHistogram->sum, aMicroseconds);
+    uint64_t aMaximum = _Load(&aHistogram->maximum);
+    while (aMicroseconds > aMaximum && !__atomic_compare_exchange_n(&aHistogram->maximum, &aMaximum, aMicroseconds, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void _HistogramClear(DPHueHistogramCounters* aHistogram) {
+    for (unsigned i = 0; i < kDPHueHistogramBuckets; i++)
+        _Clear(&aHistogram->buckets[i]);
+    _Clear(&aHistogram->count);
+    _Clear(&aHistogram->sum);
+    _Clear(&aHistogram->maximum);
+}
+
+static NSDictionary<NSNumber*, NSNumber*>* _NonZeroCounts(const uint64_t* aCounters, NSUInteger aLimit) {
+    NSMutableDictionary* aCounts = [NSMutableDictionary new];
+    for (NSUInteger i = 0; i < aLimit; i++) {
+        uint64_t aCount = _Load(&aCounters[i]);
+        if (aCount)
+            aCounts[@(i)] = @(aCount);
+    }
+    return aCounts;
+}
+
+#pragma mark - DPHueMetricsHistogram
+
+@implementation DPHueMetricsHistogram {
+    uint64_t sum;
+}
+
+- (instancetype)initWithCounters:(const DPHueHistogramCounters*)aCounters {
+    self = [super init];
+    if (self) {
+        NSMutableArray<NSNumber*>* aBuckets = [NSMutableArray arrayWithCapacity:kDPHueHistogramBuckets];
+        for (unsigned i = 0; i < kDPHueHistogramBuckets; i++)
+            [aBuckets addObject:@(_Load(&aCounters->buckets[i]))];
+        _bucketCounts = aBuckets;
+        _count = _Load(&aCounters->count);
+        sum = _Load(&aCounters->sum);
+        _maximum = (NSTimeInterval)_Load(&aCounters->maximum) / USEC_PER_SEC;
+    }
+    return self;
+}
+
+- (NSTimeInterval)mean {
+    return _count ? (NSTimeInterval)sum / _count / USEC_PER_SEC : 0;
+}
+
+- (NSTimeInterval)percentile:(double)aPercentile {
+    // Buckets are read one by one, so their total may differ slightly from count
+    uint64_t aTotal = 0;
+    for (NSNumber* aCount in _bucketCounts)
+        aTotal += aCount.unsignedLongLongValue;
+    if (!aTotal)
+        return 0;
+    uint64_t aRank = (uint64_t)ceil(aPercentile / 100.0 * aTotal);
+    uint64_t aSeen = 0;
+    for (NSUInteger i = 0; i < _bucketCounts.count; i++) {
+        aSeen += _bucketCounts[i].unsignedLongLongValue;
+        if (aSeen >= aRank)
+            return MIN(_maximum, (NSTimeInterval)(2ull << i) / USEC_PER_SEC);
+    }
+    return _maximum;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"%llu samples, mean %.1f ms, p50 %.1f ms, p99 %.1f ms, max %.1f ms",
+            _count, self.mean * 1000, [self percentile:50] * 1000, [self percentile:99] * 1000, _maximum * 1000];
+}
+
+@end
+
+#pragma mark - DPHueBridgeMetricsSnapshot
+
+@interface DPHueBridgeMetricsSnapshot ()
+
+@property (nonatomic, readwrite) NSTimeInterval takenAt;
+@property (nonatomic, readwrite) NSInteger queueDepth;
+@property (nonatomic, readwrite) NSInteger inFlight;
+@property (nonatomic, readwrite, strong) DPHueMetricsHistogram *queueWait;
+@property (nonatomic, readwrite, copy) NSArray<DPHueMetricsHistogram *> *queueWaitByPriority;
+@property (nonatomic, readwrite, strong) DPHueMetricsHistogram *roundTrip;
+@property (nonatomic, readwrite, strong) DPHueMetricsHistogram *parse;
+@property (nonatomic, readwrite, copy) NSDictionary<NSNumber *, NSNumber *> *statusCodeCounts;
+@property (nonatomic, readwrite, copy) NSDictionary<NSNumber *, NSNumber *> *bridgeErrorTypeCounts;
+@property (nonatomic, readwrite) uint64_t transportErrorCount;
+
+@end
+
+@implementation DPHueBridgeMetricsSnapshot
+
+- (DPHueMetricsHistogram *)queueWaitForPriority:(DPHueCommandPriority)aPriority {
+    if (aPriority < 0 || aPriority >= DPHueCommandPriorityCount)
+        return nil;
+    return _queueWaitByPriority[aPriority];
+}
+
+- (NSString *)description {
+    NSMutableString *descr = [[NSMutableString alloc] init];
+    [descr appendFormat:@"Queue depth: %ld\n", (long)_queueDepth];
+    [descr appendFormat:@"In flight: %ld\n", (long)_inFlight];
+    [descr appendFormat:@"Queue wait: %@\n", _queueWait];
+    for (NSInteger i = 0; i < DPHueCommandPriorityCount; i++)
+        [descr appendFormat:@"  %@: %@\n", kDPHuePriorityNames[i], _queueWaitByPriority[i]];
+    [descr appendFormat:@"Round trip: %@\n", _roundTrip];
+    [descr appendFormat:@"Parse: %@\n", _parse];
+    [descr appendFormat:@"HTTP status: %@\n", _statusCodeCounts];
+    [descr appendFormat:@"Bridge errors: %@\n", _bridgeErrorTypeCounts];
+    [descr appendFormat:@"Transport errors: %llu\n", _transportErrorCount];
+    return descr;
+}
+
+@end
+
+#pragma mark - DPHueBridgeMetrics
+
+@implementation DPHueBridgeMetrics {
+    DPHueHistogramCounters queueWait;
+    DPHueHistogramCounters queueWaitByPriority[DPHueCommandPriorityCount];
+    DPHueHistogramCounters roundTrip;
+    DPHueHistogramCounters parse;
+    uint64_t statusCodeCounts[kDPHueStatusCodeLimit];
+    uint64_t bridgeErrorTypeCounts[kDPHueBridgeErrorTypeLimit];
+    uint64_t transportErrorCount;
+    int64_t queueDepth;
+    int64_t inFlight;
+    // Guards reportTimer
+    dispatch_queue_t reportQueue;
+    dispatch_source_t reportTimer;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _callbackQueue = dispatch_get_main_queue();
+        reportQueue = dispatch_queue_create("DPHueBridgeMetrics.report", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (reportTimer) {
+        dispatch_source_cancel(reportTimer);
+#if !OS_OBJECT_USE_OBJC
+        dispatch_release(reportTimer);
+#endif
+    }
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(reportQueue);
+#endif
+}
+
+- (DPHueBridgeMetricsSnapshot *)snapshot {
+    DPHueBridgeMetricsSnapshot* aSnapshot = [DPHueBridgeMetricsSnapshot new];
+    aSnapshot.takenAt = [NSProcessInfo processInfo].systemUptime;
+    aSnapshot.queueDepth = (NSInteger)__atomic_load_n(&queueDepth, __ATOMIC_RELAXED);
+    aSnapshot.inFlight = (NSInteger)__atomic_load_n(&inFlight, __ATOMIC_RELAXED);
+    aSnapshot.queueWait = [[DPHueMetricsHistogram alloc] initWithCounters:&queueWait];
+    NSMutableArray<DPHueMetricsHistogram*>* aByPriority = [NSMutableArray arrayWithCapacity:DPHueCommandPriorityCount];
+    for (NSInteger i = 0; i < DPHueCommandPriorityCount; i++)
+        [aByPriority addObject:[[DPHueMetricsHistogram alloc] initWithCounters:&queueWaitByPriority[i]]];
+    aSnapshot.queueWaitByPriority = aByPriority;
+    aSnapshot.roundTrip = [[DPHueMetricsHistogram alloc] initWithCounters:&roundTrip];
+    aSnapshot.parse = [[DPHueMetricsHistogram alloc] initWithCounters:&parse];
+    aSnapshot.statusCodeCounts = _NonZeroCounts(statusCodeCounts, kDPHueStatusCodeLimit);
+    aSnapshot.bridgeErrorTypeCounts = _NonZeroCounts(bridgeErrorTypeCounts, kDPHueBridgeErrorTypeLimit);
+    aSnapshot.transportErrorCount = _Load(&transportErrorCount);
+    return aSnapshot;
+}
+
+- (void)reset {
+    _HistogramClear(&queueWait);
+    for (NSInteger i = 0; i < DPHueCommandPriorityCount; i++)
+        _HistogramClear(&queueWaitByPriority[i]);
+    _HistogramClear(&roundTrip);
+    _HistogramClear(&parse);
+    for (NSUInteger i = 0; i < kDPHueStatusCodeLimit; i++)
+        _Clear(&statusCodeCounts[i]);
+    for (NSUInteger i = 0; i < kDPHueBridgeErrorTypeLimit; i++)
+        _Clear(&bridgeErrorTypeCounts[i]);
+    _Clear(&transportErrorCount);
+}
+
+- (void)reportEvery:(NSTimeInterval)anInterval reset:(BOOL)aReset usingBlock:(void (^)(DPHueBridgeMetricsSnapshot *))aBlock {
+    dispatch_async(reportQueue, ^{
+        if (reportTimer) {
+            dispatch_source_cancel(reportTimer);
+#if !OS_OBJECT_USE_OBJC
+            dispatch_release(reportTimer);
+#endif
+            reportTimer = nil;
+        }
+        if (!aBlock || anInterval <= 0)
+            return;
+        reportTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, reportQueue);
+        __weak typeof(self) wkSelf = self;
+        dispatch_source_set_event_handler(reportTimer, ^{
+            __strong typeof(wkSelf) strongSelf = wkSelf;
+            if (!strongSelf)
+                return;
+            DPHueBridgeMetricsSnapshot* aSnapshot = [strongSelf snapshot];
+            if (aReset)
+                [strongSelf reset];
+            dispatch_async(strongSelf.callbackQueue ?: dispatch_get_main_queue(), ^{
+                aBlock(aSnapshot);
+            });
+        });
+        uint64_t anIntervalNanoseconds = (uint64_t)(anInterval * NSEC_PER_SEC);
+        dispatch_source_set_timer(reportTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)anIntervalNanoseconds), anIntervalNanoseconds, anIntervalNanoseconds / 10);
+        dispatch_resume(reportTimer);
+    });
+}
+
+#pragma mark - Recording
+
+- (void)recordQueueWait:(NSTimeInterval)aDuration priority:(DPHueCommandPriority)aPriority {
+    _HistogramRecord(&queueWait, aDuration);
+    if (aPriority >= 0 && aPriority < DPHueCommandPriorityCount)
+        _HistogramRecord(&queueWaitByPriority[aPriority], aDuration);
+}
+
+- (void)recordRoundTrip:(NSTimeInterval)aDuration {
+    _HistogramRecord(&roundTrip, aDuration);
+}
+
+- (void)recordParse:(NSTimeInterval)aDuration {
+    _HistogramRecord(&parse, aDuration);
+}
+
+- (void)recordStatusCode:(NSInteger)aStatusCode {
+    if (aStatusCode >= 0 && aStatusCode < kDPHueStatusCodeLimit)
+        _Increment(&statusCodeCounts[aStatusCode], 1);
+}
+
+- (void)recordBridgeErrorType:(NSInteger)aType {
+    if (aType >= 0 && aType < kDPHueBridgeErrorTypeLimit)
+        _Increment(&bridgeErrorTypeCounts[aType], 1);
+}
+
+- (void)recordTransportError {
+    _Increment(&transportErrorCount, 1);
+}
+
+- (void)requestStarted {
+    __atomic_fetch_add(&inFlight, 1, __ATOMIC_RELAXED);
+}
+
+- (void)requestFinished {
+    __atomic_fetch_sub(&inFlight, 1, __ATOMIC_RELAXED);
+}
+
+- (void)setQueueDepth:(NSInteger)aDepth {
+    __atomic_store_n(&queueDepth, (int64_t)aDepth, __ATOMIC_RELAXED);
+}
+
+@end
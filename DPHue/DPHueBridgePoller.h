@@ -0,0 +1,53 @@
+//
+//  DPHueBridgePoller.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueBridgePoller keeps the state of a DPHueBridge fresh by downloading it
+// periodically. The interval adapts: it drops to the minimum after local
+// writes and after polls that found changes, and grows while the controller
+// is idle. Polls are queued behind any writes, and responses that are
+// identical to the previous ones are not decoded at all.
+
+#import <Foundation/Foundation.h>
+
+@class DPHueBridge;
+@class DPHueBridgeChanges;
+
+@interface DPHueBridgePoller : NSObject
+
+- (instancetype)initWithBridge:(DPHueBridge *)aBridge;
+
+/// Seconds between polls while things change. Defaults to 1.
+@property (nonatomic, assign) NSTimeInterval minimumInterval;
+
+/// Seconds between polls when the controller has been idle for a while. Defaults to 30.
+@property (nonatomic, assign) NSTimeInterval maximumInterval;
+
+/// Seconds until the next poll is due, as currently adapted.
+@property (nonatomic, readonly) NSTimeInterval currentInterval;
+
+@property (nonatomic, readonly, getter=isRunning) BOOL running;
+
+- (void)start;
+- (void)stop;
+
+/// Poll again soon, e.g. because something was written to the controller.
+- (void)noteActivity;
+
+@end
+
+
+@interface DPHueBridge (DPHuePolling)
+
+/**
+ Download the state of the controller for a poll: the requests wait behind any
+ queued commands, and responses identical to those of the previous download are
+ not decoded. Calls back on @p callbackQueue.
+ */
+- (void)pollWithCompletion:(void (^)(DPHueBridgeChanges *changes, NSError *err))block;
+
+@end
@@ -0,0 +1,104 @@
+//
+//  DPHueBridgePoller.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueBridgePoller.h"
+#import "DPHueBridge.h"
+#import "DPHueBridgeChanges.h"
+
+// How much longer the interval gets after each poll that found nothing new
+static const double kDPHuePollingBackOff = 1.5;
+
+@implementation DPHueBridgePoller {
+    __weak DPHueBridge* bridge;
+    // Polling state is only used on this queue
+    dispatch_queue_t queue;
+    dispatch_source_t timer;
+    BOOL polling;
+    NSTimeInterval dueAt;
+}
+
+- (instancetype)initWithBridge:(DPHueBridge *)aBridge {
+    self = [super init];
+    if (self) {
+        bridge = aBridge;
+        _minimumInterval = 1;
+        _maximumInterval = 30;
+        _currentInterval = _minimumInterval;
+        queue = dispatch_queue_create("DPHueBridgePoller", DISPATCH_QUEUE_SERIAL);
+        timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+        __weak typeof(self) wkSelf = self;
+        dispatch_source_set_event_handler(timer, ^{
+            [wkSelf poll];
+        });
+        dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(timer);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    dispatch_source_cancel(timer);
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(timer);
+    dispatch_release(queue);
+#endif
+}
+
+- (void)start {
+    dispatch_async(queue, ^{
+        if (_running)
+            return;
+        _running = YES;
+        _currentInterval = _minimumInterval;
+        [self scheduleAfter:0];
+    });
+}
+
+- (void)stop {
+    dispatch_async(queue, ^{
+        _running = NO;
+        dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+    });
+}
+
+- (void)noteActivity {
+    dispatch_async(queue, ^{
+        _currentInterval = _minimumInterval;
+        // Only bring the next poll forward; one in flight schedules the next itself
+        if (_running && !polling && dueAt - [NSProcessInfo processInfo].systemUptime > _minimumInterval)
+            [self scheduleAfter:_minimumInterval];
+    });
+}
+
+#pragma mark - Private, called on queue
+
+- (void)scheduleAfter:(NSTimeInterval)anInterval {
+    dueAt = [NSProcessInfo processInfo].systemUptime + anInterval;
+    // Polls need not be punctual, which lets the system coalesce wake-ups
+    dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(anInterval * NSEC_PER_SEC)),
+                              DISPATCH_TIME_FOREVER, (uint64_t)(anInterval * 0.1 * NSEC_PER_SEC));
+}
+
+- (void)poll {
+    DPHueBridge* aBridge = bridge;
+    if (!_running || polling || !aBridge)
+        return;
+    polling = YES;
+    // Not on callbackQueue, which nobody may be servicing
+    [aBridge readControllerStateForPoll:YES callbackQueue:queue completion:^(DPHueBridge* aHue, DPHueBridgeChanges* aChanges, NSError* anError) {
+        polling = NO;
+        if (aChanges.hasChanges)
+            _currentInterval = _minimumInterval;
+        else
+            _currentInterval = MIN(_maximumInterval, MAX(_minimumInterval, _currentInterval * kDPHuePollingBackOff));
+        if (_running)
+            [self scheduleAfter:_currentInterval];
+    }];
+}
+
+@end
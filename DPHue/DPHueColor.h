@@ -0,0 +1,69 @@
+//
+//  DPHueColor.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueColor converts colors for many lights at once into the values the
+// bridge takes: RGB or HSV into CIE 1931 xy, clamped to the gamut each lamp
+// model can show, and color temperatures in Kelvin into mireds. Colors are
+// passed as one array per component (structure of arrays), so the kernels
+// run on whole vectors with Accelerate instead of one light at a time.
+
+#import <Foundation/Foundation.h>
+
+/// The corners of the triangle of xy colors a lamp can show.
+typedef struct {
+    float redX, redY;
+    float greenX, greenY;
+    float blueX, blueY;
+} DPHueGamut;
+
+/// LivingColors and LightStrips, e.g. @p LST001 and @p LLC012.
+extern const DPHueGamut DPHueGamutA;
+
+/// The first Hue bulbs, e.g. @p LCT001.
+extern const DPHueGamut DPHueGamutB;
+
+/// Later Hue bulbs and LightStrips plus, e.g. @p LCT010 and @p LST002.
+extern const DPHueGamut DPHueGamutC;
+
+/// The whole xy plane, for lamps of unknown models.
+extern const DPHueGamut DPHueGamutUnlimited;
+
+@interface DPHueColor : NSObject
+
+/// The gamut of a lamp model, from @p DPHueLight.modelid; @p DPHueGamutUnlimited if unknown.
++ (DPHueGamut)gamutForModelId:(NSString *)aModelId;
+
+/**
+ Convert sRGB colors to xy and brightness.
+
+ @param aRed, aGreen, aBlue
+          @p aCount components from 0 to 1.
+ @param anX, aY
+          Receive the xy color of each light. Black becomes the white point.
+ @param aBrightness
+          Receives the relative luminance of each color from 0 to 254, for @p bri; may be NULL.
+ @param aGamuts
+          The gamut of each light, that colors outside of it are moved into; may be
+          NULL to not clamp.
+ */
++ (void)convertRed:(const float *)aRed green:(const float *)aGreen blue:(const float *)aBlue
+               toX:(float *)anX y:(float *)aY brightness:(float *)aBrightness
+             count:(NSUInteger)aCount gamuts:(const DPHueGamut *)aGamuts;
+
+/// Like the RGB conversion, for hue, saturation and value from 0 to 1.
++ (void)convertHue:(const float *)aHue saturation:(const float *)aSaturation value:(const float *)aValue
+               toX:(float *)anX y:(float *)aY brightness:(float *)aBrightness
+             count:(NSUInteger)aCount gamuts:(const DPHueGamut *)aGamuts;
+
+/// Move each xy color that is outside its gamut to the closest color inside it.
++ (void)clampX:(float *)anX y:(float *)aY count:(NSUInteger)aCount toGamuts:(const DPHueGamut *)aGamuts;
+
+/// Convert color temperatures in Kelvin to mireds, clamped to the 154 - 500 the bridge takes for @p ct.
++ (void)convertKelvin:(const float *)aKelvin toMired:(float *)aMired count:(NSUInteger)aCount;
+
+@end
@@ -0,0 +1,289 @@
+//
+//  DPHueColor.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueColor.h"
+#import <Accelerate/Accelerate.h>
+
+const DPHueGamut DPHueGamutA = {0.704f, 0.296f, 0.2151f, 0.7106f, 0.138f, 0.08f};
+const DPHueGamut DPHueGamutB = {0.675f, 0.322f, 0.409f, 0.518f, 0.167f, 0.04f};
+const DPHueGamut DPHueGamutC = {0.6915f, 0.3083f, 0.17f, 0.7f, 0.1532f, 0.0475f};
+const DPHueGamut DPHueGamutUnlimited = {1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f};
+
+// Where black ends up, as there is no chromaticity to keep
+static const float kDPHueWhiteX = 0.3227f;
+static const float kDPHueWhiteY = 0.329f;
+
+// The bridge takes ct from 154 (6500K) to 500 (2000K) mireds
+static const float kDPHueMinimumMired = 154;
+static const float kDPHueMaximumMired = 500;
+
+typedef float DPHueFloat4 __attribute__((ext_vector_type(4)));
+typedef int DPHueInt4 __attribute__((ext_vector_type(4)));
+
+#pragma mark - C functions
+
+static inline DPHueFloat4 _Splat(float aValue) {
+    DPHueFloat4 aVector = {aValue, aValue, aValue, aValue};
+    return aVector;
+}
+
+static inline DPHueFloat4 _Load4(const float* aSource) {
+    DPHueFloat4 aVector;
+    __builtin_memcpy(&aVector, aSource, sizeof(aVector));
+    return aVector;
+}
+
+static inline void _Store4(float* aDestination, DPHueFloat4 aVector) {
+    __builtin_memcpy(aDestination, &aVector, sizeof(aVector));
+}
+
+// aMask lanes are all ones or all zeros, as produced by vector comparisons
+static inline DPHueFloat4 _Select(DPHueInt4 aMask, DPHueFloat4 aTrue, DPHueFloat4 aFalse) {
+    return (DPHueFloat4)(((DPHueInt4)aTrue & aMask) | ((DPHueInt4)aFalse & ~aMask));
+}
+
+static inline DPHueFloat4 _Clamp01(DPHueFloat4 aVector) {
+    return _Select(aVector < 0, _Splat(0), _Select(aVector > 1, _Splat(1), aVector));
+}
+
+static inline DPHueFloat4 _Cross(DPHueFloat4 anAX, DPHueFloat4 anAY, DPHueFloat4 aBX, DPHueFloat4 aBY) {
+    return anAX * aBY - anAY * aBX;
+}
+
+// The closest point to (aPX, aPY) on the segment from A to B, and its squared distance
+static inline DPHueFloat4 _ClosestOnSegment(DPHueFloat4 aPX, DPHueFloat4 aPY, DPHueFloat4 anAX, DPHueFloat4 anAY,
+                                            DPHueFloat4 aBX, DPHueFloat4 aBY, DPHueFloat4* aQX, DPHueFloat4* aQY) {
+    DPHueFloat4 anABX = aBX - anAX, anABY = aBY - anAY;
+    DPHueFloat4 aLength = anABX * anABX + anABY * anABY;
+    DPHueFloat4 aT = _Clamp01(((aPX - anAX) * anABX + (aPY - anAY) * anABY) / _Select(aLength > 0, aLength, _Splat(1)));
+    *aQX = anAX + aT * anABX;
+    *aQY = anAY + aT * anABY;
+    DPHueFloat4 aDX = aPX - *aQX, aDY = aPY - *aQY;
+    return aDX * aDX + aDY * aDY;
+}
+
+// Clamp four xy colors, with their gamuts, in place
+static inline void _ClampToGamut4(DPHueFloat4* anX, DPHueFloat4* aY, const DPHueGamut* aGamuts) {
+    DPHueFloat4 aRX = {aGamuts[0].redX, aGamuts[1].redX, aGamuts[2].redX, aGamuts[3].redX};
+    DPHueFloat4 aRY = {aGamuts[0].redY, aGamuts[1].redY, aGamuts[2].redY, aGamuts[3].redY};
+    DPHueFloat4 aGX = {aGamuts[0].greenX, aGamuts[1].greenX, aGamuts[2].greenX, aGamuts[3].greenX};
+    DPHueFloat4 aGY = {aGamuts[0].greenY, aGamuts[1].greenY, aGamuts[2].greenY, aGamuts[3].greenY};
+    DPHueFloat4 aBX = {aGamuts[0].blueX, aGamuts[1].blueX, aGamuts[2].blueX, aGamuts[3].blueX};
+    DPHueFloat4 aBY = {aGamuts[0].blueY, aGamuts[1].blueY, aGamuts[2].blueY, aGamuts[3].blueY};
+    DPHueFloat4 aPX = *anX, aPY = *aY;
+
+    // Inside if on the same side of all three edges
+    DPHueFloat4 aD1 = _Cross(aPX - aRX, aPY - aRY, aGX - aRX, aGY - aRY);
+    DPHueFloat4 aD2 = _Cross(aPX - aGX, aPY - aGY, aBX - aGX, aBY - aGY);
+    DPHueFloat4 aD3 = _Cross(aPX - aBX, aPY - aBY, aRX - aBX, aRY - aBY);
+    DPHueInt4 aNegative = (aD1 < 0) | (aD2 < 0) | (aD3 < 0);
+    DPHueInt4 aPositive = (aD1 > 0) | (aD2 > 0) | (aD3 > 0);
+    DPHueInt4 anInside = ~(aNegative & aPositive);
+
+    DPHueFloat4 aQX, aQY, aQX2, aQY2;
+    DPHueFloat4 aDistance = _ClosestOnSegment(aPX, aPY, aRX, aRY, aGX, aGY, &aQX, &aQY);
+    DPHueFloat4 aDistance2 = _ClosestOnSegment(aPX, aPY, aGX, aGY, aBX, aBY, &aQX2, &aQY2);
+    DPHueInt4 aCloser = aDistance2 < aDistance;
+    aQX = _Select(aCloser, aQX2, aQX);
+    aQY = _Select(aCloser, aQY2, aQY);
+    aDistance = _Select(aCloser, aDistance2, aDistance);
+    aDistance2 = _ClosestOnSegment(aPX, aPY, aBX, aBY, aRX, aRY, &aQX2, &aQY2);
+    aCloser = aDistance2 < aDistance;
+    aQX = _Select(aCloser, aQX2, aQX);
+    aQY = _Select(aCloser, aQY2, aQY);
+
+    *anX = _Select(anInside, aPX, aQX);
+    *aY = _Select(anInside, aPY, aQY);
+}
+
+// Undo the sRGB transfer function in place; aScratch holds aCount floats
+static void _Linearize(float* aValues, float* aScratch, NSUInteger aCount) {
+    const float aZero = 0, anOne = 1, anOffset = 0.055f, aScale = 1 / 1.055f, aGamma = 2.4f;
+    const int aLength = (int)aCount;
+    vDSP_vclip(aValues, 1, &aZero, &anOne, aValues, 1, aCount);
+    vDSP_vsadd(aValues, 1, &anOffset, aScratch, 1, aCount);
+    vDSP_vsmul(aScratch, 1, &aScale, aScratch, 1, aCount);
+    vvpowsf(aScratch, &aGamma, aScratch, &aLength);
+    NSUInteger i = 0;
+    for (; i + 4 <= aCount; i += 4) {
+        DPHueFloat4 aValue = _Load4(aValues + i);
+        _Store4(aValues + i, _Select(aValue > 0.04045f, _Load4(aScratch + i), aValue / 12.92f));
+    }
+    for (; i < aCount; i++)
+        aValues[i] = aValues[i] > 0.04045f ? aScratch[i] : aValues[i] / 12.92f;
+}
+
+// Linear RGB, overwritten, to xy and brightness
+static void _LinearRGBToXY(float* aRed, float* aGreen, float* aBlue, float* aScratch,
+                           float* anX, float* aY, float* aBrightness, NSUInteger aCount, const DPHueGamut* aGamuts) {
+    // Wide gamut D65 conversion, as recommended for Hue
+    static const float sMatrix[3][3] = {
+        {0.664511f, 0.154324f, 0.162028f},
+        {0.283881f, 0.668433f, 0.047685f},
+        {0.000088f, 0.072310f, 0.986039f},
+    };
+    float* aRGB[3] = {aRed, aGreen, aBlue};
+    float* aXYZ[3] = {anX, aY, aScratch};
+    for (int aRow = 0; aRow < 3; aRow++) {
+        vDSP_vsmul(aRGB[0], 1, &sMatrix[aRow][0], aXYZ[aRow], 1, aCount);
+        vDSP_vsma(aRGB[1], 1, &sMatrix[aRow][1], aXYZ[aRow], 1, aXYZ[aRow], 1, aCount);
+        vDSP_vsma(aRGB[2], 1, &sMatrix[aRow][2], aXYZ[aRow], 1, aXYZ[aRow], 1, aCount);
+    }
+    if (aBrightness) {
+        const float aZero = 0, aMaximum = 254;
+        vDSP_vsmul(aY, 1, &aMaximum, aBrightness, 1, aCount);
+        vDSP_vclip(aBrightness, 1, &aZero, &aMaximum, aBrightness, 1, aCount);
+    }
+    // X + Y + Z, then divide; the red buffer is free by now
+    vDSP_vadd(anX, 1, aY, 1, aRed, 1, aCount);
+    vDSP_vadd(aRed, 1, aScratch, 1, aRed, 1, aCount);
+    vDSP_vdiv(aRed, 1, anX, 1, anX, 1, aCount);
+    vDSP_vdiv(aRed, 1, aY, 1, aY, 1, aCount);
+    NSUInteger i = 0;
+    for (; i + 4 <= aCount; i += 4) {
+        DPHueInt4 aBlack = _Load4(aRed + i) <= 0;
+        DPHueFloat4 aX4 = _Select(aBlack, _Splat(kDPHueWhiteX), _Load4(anX + i));
+        DPHueFloat4 aY4 = _Select(aBlack, _Splat(kDPHueWhiteY), _Load4(aY + i));
+        if (aGamuts)
+            _ClampToGamut4(&aX4, &aY4, aGamuts + i);
+        _Store4(anX + i, aX4);
+        _Store4(aY + i, aY4);
+    }
+    if (i < aCount) {
+        // Pad the tail to a whole vector
+        float aTailX[4] = {kDPHueWhiteX, kDPHueWhiteX, kDPHueWhiteX, kDPHueWhiteX};
+        float aTailY[4] = {kDPHueWhiteY, kDPHueWhiteY, kDPHueWhiteY, kDPHueWhiteY};
+        DPHueGamut aTailGamuts[4] = {DPHueGamutUnlimited, DPHueGamutUnlimited, DPHueGamutUnlimited, DPHueGamutUnlimited};
+        for (NSUInteger j = i; j < aCount; j++) {
+            BOOL aBlack = aRed[j] <= 0;
+            aTailX[j - i] = aBlack ? kDPHueWhiteX : anX[j];
+            aTailY[j - i] = aBlack ? kDPHueWhiteY : aY[j];
+            if (aGamuts)
+                aTailGamuts[j - i] = aGamuts[j];
+        }
+        DPHueFloat4 aX4 = _Load4(aTailX), aY4 = _Load4(aTailY);
+        if (aGamuts)
+            _ClampToGamut4(&aX4, &aY4, aTailGamuts);
+        _Store4(aTailX, aX4);
+        _Store4(aTailY, aY4);
+        for (NSUInteger j = i; j < aCount; j++) {
+            anX[j] = aTailX[j - i];
+            aY[j] = aTailY[j - i];
+        }
+    }
+}
+
+#pragma mark - DPHueColor
+
+@implementation DPHueColor
+
++ (DPHueGamut)gamutForModelId:(NSString *)aModelId {
+    static NSSet<NSString*>* sGamutA;
+    static NSSet<NSString*>* sGamutB;
+    static NSSet<NSString*>* sGamutC;
+    static dispatch_once_t sOnce;
+    dispatch_once(&sOnce, ^{
+        sGamutA = [NSSet setWithArray:@[@"LLC001", @"LLC005", @"LLC006", @"LLC007", @"LLC010", @"LLC011",
+                                        @"LLC012", @"LLC013", @"LLC014", @"LST001"]];
+        sGamutB = [NSSet setWithArray:@[@"LCT001", @"LCT002", @"LCT003", @"LCT007", @"LLM001"]];
+        sGamutC = [NSSet setWithArray:@[@"LCT010", @"LCT011", @"LCT012", @"LCT014", @"LCT015", @"LCT016",
+                                        @"LLC020", @"LST002"]];
+    });
+    if (!aModelId)
+        return DPHueGamutUnlimited;
+    if ([sGamutA containsObject:aModelId])
+        return DPHueGamutA;
+    if ([sGamutB containsObject:aModelId])
+        return DPHueGamutB;
+    if ([sGamutC containsObject:aModelId])
+        return DPHueGamutC;
+    return DPHueGamutUnlimited;
+}
+
++ (void)convertRed:(const float *)aRed green:(const float *)aGreen blue:(const float *)aBlue
+               toX:(float *)anX y:(float *)aY brightness:(float *)aBrightness
+             count:(NSUInteger)aCount gamuts:(const DPHueGamut *)aGamuts {
+    if (!aCount)
+        return;
+    float* aBuffer = malloc(4 * aCount * sizeof(float));
+    float* aLinear[3] = {aBuffer, aBuffer + aCount, aBuffer + 2 * aCount};
+    float* aScratch = aBuffer + 3 * aCount;
+    memcpy(aLinear[0], aRed, aCount * sizeof(float));
+    memcpy(aLinear[1], aGreen, aCount * sizeof(float));
+    memcpy(aLinear[2], aBlue, aCount * sizeof(float));
+    for (int c = 0; c < 3; c++)
+        _Linearize(aLinear[c], aScratch, aCount);
+    _LinearRGBToXY(aLinear[0], aLinear[1], aLinear[2], aScratch, anX, aY, aBrightness, aCount, aGamuts);
+    free(aBuffer);
+}
+
++ (void)convertHue:(const float *)aHue saturation:(const float *)aSaturation value:(const float *)aValue
+               toX:(float *)anX y:(float *)aY brightness:(float *)aBrightness
+             count:(NSUInteger)aCount gamuts:(const DPHueGamut *)aGamuts {
+    if (!aCount)
+        return;
+    float* aBuffer = malloc(4 * aCount * sizeof(float));
+    float* aRGB[3] = {aBuffer, aBuffer + aCount, aBuffer + 2 * aCount};
+    float* aScratch = aBuffer + 3 * aCount;
+    // Branchless HSV to RGB: channel c is v * mix(1, clamp(|fract(h + k_c) * 6 - 3| - 1), s),
+    // with k = (1, 2/3, 1/3)
+    static const float sOffsets[3] = {1.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    for (NSUInteger i = 0; i < aCount; i += 4) {
+        float aLanes[3][4] = {{0}};
+        NSUInteger aWidth = MIN(4, aCount - i);
+        memcpy(aLanes[0], aHue + i, aWidth * sizeof(float));
+        memcpy(aLanes[1], aSaturation + i, aWidth * sizeof(float));
+        memcpy(aLanes[2], aValue + i, aWidth * sizeof(float));
+        DPHueFloat4 aH = _Load4(aLanes[0]), aS = _Clamp01(_Load4(aLanes[1])), aV = _Clamp01(_Load4(aLanes[2]));
+        for (int c = 0; c < 3; c++) {
+            DPHueFloat4 aShifted = aH + sOffsets[c];
+            DPHueFloat4 aFraction = aShifted - __builtin_convertvector(__builtin_convertvector(aShifted, DPHueInt4), DPHueFloat4);
+            aFraction = _Select(aFraction < 0, aFraction + 1, aFraction);
+            DPHueFloat4 aDistance = aFraction * 6 - 3;
+            DPHueFloat4 aChannel = _Clamp01(_Select(aDistance < 0, -aDistance, aDistance) - 1);
+            _Store4(aLanes[c], aV * (1 + (aChannel - 1) * aS));
+        }
+        for (int c = 0; c < 3; c++)
+            memcpy(aRGB[c] + i, aLanes[c], aWidth * sizeof(float));
+    }
+    for (int c = 0; c < 3; c++)
+        _Linearize(aRGB[c], aScratch, aCount);
+    _LinearRGBToXY(aRGB[0], aRGB[1], aRGB[2], aScratch, anX, aY, aBrightness, aCount, aGamuts);
+    free(aBuffer);
+}
+
++ (void)clampX:(float *)anX y:(float *)aY count:(NSUInteger)aCount toGamuts:(const DPHueGamut *)aGamuts {
+    NSUInteger i = 0;
+    for (; i + 4 <= aCount; i += 4) {
+        DPHueFloat4 aX4 = _Load4(anX + i), aY4 = _Load4(aY + i);
+        _ClampToGamut4(&aX4, &aY4, aGamuts + i);
+        _Store4(anX + i, aX4);
+        _Store4(aY + i, aY4);
+    }
+    if (i < aCount) {
+        float aTailX[4] = {0}, aTailY[4] = {0};
+        DPHueGamut aTailGamuts[4] = {DPHueGamutUnlimited, DPHueGamutUnlimited, DPHueGamutUnlimited, DPHueGamutUnlimited};
+        memcpy(aTailX, anX + i, (aCount - i) * sizeof(float));
+        memcpy(aTailY, aY + i, (aCount - i) * sizeof(float));
+        memcpy(aTailGamuts, aGamuts + i, (aCount - i) * sizeof(DPHueGamut));
+        DPHueFloat4 aX4 = _Load4(aTailX), aY4 = _Load4(aTailY);
+        _ClampToGamut4(&aX4, &aY4, aTailGamuts);
+        _Store4(aTailX, aX4);
+        _Store4(aTailY, aY4);
+        memcpy(anX + i, aTailX, (aCount - i) * sizeof(float));
+        memcpy(aY + i, aTailY, (aCount - i) * sizeof(float));
+    }
+}
+
++ (void)convertKelvin:(const float *)aKelvin toMired:(float *)aMired count:(NSUInteger)aCount {
+    const float aMillion = 1000000, aMinimum = kDPHueMinimumMired, aMaximum = kDPHueMaximumMired;
+    vDSP_svdiv(&aMillion, aKelvin, 1, aMired, 1, aCount);
+    vDSP_vclip(aMired, 1, &aMinimum, &aMaximum, aMired, 1, aCount);
+}
+
+@end
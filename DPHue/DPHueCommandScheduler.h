@@ -0,0 +1,120 @@
+//
+//  DPHueCommandScheduler.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueCommandScheduler paces commands sent to a Hue bridge. Commands
+// are grouped into classes by their maximum rate (about 10/s for lights
+// and 1/s for groups). Each class has its own token bucket and a ring
+// buffer of waiting commands, drained by a single dispatch timer on the
+// monotonic clock, so enqueueing and dequeueing are both O(1). Writes to
+// a target that already has a command waiting are coalesced into it.
+//
+// The rate of each class starts at its nominal rate and is then adapted
+// (AIMD) from the HTTP status and round trip time of every response: it is
+// raised additively while requests succeed, and cut multiplicatively on
+// HTTP 503 or rising latency. Commands rejected with 503 are retried with a
+// jittered backoff before their completion is called.
+//
+// Commands that were cancelled or whose deadline passed while waiting are
+// dropped when their turn comes, without using a token.
+//
+// Within a class, commands wait in one lane per DPHueCommandPriority. The
+// most urgent waiting command takes the next token, except that a lower lane
+// that has been passed over too often gets its turn first: normal commands
+// get at least every 4th token, background ones every 8th and maintenance
+// ones every 16th while they wait. A write coalesced into a waiting command
+// of a lower lane moves that command up to its own lane.
+
+#import <Foundation/Foundation.h>
+
+@class DPHueBridgeMetrics;
+@class DPJSONConnection;
+@class DPHueCommandScheduler;
+
+@protocol DPHueCommandSchedulerDelegate <NSObject>
+
+/**
+ Called on the scheduler queue before waiting commands of a class are started,
+ whenever new writes have arrived. The delegate may take over some of the commands,
+ e.g. to replace them with fewer equivalent ones. Every command taken over must
+ later be handed back with @p completeTakenOverCommands:withJSON:error: or
+ @p returnTakenOverCommands:.
+
+ @return The indexes in @p aWaiting of the commands that were taken over.
+ */
+- (NSIndexSet *)commandScheduler:(DPHueCommandScheduler *)aScheduler takeOverWaitingCommands:(NSArray<DPJSONConnection *> *)aWaiting;
+
+@end
+
+
+@interface DPHueCommandScheduler : NSObject
+
+@property (nonatomic, weak) id<DPHueCommandSchedulerDelegate> delegate;
+
+/**
+ How long, in seconds, writes are held back before they are started, so that a
+ burst of writes is offered to @p delegate as a whole. Only applies when a
+ delegate is set.
+ */
+@property (nonatomic, assign) NSTimeInterval batchingDelay;
+
+/// If set, commands are sent through this session, including when they are retried.
+@property (atomic, strong) NSURLSession *session;
+
+/// If set, queue depth and queue wait times are recorded here, and commands record their requests.
+@property (atomic, strong) DPHueBridgeMetrics *metrics;
+
+/**
+ Create a scheduler with its own private serial queue.
+
+ @param aLabel
+          Label for the private queue, useful when debugging.
+ */
+- (instancetype)initWithLabel:(NSString *)aLabel;
+
+/**
+ Send @p aCommand as soon as the token bucket for its class allows, and the
+ commands waiting in more urgent lanes (see @p priority of @p aCommand) have
+ had their turn.
+
+ @param aCommand
+          The connection to start.
+ @param aMaxPerSecond
+          The nominal rate of the command class, which also identifies the class.
+          Commands of a class may burst up to one second worth of tokens. A rate
+          of 0 means the command is not rate limited and is started right away.
+ */
+- (void)enqueueCommand:(DPJSONConnection *)aCommand maxPerSecond:(double)aMaxPerSecond;
+
+/**
+ Like @p enqueueCommand:maxPerSecond:, for a command that yields to all others, e.g. a
+ poll. It is only started while no other command of its class is waiting and the token
+ bucket of the class is full. Such commands are never coalesced or offered to the delegate.
+ */
+- (void)enqueueIdleCommand:(DPJSONConnection *)aCommand maxPerSecond:(double)aMaxPerSecond;
+
+/**
+ Finish commands that the delegate took over and sent some other way. Commands that
+ had later writes coalesced into them in the meantime are queued again, so that the
+ merged state is sent after the delegate's request; the others are completed with
+ @p aJson and @p anError.
+ */
+- (void)completeTakenOverCommands:(NSArray<DPJSONConnection *> *)aCommands withJSON:(id)aJson error:(NSError *)anError;
+
+/// The rate currently used for the class with nominal rate @p aMaxPerSecond.
+- (double)learnedRateForMaxPerSecond:(double)aMaxPerSecond;
+
+/// Queue commands that the delegate took over but could not handle; they are sent as usual and not offered again.
+- (void)returnTakenOverCommands:(NSArray<DPJSONConnection *> *)aCommands;
+
+/**
+ Number of commands that were merged into an already waiting command with the
+ same @p coalescingKey, i.e. the number of requests that never had to be sent.
+ */
+@property (atomic, readonly) NSUInteger coalescedCount;
+
+@end
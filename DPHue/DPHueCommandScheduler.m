@@ -0,0 +1,597 @@
+//
+//  DPHueCommandScheduler.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueCommandScheduler.h"
+#import "DPHueBridgeMetrics.h"
+#import "DPJSONConnection.h"
+#include <mach/mach_time.h>
+
+// Number of waiting commands of a class that are offered to the delegate at once
+static const NSUInteger kDPHueCommandReviewWindow = 64;
+
+// How many tokens may go to more urgent lanes in a row while a lane has commands
+// waiting; indexed by DPHueCommandPriority
+static const NSUInteger kDPHueLanePassLimits[DPHueCommandPriorityCount] = {0, 3, 7, 15};
+
+// Rate control; rates are relative to the nominal rate of a command class
+static const double kDPHueAdditiveIncrease = 0.05;
+static const double kDPHueOverloadDecrease = 0.5;
+static const double kDPHueLatencyDecrease = 0.8;
+static const double kDPHueMinimumRateFactor = 0.1;
+static const double kDPHueMaximumRateFactor = 2.0;
+static const NSTimeInterval kDPHueLatencyTolerance = 0.05;
+static const uint64_t kDPHueDecreaseHoldOff = NSEC_PER_SEC;
+
+// Commands rejected with HTTP 503 are retried this many times, after a jittered,
+// exponentially growing delay starting at kDPHueRetryDelay
+static const NSUInteger kDPHueMaximumRetries = 3;
+static const NSTimeInterval kDPHueRetryDelay = 0.25;
+
+#pragma mark - C functions
+
+static NSInteger _LaneOfCommand(DPJSONConnection* aCommand) {
+    return MIN(MAX(aCommand.priority, 0), DPHueCommandPriorityCount - 1);
+}
+
+static uint64_t _MonotonicNanoseconds(void) {
+    static mach_timebase_info_data_t sTimebase;
+    if (sTimebase.denom == 0)
+        mach_timebase_info(&sTimebase);
+    return mach_absolute_time() * sTimebase.numer / sTimebase.denom;
+}
+
+#pragma mark - DPHueCommandRing
+
+// Growable FIFO ring buffer; capacity is always a power of two so that
+// indices wrap with a mask. Objects can be removed from the middle in O(1),
+// which leaves an empty slot that is skipped when popping.
+@interface DPHueCommandRing : NSObject
+
+/// Number of objects in the ring, not counting removed ones
+@property (nonatomic, readonly) NSUInteger count;
+
+- (void)push:(id)anObject;
+- (id)pop;
+- (void)enumerateObjectsWithLimit:(NSUInteger)aLimit usingBlock:(void (^)(id anObject, NSUInteger anIndex))aBlock;
+- (void)removeObjectAtIndex:(NSUInteger)anIndex;
+- (BOOL)removeObjectIdenticalTo:(id)anObject;
+
+@end
+
+@implementation DPHueCommandRing {
+    __strong id* buffer;
+    NSUInteger capacity;
+    NSUInteger head;
+    NSUInteger used;
+}
+
+- (void)dealloc {
+    for (NSUInteger i = 0; i < used; i++)
+        buffer[(head + i) & (capacity - 1)] = nil;
+    free((void*)buffer);
+}
+
+- (void)push:(id)anObject {
+    if (used == capacity) {
+        // Grow, dropping the slots of removed objects on the way...
+        NSUInteger aCapacity = capacity ? capacity * 2 : 16;
+        __strong id* aBuffer = (__strong id*)calloc(aCapacity, sizeof(id));
+        NSUInteger aUsed = 0;
+        for (NSUInteger i = 0; i < used; i++) {
+            id anExisting = buffer[(head + i) & (capacity - 1)];
+            if (anExisting)
+                aBuffer[aUsed++] = anExisting;
+            buffer[(head + i) & (capacity - 1)] = nil;
+        }
+        free((void*)buffer);
+        buffer = aBuffer;
+        capacity = aCapacity;
+        head = 0;
+        used = aUsed;
+    }
+    buffer[(head + used) & (capacity - 1)] = anObject;
+    used++;
+    _count++;
+}
+
+- (id)pop {
+    while (used) {
+        id anObject = buffer[head];
+        buffer[head] = nil;
+        head = (head + 1) & (capacity - 1);
+        used--;
+        if (anObject) {
+            _count--;
+            return anObject;
+        }
+    }
+    return nil;
+}
+
+// Indexes passed to aBlock stay valid until the next push or pop
+- (void)enumerateObjectsWithLimit:(NSUInteger)aLimit usingBlock:(void (^)(id anObject, NSUInteger anIndex))aBlock {
+    NSUInteger aVisited = 0;
+    for (NSUInteger i = 0; i < used && aVisited < aLimit; i++) {
+        id anObject = buffer[(head + i) & (capacity - 1)];
+        if (anObject) {
+            aBlock(anObject, i);
+            aVisited++;
+        }
+    }
+}
+
+- (void)removeObjectAtIndex:(NSUInteger)anIndex {
+    if (anIndex < used && buffer[(head + anIndex) & (capacity - 1)]) {
+        buffer[(head + anIndex) & (capacity - 1)] = nil;
+        _count--;
+    }
+}
+
+// O(n); only needed when a command changes lanes
+- (BOOL)removeObjectIdenticalTo:(id)anObject {
+    for (NSUInteger i = 0; i < used; i++) {
+        if (buffer[(head + i) & (capacity - 1)] == anObject) {
+            [self removeObjectAtIndex:i];
+            return YES;
+        }
+    }
+    return NO;
+}
+
+@end
+
+#pragma mark - DPHueTokenBucket
+
+// Token bucket whose rate is learned with AIMD: the rate grows additively while
+// commands succeed, and is cut multiplicatively on HTTP 503 or when the round
+// trip time rises well above the best seen so far.
+@interface DPHueTokenBucket : NSObject
+
+@property (nonatomic, readonly) double nominalRate;
+@property (nonatomic, readonly) double rate;
+@property (nonatomic, assign) double tokens;
+@property (nonatomic, assign) uint64_t refilledAt;
+// One ring per DPHueCommandPriority
+@property (nonatomic, readonly) NSArray<DPHueCommandRing*>* lanes;
+@property (nonatomic, readonly) NSUInteger waitingCount;
+// Commands only started while nothing else waits and the bucket is full
+@property (nonatomic, readonly) DPHueCommandRing* idleWaiting;
+@property (nonatomic, assign) BOOL hasNewWrites;
+@property (nonatomic, readonly) double capacity;
+
+- (void)pushCommand:(DPJSONConnection*)aCommand;
+- (DPJSONConnection*)popCommand;
+- (void)moveCommand:(DPJSONConnection*)aCommand toPriority:(DPHueCommandPriority)aPriority;
+
+@end
+
+@implementation DPHueTokenBucket {
+    NSTimeInterval minimumRoundTrip;
+    NSTimeInterval averageRoundTrip;
+    uint64_t decreasedAt;
+    // Tokens given to more urgent lanes in a row while the lane had commands waiting
+    NSUInteger passedOver[DPHueCommandPriorityCount];
+}
+
+- (instancetype)initWithRate:(double)aRate {
+    self = [super init];
+    if (self) {
+        _nominalRate = aRate;
+        _rate = aRate;
+        _tokens = [self capacity];
+        _refilledAt = _MonotonicNanoseconds();
+        NSMutableArray<DPHueCommandRing*>* aLanes = [NSMutableArray arrayWithCapacity:DPHueCommandPriorityCount];
+        for (NSInteger i = 0; i < DPHueCommandPriorityCount; i++)
+            [aLanes addObject:[DPHueCommandRing new]];
+        _lanes = aLanes;
+        _idleWaiting = [DPHueCommandRing new];
+    }
+    return self;
+}
+
+- (NSUInteger)waitingCount {
+    NSUInteger aCount = 0;
+    for (DPHueCommandRing* aLane in _lanes)
+        aCount += aLane.count;
+    return aCount;
+}
+
+- (void)pushCommand:(DPJSONConnection*)aCommand {
+    [_lanes[_LaneOfCommand(aCommand)] push:aCommand];
+}
+
+// The most urgent command, unless a lane has been passed over too often
+- (DPJSONConnection*)popCommand {
+    NSInteger aChosen = -1;
+    for (NSInteger i = 1; i < DPHueCommandPriorityCount && aChosen < 0; i++)
+        if (_lanes[i].count && passedOver[i] >= kDPHueLanePassLimits[i])
+            aChosen = i;
+    for (NSInteger i = 0; i < DPHueCommandPriorityCount && aChosen < 0; i++)
+        if (_lanes[i].count)
+            aChosen = i;
+    if (aChosen < 0)
+        return nil;
+    for (NSInteger i = 0; i < DPHueCommandPriorityCount; i++)
+        passedOver[i] = i == aChosen || !_lanes[i].count ? 0 : passedOver[i] + 1;
+    return [_lanes[aChosen] pop];
+}
+
+- (void)moveCommand:(DPJSONConnection*)aCommand toPriority:(DPHueCommandPriority)aPriority {
+    NSInteger aLane = _LaneOfCommand(aCommand);
+    aCommand.priority = aPriority;
+    if (aLane != _LaneOfCommand(aCommand) && [_lanes[aLane] removeObjectIdenticalTo:aCommand])
+        [self pushCommand:aCommand];
+}
+
+// Allow a burst of one second worth of commands, but never less than one
+- (double)capacity {
+    return MAX(1.0, _rate);
+}
+
+- (void)refillAt:(uint64_t)aNow {
+    if (aNow > _refilledAt)
+        _tokens = MIN([self capacity], _tokens + (double)(aNow - _refilledAt) / NSEC_PER_SEC * _rate);
+    _refilledAt = aNow;
+}
+
+// Nanoseconds until the next whole token is available
+- (uint64_t)delayUntilNextToken {
+    return _tokens >= 1.0 ? 0 : (uint64_t)ceil((1.0 - _tokens) / _rate * NSEC_PER_SEC);
+}
+
+- (uint64_t)delayUntilFull {
+    double aCapacity = [self capacity];
+    return _tokens >= aCapacity ? 0 : (uint64_t)ceil((aCapacity - _tokens) / _rate * NSEC_PER_SEC);
+}
+
+- (void)recordSuccessWithRoundTrip:(NSTimeInterval)aRoundTrip at:(uint64_t)aNow {
+    // Let the baseline drift up slowly, so a permanently slower network is accepted
+    minimumRoundTrip = minimumRoundTrip > 0 ? MIN(aRoundTrip, minimumRoundTrip * 1.01) : aRoundTrip;
+    averageRoundTrip = averageRoundTrip > 0 ? 0.8 * averageRoundTrip + 0.2 * aRoundTrip : aRoundTrip;
+    if (averageRoundTrip > MAX(2.0 * minimumRoundTrip, minimumRoundTrip + kDPHueLatencyTolerance)) {
+        [self decreaseBy:kDPHueLatencyDecrease at:aNow];
+        return;
+    }
+    // Grows by about kDPHueAdditiveIncrease * nominalRate per second at full load
+    _rate = MIN(_nominalRate * kDPHueMaximumRateFactor, _rate + kDPHueAdditiveIncrease * _nominalRate / _rate);
+}
+
+- (void)recordOverloadAt:(uint64_t)aNow {
+    [self decreaseBy:kDPHueOverloadDecrease at:aNow];
+}
+
+- (void)decreaseBy:(double)aFactor at:(uint64_t)aNow {
+    // Responses to commands sent before a decrease say nothing about the new rate
+    if (decreasedAt && aNow - decreasedAt < kDPHueDecreaseHoldOff)
+        return;
+    decreasedAt = aNow;
+    _rate = MAX(_nominalRate * kDPHueMinimumRateFactor, _rate * aFactor);
+    _tokens = MIN(_tokens, [self capacity]);
+}
+
+@end
+
+#pragma mark - DPHueCommandScheduler
+
+@interface DPHueCommandScheduler ()
+
+@property (atomic, readwrite) NSUInteger coalescedCount;
+@property (atomic, readwrite, copy) NSDictionary<NSNumber *, NSNumber *> *learnedRates;
+
+@end
+
+@implementation DPHueCommandScheduler {
+    dispatch_queue_t queue;
+    dispatch_source_t timer;
+    NSMutableDictionary<NSNumber*, DPHueTokenBucket*>* buckets;
+    NSMutableDictionary<NSString*, DPJSONConnection*>* waitingByKey;
+    // Commands taken over by the delegate: their body at the time, and the bucket they came from
+    NSMapTable<DPJSONConnection*, NSData*>* takenBodies;
+    NSMapTable<DPJSONConnection*, DPHueTokenBucket*>* takenBuckets;
+    NSHashTable<DPJSONConnection*>* returned;
+    // When commands were first enqueued, for the queue wait metric
+    NSMapTable<DPJSONConnection*, NSNumber*>* enqueuedAt;
+    uint64_t timerDeadline;
+}
+
+- (instancetype)initWithLabel:(NSString *)aLabel {
+    self = [super init];
+    if (self) {
+        queue = dispatch_queue_create(aLabel.UTF8String, DISPATCH_QUEUE_SERIAL);
+        buckets = [NSMutableDictionary new];
+        waitingByKey = [NSMutableDictionary new];
+        takenBodies = [NSMapTable strongToStrongObjectsMapTable];
+        takenBuckets = [NSMapTable strongToStrongObjectsMapTable];
+        returned = [NSHashTable weakObjectsHashTable];
+        enqueuedAt = [NSMapTable weakToStrongObjectsMapTable];
+        timerDeadline = UINT64_MAX;
+        timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+        __weak typeof(self) wkSelf = self;
+        dispatch_source_set_event_handler(timer, ^{
+            __strong typeof(wkSelf) strongSelf = wkSelf;
+            [strongSelf timerFired];
+        });
+        dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(timer);
+    }
+    return self;
+}
+
+- (instancetype)init {
+    return [self initWithLabel:@"DPHueCommandScheduler"];
+}
+
+- (void)dealloc {
+    dispatch_source_cancel(timer);
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(timer);
+    dispatch_release(queue);
+#endif
+}
+
+- (void)enqueueCommand:(DPJSONConnection *)aCommand maxPerSecond:(double)aMaxPerSecond {
+    if (aMaxPerSecond <= 0) {
+        [self startCommand:aCommand];
+        return;
+    }
+    dispatch_async(queue, ^{
+        // Merge into a waiting command for the same target, unless that was cancelled...
+        DPHueTokenBucket* aBucket = [self bucketForRate:aMaxPerSecond];
+        DPJSONConnection* aWaiting = aCommand.coalescingKey ? waitingByKey[aCommand.coalescingKey] : nil;
+        if (aWaiting && [aWaiting coalesceConnection:aCommand]) {
+            self.coalescedCount++;
+            // The merged write is as urgent as the most urgent of them
+            if (aCommand.priority < aWaiting.priority) {
+                [aBucket moveCommand:aWaiting toPriority:aCommand.priority];
+                [self drainBucket:aBucket at:_MonotonicNanoseconds()];
+            }
+            return;
+        }
+        if (aCommand.coalescingKey)
+            waitingByKey[aCommand.coalescingKey] = aCommand;
+        [enqueuedAt setObject:@(_MonotonicNanoseconds()) forKey:aCommand];
+        [aBucket pushCommand:aCommand];
+        // Give the delegate a chance to see a burst of writes as a whole...
+        if (aCommand.coalescingKey && self.delegate) {
+            aBucket.hasNewWrites = YES;
+            if (self.batchingDelay > 0) {
+                [self armTimerAt:_MonotonicNanoseconds() + (uint64_t)(self.batchingDelay * NSEC_PER_SEC)];
+                return;
+            }
+        }
+        [self drainBucket:aBucket at:_MonotonicNanoseconds()];
+    });
+}
+
+- (void)enqueueIdleCommand:(DPJSONConnection *)aCommand maxPerSecond:(double)aMaxPerSecond {
+    dispatch_async(queue, ^{
+        DPHueTokenBucket* aBucket = [self bucketForRate:aMaxPerSecond];
+        [enqueuedAt setObject:@(_MonotonicNanoseconds()) forKey:aCommand];
+        [aBucket.idleWaiting push:aCommand];
+        [self drainBucket:aBucket at:_MonotonicNanoseconds()];
+    });
+}
+
+- (void)completeTakenOverCommands:(NSArray<DPJSONConnection *> *)aCommands withJSON:(id)aJson error:(NSError *)anError {
+    dispatch_async(queue, ^{
+        for (DPJSONConnection* aCommand in aCommands) {
+            NSData* aBody = [takenBodies objectForKey:aCommand];
+            DPHueTokenBucket* aBucket = [takenBuckets objectForKey:aCommand];
+            [takenBodies removeObjectForKey:aCommand];
+            [takenBuckets removeObjectForKey:aCommand];
+            if (aBucket && ![aCommand.request.HTTPBody isEqualToData:aBody]) {
+                // Later writes were coalesced into the command in the meantime, so
+                // send the merged state after what the delegate sent...
+                [self requeueCommand:aCommand inBucket:aBucket];
+                continue;
+            }
+            if (aCommand.coalescingKey && waitingByKey[aCommand.coalescingKey] == aCommand)
+                [waitingByKey removeObjectForKey:aCommand.coalescingKey];
+            [aCommand completeWithJSON:aJson error:anError];
+        }
+    });
+}
+
+- (void)returnTakenOverCommands:(NSArray<DPJSONConnection *> *)aCommands {
+    dispatch_async(queue, ^{
+        for (DPJSONConnection* aCommand in aCommands) {
+            DPHueTokenBucket* aBucket = [takenBuckets objectForKey:aCommand];
+            [takenBodies removeObjectForKey:aCommand];
+            [takenBuckets removeObjectForKey:aCommand];
+            if (!aBucket)
+                continue;
+            [returned addObject:aCommand];
+            [self requeueCommand:aCommand inBucket:aBucket];
+        }
+    });
+}
+
+- (double)learnedRateForMaxPerSecond:(double)aMaxPerSecond {
+    NSNumber* aRate = self.learnedRates[@(aMaxPerSecond)];
+    return aRate ? aRate.doubleValue : aMaxPerSecond;
+}
+
+#pragma mark - Private, called on queue
+
+- (DPHueTokenBucket*)bucketForRate:(double)aMaxPerSecond {
+    DPHueTokenBucket* aBucket = buckets[@(aMaxPerSecond)];
+    if (!aBucket)
+        buckets[@(aMaxPerSecond)] = aBucket = [[DPHueTokenBucket alloc] initWithRate:aMaxPerSecond];
+    return aBucket;
+}
+
+- (void)requeueCommand:(DPJSONConnection*)aCommand inBucket:(DPHueTokenBucket*)aBucket {
+    if (aCommand.coalescingKey)
+        waitingByKey[aCommand.coalescingKey] = aCommand;
+    [aBucket pushCommand:aCommand];
+    [self drainBucket:aBucket at:_MonotonicNanoseconds()];
+}
+
+- (void)timerFired {
+    timerDeadline = UINT64_MAX;
+    uint64_t aNow = _MonotonicNanoseconds();
+    for (DPHueTokenBucket* aBucket in buckets.objectEnumerator)
+        [self drainBucket:aBucket at:aNow];
+}
+
+// Start as many waiting commands as the bucket has tokens for, and make sure
+// the timer fires when the next token becomes available
+- (void)drainBucket:(DPHueTokenBucket*)aBucket at:(uint64_t)aNow {
+    if (aBucket.hasNewWrites) {
+        aBucket.hasNewWrites = NO;
+        [self offerWaitingCommandsOfBucket:aBucket];
+    }
+    [aBucket refillAt:aNow];
+    while (aBucket.waitingCount && aBucket.tokens >= 1.0) {
+        DPJSONConnection* aCommand = [aBucket popCommand];
+        // A cancelled command may have been replaced under its key already
+        if (aCommand.coalescingKey && waitingByKey[aCommand.coalescingKey] == aCommand)
+            [waitingByKey removeObjectForKey:aCommand.coalescingKey];
+        // Cancelled and expired commands are dropped without using a token
+        if ([aCommand dropIfCancelledOrExpired])
+            continue;
+        aBucket.tokens -= 1.0;
+        [self startCommand:aCommand fromBucket:aBucket];
+    }
+    // Idle commands wait until the bucket has refilled completely, so they
+    // never hold back a burst of other commands
+    while (!aBucket.waitingCount && aBucket.idleWaiting.count && aBucket.tokens >= aBucket.capacity) {
+        DPJSONConnection* aCommand = [aBucket.idleWaiting pop];
+        if ([aCommand dropIfCancelledOrExpired])
+            continue;
+        aBucket.tokens -= 1.0;
+        [self startCommand:aCommand fromBucket:aBucket];
+    }
+    if (aBucket.waitingCount)
+        [self armTimerAt:aNow + [aBucket delayUntilNextToken]];
+    else if (aBucket.idleWaiting.count)
+        [self armTimerAt:aNow + [aBucket delayUntilFull]];
+    [self publishQueueDepth];
+}
+
+- (void)startCommand:(DPJSONConnection*)aCommand fromBucket:(DPHueTokenBucket*)aBucket {
+    __weak typeof(self) wkSelf = self;
+    aCommand.responseInterceptor = ^BOOL(DPJSONConnection* aConnection, NSError* anError) {
+        __strong typeof(wkSelf) strongSelf = wkSelf;
+        if (!strongSelf)
+            return YES;
+        BOOL aRetry = aConnection.statusCode == 503 && aConnection.retryCount < kDPHueMaximumRetries;
+        dispatch_async(strongSelf->queue, ^{
+            [strongSelf command:aConnection finishedInBucket:aBucket retry:aRetry];
+        });
+        return !aRetry;
+    };
+    // Only the first start counts as queue wait; retries are delayed on purpose
+    NSNumber* anEnqueuedAt = [enqueuedAt objectForKey:aCommand];
+    if (anEnqueuedAt) {
+        [enqueuedAt removeObjectForKey:aCommand];
+        [self.metrics recordQueueWait:(NSTimeInterval)(_MonotonicNanoseconds() - anEnqueuedAt.unsignedLongLongValue) / NSEC_PER_SEC priority:aCommand.priority];
+    }
+    [self startCommand:aCommand];
+}
+
+- (void)startCommand:(DPJSONConnection*)aCommand {
+    NSURLSession* aSession = self.session;
+    if (aSession)
+        aCommand.session = aSession;
+    DPHueBridgeMetrics* aMetrics = self.metrics;
+    if (aMetrics)
+        aCommand.metrics = aMetrics;
+    [aCommand start];
+}
+
+- (void)command:(DPJSONConnection*)aCommand finishedInBucket:(DPHueTokenBucket*)aBucket retry:(BOOL)aRetry {
+    uint64_t aNow = _MonotonicNanoseconds();
+    if (aCommand.statusCode == 503)
+        [aBucket recordOverloadAt:aNow];
+    else if (aCommand.statusCode >= 200 && aCommand.statusCode < 300)
+        [aBucket recordSuccessWithRoundTrip:aCommand.roundTripTime at:aNow];
+    [self publishLearnedRates];
+    if (!aRetry)
+        return;
+    aCommand.retryCount++;
+    double aJitter = 0.5 + arc4random_uniform(1001) / 1000.0;
+    NSTimeInterval aDelay = kDPHueRetryDelay * (1 << (aCommand.retryCount - 1)) * aJitter;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(aDelay * NSEC_PER_SEC)), queue, ^{
+        if ([aCommand dropIfCancelledOrExpired])
+            return;
+        // A newer write to the same target may be waiting by now; it must win over the retried one
+        DPJSONConnection* aWaiting = aCommand.coalescingKey ? waitingByKey[aCommand.coalescingKey] : nil;
+        if (aWaiting && [aWaiting coalesceEarlierConnection:aCommand]) {
+            if (aCommand.priority < aWaiting.priority)
+                [aBucket moveCommand:aWaiting toPriority:aCommand.priority];
+            [self drainBucket:aBucket at:_MonotonicNanoseconds()];
+            return;
+        }
+        if (aCommand.coalescingKey)
+            waitingByKey[aCommand.coalescingKey] = aCommand;
+        [aBucket pushCommand:aCommand];
+        [self drainBucket:aBucket at:_MonotonicNanoseconds()];
+    });
+}
+
+- (void)publishQueueDepth {
+    DPHueBridgeMetrics* aMetrics = self.metrics;
+    if (!aMetrics)
+        return;
+    NSUInteger aDepth = 0;
+    for (DPHueTokenBucket* aBucket in buckets.objectEnumerator)
+        aDepth += aBucket.waitingCount + aBucket.idleWaiting.count;
+    [aMetrics setQueueDepth:aDepth];
+}
+
+- (void)publishLearnedRates {
+    NSMutableDictionary<NSNumber*, NSNumber*>* aRates = [NSMutableDictionary new];
+    [buckets enumerateKeysAndObjectsUsingBlock:^(NSNumber* aMaxPerSecond, DPHueTokenBucket* aBucket, BOOL* aStop) {
+        aRates[aMaxPerSecond] = @(aBucket.rate);
+    }];
+    self.learnedRates = aRates;
+}
+
+// Let the delegate take over waiting commands, e.g. to replace them with fewer
+// equivalent ones
+- (void)offerWaitingCommandsOfBucket:(DPHueTokenBucket*)aBucket {
+    id<DPHueCommandSchedulerDelegate> aDelegate = self.delegate;
+    if (!aDelegate || aBucket.waitingCount < 2)
+        return;
+    NSMutableArray<DPJSONConnection*>* aCommands = [NSMutableArray new];
+    NSMutableArray<DPHueCommandRing*>* aRings = [NSMutableArray new];
+    NSMutableArray<NSNumber*>* aRingIndexes = [NSMutableArray new];
+    // Most urgent lanes first, so they make it into the window
+    for (DPHueCommandRing* aLane in aBucket.lanes) {
+        [aLane enumerateObjectsWithLimit:kDPHueCommandReviewWindow - aCommands.count usingBlock:^(id anObject, NSUInteger anIndex) {
+            if ([returned containsObject:anObject] || [anObject cancelled])
+                return;
+            [aCommands addObject:anObject];
+            [aRings addObject:aLane];
+            [aRingIndexes addObject:@(anIndex)];
+        }];
+    }
+    if (aCommands.count < 2)
+        return;
+    NSIndexSet* aTaken = [aDelegate commandScheduler:self takeOverWaitingCommands:aCommands];
+    // Taken over commands stay registered under their coalescing key, so that later
+    // writes to the same target are merged into them rather than overtaking them
+    [aTaken enumerateIndexesUsingBlock:^(NSUInteger anIndex, BOOL* aStop) {
+        DPJSONConnection* aCommand = aCommands[anIndex];
+        [takenBodies setObject:aCommand.request.HTTPBody ?: [NSData data] forKey:aCommand];
+        [takenBuckets setObject:aBucket forKey:aCommand];
+        [aRings[anIndex] removeObjectAtIndex:aRingIndexes[anIndex].unsignedIntegerValue];
+    }];
+}
+
+- (void)armTimerAt:(uint64_t)aDeadline {
+    if (aDeadline >= timerDeadline)
+        return;
+    timerDeadline = aDeadline;
+    uint64_t aNow = _MonotonicNanoseconds();
+    int64_t aDelay = aDeadline > aNow ? (int64_t)(aDeadline - aNow) : 0;
+    dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, aDelay), DISPATCH_TIME_FOREVER, NSEC_PER_MSEC);
+}
+
+@end
@@ -8,13 +8,22 @@
 //  https://github.com/danparsons/DPHue
 
 // DPHueDiscover provides a full Hue controller autodiscovery
-// system, using two discovery methods: meethue.com's API
-// and also SSDP.
+// system. Four methods run at the same time: bridges found
+// before are looked for at their last known address, meethue.com's
+// API is asked, an SSDP search is broadcast, and optionally a list
+// of hosts (e.g. a whole subnet) is probed directly. Discovery ends
+// as soon as one of them, other than SSDP, has found bridges, or
+// when the duration is up.
+// Bridges found are cached on disk by MAC address, so on the next
+// launch a known bridge is usually found within milliseconds.
 // See QuickHue for implementation example:
 // https://github.com/danparsons/QuickHue
 
 #import <Foundation/Foundation.h>
 
+/// Number of hosts of @p probeHosts that are probed at once.
+extern const NSUInteger DPHueDiscoverMaximumConcurrentProbes;
+
 @interface DPHueDiscover : NSObject
 
 - (instancetype)init NS_UNAVAILABLE;
@@ -23,6 +32,41 @@
 
 - (instancetype)initWithDuration:(NSInteger)duration hueFound:(void(^_Nullable)(NSString* host, NSString* mac))hueFound completion:(void(^_Nullable)(NSDictionary* discovered, NSString* _Nullable log, NSError* _Nullable error))completion;
 
+/**
+ Like @p discoverWithDuration:hueFound:completion:, but also asks every host in
+ @p probeHosts for its description.xml, at most @p DPHueDiscoverMaximumConcurrentProbes
+ at a time. Useful on networks that block SSDP multicast; see @p hostsInSubnet:.
+ */
++ (instancetype)discoverWithDuration:(NSInteger)duration probeHosts:(NSArray<NSString*>* _Nullable)probeHosts hueFound:(void(^_Nullable)(NSString* host, NSString* mac))hueFound completion:(void(^_Nullable)(NSDictionary* discovered, NSString* _Nullable log, NSError* _Nullable error))completion;
+
+- (instancetype)initWithDuration:(NSInteger)duration probeHosts:(NSArray<NSString*>* _Nullable)probeHosts hueFound:(void(^_Nullable)(NSString* host, NSString* mac))hueFound completion:(void(^_Nullable)(NSDictionary* discovered, NSString* _Nullable log, NSError* _Nullable error))completion;
+
 - (void)stopDiscovery;
 
+/**
+ The host addresses of an IPv4 subnet in CIDR notation, e.g. @"192.168.1.0/24",
+ without its network and broadcast address. Prefixes shorter than /16 are refused.
+
+ @return The addresses, or nil if @p aCIDR is not valid.
+ */
++ (NSArray<NSString*>* _Nullable)hostsInSubnet:(NSString*)aCIDR;
+
+#pragma mark - Cache
+
+/**
+ Seconds a cached bridge is still looked for after it was last found.
+ Defaults to 30 days; 0 disables the cache.
+ */
++ (NSTimeInterval)cacheTimeToLive;
++ (void)setCacheTimeToLive:(NSTimeInterval)aTimeToLive;
+
+/// File bridges are cached in; defaults to DPHueDiscover.plist in the caches directory.
++ (NSURL* _Nullable)cacheURL;
++ (void)setCacheURL:(NSURL* _Nullable)aURL;
+
+/// Bridges in the cache that have not expired, host per MAC address.
++ (NSDictionary<NSString*, NSString*>*)cachedBridges;
+
++ (void)clearCache;
+
 @end
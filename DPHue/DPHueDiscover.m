@@ -12,8 +12,17 @@
 #import "DPHueNUPNP.h"
 #import "WSLog.h"
 #import <CocoaAsyncSocket/GCDAsyncUdpSocket.h>
+#import <arpa/inet.h>
 
-#define AppendLogStr(str, fmt, ...) { if (str) { str = [str stringByAppendingFormat:@"%@: %@\n", [NSDate date], [NSString stringWithFormat:(fmt), ##__VA_ARGS__]]; } else { str = [NSString stringWithFormat:@"%@: %@\n", [NSDate date], [NSString stringWithFormat:(fmt), ##__VA_ARGS__]]; } };
+#define AppendLogStr(str, fmt, ...) { [str appendFormat:@"%@: ", [NSDate date]]; [str appendFormat:(fmt), ##__VA_ARGS__]; [str appendString:@"\n"]; };
+
+const NSUInteger DPHueDiscoverMaximumConcurrentProbes = 16;
+
+// A bridge answers for its description.xml within milliseconds; most other hosts of a sweep never answer
+static const NSTimeInterval kProbeTimeout = 2.0;
+
+static NSTimeInterval sCacheTimeToLive = 30 * 24 * 60 * 60;
+static NSURL* sCacheURL = nil;
 
 #pragma mark - C functions
 
@@ -30,100 +39,168 @@ NSString* _MacAddressWithSeparators(NSString* aMacAddress) {
     return aMacAddress;
 }
 
+// The cloud and description.xml spell the same MAC differently
+static NSString* _NormalizedMAC(NSString* aMAC) {
+    NSCharacterSet* aSeparators = [NSCharacterSet characterSetWithCharactersInString:@":-"];
+    return [[[aMAC lowercaseString] componentsSeparatedByCharactersInSet:aSeparators] componentsJoinedByString:@""];
+}
+
+static NSRegularExpression* _DescriptionURLExpression(void) {
+    static NSRegularExpression* sExpression;
+    static dispatch_once_t sOnce;
+    dispatch_once(&sOnce, ^{
+        sExpression = [[NSRegularExpression alloc] initWithPattern:@"http:\\/\\/(.*?)description\\.xml" options:0 error:nil];
+    });
+    return sExpression;
+}
+
+static NSRegularExpression* _SerialNumberExpression(void) {
+    static NSRegularExpression* sExpression;
+    static dispatch_once_t sOnce;
+    dispatch_once(&sOnce, ^{
+        sExpression = [[NSRegularExpression alloc] initWithPattern:@"<serialNumber>(.*?)</serialNumber>" options:0 error:nil];
+    });
+    return sExpression;
+}
+
 #pragma mark - DPHueDiscover
 
 @implementation DPHueDiscover
 {
-    NSString* log;
+    NSMutableString* log;
     NSMutableDictionary* discovered;
+    NSMutableSet* foundMACs;
     NSMutableSet* tested;
     GCDAsyncUdpSocket* udpSocket;
+    NSURLSession* probeSession;
+    NSArray<NSString*>* probeHosts;
+    NSUInteger nextProbe;
+    NSUInteger activeProbes;
+    NSUInteger probesFound;
     NSError* discoveryError;
+    DPHueDiscover* keepAlive;
     void (^doHueFound)(NSString* host, NSString* mac);
     void (^doCompletion)(NSDictionary* discovered, NSString* log, NSError* error);
 }
 
 + (instancetype)discoverWithDuration:(NSInteger)duration hueFound:(void(^_Nullable)(NSString* host, NSString* mac))hueFound completion:(void(^_Nullable)(NSDictionary* discovered, NSString* _Nullable log, NSError* _Nullable error))completion {
-    return [[DPHueDiscover alloc] initWithDuration:duration hueFound:hueFound completion:completion];
+    return [[DPHueDiscover alloc] initWithDuration:duration probeHosts:nil hueFound:hueFound completion:completion];
 }
 
 - (instancetype)initWithDuration:(NSInteger)duration hueFound:(void(^_Nullable)(NSString* host, NSString* mac))hueFound completion:(void(^_Nullable)(NSDictionary* discovered, NSString* _Nullable log, NSError* _Nullable error))completion {
+    return [self initWithDuration:duration probeHosts:nil hueFound:hueFound completion:completion];
+}
+
++ (instancetype)discoverWithDuration:(NSInteger)duration probeHosts:(NSArray<NSString*>* _Nullable)probeHosts hueFound:(void(^_Nullable)(NSString* host, NSString* mac))hueFound completion:(void(^_Nullable)(NSDictionary* discovered, NSString* _Nullable log, NSError* _Nullable error))completion {
+    return [[DPHueDiscover alloc] initWithDuration:duration probeHosts:probeHosts hueFound:hueFound completion:completion];
+}
+
+- (instancetype)initWithDuration:(NSInteger)duration probeHosts:(NSArray<NSString*>* _Nullable)probeHosts hueFound:(void(^_Nullable)(NSString* host, NSString* mac))hueFound completion:(void(^_Nullable)(NSDictionary* discovered, NSString* _Nullable log, NSError* _Nullable error))completion {
     self = [super init];
     if (self) {
-        [self discoverHueForDuration:duration hueFound:hueFound completion:completion];
+        [self discoverHueForDuration:duration probeHosts:probeHosts hueFound:hueFound completion:completion];
     }
     return self;
 }
 
 #pragma mark Discovery
 
-
--(void)discoverHueForDuration:(NSInteger)duration hueFound:(void(^_Nullable)(NSString* host, NSString* mac))hueFound completion:(void(^_Nullable)(NSDictionary* discovered, NSString* log, NSError* error))completion {
+-(void)discoverHueForDuration:(NSInteger)duration probeHosts:(NSArray<NSString*>*)aProbeHosts hueFound:(void(^_Nullable)(NSString* host, NSString* mac))hueFound completion:(void(^_Nullable)(NSDictionary* discovered, NSString* log, NSError* error))completion {
     assert(discovered == nil);
+    log = [NSMutableString new];
     discovered = [NSMutableDictionary new];
+    foundMACs = [NSMutableSet new];
+    tested = [NSMutableSet new];
     doHueFound = hueFound;
     doCompletion = completion;
-    __block DPHueDiscover* sSelf = self;
-   
-    AppendLogStr(log, @"Starting discovery, via meethue.com API first");
+    // Stay alive until stopDiscovery, even if the caller lets go
+    keepAlive = self;
+
+    NSURLSessionConfiguration* aConfiguration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    aConfiguration.timeoutIntervalForRequest = kProbeTimeout;
+    aConfiguration.timeoutIntervalForResource = kProbeTimeout;
+    aConfiguration.HTTPMaximumConnectionsPerHost = 1;
+    probeSession = [NSURLSession sessionWithConfiguration:aConfiguration delegate:nil delegateQueue:[NSOperationQueue mainQueue]];
+
+    AppendLogStr(log, @"Starting discovery via cache, meethue.com API, SSDP and %lu probe hosts at once", (unsigned long)aProbeHosts.count);
+    [self verifyCachedBridges];
+    [self startCloudDiscovery];
+    [self startSSDPDiscovery];
+    [self startProbingHosts:aProbeHosts];
+
+    __weak DPHueDiscover* wSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(duration * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [wSelf stopDiscovery];
+    });
+}
+
+- (void)verifyCachedBridges {
+    NSDictionary<NSString*, NSString*>* aCached = [DPHueDiscover cachedBridges];
+    if (!aCached.count)
+        return;
+    AppendLogStr(log, @"Verifying %lu cached bridges", (unsigned long)aCached.count);
+    __block NSUInteger aPending = aCached.count;
+    __block NSUInteger aVerified = 0;
+    [aCached enumerateKeysAndObjectsUsingBlock:^(NSString* aCachedMac, NSString* aCachedHost, BOOL* aStop) {
+        [tested addObject:aCachedHost];
+        [self probeHost:aCachedHost logFailures:YES completion:^(NSString* aHost, NSString* aMac) {
+            if (aMac && [_NormalizedMAC(aMac) isEqualToString:_NormalizedMAC(aCachedMac)])
+                aVerified++;
+            else
+                AppendLogStr(log, @"Cached bridge %@ is no longer at %@", aCachedMac, aCachedHost);
+            // All known bridges are back where they were, no need to wait for the others
+            if (--aPending == 0 && aVerified == aCached.count) {
+                AppendLogStr(log, @"All cached bridges verified");
+                [self stopDiscovery];
+            }
+        }];
+    }];
+}
+
+- (void)startCloudDiscovery {
     AppendLogStr(log, @"Making request to https://discovery.meethue.com");
     DPJSONConnection* connection = [[DPJSONConnection alloc] initWithRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"https://discovery.meethue.com"]] sender:nil];
     connection.completionBlock = ^(DPHueDiscover* sender, id json, NSError* err) {
-        // If there was an error, use SSDP discovery...
+        if (!discovered)
+            return;
         if (err) {
-            AppendLogStr(log, @"Error hitting web service, starting SSDP discovery");
-            [self startSSDPDiscovery];
+            AppendLogStr(log, @"Error hitting web service: %@", err.localizedDescription);
             return;
         }
-        // Get the hues registered at the local network from www.meethue.com/api/nupnp
+        // Parse all hues registered at the local network...
         NSInteger nFound = 0;
-        if ([json respondsToSelector:@selector(objectAtIndex:)] && [json respondsToSelector:@selector(count)])
-            for (id aProperties in json)
-                if ([aProperties respondsToSelector:@selector(objectForKey:)] && aProperties[@"id"] && aProperties[@"internalipaddress"])
-                    nFound++;
-        // If no hues are found, use SSDP discovery...
-        if (nFound == 0) {
-            AppendLogStr(log, @"Received response from web service, but no IP, starting SSDP discovery");
-            [self startSSDPDiscovery];
-            return;
-        }
-        // Parse all hues found...
-        for (id aProperties in json) {
-            NSString* hueID;
-            NSString* hueInternalIP;
-            if ([aProperties respondsToSelector:@selector(objectForKey:)] && (hueID = aProperties[@"id"]) && (hueInternalIP = aProperties[@"internalipaddress"])) {
-                NSString* hueMac = aProperties[@"macaddress"];
-                // If mac address is missing, extract mac address from id (first 6 and last 6 characters)...
-                if (!hueMac && (hueID.length >= 12))
-                    hueMac = [[hueID substringToIndex:6] stringByAppendingString:[hueID substringFromIndex:hueID.length-6]];
-                // Insert mac address separators...
-                hueMac = _MacAddressWithSeparators(hueMac);
-                // Log and Report...
-                AppendLogStr(log, @"Received Hue IP from web service: %@ with id %@", hueInternalIP, hueID);
-                if (hueMac && discovered && !discovered[hueMac]) {
-                    discovered[hueMac] = hueInternalIP;
-                    if (doHueFound)
-                        doHueFound(hueInternalIP, hueMac);
+        if ([json respondsToSelector:@selector(objectAtIndex:)] && [json respondsToSelector:@selector(count)]) {
+            for (id aProperties in json) {
+                NSString* hueID;
+                NSString* hueInternalIP;
+                if ([aProperties respondsToSelector:@selector(objectForKey:)] && (hueID = aProperties[@"id"]) && (hueInternalIP = aProperties[@"internalipaddress"])) {
+                    NSString* hueMac = aProperties[@"macaddress"];
+                    // If mac address is missing, extract mac address from id (first 6 and last 6 characters)...
+                    if (!hueMac && (hueID.length >= 12))
+                        hueMac = [[hueID substringToIndex:6] stringByAppendingString:[hueID substringFromIndex:hueID.length-6]];
+                    // Insert mac address separators...
+                    hueMac = _MacAddressWithSeparators(hueMac);
+                    AppendLogStr(log, @"Received Hue IP from web service: %@ with id %@", hueInternalIP, hueID);
+                    if (hueMac) {
+                        [self foundHueAt:hueInternalIP mac:hueMac];
+                        nFound++;
+                    }
                 }
             }
         }
-        // If we have not initiated an SSDP search, then stop discovery at this point...
-        if (!udpSocket) {
-            [self stopDiscovery];
-            sSelf = nil;
+        if (nFound == 0) {
+            AppendLogStr(log, @"Received response from web service, but no IP");
+            return;
         }
+        // First complete answer wins
+        [self stopDiscovery];
     };
     [connection start];
-    
-    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(duration * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
-        [sSelf stopDiscovery];
-    });
 }
 
 - (void)startSSDPDiscovery {
     if (!udpSocket) {
         AppendLogStr(log, @"Starting SSDP discovery");
-        tested = [NSMutableSet new];
         udpSocket = [self createSocket];
         NSString *msg = @"M-SEARCH * HTTP/1.1\r\nHost: 239.255.255.250:1900\r\nMan: ssdp:discover\r\nMx: 3\r\nST: \"ssdp:all\"\r\n\r\n";
         NSData *msgData = [msg dataUsingEncoding:NSUTF8StringEncoding];
@@ -131,17 +208,58 @@ NSString* _MacAddressWithSeparators(NSString* aMacAddress) {
     }
 }
 
+- (void)startProbingHosts:(NSArray<NSString*>*)aHosts {
+    if (!aHosts.count)
+        return;
+    AppendLogStr(log, @"Probing %lu hosts, %lu at a time", (unsigned long)aHosts.count, (unsigned long)DPHueDiscoverMaximumConcurrentProbes);
+    probeHosts = [aHosts copy];
+    nextProbe = 0;
+    for (NSUInteger i = 0; i < DPHueDiscoverMaximumConcurrentProbes; i++)
+        [self probeNextHost];
+}
+
+- (void)probeNextHost {
+    while (probeHosts && nextProbe < probeHosts.count) {
+        NSString* aProbeHost = probeHosts[nextProbe++];
+        if ([tested containsObject:aProbeHost])
+            continue;
+        [tested addObject:aProbeHost];
+        activeProbes++;
+        [self probeHost:aProbeHost logFailures:NO completion:^(NSString* aHost, NSString* aMac) {
+            activeProbes--;
+            if (aMac)
+                probesFound++;
+            [self probeNextHost];
+        }];
+        return;
+    }
+    if (probeHosts && !activeProbes) {
+        AppendLogStr(log, @"Probed all hosts, found %lu bridges", (unsigned long)probesFound);
+        probeHosts = nil;
+        if (probesFound)
+            [self stopDiscovery];
+    }
+}
+
 - (void)stopDiscovery {
+    // Setting keepAlive to nil must not end self in the middle of this method
+    __unused DPHueDiscover* aKeepAlive = keepAlive;
+    keepAlive = nil;
     if (udpSocket)
         [udpSocket close];
+    [probeSession invalidateAndCancel];
     if (discovered) {
         AppendLogStr(log, @"Discovery stopped");
+        [DPHueDiscover cacheBridges:discovered];
         if (doCompletion)
-            doCompletion([NSDictionary dictionaryWithDictionary:discovered], log, discoveryError);
+            doCompletion([NSDictionary dictionaryWithDictionary:discovered], [log copy], discoveryError);
     }
     log = nil;
     udpSocket = nil;
+    probeSession = nil;
+    probeHosts = nil;
     discovered = nil;
+    foundMACs = nil;
     tested = nil;
     discoveryError = nil;
     doHueFound = nil;
@@ -161,11 +279,42 @@ NSString* _MacAddressWithSeparators(NSString* aMacAddress) {
   return socket;
 }
 
+#pragma mark - Private, called on main queue
+
+// Reports each bridge once, whichever path found it first
+- (void)foundHueAt:(NSString*)aHost mac:(NSString*)aMac {
+    NSString* aKey = _NormalizedMAC(aMac);
+    if (!discovered || [foundMACs containsObject:aKey])
+        return;
+    [foundMACs addObject:aKey];
+    discovered[aMac] = aHost;
+    if (doHueFound)
+        doHueFound(aHost, aMac);
+}
+
+// Completion is not called once discovery has stopped; aMac is nil if aHost is not a Hue
+- (void)probeHost:(NSString*)aHost logFailures:(BOOL)aLogFailures completion:(void(^)(NSString* host, NSString* mac))completion {
+    NSURL* aURL = [NSURL URLWithString:[NSString stringWithFormat:@"http://%@/description.xml", aHost]];
+    if (!aURL) {
+        completion(aHost, nil);
+        return;
+    }
+    [self searchForHueAt:aURL completion:^(NSString* aFoundHost, NSString* aFoundMac, NSString* aLog, NSError* aError) {
+        if (!discovered)
+            return;
+        if (aFoundMac || aLogFailures)
+            [log appendString:aLog];
+        if (aFoundHost && aFoundMac && !aError)
+            [self foundHueAt:aFoundHost mac:aFoundMac];
+        completion(aHost, aError ? nil : aFoundMac);
+    }];
+}
+
 #pragma mark - Block based, stateless discovery
 
 -(void)searchForHueAt:(NSURL*)aURL completion:(void(^_Nonnull)(NSString* host, NSString* mac, NSString* log, NSError* error))completion {
     NSString* aLog = [NSString stringWithFormat:@"%@: Searching for Hue controller at %@\n", [NSDate date], aURL];
-    [[[NSURLSession sharedSession] dataTaskWithURL:aURL completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+    [[(probeSession ?: [NSURLSession sharedSession]) dataTaskWithURL:aURL completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
         if (error) {
             completion(nil, nil, [aLog stringByAppendingFormat:@"%@: Error while searching for Hue controller %@\n", [NSDate date], error], error);
             return;
@@ -175,7 +324,7 @@ NSString* _MacAddressWithSeparators(NSString* aMacAddress) {
             // Extract serialNumber from aMsg into aHueMac...
             NSString* aHueMac;
             NSTextCheckingResult* aMatch;
-            if (aMatch = [[[NSRegularExpression regularExpressionWithPattern:@"<serialNumber>(.*?)</serialNumber>" options:0 error:nil] matchesInString:aMsg options:0 range:NSMakeRange(0, aMsg.length)] firstObject])
+            if ((aMatch = [_SerialNumberExpression() firstMatchInString:aMsg options:0 range:NSMakeRange(0, aMsg.length)]))
                 aHueMac = _MacAddressWithSeparators([aMsg substringWithRange:[aMatch rangeAtIndex:1]]);
             // Found a Hue, report host and mac address (latter may be nil)...
             completion(aURL.host, aHueMac, [aLog stringByAppendingFormat:@"%@: Found hue at %@ with id %@\n", [NSDate date], aURL.host, aHueMac], nil);
@@ -185,28 +334,134 @@ NSString* _MacAddressWithSeparators(NSString* aMacAddress) {
     }] resume];
 }
 
++ (NSArray<NSString*>*)hostsInSubnet:(NSString*)aCIDR {
+    NSArray<NSString*>* aParts = [aCIDR componentsSeparatedByString:@"/"];
+    if (aParts.count != 2)
+        return nil;
+    struct in_addr anAddress;
+    if (inet_pton(AF_INET, aParts[0].UTF8String, &anAddress) != 1)
+        return nil;
+    NSInteger aPrefix = aParts[1].integerValue;
+    if (aPrefix < 16 || aPrefix > 32)
+        return nil;
+    uint32_t aMask = aPrefix == 32 ? 0xffffffff : ~(0xffffffff >> aPrefix);
+    uint32_t aFirst = ntohl(anAddress.s_addr) & aMask;
+    uint32_t aLast = aFirst | ~aMask;
+    // /31 and /32 have no network and broadcast address
+    if (aPrefix < 31) {
+        aFirst++;
+        aLast--;
+    }
+    NSMutableArray<NSString*>* aHosts = [NSMutableArray arrayWithCapacity:aLast - aFirst + 1];
+    for (uint64_t i = aFirst; i <= aLast; i++)
+        [aHosts addObject:[NSString stringWithFormat:@"%u.%u.%u.%u", (unsigned)(i >> 24) & 0xff, (unsigned)(i >> 16) & 0xff, (unsigned)(i >> 8) & 0xff, (unsigned)i & 0xff]];
+    return aHosts;
+}
+
+#pragma mark - Cache
+
++ (NSTimeInterval)cacheTimeToLive {
+    @synchronized([DPHueDiscover class]) {
+        return sCacheTimeToLive;
+    }
+}
+
++ (void)setCacheTimeToLive:(NSTimeInterval)aTimeToLive {
+    @synchronized([DPHueDiscover class]) {
+        sCacheTimeToLive = aTimeToLive;
+    }
+}
+
++ (NSURL*)cacheURL {
+    @synchronized([DPHueDiscover class]) {
+        if (sCacheURL)
+            return sCacheURL;
+        NSURL* aCaches = [[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask].firstObject;
+        return [aCaches URLByAppendingPathComponent:@"DPHueDiscover.plist"];
+    }
+}
+
++ (void)setCacheURL:(NSURL*)aURL {
+    @synchronized([DPHueDiscover class]) {
+        sCacheURL = aURL;
+    }
+}
+
+// MAC -> @{host, seen}, without expired entries
++ (NSMutableDictionary*)readCache {
+    NSMutableDictionary* aCache = [NSMutableDictionary new];
+    NSTimeInterval aTimeToLive = [self cacheTimeToLive];
+    NSURL* aURL = [self cacheURL];
+    if (aTimeToLive <= 0 || !aURL)
+        return aCache;
+    NSDictionary* aStored = [NSDictionary dictionaryWithContentsOfURL:aURL];
+    [aStored enumerateKeysAndObjectsUsingBlock:^(NSString* aMac, NSDictionary* anEntry, BOOL* aStop) {
+        if (![anEntry isKindOfClass:[NSDictionary class]] || ![anEntry[@"host"] isKindOfClass:[NSString class]] || ![anEntry[@"seen"] isKindOfClass:[NSDate class]])
+            return;
+        if (-[anEntry[@"seen"] timeIntervalSinceNow] < aTimeToLive)
+            aCache[aMac] = anEntry;
+    }];
+    return aCache;
+}
+
++ (NSDictionary<NSString*, NSString*>*)cachedBridges {
+    @synchronized([DPHueDiscover class]) {
+        NSMutableDictionary* aBridges = [NSMutableDictionary new];
+        [[self readCache] enumerateKeysAndObjectsUsingBlock:^(NSString* aMac, NSDictionary* anEntry, BOOL* aStop) {
+            aBridges[aMac] = anEntry[@"host"];
+        }];
+        return aBridges;
+    }
+}
+
++ (void)cacheBridges:(NSDictionary<NSString*, NSString*>*)aBridges {
+    if (!aBridges.count || [self cacheTimeToLive] <= 0)
+        return;
+    @synchronized([DPHueDiscover class]) {
+        NSMutableDictionary* aCache = [self readCache];
+        NSDate* aNow = [NSDate date];
+        [aBridges enumerateKeysAndObjectsUsingBlock:^(NSString* aMac, NSString* aHost, BOOL* aStop) {
+            // Replace the entry of the same bridge, even if spelled differently
+            NSString* aKey = _NormalizedMAC(aMac);
+            for (NSString* aCachedMac in aCache.allKeys)
+                if ([_NormalizedMAC(aCachedMac) isEqualToString:aKey])
+                    [aCache removeObjectForKey:aCachedMac];
+            aCache[aMac] = @{@"host": aHost, @"seen": aNow};
+        }];
+        NSURL* aURL = [self cacheURL];
+        [[NSFileManager defaultManager] createDirectoryAtURL:[aURL URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+        if (![aCache writeToURL:aURL atomically:YES])
+            WSLog(@"Could not write discovery cache to %@", aURL);
+    }
+}
+
++ (void)clearCache {
+    @synchronized([DPHueDiscover class]) {
+        NSURL* aURL = [self cacheURL];
+        if (aURL)
+            [[NSFileManager defaultManager] removeItemAtURL:aURL error:nil];
+    }
+}
+
 #pragma mark - GCDAsyncUdpSocketDelegate
 
 - (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext {
     NSString *msg = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
     if (msg) {
         AppendLogStr(log, @"Received UDP data");
-        NSRegularExpression *reg = [[NSRegularExpression alloc] initWithPattern:@"http:\\/\\/(.*?)description\\.xml" options:0 error:nil];
-        NSArray *matches = [reg matchesInString:msg options:0 range:NSMakeRange(0, msg.length)];
-        if (matches.count > 0) {
-            NSTextCheckingResult *result = matches[0];
+        NSTextCheckingResult *result = [_DescriptionURLExpression() firstMatchInString:msg options:0 range:NSMakeRange(0, msg.length)];
+        if (result) {
             NSString *matched = [msg substringWithRange:[result rangeAtIndex:0]];
             NSURL *url = [NSURL URLWithString:matched];
-            if (tested && ![tested containsObject:url.host]) {
+            if (url.host && tested && ![tested containsObject:url.host]) {
                 AppendLogStr(log, @"Possibly found a Hue controller, verifying...");
                 [tested addObject:url.host];
                 [self searchForHueAt:url completion:^(NSString *aHost, NSString *aMac, NSString *aLog, NSError *aError) {
-                    log = [log stringByAppendingString:aLog];
-                    if (aHost && aMac && discovered && !discovered[aMac] && !aError) {
-                        discovered[aMac] = aHost;
-                        if (doHueFound)
-                            doHueFound(aHost, aMac);
-                    }
+                    if (!discovered)
+                        return;
+                    [log appendString:aLog];
+                    if (aHost && aMac && !aError)
+                        [self foundHueAt:aHost mac:aMac];
                 }];
             }
         }
@@ -0,0 +1,78 @@
+//
+//  DPHueEventStream.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueEventStream keeps a DPHueBridge up to date from the event stream of
+// the controller instead of polling it. One long-lived connection receives
+// the changes as they happen, and each is applied to the DPHueLight or
+// DPHueLightGroup it concerns, without downloading the controller state.
+// When the connection breaks it is opened again, resuming after the last
+// event received. Controllers without an event stream, or that cannot be
+// reached, are polled by the bridge's DPHueBridgePoller until the stream
+// is back.
+
+#import <Foundation/Foundation.h>
+
+@class DPHueBridge;
+
+@interface DPHueEventStream : NSObject
+
+- (instancetype)initWithBridge:(DPHueBridge *)aBridge;
+
+/**
+ Where the events are read from. Defaults to @p https://{host}/eventstream/clip/v2 of
+ the bridge; set it before @p start to use another one.
+ */
+@property (nonatomic, copy) NSURL *URL;
+
+/**
+ Certificates the controller's certificate must be issued by, as @p SecCertificateRef.
+ Controllers use certificates of their own CA; without anchors the system decides
+ whether to trust them.
+ */
+@property (nonatomic, copy) NSArray *anchorCertificates;
+
+/// Poll the controller while the stream is not connected. Defaults to YES.
+@property (nonatomic, assign) BOOL fallsBackToPolling;
+
+/// Seconds to wait before connecting again after the first failure; doubles with each further one. Defaults to 1.
+@property (nonatomic, assign) NSTimeInterval minimumReconnectDelay;
+
+/// Most seconds to wait before connecting again. Defaults to 30.
+@property (nonatomic, assign) NSTimeInterval maximumReconnectDelay;
+
+@property (nonatomic, readonly, getter=isRunning) BOOL running;
+
+/// YES while events are being received.
+@property (nonatomic, readonly, getter=isConnected) BOOL connected;
+
+/// YES while the stream has failed and the bridge is polled instead.
+@property (nonatomic, readonly, getter=isPolling) BOOL polling;
+
+/// Number of events received.
+@property (atomic, readonly) NSUInteger eventCount;
+
+/// Number of times the stream was connected.
+@property (atomic, readonly) NSUInteger connectionCount;
+
+- (void)start;
+- (void)stop;
+
+@end
+
+
+@interface DPHueBridge (DPHueEventStreaming)
+
+/**
+ Apply changes received from the event stream: @p aLightStates maps light numbers to
+ keys of their v1 "state" object, @p aGroupStates group numbers to keys of their
+ "action" object. Only the keys given change. Observers are told about what did.
+ */
+- (void)updateWithLightStates:(NSDictionary<NSNumber *, NSDictionary *> *)aLightStates
+                  groupStates:(NSDictionary<NSNumber *, NSDictionary *> *)aGroupStates;
+
+@end
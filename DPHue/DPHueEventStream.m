@@ -0,0 +1,398 @@
+//
+//  DPHueEventStream.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueEventStream.h"
+#import "DPHueBridge.h"
+#import "DPHueBridgePoller.h"
+#import "DPHueEventStreamParser.h"
+#import "WSLog.h"
+#import <Security/Security.h>
+
+// Failed connections in a row before the bridge is polled instead
+static const NSUInteger kDPHueEventStreamFailuresBeforePolling = 2;
+
+// Seconds without a byte before the connection is considered broken and opened again
+static const NSTimeInterval kDPHueEventStreamIdleTimeout = 300;
+
+#pragma mark - C functions
+
+// The v1 number of an event stream resource, e.g. 3 of "/lights/3"
+static NSNumber* _NumberOfResource(NSDictionary* anItem, NSString* aCollection) {
+    NSString* anIdV1 = anItem[@"id_v1"];
+    if (![anIdV1 isKindOfClass:[NSString class]])
+        return nil;
+    NSArray<NSString*>* aParts = [anIdV1 componentsSeparatedByString:@"/"];
+    if (aParts.count != 3 || ![aParts[1] isEqualToString:aCollection])
+        return nil;
+    return @(aParts[2].integerValue);
+}
+
+static id _Member(id anObject, NSString* aKey, Class aClass) {
+    id aValue = [anObject isKindOfClass:[NSDictionary class]] ? anObject[aKey] : nil;
+    return [aValue isKindOfClass:aClass] ? aValue : nil;
+}
+
+// The keys of a v1 "state" or "action" object that an update of a v2 resource sets
+static NSDictionary* _V1StateOfItem(NSDictionary* anItem) {
+    NSMutableDictionary* aState = [NSMutableDictionary new];
+    NSNumber* anOn = _Member(anItem[@"on"], @"on", [NSNumber class]);
+    if (anOn)
+        aState[@"on"] = anOn;
+    // Percent, where v1 brightness goes from 1 to 254
+    NSNumber* aBrightness = _Member(anItem[@"dimming"], @"brightness", [NSNumber class]);
+    if (aBrightness)
+        aState[@"bri"] = @(MAX(1, MIN(254, lround(aBrightness.doubleValue * 254.0 / 100.0))));
+    NSDictionary* anXY = _Member(anItem[@"color"], @"xy", [NSDictionary class]);
+    NSNumber* anX = _Member(anXY, @"x", [NSNumber class]);
+    NSNumber* aY = _Member(anXY, @"y", [NSNumber class]);
+    if (anX && aY) {
+        aState[@"xy"] = @[anX, aY];
+        aState[@"colormode"] = @"xy";
+    }
+    // null while the light shows a color instead
+    NSNumber* aMirek = _Member(anItem[@"color_temperature"], @"mirek", [NSNumber class]);
+    if (aMirek) {
+        aState[@"ct"] = aMirek;
+        aState[@"colormode"] = @"ct";
+    }
+    NSString* aStatus = _Member(anItem, @"status", [NSString class]);
+    if (aStatus && [_Member(anItem, @"type", [NSString class]) isEqualToString:@"zigbee_connectivity"])
+        aState[@"reachable"] = @([aStatus isEqualToString:@"connected"]);
+    return aState;
+}
+
+static void _Merge(NSMutableDictionary<NSNumber*, NSMutableDictionary*>* aStates, NSNumber* aNumber, NSDictionary* aState) {
+    if (!aNumber || !aState.count)
+        return;
+    if (!aStates[aNumber])
+        aStates[aNumber] = [NSMutableDictionary new];
+    [aStates[aNumber] addEntriesFromDictionary:aState];
+}
+
+
+// Sessions keep their delegate until invalidated; this one does not keep the stream
+@interface DPHueEventStreamSessionDelegate : NSObject <NSURLSessionDataDelegate>
+
+@property (nonatomic, weak) DPHueEventStream* stream;
+
+@end
+
+
+@interface DPHueEventStream ()
+
+@property (atomic, readwrite) NSUInteger eventCount;
+@property (atomic, readwrite) NSUInteger connectionCount;
+
+- (void)task:(NSURLSessionDataTask*)aTask didReceiveResponse:(NSURLResponse*)aResponse completionHandler:(void (^)(NSURLSessionResponseDisposition))aCompletion;
+- (void)task:(NSURLSessionDataTask*)aTask didReceiveData:(NSData*)aData;
+- (void)task:(NSURLSessionTask*)aTask didCompleteWithError:(NSError*)anError;
+- (void)didReceiveChallenge:(NSURLAuthenticationChallenge*)aChallenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition, NSURLCredential*))aCompletion;
+
+@end
+
+@implementation DPHueEventStreamSessionDelegate
+
+- (void)URLSession:(NSURLSession *)aSession dataTask:(NSURLSessionDataTask *)aTask didReceiveResponse:(NSURLResponse *)aResponse completionHandler:(void (^)(NSURLSessionResponseDisposition))aCompletion {
+    DPHueEventStream* aStream = self.stream;
+    if (aStream)
+        [aStream task:aTask didReceiveResponse:aResponse completionHandler:aCompletion];
+    else
+        aCompletion(NSURLSessionResponseCancel);
+}
+
+- (void)URLSession:(NSURLSession *)aSession dataTask:(NSURLSessionDataTask *)aTask didReceiveData:(NSData *)aData {
+    [self.stream task:aTask didReceiveData:aData];
+}
+
+- (void)URLSession:(NSURLSession *)aSession task:(NSURLSessionTask *)aTask didCompleteWithError:(NSError *)anError {
+    [self.stream task:aTask didCompleteWithError:anError];
+}
+
+- (void)URLSession:(NSURLSession *)aSession didReceiveChallenge:(NSURLAuthenticationChallenge *)aChallenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition, NSURLCredential *))aCompletion {
+    DPHueEventStream* aStream = self.stream;
+    if (aStream)
+        [aStream didReceiveChallenge:aChallenge completionHandler:aCompletion];
+    else
+        aCompletion(NSURLSessionAuthChallengeCancelAuthenticationChallenge, nil);
+}
+
+@end
+
+
+@implementation DPHueEventStream {
+    __weak DPHueBridge* bridge;
+    // Created by start, invalidated by stop
+    NSURLSession* session;
+    // The connection events are read from; guarded by @synchronized(self)
+    NSURLSessionDataTask* task;
+    // Fed on the session's delegate queue; guarded by @synchronized(self), as connect reads it
+    DPHueEventStreamParser* parser;
+    // Changes of the chunk being parsed, only used on the session's delegate queue
+    NSMutableDictionary<NSNumber*, NSMutableDictionary*>* lightStates;
+    NSMutableDictionary<NSNumber*, NSMutableDictionary*>* groupStates;
+    BOOL needsRead;
+    // State below is only used on this queue, like that of DPHueBridgePoller
+    dispatch_queue_t queue;
+    dispatch_source_t reconnectTimer;
+    NSUInteger failureCount;
+    BOOL resuming;
+}
+
+- (instancetype)initWithBridge:(DPHueBridge *)aBridge {
+    self = [super init];
+    if (self) {
+        bridge = aBridge;
+        _fallsBackToPolling = YES;
+        _minimumReconnectDelay = 1;
+        _maximumReconnectDelay = 30;
+        parser = [DPHueEventStreamParser new];
+        lightStates = [NSMutableDictionary new];
+        groupStates = [NSMutableDictionary new];
+        __weak typeof(self) wkSelf = self;
+        parser.eventBlock = ^(NSString* anEventId, NSString* anEventType, NSData* aData) {
+            [wkSelf handleEventData:aData];
+        };
+        queue = dispatch_queue_create("DPHueEventStream", DISPATCH_QUEUE_SERIAL);
+        reconnectTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+        dispatch_source_set_event_handler(reconnectTimer, ^{
+            [wkSelf connect];
+        });
+        dispatch_source_set_timer(reconnectTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(reconnectTimer);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [session invalidateAndCancel];
+    dispatch_source_cancel(reconnectTimer);
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(reconnectTimer);
+    dispatch_release(queue);
+#endif
+}
+
+- (void)start {
+    dispatch_async(queue, ^{
+        if (_running)
+            return;
+        _running = YES;
+        failureCount = 0;
+        NSURLSessionConfiguration* aConfiguration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+        aConfiguration.timeoutIntervalForRequest = kDPHueEventStreamIdleTimeout;
+        aConfiguration.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+        aConfiguration.URLCache = nil;
+        aConfiguration.HTTPCookieStorage = nil;
+        aConfiguration.HTTPShouldSetCookies = NO;
+        DPHueEventStreamSessionDelegate* aDelegate = [DPHueEventStreamSessionDelegate new];
+        aDelegate.stream = self;
+        // Events are parsed on a queue of their own, one chunk at a time
+        NSOperationQueue* aQueue = [NSOperationQueue new];
+        aQueue.maxConcurrentOperationCount = 1;
+        session = [NSURLSession sessionWithConfiguration:aConfiguration delegate:aDelegate delegateQueue:aQueue];
+        [self connect];
+    });
+}
+
+- (void)stop {
+    dispatch_async(queue, ^{
+        if (!_running)
+            return;
+        _running = NO;
+        _connected = NO;
+        dispatch_source_set_timer(reconnectTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        @synchronized(self) {
+            task = nil;
+        }
+        [session invalidateAndCancel];
+        session = nil;
+        [self stopPolling];
+    });
+}
+
+#pragma mark - Private, called on queue
+
+- (NSURL*)streamURL {
+    if (self.URL)
+        return self.URL;
+    return [NSURL URLWithString:[NSString stringWithFormat:@"https://%@/eventstream/clip/v2", bridge.host]];
+}
+
+- (void)connect {
+    DPHueBridge* aBridge = bridge;
+    if (!_running || !aBridge)
+        return;
+    NSMutableURLRequest* aRequest = [NSMutableURLRequest requestWithURL:[self streamURL]];
+    [aRequest setValue:@"text/event-stream" forHTTPHeaderField:@"Accept"];
+    if (aBridge.generatedUsername)
+        [aRequest setValue:aBridge.generatedUsername forHTTPHeaderField:@"hue-application-key"];
+    NSURLSessionDataTask* aTask;
+    @synchronized(self) {
+        // Events after the last one received are sent again, if the controller still has them
+        NSString* aLastEventId = parser.lastEventId;
+        resuming = aLastEventId != nil;
+        if (resuming)
+            [aRequest setValue:aLastEventId forHTTPHeaderField:@"Last-Event-ID"];
+        aTask = [session dataTaskWithRequest:aRequest];
+        task = aTask;
+    }
+    [aTask resume];
+}
+
+- (void)didConnect:(NSURLSessionDataTask*)aTask {
+    if (![self isCurrentTask:aTask])
+        return;
+    _connected = YES;
+    failureCount = 0;
+    self.connectionCount++;
+    BOOL aMissedEvents = _polling || !resuming;
+    [self stopPolling];
+    // Nothing tells what changed while no events were received
+    if (aMissedEvents)
+        [bridge readWithCompletion:nil];
+}
+
+- (void)didDisconnect:(NSURLSessionTask*)aTask error:(NSError*)anError {
+    if (![self isCurrentTask:aTask])
+        return;
+    @synchronized(self) {
+        task = nil;
+    }
+    _connected = NO;
+    if (!_running)
+        return;
+    WSLog(@"Event stream of %@ closed: %@", bridge.host, anError);
+    failureCount++;
+    if (_fallsBackToPolling && failureCount >= kDPHueEventStreamFailuresBeforePolling && !_polling) {
+        _polling = YES;
+        [bridge.poller start];
+    }
+    NSTimeInterval aDelay;
+    @synchronized(self) {
+        aDelay = parser.retryInterval;
+    }
+    if (aDelay <= 0)
+        aDelay = MIN(_maximumReconnectDelay, _minimumReconnectDelay * pow(2, failureCount - 1));
+    dispatch_source_set_timer(reconnectTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(aDelay * NSEC_PER_SEC)),
+                              DISPATCH_TIME_FOREVER, (uint64_t)(aDelay * 0.1 * NSEC_PER_SEC));
+}
+
+- (void)stopPolling {
+    if (!_polling)
+        return;
+    _polling = NO;
+    [bridge.poller stop];
+}
+
+- (BOOL)isCurrentTask:(NSURLSessionTask*)aTask {
+    @synchronized(self) {
+        return aTask == task;
+    }
+}
+
+#pragma mark - Private, called on the session's delegate queue
+
+- (void)task:(NSURLSessionDataTask*)aTask didReceiveResponse:(NSURLResponse*)aResponse completionHandler:(void (^)(NSURLSessionResponseDisposition))aCompletion {
+    NSHTTPURLResponse* aHTTPResponse = [aResponse isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse*)aResponse : nil;
+    // e.g. 404 from controllers that only speak v1
+    if (aHTTPResponse.statusCode != 200 || ![aResponse.MIMEType isEqualToString:@"text/event-stream"]) {
+        aCompletion(NSURLSessionResponseCancel);
+        return;
+    }
+    if ([self isCurrentTask:aTask]) {
+        // A new response starts a new stream
+        @synchronized(self) {
+            [parser reset];
+        }
+        [lightStates removeAllObjects];
+        [groupStates removeAllObjects];
+        needsRead = NO;
+    }
+    aCompletion(NSURLSessionResponseAllow);
+    dispatch_async(queue, ^{
+        [self didConnect:aTask];
+    });
+}
+
+- (void)task:(NSURLSessionDataTask*)aTask didReceiveData:(NSData*)aData {
+    if (![self isCurrentTask:aTask])
+        return;
+    NSUInteger anEventCount = parser.eventCount;
+    @synchronized(self) {
+        [parser parseData:aData];
+    }
+    self.eventCount += parser.eventCount - anEventCount;
+
+    // All events of a chunk are applied at once
+    DPHueBridge* aBridge = bridge;
+    if (lightStates.count || groupStates.count) {
+        [aBridge updateWithLightStates:lightStates groupStates:groupStates];
+        lightStates = [NSMutableDictionary new];
+        groupStates = [NSMutableDictionary new];
+    }
+    if (needsRead) {
+        needsRead = NO;
+        [aBridge readWithCompletion:nil];
+    }
+}
+
+- (void)task:(NSURLSessionTask*)aTask didCompleteWithError:(NSError*)anError {
+    dispatch_async(queue, ^{
+        [self didDisconnect:aTask error:anError];
+    });
+}
+
+- (void)didReceiveChallenge:(NSURLAuthenticationChallenge*)aChallenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition, NSURLCredential*))aCompletion {
+    SecTrustRef aTrust = aChallenge.protectionSpace.serverTrust;
+    NSArray* anAnchors = self.anchorCertificates;
+    if (!anAnchors.count || !aTrust || ![aChallenge.protectionSpace.authenticationMethod isEqualToString:NSURLAuthenticationMethodServerTrust]) {
+        aCompletion(NSURLSessionAuthChallengePerformDefaultHandling, nil);
+        return;
+    }
+    // Controllers are reached by address, and their certificates are issued to their bridge id
+    SecPolicyRef aPolicy = SecPolicyCreateSSL(true, NULL);
+    SecTrustSetPolicies(aTrust, aPolicy);
+    CFRelease(aPolicy);
+    SecTrustSetAnchorCertificates(aTrust, (__bridge CFArrayRef)anAnchors);
+    SecTrustSetAnchorCertificatesOnly(aTrust, true);
+    SecTrustResultType aResult = kSecTrustResultInvalid;
+    if (SecTrustEvaluate(aTrust, &aResult) == errSecSuccess && (aResult == kSecTrustResultUnspecified || aResult == kSecTrustResultProceed))
+        aCompletion(NSURLSessionAuthChallengeUseCredential, [NSURLCredential credentialForTrust:aTrust]);
+    else
+        aCompletion(NSURLSessionAuthChallengeCancelAuthenticationChallenge, nil);
+}
+
+// An event is a JSON array of updates, additions and deletions of resources
+- (void)handleEventData:(NSData*)aData {
+    NSArray* aContainers = [NSJSONSerialization JSONObjectWithData:aData options:0 error:nil];
+    if (![aContainers isKindOfClass:[NSArray class]])
+        return;
+    for (NSDictionary* aContainer in aContainers) {
+        NSString* aType = _Member(aContainer, @"type", [NSString class]);
+        NSArray* anItems = _Member(aContainer, @"data", [NSArray class]);
+        for (NSDictionary* anItem in anItems) {
+            if (![anItem isKindOfClass:[NSDictionary class]])
+                continue;
+            NSNumber* aLightNumber = _NumberOfResource(anItem, @"lights");
+            NSNumber* aGroupNumber = _NumberOfResource(anItem, @"groups");
+            if (!aLightNumber && !aGroupNumber)
+                continue;
+            // Lights or groups that appeared or disappeared, and rooms and zones whose
+            // lights changed, need their whole state
+            if (![aType isEqualToString:@"update"] || anItem[@"children"]) {
+                needsRead = YES;
+                continue;
+            }
+            NSDictionary* aState = _V1StateOfItem(anItem);
+            _Merge(lightStates, aLightNumber, aState);
+            _Merge(groupStates, aGroupNumber, aState);
+        }
+    }
+}
+
+@end
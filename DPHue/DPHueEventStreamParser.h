@@ -0,0 +1,41 @@
+//
+//  DPHueEventStreamParser.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueEventStreamParser splits a text/event-stream into events as its bytes
+// arrive. Chunks may end anywhere, even inside a line or between the CR and
+// LF of a line break; what is left of a line waits for the next chunk. Lines
+// may end in CR, LF or CRLF, comments are skipped, and "retry" and "id"
+// fields are remembered for reconnecting.
+
+#import <Foundation/Foundation.h>
+
+@interface DPHueEventStreamParser : NSObject
+
+/**
+ Called for each complete event with a "data" field, with the last event id seen
+ (which need not be set by this event), the event type ("message" unless set), and
+ the data, its lines joined by LF.
+ */
+@property (nonatomic, copy) void (^eventBlock)(NSString *eventId, NSString *eventType, NSData *data);
+
+/// The last "id" field seen; send it as @p Last-Event-ID when reconnecting.
+@property (nonatomic, copy) NSString *lastEventId;
+
+/// Reconnection delay the server asked for with a "retry" field, in seconds, or 0.
+@property (nonatomic, readonly) NSTimeInterval retryInterval;
+
+/// Number of events passed to @p eventBlock.
+@property (nonatomic, readonly) NSUInteger eventCount;
+
+/// Parse the next bytes of the stream, calling @p eventBlock for each event they complete.
+- (void)parseData:(NSData *)aData;
+
+/// Drop what is buffered of an incomplete event, e.g. because the connection broke.
+- (void)reset;
+
+@end
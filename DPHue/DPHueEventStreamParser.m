@@ -0,0 +1,136 @@
+//
+//  DPHueEventStreamParser.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueEventStreamParser.h"
+
+#pragma mark - C functions
+
+static BOOL _FieldIs(const uint8_t* aName, NSUInteger aLength, const char* aField) {
+    return aLength == strlen(aField) && memcmp(aName, aField, aLength) == 0;
+}
+
+static NSString* _String(const uint8_t* aBytes, NSUInteger aLength) {
+    return [[NSString alloc] initWithBytes:aBytes length:aLength encoding:NSUTF8StringEncoding];
+}
+
+
+@implementation DPHueEventStreamParser {
+    // The start of a line whose end has not arrived yet
+    NSMutableData* lineBuffer;
+    // The "data" lines of the event being parsed, each followed by LF
+    NSMutableData* dataBuffer;
+    BOOL hasData;
+    NSString* eventType;
+    // The last chunk ended in CR, so a LF starting the next one ends no line
+    BOOL skipLF;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        lineBuffer = [NSMutableData new];
+        dataBuffer = [NSMutableData new];
+    }
+    return self;
+}
+
+- (void)parseData:(NSData *)aData {
+    const uint8_t* aBytes = aData.bytes;
+    NSUInteger aLength = aData.length;
+    NSUInteger aStart = 0;
+    for (NSUInteger i = 0; i < aLength; i++) {
+        uint8_t aByte = aBytes[i];
+        if (skipLF) {
+            skipLF = NO;
+            if (aByte == '\n') {
+                aStart = i + 1;
+                continue;
+            }
+        }
+        if (aByte != '\n' && aByte != '\r')
+            continue;
+        // Lines are parsed in place unless they began in an earlier chunk
+        if (lineBuffer.length) {
+            [lineBuffer appendBytes:aBytes + aStart length:i - aStart];
+            [self parseLine:lineBuffer.bytes length:lineBuffer.length];
+            lineBuffer.length = 0;
+        } else {
+            [self parseLine:aBytes + aStart length:i - aStart];
+        }
+        skipLF = aByte == '\r';
+        aStart = i + 1;
+    }
+    if (aStart < aLength)
+        [lineBuffer appendBytes:aBytes + aStart length:aLength - aStart];
+}
+
+- (void)reset {
+    lineBuffer.length = 0;
+    dataBuffer.length = 0;
+    hasData = NO;
+    eventType = nil;
+    skipLF = NO;
+}
+
+#pragma mark - Private
+
+- (void)parseLine:(const uint8_t*)aLine length:(NSUInteger)aLength {
+    if (!aLength) {
+        [self dispatchEvent];
+        return;
+    }
+    // Comments, e.g. keep-alives
+    if (aLine[0] == ':')
+        return;
+    const uint8_t* aColon = memchr(aLine, ':', aLength);
+    NSUInteger aNameLength = aColon ? (NSUInteger)(aColon - aLine) : aLength;
+    const uint8_t* aValue = aColon ? aColon + 1 : aLine + aLength;
+    NSUInteger aValueLength = aLength - (NSUInteger)(aValue - aLine);
+    if (aValueLength && aValue[0] == ' ') {
+        aValue++;
+        aValueLength--;
+    }
+
+    if (_FieldIs(aLine, aNameLength, "data")) {
+        [dataBuffer appendBytes:aValue length:aValueLength];
+        [dataBuffer appendBytes:"\n" length:1];
+        hasData = YES;
+    } else if (_FieldIs(aLine, aNameLength, "event")) {
+        eventType = _String(aValue, aValueLength);
+    } else if (_FieldIs(aLine, aNameLength, "id")) {
+        if (!memchr(aValue, 0, aValueLength))
+            _lastEventId = _String(aValue, aValueLength);
+    } else if (_FieldIs(aLine, aNameLength, "retry")) {
+        if (!aValueLength)
+            return;
+        NSUInteger aMilliseconds = 0;
+        for (NSUInteger i = 0; i < aValueLength; i++) {
+            if (aValue[i] < '0' || aValue[i] > '9')
+                return;
+            aMilliseconds = aMilliseconds * 10 + (aValue[i] - '0');
+        }
+        _retryInterval = aMilliseconds / 1000.0;
+    }
+}
+
+- (void)dispatchEvent {
+    if (!hasData) {
+        eventType = nil;
+        return;
+    }
+    NSData* aData = [NSData dataWithBytes:dataBuffer.bytes length:dataBuffer.length - 1];
+    NSString* anEventType = eventType ?: @"message";
+    dataBuffer.length = 0;
+    hasData = NO;
+    eventType = nil;
+    _eventCount++;
+    if (self.eventBlock)
+        self.eventBlock(_lastEventId, anEventType, aData);
+}
+
+@end
@@ -0,0 +1,31 @@
+//
+//  DPHueFanInOptimizer.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueFanInOptimizer watches the light writes waiting in a bridge queue.
+// When several lights are about to receive an identical state payload, the
+// writes are replaced by a single PUT /groups/{id}/action. The group used is
+// group 0 when all lights are targeted, an existing group with exactly the
+// same lights, or a scratch group that is created or updated on demand.
+// Lights with differing payloads are still written one by one.
+
+#import <Foundation/Foundation.h>
+#import "DPHueCommandScheduler.h"
+
+@class DPHueBridge;
+
+@interface DPHueFanInOptimizer : NSObject <DPHueCommandSchedulerDelegate>
+
+- (instancetype)initWithBridge:(DPHueBridge *)aBridge;
+
+/// Minimum number of lights with an identical payload to send as a group action. Defaults to 3.
+@property (nonatomic, assign) NSUInteger minimumLightCount;
+
+/// Maximum number of scratch groups this optimizer may create on the bridge. Defaults to 4.
+@property (nonatomic, assign) NSUInteger maximumScratchGroups;
+
+@end
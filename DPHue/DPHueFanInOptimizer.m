@@ -0,0 +1,196 @@
+//
+//  DPHueFanInOptimizer.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueFanInOptimizer.h"
+#import "DPHueBridge.h"
+#import "DPHueLight.h"
+#import "DPHueLightGroup.h"
+#import "DPJSONConnection.h"
+
+static NSString* const DPHueScratchGroupName = @"DPHue fan-in";
+
+@implementation DPHueFanInOptimizer {
+    __weak DPHueBridge* bridge;
+    __weak DPHueCommandScheduler* scheduler;
+    // Scratch group state is only accessed on this queue
+    dispatch_queue_t queue;
+    NSMutableArray<DPHueLightGroup*>* scratchGroups;
+    NSMutableSet<NSNumber*>* busyScratchGroups;
+    NSUInteger pendingScratchGroups;
+    BOOL adoptedScratchGroups;
+}
+
+- (instancetype)initWithBridge:(DPHueBridge *)aBridge {
+    self = [super init];
+    if (self) {
+        bridge = aBridge;
+        _minimumLightCount = 3;
+        _maximumScratchGroups = 4;
+        queue = dispatch_queue_create("DPHueFanInOptimizer", DISPATCH_QUEUE_SERIAL);
+        scratchGroups = [NSMutableArray new];
+        busyScratchGroups = [NSMutableSet new];
+    }
+    return self;
+}
+
+#if !OS_OBJECT_USE_OBJC
+- (void)dealloc {
+    dispatch_release(queue);
+}
+#endif
+
+#pragma mark - DPHueCommandSchedulerDelegate
+
+- (NSIndexSet *)commandScheduler:(DPHueCommandScheduler *)aScheduler takeOverWaitingCommands:(NSArray<DPJSONConnection *> *)aWaiting {
+    scheduler = aScheduler;
+    // Group waiting light state writes by payload...
+    NSMutableDictionary<NSDictionary*, NSMutableIndexSet*>* aByPayload = [NSMutableDictionary new];
+    [aWaiting enumerateObjectsUsingBlock:^(DPJSONConnection* aCommand, NSUInteger anIndex, BOOL* aStop) {
+        if (![aCommand.sender isKindOfClass:[DPHueLight class]] || ![aCommand.coalescingKey hasSuffix:@"/state"] || !aCommand.request.HTTPBody)
+            return;
+        id aPayload = [NSJSONSerialization JSONObjectWithData:aCommand.request.HTTPBody options:0 error:nil];
+        if (![aPayload isKindOfClass:[NSDictionary class]])
+            return;
+        NSMutableIndexSet* aIndexes = aByPayload[aPayload];
+        if (!aIndexes)
+            aByPayload[aPayload] = aIndexes = [NSMutableIndexSet new];
+        [aIndexes addIndex:anIndex];
+    }];
+    // ...and take over those that are sent to enough lights
+    NSMutableIndexSet* aTaken = [NSMutableIndexSet new];
+    [aByPayload enumerateKeysAndObjectsUsingBlock:^(NSDictionary* aPayload, NSMutableIndexSet* aIndexes, BOOL* aStop) {
+        if (aIndexes.count < _minimumLightCount)
+            return;
+        NSArray<DPJSONConnection*>* aCommands = [aWaiting objectsAtIndexes:aIndexes];
+        [aTaken addIndexes:aIndexes];
+        dispatch_async(queue, ^{
+            [self fanInCommands:aCommands payload:aPayload];
+        });
+    }];
+    return aTaken;
+}
+
+#pragma mark - Private, called on queue
+
+- (void)fanInCommands:(NSArray<DPJSONConnection*>*)aCommands payload:(NSDictionary*)aPayload {
+    DPHueBridge* aBridge = bridge;
+    NSMutableSet<NSNumber*>* aLightIds = [NSMutableSet new];
+    for (DPJSONConnection* aCommand in aCommands)
+        [aLightIds addObject:((DPHueLight*)aCommand.sender).number];
+    // Group 0 always contains all lights of the bridge...
+    if ([aLightIds isEqualToSet:[NSSet setWithArray:[aBridge.lights valueForKey:@"number"]]]) {
+        DPHueLightGroup* aGroup = [[DPHueLightGroup alloc] initWithBridge:aBridge];
+        aGroup.number = @0;
+        aGroup.host = aBridge.host;
+        aGroup.username = aBridge.generatedUsername;
+        [self sendPayload:aPayload toGroup:aGroup forCommands:aCommands];
+        return;
+    }
+    // Use an existing group with exactly the same lights...
+    for (DPHueLightGroup* aGroup in aBridge.groups) {
+        if (![busyScratchGroups containsObject:aGroup.number] && [[NSSet setWithArray:aGroup.lightIds] isEqualToSet:aLightIds]) {
+            if ([self isScratchGroup:aGroup])
+                [busyScratchGroups addObject:aGroup.number];
+            [self sendPayload:aPayload toGroup:aGroup forCommands:aCommands];
+            return;
+        }
+    }
+    // Otherwise reuse a free scratch group...
+    [self adoptScratchGroups];
+    NSArray<NSNumber*>* aSortedIds = [aLightIds.allObjects sortedArrayUsingSelector:@selector(compare:)];
+    for (DPHueLightGroup* aScratch in scratchGroups) {
+        if ([busyScratchGroups containsObject:aScratch.number])
+            continue;
+        [busyScratchGroups addObject:aScratch.number];
+        [aBridge updateGroup:aScratch withName:nil lightIds:aSortedIds callbackQueue:queue onCompletion:^(DPHueLightGroup* aGroup, NSError* aError) {
+            if (aError || !aGroup) {
+                [busyScratchGroups removeObject:aScratch.number];
+                [self declineCommands:aCommands];
+                return;
+            }
+            aGroup.lightIds = aSortedIds;
+            [self sendPayload:aPayload toGroup:aGroup forCommands:aCommands];
+        }];
+        return;
+    }
+    // ...or create a new one, if the pool is not full
+    if (scratchGroups.count + pendingScratchGroups < _maximumScratchGroups) {
+        pendingScratchGroups++;
+        NSString* aName = [NSString stringWithFormat:@"%@ %lu", DPHueScratchGroupName, (unsigned long)(scratchGroups.count + pendingScratchGroups)];
+        [aBridge createGroupWithName:aName lightIds:aSortedIds callbackQueue:queue onCompletion:^(DPHueLightGroup* aGroup, NSError* aError) {
+            pendingScratchGroups--;
+            if (aError || !aGroup) {
+                [self declineCommands:aCommands];
+                return;
+            }
+            [scratchGroups addObject:aGroup];
+            [busyScratchGroups addObject:aGroup.number];
+            [self sendPayload:aPayload toGroup:aGroup forCommands:aCommands];
+        }];
+        return;
+    }
+    [self declineCommands:aCommands];
+}
+
+// Pick up scratch groups created by earlier sessions, as reported by the bridge
+- (void)adoptScratchGroups {
+    if (adoptedScratchGroups || !bridge.groups)
+        return;
+    adoptedScratchGroups = YES;
+    for (DPHueLightGroup* aGroup in bridge.groups)
+        if ([aGroup.name hasPrefix:DPHueScratchGroupName] && scratchGroups.count < _maximumScratchGroups)
+            [scratchGroups addObject:aGroup];
+}
+
+- (BOOL)isScratchGroup:(DPHueLightGroup*)aGroup {
+    if ([aGroup.name hasPrefix:DPHueScratchGroupName])
+        return YES;
+    for (DPHueLightGroup* aScratch in scratchGroups)
+        if ([aScratch.number isEqualToNumber:aGroup.number])
+            return YES;
+    return NO;
+}
+
+- (void)sendPayload:(NSDictionary*)aPayload toGroup:(DPHueLightGroup*)aGroup forCommands:(NSArray<DPJSONConnection*>*)aCommands {
+    NSNumber* aScratchNumber = [self isScratchGroup:aGroup] ? aGroup.number : nil;
+    // The group would still set lights whose writes were cancelled since they were taken over
+    NSMutableArray<DPJSONConnection*>* aDropped = [NSMutableArray new];
+    for (DPJSONConnection* aCommand in aCommands)
+        if ([aCommand dropIfCancelledOrExpired])
+            [aDropped addObject:aCommand];
+    if (aDropped.count) {
+        if (aScratchNumber)
+            [busyScratchGroups removeObject:aScratchNumber];
+        // They have completed already, so this only forgets them
+        [scheduler completeTakenOverCommands:aDropped withJSON:nil error:nil];
+        NSMutableArray<DPJSONConnection*>* aLive = [aCommands mutableCopy];
+        [aLive removeObjectsInArray:aDropped];
+        [self declineCommands:aLive];
+        return;
+    }
+    DPJSONConnection* anAction = [[DPJSONConnection alloc] initWithRequest:[aGroup requestForSettingGroupState:aPayload] sender:aGroup];
+    anAction.completionBlock = ^(DPHueLightGroup* aSender, id aJson, NSError* aError) {
+        if (aScratchNumber)
+            dispatch_async(queue, ^{
+                [busyScratchGroups removeObject:aScratchNumber];
+            });
+        [scheduler completeTakenOverCommands:aCommands withJSON:aJson error:aError];
+    };
+    // As urgent as the most urgent of the writes it replaces
+    anAction.priority = DPHueCommandPriorityMaintenance;
+    for (DPJSONConnection* aCommand in aCommands)
+        anAction.priority = MIN(anAction.priority, aCommand.priority);
+    [bridge queueCommand:anAction maxPerSecond:DPHueGroupCommandsPerSecond];
+}
+
+// Send the light writes one by one after all
+- (void)declineCommands:(NSArray<DPJSONConnection*>*)aCommands {
+    [scheduler returnTakenOverCommands:aCommands];
+}
+
+@end
@@ -0,0 +1,106 @@
+//
+//  DPHueFleet.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueFleet owns the bridges of a site, keyed by MAC address as DPHueDiscover
+// reports them. Every bridge keeps its own command queue, rate limits and
+// session, so a slow or rate-limited bridge never holds up the others.
+// Fleet-wide operations are sent to all bridges at once, and report one
+// aggregated result when every bridge has answered or timed out.
+
+#import <Foundation/Foundation.h>
+#import "DPHueStateStore.h"
+
+@class DPHueBridge;
+
+@interface DPHueFleetResult : NSObject
+
+/// MACs of the bridges the operation succeeded on.
+@property (nonatomic, readonly, copy) NSArray<NSString *> *succeededMACs;
+
+/// The error per MAC of the bridges the operation failed or timed out on.
+@property (nonatomic, readonly, copy) NSDictionary<NSString *, NSError *> *errorsByMAC;
+
+/// Seconds from sending the operation until the result was complete.
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+/// Seconds until each bridge answered, per MAC; timed out bridges are left out.
+@property (nonatomic, readonly, copy) NSDictionary<NSString *, NSNumber *> *durationsByMAC;
+
+/// YES if the operation succeeded on every bridge.
+@property (nonatomic, readonly) BOOL succeeded;
+
+@end
+
+
+@interface DPHueFleet : NSObject
+
+/**
+ Seconds after which a fleet-wide operation reports bridges that have not answered
+ as failed, with error code 8. Defaults to 10.
+ */
+@property (nonatomic, assign) NSTimeInterval operationTimeout;
+
+/**
+ The queue the completions of fleet-wide operations are called on. The operations
+ keep their bookkeeping on a private queue and do not wait for this one, or for the
+ @p callbackQueue of the bridges.
+
+ @note Defaults to the main queue.
+ */
+#if OS_OBJECT_USE_OBJC
+@property (strong) dispatch_queue_t callbackQueue;
+#else
+@property (assign) dispatch_queue_t callbackQueue;
+#endif
+
+/// All bridges, per MAC.
+@property (nonatomic, readonly, copy) NSDictionary<NSString *, DPHueBridge *> *bridges;
+
+/**
+ Add a bridge, or update the host of the bridge with the same MAC, e.g. after
+ its DHCP lease changed. Safe to call from any thread.
+
+ @return The bridge for @p aMAC.
+ */
+- (DPHueBridge *)addBridgeWithMAC:(NSString *)aMAC host:(NSString *)aHost generatedUsername:(NSString *)aGeneratedUsername;
+
+/**
+ Add the bridges of a @p DPHueDiscover completion, whose @p discovered maps MACs to
+ hosts. Bridges without a username in @p aGeneratedUsernames, which is keyed by
+ MAC as well, are skipped.
+ */
+- (void)addBridgesFromDiscovery:(NSDictionary<NSString *, NSString *> *)aDiscovered generatedUsernames:(NSDictionary<NSString *, NSString *> *)aGeneratedUsernames;
+
+- (DPHueBridge *)bridgeForMAC:(NSString *)aMAC;
+- (void)removeBridgeForMAC:(NSString *)aMAC;
+
+/**
+ Numbers of the lights for which @p aTest returns YES, per MAC, scanning the
+ @p stateStore of every bridge. Bridges without such lights are left out.
+ */
+- (NSDictionary<NSString *, NSArray<NSNumber *> *> *)lightIdsPassingTest:(BOOL (^)(const DPHueLightAttributes *anAttributes))aTest;
+
+#pragma mark - Fleet-wide operations, calling back on callbackQueue
+
+/// Read the state of every bridge.
+- (void)readAllWithCompletion:(void (^)(DPHueFleetResult *result))aCompletion;
+
+/// Turn all lights of every bridge on or off, with one group 0 write per bridge.
+- (void)setAllLightsOn:(BOOL)anOn completion:(void (^)(DPHueFleetResult *result))aCompletion;
+
+/// Send @p aState, a body of PUT /groups/0/action, to every bridge.
+- (void)setAllLightsState:(NSDictionary *)aState completion:(void (^)(DPHueFleetResult *result))aCompletion;
+
+/**
+ Run @p anOperation on every bridge at once. It must call @p done exactly once, on
+ any queue, with nil or the error the bridge failed with.
+ */
+- (void)performOnAllBridges:(void (^)(DPHueBridge *bridge, void (^done)(NSError *err)))anOperation
+                 completion:(void (^)(DPHueFleetResult *result))aCompletion;
+
+@end
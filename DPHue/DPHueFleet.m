@@ -0,0 +1,256 @@
+//
+//  DPHueFleet.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueFleet.h"
+#import "DPHueBridge.h"
+#import "DPHueLightGroup.h"
+#import "DPJSONConnection.h"
+
+#pragma mark - C functions
+
+// DPHueDiscover reports MACs as the bridges do, in either case and with or without separators
+static NSString* _NormalizedMAC(NSString* aMAC) {
+    NSCharacterSet* aSeparators = [NSCharacterSet characterSetWithCharactersInString:@":-"];
+    return [[[aMAC lowercaseString] componentsSeparatedByCharactersInSet:aSeparators] componentsJoinedByString:@""];
+}
+
+#pragma mark - DPHueFleetResult
+
+@interface DPHueFleetResult ()
+
+@property (nonatomic, readwrite, copy) NSArray<NSString *> *succeededMACs;
+@property (nonatomic, readwrite, copy) NSDictionary<NSString *, NSError *> *errorsByMAC;
+@property (nonatomic, readwrite) NSTimeInterval duration;
+@property (nonatomic, readwrite, copy) NSDictionary<NSString *, NSNumber *> *durationsByMAC;
+
+@end
+
+@implementation DPHueFleetResult
+
+- (BOOL)succeeded {
+    return !_errorsByMAC.count;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"%lu succeeded, %lu failed in %.3fs",
+            (unsigned long)_succeededMACs.count, (unsigned long)_errorsByMAC.count, _duration];
+}
+
+@end
+
+#pragma mark - DPHueFleetOperation
+
+// The bookkeeping of one fleet-wide operation, touched on the queue of the fleet only
+@interface DPHueFleetOperation : NSObject
+
+@property (nonatomic, assign) NSTimeInterval startedAt;
+@property (nonatomic, strong) NSMutableSet<NSString*>* pendingMACs;
+@property (nonatomic, strong) NSMutableArray<NSString*>* succeededMACs;
+@property (nonatomic, strong) NSMutableDictionary<NSString*, NSError*>* errorsByMAC;
+@property (nonatomic, strong) NSMutableDictionary<NSString*, NSNumber*>* durationsByMAC;
+@property (nonatomic, copy) void (^completion)(DPHueFleetResult*);
+
+@end
+
+@implementation DPHueFleetOperation
+@end
+
+#pragma mark - DPHueFleet
+
+@implementation DPHueFleet {
+    NSMutableDictionary<NSString*, DPHueBridge*>* bridges;
+    // Operations are tracked on this queue
+    dispatch_queue_t queue;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _operationTimeout = 10;
+        _callbackQueue = dispatch_get_main_queue();
+        bridges = [NSMutableDictionary new];
+        queue = dispatch_queue_create("DPHueFleet", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+#if !OS_OBJECT_USE_OBJC
+- (void)dealloc {
+    dispatch_release(queue);
+}
+#endif
+
+- (NSDictionary<NSString *, DPHueBridge *> *)bridges {
+    @synchronized(self) {
+        return [bridges copy];
+    }
+}
+
+- (DPHueBridge *)addBridgeWithMAC:(NSString *)aMAC host:(NSString *)aHost generatedUsername:(NSString *)aGeneratedUsername {
+    NSString* aKey = _NormalizedMAC(aMAC);
+    @synchronized(self) {
+        DPHueBridge* aBridge = bridges[aKey];
+        if (aBridge) {
+            if (![aBridge.host isEqualToString:aHost])
+                aBridge.host = aHost;
+            if (aGeneratedUsername && ![aBridge.generatedUsername isEqualToString:aGeneratedUsername])
+                aBridge.generatedUsername = aGeneratedUsername;
+            return aBridge;
+        }
+        aBridge = [[DPHueBridge alloc] initWithHueHost:aHost generatedUsername:aGeneratedUsername];
+        bridges[aKey] = aBridge;
+        return aBridge;
+    }
+}
+
+- (void)addBridgesFromDiscovery:(NSDictionary<NSString *, NSString *> *)aDiscovered generatedUsernames:(NSDictionary<NSString *, NSString *> *)aGeneratedUsernames {
+    NSMutableDictionary<NSString*, NSString*>* aUsernames = [NSMutableDictionary new];
+    [aGeneratedUsernames enumerateKeysAndObjectsUsingBlock:^(NSString* aMAC, NSString* aUsername, BOOL* aStop) {
+        aUsernames[_NormalizedMAC(aMAC)] = aUsername;
+    }];
+    [aDiscovered enumerateKeysAndObjectsUsingBlock:^(NSString* aMAC, NSString* aHost, BOOL* aStop) {
+        NSString* aUsername = aUsernames[_NormalizedMAC(aMAC)];
+        if (aUsername)
+            [self addBridgeWithMAC:aMAC host:aHost generatedUsername:aUsername];
+    }];
+}
+
+- (DPHueBridge *)bridgeForMAC:(NSString *)aMAC {
+    @synchronized(self) {
+        return bridges[_NormalizedMAC(aMAC)];
+    }
+}
+
+- (void)removeBridgeForMAC:(NSString *)aMAC {
+    @synchronized(self) {
+        [bridges removeObjectForKey:_NormalizedMAC(aMAC)];
+    }
+}
+
+- (NSDictionary<NSString *, NSArray<NSNumber *> *> *)lightIdsPassingTest:(BOOL (^)(const DPHueLightAttributes *))aTest {
+    NSMutableDictionary<NSString*, NSArray<NSNumber*>*>* aResult = [NSMutableDictionary new];
+    [self.bridges enumerateKeysAndObjectsUsingBlock:^(NSString* aMAC, DPHueBridge* aBridge, BOOL* aStop) {
+        NSArray<NSNumber*>* anIds = [aBridge.stateStore lightIdsPassingTest:aTest];
+        if (anIds.count)
+            aResult[aMAC] = anIds;
+    }];
+    return aResult;
+}
+
+#pragma mark - Fleet-wide operations
+
+- (void)readAllWithCompletion:(void (^)(DPHueFleetResult *))aCompletion {
+    [self performOnAllBridges:^(DPHueBridge* aBridge, void (^aDone)(NSError*)) {
+        [aBridge readControllerStateForPoll:NO callbackQueue:queue completion:^(DPHueBridge* aHue, DPHueBridgeChanges* aChanges, NSError* anError) {
+            aDone(anError);
+        }];
+    } completion:aCompletion];
+}
+
+- (void)setAllLightsOn:(BOOL)anOn completion:(void (^)(DPHueFleetResult *))aCompletion {
+    [self setAllLightsState:@{@"on": @(anOn)} completion:aCompletion];
+}
+
+- (void)setAllLightsState:(NSDictionary *)aState completion:(void (^)(DPHueFleetResult *))aCompletion {
+    [self performOnAllBridges:^(DPHueBridge* aBridge, void (^aDone)(NSError*)) {
+        // Group 0 always contains all lights of the bridge
+        DPHueLightGroup* aGroup = [[DPHueLightGroup alloc] initWithBridge:aBridge];
+        aGroup.number = @0;
+        aGroup.host = aBridge.host;
+        aGroup.username = aBridge.generatedUsername;
+        NSURLRequest* aRequest = [aGroup requestForSettingGroupState:aState];
+        DPJSONConnection* aConnection = [[DPJSONConnection alloc] initWithRequest:aRequest sender:aGroup];
+        aConnection.coalescingKey = [aGroup coalescingKeyForSettingGroupState];
+        aConnection.priority = DPHueCommandPriorityInteractive;
+        aConnection.completionBlock = ^(DPHueLightGroup* aSender, id aJson, NSError* anError) {
+            if (!anError) {
+                BOOL anAmbiguous = NO;
+                NSDictionary* anAction = [aSender actionConfirmedByGroupStateSet:aJson ambiguous:&anAmbiguous];
+                [aBridge updateLightsOfGroup:aSender withAction:anAction ambiguous:anAmbiguous];
+            }
+            if (!anError && [aJson isKindOfClass:[NSArray class]]) {
+                for (id aResult in aJson) {
+                    NSDictionary* aFailure = [aResult isKindOfClass:[NSDictionary class]] ? aResult[@"error"] : nil;
+                    if ([aFailure isKindOfClass:[NSDictionary class]]) {
+                        anError = [NSError errorWithDomain:@"DPHue" code:2 userInfo:@{NSLocalizedDescriptionKey: aFailure[@"description"] ?: @"Write failed"}];
+                        break;
+                    }
+                }
+            }
+            aDone(anError);
+        };
+        [aBridge queueCommand:aConnection maxPerSecond:DPHueGroupCommandsPerSecond];
+    } completion:aCompletion];
+}
+
+- (void)performOnAllBridges:(void (^)(DPHueBridge *, void (^)(NSError *)))anOperation completion:(void (^)(DPHueFleetResult *))aCompletion {
+    NSDictionary<NSString*, DPHueBridge*>* aBridges = self.bridges;
+    NSTimeInterval aTimeout = self.operationTimeout;
+    dispatch_queue_t aCallbackQueue = self.callbackQueue ?: dispatch_get_main_queue();
+    dispatch_async(queue, ^{
+        DPHueFleetOperation* anOperationState = [DPHueFleetOperation new];
+        anOperationState.startedAt = [NSProcessInfo processInfo].systemUptime;
+        anOperationState.pendingMACs = [NSMutableSet setWithArray:aBridges.allKeys];
+        anOperationState.succeededMACs = [NSMutableArray new];
+        anOperationState.errorsByMAC = [NSMutableDictionary new];
+        anOperationState.durationsByMAC = [NSMutableDictionary new];
+        anOperationState.completion = aCompletion ? ^(DPHueFleetResult* aResult) {
+            dispatch_async(aCallbackQueue, ^{
+                aCompletion(aResult);
+            });
+        } : nil;
+        if (!aBridges.count) {
+            [self finishOperation:anOperationState];
+            return;
+        }
+        // Each bridge works through its own queue, so all of them start at once
+        [aBridges enumerateKeysAndObjectsUsingBlock:^(NSString* aMAC, DPHueBridge* aBridge, BOOL* aStop) {
+            anOperation(aBridge, ^(NSError* anError) {
+                dispatch_async(queue, ^{
+                    [self operation:anOperationState finishedOnMAC:aMAC error:anError timedOut:NO];
+                });
+            });
+        }];
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(aTimeout * NSEC_PER_SEC)), queue, ^{
+            for (NSString* aMAC in [anOperationState.pendingMACs copy]) {
+                NSError* anError = [NSError errorWithDomain:@"DPHue" code:8 userInfo:@{NSLocalizedDescriptionKey: @"The bridge did not answer in time"}];
+                [self operation:anOperationState finishedOnMAC:aMAC error:anError timedOut:YES];
+            }
+        });
+    });
+}
+
+#pragma mark - Private, called on queue
+
+- (void)operation:(DPHueFleetOperation*)anOperation finishedOnMAC:(NSString*)aMAC error:(NSError*)anError timedOut:(BOOL)aTimedOut {
+    if (![anOperation.pendingMACs containsObject:aMAC])
+        return;
+    [anOperation.pendingMACs removeObject:aMAC];
+    if (!aTimedOut)
+        anOperation.durationsByMAC[aMAC] = @([NSProcessInfo processInfo].systemUptime - anOperation.startedAt);
+    if (anError)
+        anOperation.errorsByMAC[aMAC] = anError;
+    else
+        [anOperation.succeededMACs addObject:aMAC];
+    if (!anOperation.pendingMACs.count)
+        [self finishOperation:anOperation];
+}
+
+- (void)finishOperation:(DPHueFleetOperation*)anOperation {
+    DPHueFleetResult* aResult = [DPHueFleetResult new];
+    aResult.succeededMACs = anOperation.succeededMACs;
+    aResult.errorsByMAC = anOperation.errorsByMAC;
+    aResult.durationsByMAC = anOperation.durationsByMAC;
+    aResult.duration = [NSProcessInfo processInfo].systemUptime - anOperation.startedAt;
+    void (^aCompletion)(DPHueFleetResult*) = anOperation.completion;
+    anOperation.completion = nil;
+    if (aCompletion)
+        aCompletion(aResult);
+}
+
+@end
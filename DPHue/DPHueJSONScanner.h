@@ -0,0 +1,35 @@
+//
+//  DPHueJSONScanner.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueJSONScanner decodes only selected members of a JSON object. The
+// other members are skipped over byte by byte, without creating any
+// Foundation objects for them, which keeps the full bridge state response
+// (schedules, scenes, rules, sensors...) cheap when only lights, groups and
+// config are needed.
+
+#import <Foundation/Foundation.h>
+
+@interface DPHueJSONScanner : NSObject
+
+/**
+ Find the values of the members named in @p aKeys in the top-level JSON object in @p aData.
+ Member names are compared byte for byte, so names with escape sequences never match.
+
+ @return The byte range of each value found, as an NSValue, keyed by member name;
+         nil if @p aData does not hold a JSON object.
+ */
++ (NSDictionary<NSString *, NSValue *> *)rangesOfValuesForKeys:(NSSet<NSString *> *)aKeys inData:(NSData *)aData;
+
+/**
+ Decode the members named in @p aKeys of the top-level JSON object in @p aData into a
+ dictionary; the rest of the object is skipped. Any other JSON value, e.g. the array of
+ errors the bridge answers with, is decoded as a whole.
+ */
++ (id)JSONObjectWithData:(NSData *)aData keys:(NSSet<NSString *> *)aKeys error:(NSError **)anError;
+
+@end
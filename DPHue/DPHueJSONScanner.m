@@ -0,0 +1,138 @@
+//
+//  DPHueJSONScanner.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueJSONScanner.h"
+
+#pragma mark - C functions
+
+static const uint8_t* _SkipWhitespace(const uint8_t* p, const uint8_t* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
+
+// p points at the opening quote; returns the position after the closing one
+static const uint8_t* _SkipString(const uint8_t* p, const uint8_t* end) {
+    for (p++; p < end; p++) {
+        if (*p == '\\')
+            p++;
+        else if (*p == '"')
+            return p + 1;
+    }
+    return NULL;
+}
+
+// Returns the position after the value starting at p, without validating it
+static const uint8_t* _SkipValue(const uint8_t* p, const uint8_t* end) {
+    if (p >= end)
+        return NULL;
+    if (*p == '"')
+        return _SkipString(p, end);
+    if (*p != '{' && *p != '[') {
+        // Number or literal
+        while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+            p++;
+        return p;
+    }
+    NSUInteger aDepth = 0;
+    while (p < end) {
+        switch (*p) {
+            case '"':
+                p = _SkipString(p, end);
+                if (!p)
+                    return NULL;
+                continue;
+            case '{':
+            case '[':
+                aDepth++;
+                break;
+            case '}':
+            case ']':
+                if (--aDepth == 0)
+                    return p + 1;
+                break;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+@implementation DPHueJSONScanner
+
++ (NSDictionary<NSString *, NSValue *> *)rangesOfValuesForKeys:(NSSet<NSString *> *)aKeys inData:(NSData *)aData {
+    const uint8_t* aStart = aData.bytes;
+    const uint8_t* anEnd = aStart + aData.length;
+    const uint8_t* p = _SkipWhitespace(aStart, anEnd);
+    if (p >= anEnd || *p != '{')
+        return nil;
+
+    NSMutableArray<NSString*>* aWanted = [aKeys.allObjects mutableCopy];
+    NSMutableDictionary<NSString*, NSValue*>* aRanges = [NSMutableDictionary new];
+    p = _SkipWhitespace(p + 1, anEnd);
+    if (p < anEnd && *p == '}')
+        return aRanges;
+    while (p < anEnd) {
+        if (*p != '"')
+            return nil;
+        const uint8_t* aKeyEnd = _SkipString(p, anEnd);
+        if (!aKeyEnd)
+            return nil;
+        const uint8_t* aKey = p + 1;
+        NSUInteger aKeyLength = aKeyEnd - 1 - aKey;
+        p = _SkipWhitespace(aKeyEnd, anEnd);
+        if (p >= anEnd || *p != ':')
+            return nil;
+        const uint8_t* aValue = _SkipWhitespace(p + 1, anEnd);
+        p = _SkipValue(aValue, anEnd);
+        if (!p)
+            return nil;
+        // Only the few wanted names are compared, and no string is created for the others
+        for (NSUInteger i = 0; i < aWanted.count; i++) {
+            const char* aName = aWanted[i].UTF8String;
+            if (strlen(aName) == aKeyLength && memcmp(aName, aKey, aKeyLength) == 0) {
+                aRanges[aWanted[i]] = [NSValue valueWithRange:NSMakeRange(aValue - aStart, p - aValue)];
+                [aWanted removeObjectAtIndex:i];
+                break;
+            }
+        }
+        p = _SkipWhitespace(p, anEnd);
+        if (p < anEnd && *p == '}')
+            return aRanges;
+        if (p >= anEnd || *p != ',')
+            return nil;
+        p = _SkipWhitespace(p + 1, anEnd);
+    }
+    return nil;
+}
+
++ (id)JSONObjectWithData:(NSData *)aData keys:(NSSet<NSString *> *)aKeys error:(NSError **)anError {
+    const uint8_t* aStart = aData.bytes;
+    const uint8_t* p = _SkipWhitespace(aStart, aStart + aData.length);
+    if (p >= aStart + aData.length || *p != '{')
+        return [NSJSONSerialization JSONObjectWithData:aData options:0 error:anError];
+
+    NSDictionary<NSString*, NSValue*>* aRanges = [self rangesOfValuesForKeys:aKeys inData:aData];
+    if (!aRanges) {
+        if (anError)
+            *anError = [NSError errorWithDomain:@"DPHue" code:7 userInfo:@{NSLocalizedDescriptionKey: @"Malformed JSON object"}];
+        return nil;
+    }
+    NSMutableDictionary* anObject = [NSMutableDictionary dictionaryWithCapacity:aRanges.count];
+    for (NSString* aKey in aRanges) {
+        NSRange aRange = aRanges[aKey].rangeValue;
+        // Decode straight from the response bytes
+        NSData* aValueData = [NSData dataWithBytesNoCopy:(void*)(aStart + aRange.location) length:aRange.length freeWhenDone:NO];
+        id aValue = [NSJSONSerialization JSONObjectWithData:aValueData options:NSJSONReadingAllowFragments error:anError];
+        if (!aValue)
+            return nil;
+        anObject[aKey] = aValue;
+    }
+    return anObject;
+}
+
+@end
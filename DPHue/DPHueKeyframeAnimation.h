@@ -0,0 +1,70 @@
+//
+//  DPHueKeyframeAnimation.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueKeyframeAnimation plays a curve over time, such as a brightness ramp,
+// a color fade or a sunrise, with as few requests as possible. The curve is
+// sampled at the resolution of transitiontime (100ms) and reduced to the
+// fewest keyframes that keep every sample within a tolerance of the straight
+// line between its neighbouring keyframes. Each keyframe is then sent as a
+// single write whose transitiontime lets the bridge interpolate up to it.
+
+#import <Foundation/Foundation.h>
+
+@class DPHueLight;
+@class DPHueLightGroup;
+
+@interface DPHueKeyframe : NSObject
+
+/// Seconds from the start of the animation.
+@property (nonatomic, readonly) NSTimeInterval time;
+
+/// The state to reach at @p time, e.g. @p @{@"bri": @254, @"ct": @300}.
+@property (nonatomic, readonly, copy) NSDictionary *state;
+
+@end
+
+
+@interface DPHueKeyframeAnimation : NSObject
+
+/**
+ Fit a curve to keyframes.
+
+ @param aDuration
+          Length of the animation in seconds.
+ @param aTolerance
+          Largest allowed deviation from the curve, as a fraction of the range of
+          each value, e.g. 0.01 for 1% of 0-254 for @p bri.
+ @param aCurve
+          The state at a time from 0 to @p aDuration. States must always have the same
+          keys, out of @p bri, @p sat, @p hue, @p ct and @p xy.
+ */
+- (instancetype)initWithDuration:(NSTimeInterval)aDuration tolerance:(double)aTolerance curve:(NSDictionary *(^)(NSTimeInterval time))aCurve;
+
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+/// The fitted keyframes; the first is at time 0 and the last at @p duration.
+@property (nonatomic, readonly, copy) NSArray<DPHueKeyframe *> *keyframes;
+
+@property (nonatomic, readonly, getter=isPlaying) BOOL playing;
+
+/**
+ Send the keyframes to @p aLights, one write per light and keyframe. Sending the
+ keyframes to a group instead takes one write per keyframe for all its lights.
+ Calls back on the @p callbackQueue of their bridge when the last keyframe was written
+ or a write failed. The animation stops if it is deallocated, so keep a reference while
+ it plays.
+ */
+- (void)playOnLights:(NSArray<DPHueLight *> *)aLights completion:(void (^)(NSError *err))aCompletion;
+
+/// Like @p playOnLights:completion:, for the action of a group.
+- (void)playOnGroup:(DPHueLightGroup *)aGroup completion:(void (^)(NSError *err))aCompletion;
+
+/// Stop sending keyframes; the lights stay where the current transition takes them.
+- (void)stop;
+
+@end
@@ -0,0 +1,272 @@
+//
+//  DPHueKeyframeAnimation.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueKeyframeAnimation.h"
+#import "DPHueBridge.h"
+#import "DPHueLight.h"
+#import "DPHueLightGroup.h"
+#import "DPJSONConnection.h"
+
+// transitiontime is given in multiples of 100ms, and is 16 bits wide
+static const NSTimeInterval kDPHueTransitionTimeUnit = 0.1;
+static const NSUInteger kDPHueMaximumTransitionTime = UINT16_MAX;
+
+#pragma mark - C functions
+
+// Mark the samples to keep as keyframes so that every other sample is within
+// aTolerance of the straight line between the kept samples around it, in
+// every channel (Ramer-Douglas-Peucker on the time axis). aSamples holds
+// aChannels values per sample.
+static void _FitKeyframes(const double* aSamples, NSUInteger aCount, NSUInteger aChannels, double aTolerance, BOOL* aKeep) {
+    aKeep[0] = aKeep[aCount - 1] = YES;
+    NSUInteger* aStack = malloc(2 * aCount * sizeof(NSUInteger));
+    NSUInteger aDepth = 0;
+    aStack[aDepth++] = 0;
+    aStack[aDepth++] = aCount - 1;
+    while (aDepth) {
+        NSUInteger anEnd = aStack[--aDepth];
+        NSUInteger aStart = aStack[--aDepth];
+        if (anEnd - aStart < 2)
+            continue;
+        const double* aFrom = aSamples + aStart * aChannels;
+        const double* aTo = aSamples + anEnd * aChannels;
+        double aWorst = 0;
+        NSUInteger aWorstIndex = aStart;
+        for (NSUInteger i = aStart + 1; i < anEnd; i++) {
+            double aFraction = (double)(i - aStart) / (anEnd - aStart);
+            const double* aSample = aSamples + i * aChannels;
+            for (NSUInteger c = 0; c < aChannels; c++) {
+                double anError = fabs(aSample[c] - (aFrom[c] + (aTo[c] - aFrom[c]) * aFraction));
+                if (anError > aWorst) {
+                    aWorst = anError;
+                    aWorstIndex = i;
+                }
+            }
+        }
+        if (aWorst <= aTolerance)
+            continue;
+        aKeep[aWorstIndex] = YES;
+        aStack[aDepth++] = aStart;
+        aStack[aDepth++] = aWorstIndex;
+        aStack[aDepth++] = aWorstIndex;
+        aStack[aDepth++] = anEnd;
+    }
+    free(aStack);
+}
+
+// The span of each value, so that one tolerance fits all of them
+static double _RangeOfKey(NSString* aKey) {
+    static NSDictionary<NSString*, NSNumber*>* sRanges;
+    static dispatch_once_t sOnce;
+    dispatch_once(&sOnce, ^{
+        sRanges = @{@"bri": @254, @"sat": @254, @"hue": @65535, @"ct": @346, @"xy": @1};
+    });
+    return sRanges[aKey].doubleValue ?: 1;
+}
+
+#pragma mark - DPHueKeyframe
+
+@implementation DPHueKeyframe
+
+- (instancetype)initWithTime:(NSTimeInterval)aTime state:(NSDictionary *)aState {
+    self = [super init];
+    if (self) {
+        _time = aTime;
+        _state = [aState copy];
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"%.1fs: %@", _time, _state];
+}
+
+@end
+
+#pragma mark - DPHueKeyframeAnimation
+
+@implementation DPHueKeyframeAnimation {
+    // Playback state is only used on this queue
+    dispatch_queue_t queue;
+    NSArray* targets;
+    void (^completion)(NSError*);
+    NSTimeInterval startedAt;
+    // Bumped by every play and stop, so that stale callbacks are ignored
+    NSUInteger generation;
+}
+
+- (instancetype)initWithDuration:(NSTimeInterval)aDuration tolerance:(double)aTolerance curve:(NSDictionary *(^)(NSTimeInterval))aCurve {
+    self = [super init];
+    if (self) {
+        _duration = MAX(0, aDuration);
+        _keyframes = [self keyframesOfCurve:aCurve tolerance:aTolerance];
+        queue = dispatch_queue_create("DPHueKeyframeAnimation", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+#if !OS_OBJECT_USE_OBJC
+- (void)dealloc {
+    dispatch_release(queue);
+}
+#endif
+
+- (NSArray<DPHueKeyframe*>*)keyframesOfCurve:(NSDictionary* (^)(NSTimeInterval))aCurve tolerance:(double)aTolerance {
+    NSUInteger aCount = (NSUInteger)ceil(_duration / kDPHueTransitionTimeUnit) + 1;
+    NSArray<NSString*>* aKeys = [[aCurve(0) allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    NSUInteger aChannels = 0;
+    for (NSString* aKey in aKeys)
+        aChannels += [aKey isEqualToString:@"xy"] ? 2 : 1;
+    if (!aChannels || aCount < 2)
+        return @[[[DPHueKeyframe alloc] initWithTime:0 state:aCurve(0)]];
+
+    // Sample the curve, normalizing every value by its range...
+    NSMutableArray<NSDictionary*>* aStates = [NSMutableArray arrayWithCapacity:aCount];
+    double* aSamples = malloc(aCount * aChannels * sizeof(double));
+    for (NSUInteger i = 0; i < aCount; i++) {
+        NSDictionary* aState = aCurve(MIN(_duration, i * kDPHueTransitionTimeUnit));
+        [aStates addObject:aState];
+        double* aSample = aSamples + i * aChannels;
+        for (NSString* aKey in aKeys) {
+            double aRange = _RangeOfKey(aKey);
+            id aValue = aState[aKey];
+            if ([aValue isKindOfClass:[NSArray class]]) {
+                *aSample++ = [aValue[0] doubleValue] / aRange;
+                *aSample++ = [aValue[1] doubleValue] / aRange;
+            } else {
+                *aSample++ = [aValue doubleValue] / aRange;
+            }
+        }
+    }
+    BOOL* aKeep = calloc(aCount, sizeof(BOOL));
+    _FitKeyframes(aSamples, aCount, aChannels, aTolerance, aKeep);
+    free(aSamples);
+
+    // ...and keep transitions within what transitiontime can express
+    NSMutableArray<DPHueKeyframe*>* aKeyframes = [NSMutableArray new];
+    NSUInteger aLastKept = 0;
+    for (NSUInteger i = 0; i < aCount; i++) {
+        if (i - aLastKept >= kDPHueMaximumTransitionTime)
+            aKeep[i] = YES;
+        if (!aKeep[i])
+            continue;
+        aLastKept = i;
+        [aKeyframes addObject:[[DPHueKeyframe alloc] initWithTime:MIN(_duration, i * kDPHueTransitionTimeUnit) state:aStates[i]]];
+    }
+    free(aKeep);
+    return aKeyframes;
+}
+
+- (void)playOnLights:(NSArray<DPHueLight *> *)aLights completion:(void (^)(NSError *))aCompletion {
+    [self playOnTargets:aLights completion:aCompletion];
+}
+
+- (void)playOnGroup:(DPHueLightGroup *)aGroup completion:(void (^)(NSError *))aCompletion {
+    [self playOnTargets:@[aGroup] completion:aCompletion];
+}
+
+- (void)stop {
+    dispatch_async(queue, ^{
+        generation++;
+        _playing = NO;
+        targets = nil;
+        completion = nil;
+    });
+}
+
+#pragma mark - Private, called on queue
+
+- (void)playOnTargets:(NSArray*)aTargets completion:(void (^)(NSError*))aCompletion {
+    dispatch_async(queue, ^{
+        generation++;
+        _playing = YES;
+        targets = [aTargets copy];
+        completion = [aCompletion copy];
+        startedAt = [NSProcessInfo processInfo].systemUptime;
+        [self sendKeyframeAtIndex:0 generation:generation];
+    });
+}
+
+- (void)sendKeyframeAtIndex:(NSUInteger)anIndex generation:(NSUInteger)aGeneration {
+    if (aGeneration != generation)
+        return;
+    DPHueKeyframe* aKeyframe = _keyframes[anIndex];
+    // The first keyframe is where the animation starts, so go there at once;
+    // later ones take whatever time is left until they are due
+    NSTimeInterval anElapsed = [NSProcessInfo processInfo].systemUptime - startedAt;
+    long aTransitionTime = anIndex ? lround(MAX(0, aKeyframe.time - anElapsed) / kDPHueTransitionTimeUnit) : 0;
+    NSMutableDictionary* aState = [aKeyframe.state mutableCopy];
+    aState[@"transitiontime"] = @(MIN(aTransitionTime, (long)kDPHueMaximumTransitionTime));
+
+    __block NSUInteger aPending = targets.count;
+    __block NSError* aFirstError = nil;
+    __weak typeof(self) wkSelf = self;
+    void (^aFinished)(NSError*) = ^(NSError* anError) {
+        aFirstError = aFirstError ?: anError;
+        if (--aPending == 0)
+            [wkSelf keyframeAtIndex:anIndex finishedWithError:aFirstError generation:aGeneration];
+    };
+    for (id aTarget in targets) {
+        DPHueBridge* aBridge = [aTarget bridge];
+        BOOL aGroup = [aTarget isKindOfClass:[DPHueLightGroup class]];
+        NSURLRequest* aRequest = aGroup ? [aTarget requestForSettingGroupState:aState] : [aTarget requestForSettingLightState:aState];
+        DPJSONConnection* aConnection = [[DPJSONConnection alloc] initWithRequest:aRequest sender:aTarget];
+        aConnection.coalescingKey = aGroup ? [aTarget coalescingKeyForSettingGroupState] : [aTarget coalescingKeyForSettingLightState];
+        aConnection.completionBlock = ^(id aSender, id aJson, NSError* anError) {
+            if (!anError && aGroup) {
+                [aSender parseGroupStateSet:aJson];
+                // The lights of the group show what the controller confirmed
+                BOOL anAmbiguous = NO;
+                NSDictionary* anAction = [aSender actionConfirmedByGroupStateSet:aJson ambiguous:&anAmbiguous];
+                [aBridge updateLightsOfGroup:aSender withAction:anAction ambiguous:anAmbiguous];
+            } else if (!anError)
+                [aSender parseLightStateSet:aJson];
+            // Targets may belong to bridges with different private queues
+            dispatch_async(queue, ^{
+                aFinished(anError);
+            });
+        };
+        if (aBridge)
+            [aBridge queueCommand:aConnection maxPerSecond:aGroup ? DPHueGroupCommandsPerSecond : DPHueLightCommandsPerSecond];
+        else
+            [aConnection start];
+    }
+    if (!targets.count)
+        [self keyframeAtIndex:anIndex finishedWithError:nil generation:aGeneration];
+}
+
+- (void)keyframeAtIndex:(NSUInteger)anIndex finishedWithError:(NSError*)anError generation:(NSUInteger)aGeneration {
+    if (aGeneration != generation)
+        return;
+    if (anError || anIndex + 1 >= _keyframes.count) {
+        void (^aCompletion)(NSError*) = completion;
+        DPHueBridge* aBridge = [targets.firstObject bridge];
+        generation++;
+        _playing = NO;
+        targets = nil;
+        completion = nil;
+        if (!aCompletion)
+            return;
+        dispatch_block_t aCallback = ^{
+            aCompletion(anError);
+        };
+        if (aBridge)
+            [aBridge performCallback:aCallback];
+        else
+            dispatch_async(dispatch_get_main_queue(), aCallback);
+        return;
+    }
+    // The transition to the next keyframe starts once the bridge has reached this one
+    NSTimeInterval aDelay = _keyframes[anIndex].time - ([NSProcessInfo processInfo].systemUptime - startedAt);
+    __weak typeof(self) wkSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(MAX(0, aDelay) * NSEC_PER_SEC)), queue, ^{
+        [wkSelf sendKeyframeAtIndex:anIndex + 1 generation:aGeneration];
+    });
+}
+
+@end
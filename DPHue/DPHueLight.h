@@ -8,8 +8,10 @@
 //  https://github.com/danparsons/DPHue
 
 #import <Foundation/Foundation.h>
+#import "DPJSONConnection.h"
 
 @class DPHueBridge;
+@class DPHueRequest;
 
 @interface DPHueLight : NSObject <NSCoding>
 
@@ -71,6 +73,15 @@
 /// YES if it has pending changes that haven't been yet written, otherwise NO
 @property (nonatomic, readonly) BOOL hasPendingChanges;
 
+/**
+ Lane writes wait in while queued by the bridge; reads always wait in
+ @p DPHueCommandPriorityBackground.
+ 
+ @note Set to DPHueCommandPriorityInteractive by default, so writes are sent
+       before background traffic such as reads and schedule writes.
+ */
+@property (atomic, assign) DPHueCommandPriority writePriority;
+
 #pragma mark - Properties you may be interested in reading
 
 /// Lamp name, as returned by the controller.
@@ -90,6 +101,13 @@
  */
 @property (nonatomic, readonly, assign) BOOL reachable;
 
+/**
+ YES when a group write changed this light in a way the controller's response did
+ not fully tell, e.g. a scene, @p bri_inc, or a light that was unreachable. Its values
+ are then a best guess until the light or the bridge is read again, which clears it.
+ */
+@property (atomic, readonly, assign) BOOL needsVerification;
+
 /// Firmware version of the lamp.
 @property (nonatomic, readonly, copy) NSString* _Nullable swversion;
 
@@ -115,25 +133,26 @@
 
 - (void)alertLight;
 
-/// Re-download & parse controller's state for this particular light
-- (void)readWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))completion;
+/// Re-download & parse controller's state for this particular light; returns a handle to cancel it with
+- (DPHueRequest *)readWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))completion;
 
 /// Re-download & parse controller's state for this particular light
 - (void)read;
 
-/// Write only pending changes to controller
-- (void)writeWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted;
+/// Write only pending changes to controller; returns a handle to cancel it with, or nil if nothing is pending
+- (DPHueRequest *)writeWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted;
 
 /// Write only pending changes to controller
 - (void)write;
 
-/// Write entire state to controller, regardless of changes
-- (void)writeAllWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted;
+/// Write entire state to controller, regardless of changes; returns a handle to cancel it with
+- (DPHueRequest *)writeAllWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted;
 
 /// Write entire state to controller, regardless of changes
 - (void)writeAll;
 
 NSInteger _clamp_int(NSInteger number, NSInteger min, NSInteger max);
+BOOL _value_changed(id oldValue, id newValue);
 
 @end
 
@@ -143,6 +162,9 @@ NSInteger _clamp_int(NSInteger number, NSInteger min, NSInteger max);
 - (NSURLRequest *)requestForGettingLightState;
 - (NSURLRequest *)requestForSettingLightState:(NSDictionary *)state;
 
+/// "PUT <path of the state URL>", for @p DPJSONConnection.coalescingKey; computed once like the URLs.
+- (NSString *)coalescingKeyForSettingLightState;
+
 @end
 
 
@@ -151,6 +173,32 @@ NSInteger _clamp_int(NSInteger number, NSInteger min, NSInteger max);
 // GET /lights/{id}
 - (instancetype)parseLightStateGet:(id)json;
 
+/**
+ GET /lights/{id}, updating @p self in place. Properties with a pending change
+ keep their local value until it is written.
+
+ @return The names of the properties that changed.
+ */
+- (NSSet<NSString *> *)updateWithLightStateGet:(id)json;
+
+/**
+ Like @p updateWithLightStateGet:, with only some keys of the "state" object of a
+ light, e.g. @p {"on": true}; properties whose keys are missing keep their value.
+
+ @return The names of the properties that changed.
+ */
+- (NSSet<NSString *> *)updateWithLightStateChanges:(NSDictionary *)state;
+
+/**
+ Apply @p action, keys of the "action" object that the controller confirmed for a group
+ this light is in. Keys the light has no value for, e.g. @p ct of a color-only light,
+ are left out, as the controller converts or ignores them. With @p ambiguous, or when
+ anything is left out or the light is unreachable, @p needsVerification is set.
+
+ @return The names of the properties that changed.
+ */
+- (NSSet<NSString *> *)updateWithGroupAction:(NSDictionary *)action ambiguous:(BOOL)ambiguous;
+
 // PUT /lights/{id}/state
 - (instancetype)parseLightStateSet:(id)json;
 
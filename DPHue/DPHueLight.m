@@ -9,6 +9,8 @@
 
 #import "DPHueLight.h"
 #import "DPHueBridge.h"
+#import "DPHueRequest.h"
+#import "DPHueStateEncoder.h"
 #import "DPJSONConnection.h"
 #import "WSLog.h"
 
@@ -18,6 +20,10 @@
 @property (nonatomic, strong) NSMutableDictionary *pendingChanges;
 @property (nonatomic, assign) BOOL writeSuccess;
 @property (nonatomic, strong) NSMutableString *writeMessage;
+// Built once per host, username and number, see forgetURLs
+@property (nonatomic, strong) NSURL *cachedBaseURL;
+@property (nonatomic, strong) NSURL *cachedStateURL;
+@property (nonatomic, copy) NSString *cachedStateCoalescingKey;
 
 @end
 
@@ -40,6 +46,7 @@
   _host = @"";
   _holdUpdates = YES;
   _pendingChanges = [NSMutableDictionary new];
+  _writePriority = DPHueCommandPriorityInteractive;
 }
 
 - (NSString *)description {
@@ -108,184 +115,253 @@
     [coder encodeObject:_username forKey:@"username"];
 }
 
+#pragma mark - Setters that invalidate the cached URLs
+
+- (void)setHost:(NSString *)host {
+    @synchronized(self) {
+        _host = [host copy];
+        [self forgetURLs];
+    }
+}
+
+- (void)setUsername:(NSString *)username {
+    @synchronized(self) {
+        _username = [username copy];
+        [self forgetURLs];
+    }
+}
+
+- (void)setNumber:(NSNumber *)number {
+    @synchronized(self) {
+        _number = number;
+        [self forgetURLs];
+    }
+}
+
+- (void)forgetURLs {
+    _cachedBaseURL = nil;
+    _cachedStateURL = nil;
+    _cachedStateCoalescingKey = nil;
+}
+
 #pragma mark - Setters that update pendingChanges
 
 - (void)setOn:(BOOL)on {
-    _on = on;
-    self.pendingChanges[@"on"] = [NSNumber numberWithBool:on];
+    @synchronized(self) {
+        _on = on;
+        self.pendingChanges[@"on"] = [NSNumber numberWithBool:on];
+    }
     if (!self.holdUpdates)
         [self write];
 }
 
 - (void)setBrightness:(NSNumber *)brightness {
-    self.pendingChanges[@"bri"] = (_brightness = @(_clamp_int(brightness.integerValue, 0, 255)));
+    @synchronized(self) {
+        self.pendingChanges[@"bri"] = (_brightness = @(_clamp_int(brightness.integerValue, 0, 255)));
+    }
     if (!self.holdUpdates)
         [self write];
 }
 
 - (void)setHue:(NSNumber *)hue {
-    self.pendingChanges[@"hue"] = (_hue = @(_clamp_int(hue.integerValue, 0, 65535)));
+    @synchronized(self) {
+        self.pendingChanges[@"hue"] = (_hue = @(_clamp_int(hue.integerValue, 0, 65535)));
+    }
     if (!self.holdUpdates)
         [self write];
 }
 
 // This is the closest I've ever come to unintentionally naming a method "sexy"
 - (void)setXy:(NSArray *)xy {
-    _xy = xy;
-    self.pendingChanges[@"xy"] = xy;
+    @synchronized(self) {
+        _xy = xy;
+        self.pendingChanges[@"xy"] = xy;
+    }
     if (!self.holdUpdates)
         [self write];
 }
 
 - (void)setColorTemperature:(NSNumber *)colorTemperature {
-    self.pendingChanges[@"ct"] = (_colorTemperature = @(_clamp_int(colorTemperature.integerValue, 154, 500)));
+    @synchronized(self) {
+        self.pendingChanges[@"ct"] = (_colorTemperature = @(_clamp_int(colorTemperature.integerValue, 154, 500)));
+    }
     if (!self.holdUpdates)
         [self write];
 }
 
 - (void)setAlert:(NSString *)alert
 {
-  _alert = alert;
-  self.pendingChanges[@"alert"] = alert;
+  @synchronized(self) {
+    _alert = alert;
+    self.pendingChanges[@"alert"] = alert;
+  }
   if (!self.holdUpdates)
     [self write];
 }
 
 - (void)setSaturation:(NSNumber *)saturation {
-    self.pendingChanges[@"sat"] = (_saturation = @(_clamp_int(saturation.integerValue, 0, 255)));
+    @synchronized(self) {
+        self.pendingChanges[@"sat"] = (_saturation = @(_clamp_int(saturation.integerValue, 0, 255)));
+    }
     if (!self.holdUpdates)
         [self write];
 }
 
 - (BOOL)hasPendingChanges {
-    return self.pendingChanges.count > 0;
+    @synchronized(self) {
+        return self.pendingChanges.count > 0;
+    }
 }
 
 #pragma mark - Public API
 
 - (void)alertLight {
-    id pendingChanges = [self.pendingChanges copy];
+    @synchronized(self) {
+        id pendingChanges = [self.pendingChanges copy];
     
-    [self.pendingChanges removeAllObjects];
-    self.pendingChanges[@"alert"] = @"select";
+        [self.pendingChanges removeAllObjects];
+        self.pendingChanges[@"alert"] = @"select";
     
-    [self write];
+        [self write];
     
-    [self.pendingChanges addEntriesFromDictionary:pendingChanges];
+        [self.pendingChanges addEntriesFromDictionary:pendingChanges];
+    }
 }
 
-- (void)readWithCompletionHandler:(void (^ _Nullable )(NSError * _Nullable))completion {
+- (DPHueRequest *)readWithCompletionHandler:(void (^ _Nullable )(NSError * _Nullable))completion {
     NSURLRequest *request = [self requestForGettingLightState];
     DPJSONConnection *connection = [[DPJSONConnection alloc] initWithRequest:request sender:self];
     connection.completionBlock = ^(DPHueLight *sender, id json, NSError *err) {
         if (err) {
-            if (completion)
-                completion(err);
+            [sender callCompletion:completion withError:err];
             return;
         }
 
         if ([json isKindOfClass:[NSArray class]]) {
           NSString *errorDescription = ((NSArray*)json).firstObject[@"error"][@"description"];
           if (errorDescription) {
-            if (completion) {
-              completion([NSError errorWithDomain:@"DPHue" code:5 userInfo:@{NSLocalizedDescriptionKey: errorDescription}]);
-            }
+            [sender callCompletion:completion withError:[NSError errorWithDomain:@"DPHue" code:5 userInfo:@{NSLocalizedDescriptionKey: errorDescription}]];
             return;
           }
         }
         
-        [sender parseLightStateGet:json];
-        if (completion)
-            completion(nil);
+        NSSet<NSString*>* changed = [sender updateWithLightStateGet:json];
+        if (changed.count && sender.number)
+            [sender.bridge updateStateStoreWithChangedLights:@{sender.number: changed} changedGroups:nil];
+        [sender.bridge forgetPolledResponses];
+        [sender callCompletion:completion withError:nil];
     };
     
+    connection.priority = DPHueCommandPriorityBackground;
     if (_bridge) {
-        [_bridge queueCommand:connection maxPerSecond:10];
+        [_bridge queueCommand:connection maxPerSecond:DPHueLightCommandsPerSecond];
     } else {
         [connection start];
     }
+    return [[DPHueRequest alloc] initWithConnections:@[connection]];
 }
 
 - (void)read {
     [self readWithCompletionHandler:nil];
 }
 
-- (void)writeAllWithCompletionHandler:(void (^ _Nullable )(NSError * _Nullable))completion {
-    if (!self.on) {
-        // If bulb is off, it forbids changes, so send none
-        // except to turn it off
+- (DPHueRequest *)writeAllWithCompletionHandler:(void (^ _Nullable )(NSError * _Nullable))completion {
+    @synchronized(self) {
+        if (!self.on) {
+            // If bulb is off, it forbids changes, so send none
+            // except to turn it off
+            self.pendingChanges[@"on"] = [NSNumber numberWithBool:self.on];
+            return [self writeWithCompletionHandler:completion];
+        }
         self.pendingChanges[@"on"] = [NSNumber numberWithBool:self.on];
-        [self writeWithCompletionHandler:completion];
-        return;
-    }
-    self.pendingChanges[@"on"] = [NSNumber numberWithBool:self.on];
-    self.pendingChanges[@"alert"] = self.alert;
-    self.pendingChanges[@"bri"] = self.brightness;
-    // colorMode is set by the bulb itself
-    // whichever color value you sent it last determines the mode
-    if ([self.colorMode isEqualToString:@"hue"]) {
-        self.pendingChanges[@"hue"] = self.hue;
-        self.pendingChanges[@"sat"] = self.saturation;
-    }
-    if ([self.colorMode isEqualToString:@"xy"]) {
-        self.pendingChanges[@"xy"] = self.xy;
-    }
-    if ([self.colorMode isEqualToString:@"ct"]) {
-        self.pendingChanges[@"ct"] = self.colorTemperature;
+        self.pendingChanges[@"alert"] = self.alert;
+        self.pendingChanges[@"bri"] = self.brightness;
+        // colorMode is set by the bulb itself
+        // whichever color value you sent it last determines the mode
+        if ([self.colorMode isEqualToString:@"hue"]) {
+            self.pendingChanges[@"hue"] = self.hue;
+            self.pendingChanges[@"sat"] = self.saturation;
+        }
+        if ([self.colorMode isEqualToString:@"xy"]) {
+            self.pendingChanges[@"xy"] = self.xy;
+        }
+        if ([self.colorMode isEqualToString:@"ct"]) {
+            self.pendingChanges[@"ct"] = self.colorTemperature;
+        }
+        return [self writeWithCompletionHandler:completion];
     }
-    [self writeWithCompletionHandler:completion];
 }
 
 - (void)writeAll {
     [self writeAllWithCompletionHandler:nil];
 }
 
-- (void)writeWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted {
-  if (!self.pendingChanges.count)
-    return;
-  
-  // This needs to be set each time you send an update, or else it uses a default
-  // value of 4 (400ms):
-  // http://www.developers.meethue.com/watch-transition-time
-  if (self.transitionTime)
-  {
-    self.pendingChanges[@"transitiontime"] = self.transitionTime;
+- (DPHueRequest *)writeWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted {
+  NSURLRequest *request;
+  // Setters may be called on other threads meanwhile
+  @synchronized(self) {
+    if (!self.pendingChanges.count)
+      return nil;
+    
+    // This needs to be set each time you send an update, or else it uses a default
+    // value of 4 (400ms):
+    // http://www.developers.meethue.com/watch-transition-time
+    if (self.transitionTime)
+    {
+      self.pendingChanges[@"transitiontime"] = self.transitionTime;
+    }
+    
+    request = [self requestForSettingLightState:self.pendingChanges];
   }
-  
-  NSURLRequest *request = [self requestForSettingLightState:self.pendingChanges];
 
   DPJSONConnection *connection = [[DPJSONConnection alloc] initWithRequest:request sender:self];
+  connection.coalescingKey = [self coalescingKeyForSettingLightState];
   connection.completionBlock = ^(DPHueLight *sender, id json, NSError *err) {
     if ( err ) {
-      if (onCompleted) {
-        onCompleted(err);
-      }
+      [sender callCompletion:onCompleted withError:err];
       return;
     }
     
     [sender parseLightStateSet:json];
+    // Only the state of the light was written
+    if (self.writeSuccess && sender.number)
+      [sender.bridge updateStateStoreWithChangedLights:@{sender.number: [NSSet set]} changedGroups:nil];
 
     if (onCompleted) {
       if (self.writeSuccess) {
-        onCompleted(nil);
+        [sender callCompletion:onCompleted withError:nil];
       }
       else {
-        onCompleted([NSError errorWithDomain:@"DPHue" code:1 userInfo:@{NSLocalizedDescriptionKey: self.writeMessage}]);
+        [sender callCompletion:onCompleted withError:[NSError errorWithDomain:@"DPHue" code:1 userInfo:@{NSLocalizedDescriptionKey: self.writeMessage}]];
       }
     }
   };
    
+    connection.priority = self.writePriority;
     if (_bridge) {
-        [_bridge queueCommand:connection maxPerSecond:10];
+        [_bridge queueCommand:connection maxPerSecond:DPHueLightCommandsPerSecond];
     } else {
         [connection start];
     }
+    return [[DPHueRequest alloc] initWithConnections:@[connection]];
 }
 
 - (void)write {
     [self writeWithCompletionHandler:nil];
 }
 
+// Connections sent through the bridge complete on its private queue, others on the main queue
+- (void)callCompletion:(void (^)(NSError *))completion withError:(NSError *)err {
+    if (!completion)
+        return;
+    if (_bridge)
+        [_bridge performCallback:^{
+            completion(err);
+        }];
+    else
+        completion(err);
+}
+
 
 #pragma mark - HueAPIJsonParsingHueAPIRequestGeneration
 
@@ -296,30 +372,47 @@
 }
 
 - (NSURL *)baseURL {
-  NSAssert([self.host length], @"No host set");
-  NSAssert([self.username length], @"No username set");
-  NSAssert(self.number != nil, @"No light number set");
-  
-  NSString *basePath = [NSString stringWithFormat:@"http://%@/api/%@/lights/%@",
-                        self.host, self.username, self.number];
-  return [NSURL URLWithString:basePath];
+  @synchronized(self) {
+    if ( !_cachedBaseURL ) {
+      NSAssert([self.host length], @"No host set");
+      NSAssert([self.username length], @"No username set");
+      NSAssert(self.number != nil, @"No light number set");
+      
+      NSString *basePath = [NSString stringWithFormat:@"http://%@/api/%@/lights/%@",
+                            self.host, self.username, self.number];
+      _cachedBaseURL = [NSURL URLWithString:basePath];
+    }
+    return _cachedBaseURL;
+  }
+}
+
+- (NSURL *)stateURL {
+  @synchronized(self) {
+    if ( !_cachedStateURL )
+      _cachedStateURL = [[self baseURL] URLByAppendingPathComponent:@"state"];
+    return _cachedStateURL;
+  }
+}
+
+- (NSString *)coalescingKeyForSettingLightState {
+  @synchronized(self) {
+    if ( !_cachedStateCoalescingKey )
+      _cachedStateCoalescingKey = [@"PUT " stringByAppendingString:[self stateURL].path];
+    return _cachedStateCoalescingKey;
+  }
 }
 
 - (NSURLRequest *)requestForGettingLightState {
-    return [NSURLRequest requestWithURL:[self baseURL]];;
+    return [NSURLRequest requestWithURL:[self baseURL]];
 }
 
 - (NSURLRequest *)requestForSettingLightState:(NSDictionary *)state
 {
-  NSURL *url = [[self baseURL] URLByAppendingPathComponent:@"state"];
-  
-  // JPR TODO: pass and check error
-  NSData *json = [NSJSONSerialization dataWithJSONObject:state options:0 error:nil];
-  NSMutableURLRequest *request = [NSMutableURLRequest new];
-  request.URL = url;
+  NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[self stateURL]];
   request.HTTPMethod = @"PUT";
-  request.HTTPBody = json;
-  return [request copy];
+  request.HTTPBody = [DPHueStateEncoder dataWithState:state];
+  // Not copied; nothing changes it after this
+  return request;
 }
 
 
@@ -328,24 +421,176 @@
 // GET /lights/{id}
 - (instancetype)parseLightStateGet:(id)json
 {
-  // Set these via ivars to avoid the 'pendingUpdates' logic in the setters
-  _name = json[@"name"];
-  _modelid = json[@"modelid"];
-  _swversion = json[@"swversion"];
-  _type = json[@"type"];
-  _brightness = json[@"state"][@"bri"];
-  _colorMode = json[@"state"][@"colormode"];
-  _hue = json[@"state"][@"hue"];
-  _on = [json[@"state"][@"on"] boolValue];
-  _reachable = [json[@"state"][@"reachable"] boolValue];
-  _xy = json[@"state"][@"xy"];
-  _colorTemperature = json[@"state"][@"ct"];
-  _alert = json[@"state"][@"alert"];
-  _saturation = json[@"state"][@"sat"];
-  
+  [self updateWithLightStateGet:json];
   return self;
 }
 
+- (NSSet<NSString *> *)updateWithLightStateGet:(id)json
+{
+  @synchronized(self) {
+    NSMutableSet<NSString *> *changed = [NSMutableSet new];
+    NSDictionary *state = json[@"state"];
+    _needsVerification = NO;
+  
+    // Set these via ivars to avoid the 'pendingUpdates' logic in the setters
+    if ( _value_changed(_name, json[@"name"]) ) {
+      _name = json[@"name"];
+      [changed addObject:@"name"];
+    }
+    if ( _value_changed(_modelid, json[@"modelid"]) ) {
+      _modelid = json[@"modelid"];
+      [changed addObject:@"modelid"];
+    }
+    if ( _value_changed(_swversion, json[@"swversion"]) ) {
+      _swversion = json[@"swversion"];
+      [changed addObject:@"swversion"];
+    }
+    if ( _value_changed(_type, json[@"type"]) ) {
+      _type = json[@"type"];
+      [changed addObject:@"type"];
+    }
+    if ( _value_changed(_colorMode, state[@"colormode"]) ) {
+      _colorMode = state[@"colormode"];
+      [changed addObject:@"colorMode"];
+    }
+    if ( _reachable != [state[@"reachable"] boolValue] ) {
+      _reachable = [state[@"reachable"] boolValue];
+      [changed addObject:@"reachable"];
+    }
+  
+    // Values about to be written win over those of the controller
+    if ( !_pendingChanges[@"on"] && _on != [state[@"on"] boolValue] ) {
+      _on = [state[@"on"] boolValue];
+      [changed addObject:@"on"];
+    }
+    if ( !_pendingChanges[@"bri"] && _value_changed(_brightness, state[@"bri"]) ) {
+      _brightness = state[@"bri"];
+      [changed addObject:@"brightness"];
+    }
+    if ( !_pendingChanges[@"hue"] && _value_changed(_hue, state[@"hue"]) ) {
+      _hue = state[@"hue"];
+      [changed addObject:@"hue"];
+    }
+    if ( !_pendingChanges[@"sat"] && _value_changed(_saturation, state[@"sat"]) ) {
+      _saturation = state[@"sat"];
+      [changed addObject:@"saturation"];
+    }
+    if ( !_pendingChanges[@"xy"] && _value_changed(_xy, state[@"xy"]) ) {
+      _xy = state[@"xy"];
+      [changed addObject:@"xy"];
+    }
+    if ( !_pendingChanges[@"ct"] && _value_changed(_colorTemperature, state[@"ct"]) ) {
+      _colorTemperature = state[@"ct"];
+      [changed addObject:@"colorTemperature"];
+    }
+    if ( !_pendingChanges[@"alert"] && _value_changed(_alert, state[@"alert"]) ) {
+      _alert = state[@"alert"];
+      [changed addObject:@"alert"];
+    }
+  
+    return changed;
+  }
+}
+
+- (NSSet<NSString *> *)updateWithLightStateChanges:(NSDictionary *)state
+{
+  @synchronized(self) {
+    NSMutableSet<NSString *> *changed = [NSMutableSet new];
+  
+    // Only keys present are applied; the rest of the state is left alone
+    if ( state[@"colormode"] && _value_changed(_colorMode, state[@"colormode"]) ) {
+      _colorMode = state[@"colormode"];
+      [changed addObject:@"colorMode"];
+    }
+    if ( state[@"reachable"] && _reachable != [state[@"reachable"] boolValue] ) {
+      _reachable = [state[@"reachable"] boolValue];
+      [changed addObject:@"reachable"];
+    }
+  
+    // Values about to be written win over those of the controller
+    if ( state[@"on"] && !_pendingChanges[@"on"] && _on != [state[@"on"] boolValue] ) {
+      _on = [state[@"on"] boolValue];
+      [changed addObject:@"on"];
+    }
+    if ( state[@"bri"] && !_pendingChanges[@"bri"] && _value_changed(_brightness, state[@"bri"]) ) {
+      _brightness = state[@"bri"];
+      [changed addObject:@"brightness"];
+    }
+    if ( state[@"hue"] && !_pendingChanges[@"hue"] && _value_changed(_hue, state[@"hue"]) ) {
+      _hue = state[@"hue"];
+      [changed addObject:@"hue"];
+    }
+    if ( state[@"sat"] && !_pendingChanges[@"sat"] && _value_changed(_saturation, state[@"sat"]) ) {
+      _saturation = state[@"sat"];
+      [changed addObject:@"saturation"];
+    }
+    if ( state[@"xy"] && !_pendingChanges[@"xy"] && _value_changed(_xy, state[@"xy"]) ) {
+      _xy = state[@"xy"];
+      [changed addObject:@"xy"];
+    }
+    if ( state[@"ct"] && !_pendingChanges[@"ct"] && _value_changed(_colorTemperature, state[@"ct"]) ) {
+      _colorTemperature = state[@"ct"];
+      [changed addObject:@"colorTemperature"];
+    }
+  
+    return changed;
+  }
+}
+
+- (NSSet<NSString *> *)updateWithGroupAction:(NSDictionary *)action ambiguous:(BOOL)ambiguous
+{
+  @synchronized(self) {
+    NSMutableDictionary *state = [NSMutableDictionary new];
+    // The controller records the state of unreachable lights, but they may not show it
+    BOOL unclear = ambiguous || !_reachable;
+  
+    if ( action[@"on"] )
+      state[@"on"] = action[@"on"];
+    if ( action[@"bri"] ) {
+      if ( _brightness )
+        state[@"bri"] = action[@"bri"];
+      else
+        unclear = YES;
+    }
+    if ( action[@"hue"] ) {
+      if ( _hue )
+        state[@"hue"] = action[@"hue"];
+      else
+        unclear = YES;
+    }
+    if ( action[@"sat"] ) {
+      if ( _saturation )
+        state[@"sat"] = action[@"sat"];
+      else
+        unclear = YES;
+    }
+    if ( action[@"xy"] ) {
+      if ( _xy )
+        state[@"xy"] = action[@"xy"];
+      else
+        unclear = YES;
+    }
+    if ( action[@"ct"] ) {
+      if ( _colorTemperature )
+        state[@"ct"] = action[@"ct"];
+      else
+        unclear = YES;
+    }
+  
+    // Given several, the controller uses xy over ct over hue and saturation
+    if ( state[@"xy"] )
+      state[@"colormode"] = @"xy";
+    else if ( state[@"ct"] )
+      state[@"colormode"] = @"ct";
+    else if ( state[@"hue"] || state[@"sat"] )
+      state[@"colormode"] = @"hs";
+  
+    if ( unclear )
+      _needsVerification = YES;
+    return [self updateWithLightStateChanges:state];
+  }
+}
+
 // PUT /lights/{id}/state
 - (instancetype)parseLightStateSet:(id)json
 {
@@ -376,7 +621,9 @@
   {
     _writeSuccess = YES;
     // JPR TODO: should this be done unconditionally?
-    [_pendingChanges removeAllObjects];
+    @synchronized(self) {
+      [_pendingChanges removeAllObjects];
+    }
   }
   
   return self;
@@ -386,4 +633,8 @@ NSInteger _clamp_int(NSInteger number, NSInteger min, NSInteger max) {
     return number < min ? min : (number > max ? max : number);
 }
 
+BOOL _value_changed(id oldValue, id newValue) {
+    return oldValue != newValue && ![oldValue isEqual:newValue];
+}
+
 @end
@@ -8,8 +8,10 @@
 //  https://github.com/danparsons/DPHue
 
 #import <Foundation/Foundation.h>
+#import "DPJSONConnection.h"
 
 @class DPHueBridge;
+@class DPHueRequest;
 
 @interface DPHueLightGroup : NSObject <NSCoding>
 
@@ -71,6 +73,15 @@
 /// YES if it has pending changes that haven't been yet written, otherwise NO
 @property (nonatomic, readonly) BOOL hasPendingChanges;
 
+/**
+ Lane writes wait in while queued by the bridge; reads always wait in
+ @p DPHueCommandPriorityBackground.
+ 
+ @note Set to DPHueCommandPriorityInteractive by default, so writes are sent
+       before background traffic such as reads and schedule writes.
+ */
+@property (atomic, assign) DPHueCommandPriority writePriority;
+
 #pragma mark - Properties you may be interested in reading
 
 /// Group name, as returned by the controller, or as set during group creation.
@@ -100,20 +111,20 @@
 
 #pragma mark - Methods
 
-/// Re-download & parse controller's state for this particular group
-- (void)readWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))completion;
+/// Re-download & parse controller's state for this particular group; returns a handle to cancel it with
+- (DPHueRequest *)readWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))completion;
 
 /// Re-download & parse controller's state for this particular group
 - (void)read;
 
-/// Write only pending changes to controller
-- (void)writeWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted;
+/// Write only pending changes to controller; returns a handle to cancel it with, or nil if nothing is pending
+- (DPHueRequest *)writeWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted;
 
 /// Write only pending changes to controller
 - (void)write;
 
-/// Write entire state to controller, regardless of changes
-- (void)writeAllWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted;
+/// Write entire state to controller, regardless of changes; returns a handle to cancel it with
+- (DPHueRequest *)writeAllWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))onCompleted;
 
 /// Write entire state to controller, regardless of changes
 - (void)writeAll;
@@ -128,6 +139,9 @@
 - (NSURLRequest *)requestForGettingGroupState;
 - (NSURLRequest *)requestForSettingGroupState:(NSDictionary *)state;
 
+/// "PUT <path of the action URL>", for @p DPJSONConnection.coalescingKey; computed once like the URLs.
+- (NSString *)coalescingKeyForSettingGroupState;
+
 @end
 
 
@@ -142,7 +156,30 @@
 // GET /groups/{id}
 - (instancetype)parseGroupStateGet:(id)json;
 
+/**
+ GET /groups/{id}, updating @p self in place. Properties with a pending change
+ keep their local value until it is written.
+
+ @return The names of the properties that changed.
+ */
+- (NSSet<NSString *> *)updateWithGroupStateGet:(id)json;
+
+/**
+ Like @p updateWithGroupStateGet:, with only some keys of the "action" object of a
+ group, e.g. @p {"bri": 127}; properties whose keys are missing keep their value.
+
+ @return The names of the properties that changed.
+ */
+- (NSSet<NSString *> *)updateWithGroupActionChanges:(NSDictionary *)action;
+
 // PUT /groups/{id}/action
 - (instancetype)parseGroupStateSet:(id)json;
 
+/**
+ PUT /groups/{id}/action: the keys of the "action" object the result reports as set,
+ e.g. @p {"on": true, "bri": 200}. Sets @p ambiguous if the result does not tell what
+ the lights now show: errors, relative changes such as @p bri_inc, scenes or effects.
+ */
+- (NSDictionary *)actionConfirmedByGroupStateSet:(id)json ambiguous:(BOOL *)ambiguous;
+
 @end
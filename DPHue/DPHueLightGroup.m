@@ -10,13 +10,19 @@
 #import "DPHueLightGroup.h"
 #import "DPJSONConnection.h"
 #import "DPHueBridge.h"
+#import "DPHueRequest.h"
 #import "DPHueLight.h"
+#import "DPHueStateEncoder.h"
 
 @interface DPHueLightGroup ()
 
 @property (nonatomic, strong) NSMutableDictionary *pendingChanges;
 @property (nonatomic, assign) BOOL writeSuccess;
 @property (nonatomic, strong) NSMutableString *writeMessage;
+// Built once per host, username and number, see forgetURLs
+@property (nonatomic, strong) NSURL *cachedBaseURL;
+@property (nonatomic, strong) NSURL *cachedActionURL;
+@property (nonatomic, copy) NSString *cachedActionCoalescingKey;
 
 @end
 
@@ -39,6 +45,7 @@
 {
   self.holdUpdates = YES;
   self.pendingChanges = [NSMutableDictionary new];
+  self.writePriority = DPHueCommandPriorityInteractive;
 }
 
 #pragma mark - NSCoding
@@ -84,95 +91,143 @@
   [coder encodeObject:_lightIds forKey:@"lightIds"];
 }
 
+#pragma mark - Setters that invalidate the cached URLs
+
+- (void)setHost:(NSString *)host
+{
+  @synchronized(self) {
+    _host = [host copy];
+    [self forgetURLs];
+  }
+}
+
+- (void)setUsername:(NSString *)username
+{
+  @synchronized(self) {
+    _username = [username copy];
+    [self forgetURLs];
+  }
+}
+
+- (void)setNumber:(NSNumber *)number
+{
+  @synchronized(self) {
+    _number = number;
+    [self forgetURLs];
+  }
+}
+
+- (void)forgetURLs
+{
+  _cachedBaseURL = nil;
+  _cachedActionURL = nil;
+  _cachedActionCoalescingKey = nil;
+}
+
 #pragma mark - Setters that update pendingChanges
 
 - (void)setOn:(BOOL)on
 {
-  _on = on;
-  self.pendingChanges[@"on"] = [NSNumber numberWithBool:on];
+  @synchronized(self) {
+    _on = on;
+    self.pendingChanges[@"on"] = [NSNumber numberWithBool:on];
+  }
   if (!self.holdUpdates)
     [self write];
 }
 
 - (void)setBrightness:(NSNumber *)brightness {
-  self.pendingChanges[@"bri"] = (_brightness = @(_clamp_int(brightness.integerValue, 0, 255)));
+  @synchronized(self) {
+    self.pendingChanges[@"bri"] = (_brightness = @(_clamp_int(brightness.integerValue, 0, 255)));
+  }
   if (!self.holdUpdates)
     [self write];
 }
 
 - (void)setHue:(NSNumber *)hue {
-  self.pendingChanges[@"hue"] = (_hue = @(_clamp_int(hue.integerValue, 0, 65535)));
+  @synchronized(self) {
+    self.pendingChanges[@"hue"] = (_hue = @(_clamp_int(hue.integerValue, 0, 65535)));
+  }
   if (!self.holdUpdates)
     [self write];
 }
 
 - (void)setXy:(NSArray *)xy
 {
-  _xy = xy;
-  self.pendingChanges[@"xy"] = xy;
+  @synchronized(self) {
+    _xy = xy;
+    self.pendingChanges[@"xy"] = xy;
+  }
   if (!self.holdUpdates)
     [self write];
 }
 
 - (void)setColorTemperature:(NSNumber *)colorTemperature {
-  self.pendingChanges[@"ct"] = (_colorTemperature = @(_clamp_int(colorTemperature.integerValue, 154, 500)));
+  @synchronized(self) {
+    self.pendingChanges[@"ct"] = (_colorTemperature = @(_clamp_int(colorTemperature.integerValue, 154, 500)));
+  }
   if (!self.holdUpdates)
     [self write];
 }
 
 - (void)setAlert:(NSString *)alert
 {
-  _alert = alert;
-  self.pendingChanges[@"alert"] = alert;
+  @synchronized(self) {
+    _alert = alert;
+    self.pendingChanges[@"alert"] = alert;
+  }
   if (!self.holdUpdates)
     [self write];
 }
 
 - (void)setSaturation:(NSNumber *)saturation {
-  self.pendingChanges[@"sat"] = (_saturation = @(_clamp_int(saturation.integerValue, 0, 255)));
+  @synchronized(self) {
+    self.pendingChanges[@"sat"] = (_saturation = @(_clamp_int(saturation.integerValue, 0, 255)));
+  }
   if (!self.holdUpdates)
     [self write];
 }
 
 - (BOOL)hasPendingChanges {
-    return self.pendingChanges.count > 0;
+    @synchronized(self) {
+        return self.pendingChanges.count > 0;
+    }
 }
 
 #pragma mark - Public API
 
-- (void)readWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))completion
+- (DPHueRequest *)readWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))completion
 {
   NSURLRequest *request = [self requestForGettingGroupState];
   DPJSONConnection *connection = [[DPJSONConnection alloc] initWithRequest:request sender:self];
   connection.completionBlock = ^(DPHueLightGroup *sender, id json, NSError *err) {
     if ( err ) {
-      if (completion) {
-        completion(err);
-      }
+      [sender callCompletion:completion withError:err];
       return;
     }
 
     if ([json isKindOfClass:[NSArray class]]) {
       NSString *errorDescription = ((NSArray*)json).firstObject[@"error"][@"description"];
       if (errorDescription) {
-        if (completion) {
-          completion([NSError errorWithDomain:@"DPHue" code:5 userInfo:@{NSLocalizedDescriptionKey: errorDescription}]);
-        }
+        [sender callCompletion:completion withError:[NSError errorWithDomain:@"DPHue" code:5 userInfo:@{NSLocalizedDescriptionKey: errorDescription}]];
         return;
       }
     }
     
-    [sender parseGroupStateGet:json];
-    if (completion) {
-      completion(nil);
-    }
+    NSSet<NSString *> *changed = [sender updateWithGroupStateGet:json];
+    if (changed.count && sender.number)
+      [sender.bridge updateStateStoreWithChangedLights:nil changedGroups:@{sender.number: changed}];
+    [sender.bridge forgetPolledResponses];
+    [sender callCompletion:completion withError:nil];
   };
   
+    connection.priority = DPHueCommandPriorityBackground;
     if (_bridge) {
-        [_bridge queueCommand:connection maxPerSecond:1];
+        [_bridge queueCommand:connection maxPerSecond:DPHueGroupCommandsPerSecond];
     } else {
         [connection start];
     }
+    return [[DPHueRequest alloc] initWithConnections:@[connection]];
 }
 
 - (void)read
@@ -180,90 +235,113 @@
     [self readWithCompletionHandler:nil];
 }
 
-- (void)writeAllWithCompletionHandler:(void (^ _Nullable )(NSError * _Nullable))completion
+- (DPHueRequest *)writeAllWithCompletionHandler:(void (^ _Nullable )(NSError * _Nullable))completion
 {
-  if (!self.on)
-  {
-    // If bulb is off, it forbids changes, so send none
-    // except to turn it off
+  @synchronized(self) {
+    if (!self.on)
+    {
+      // If bulb is off, it forbids changes, so send none
+      // except to turn it off
+      self.pendingChanges[@"on"] = [NSNumber numberWithBool:self.on];
+      return [self writeWithCompletionHandler:completion];
+    }
+  
     self.pendingChanges[@"on"] = [NSNumber numberWithBool:self.on];
-    [self writeWithCompletionHandler:completion];
-    return;
-  }
+    self.pendingChanges[@"alert"] = self.alert;
+    self.pendingChanges[@"bri"] = self.brightness;
   
-  self.pendingChanges[@"on"] = [NSNumber numberWithBool:self.on];
-  self.pendingChanges[@"alert"] = self.alert;
-  self.pendingChanges[@"bri"] = self.brightness;
+    // colorMode is set by the bulb itself
+    // whichever color value you sent it last determines the mode
+    if ([self.colorMode isEqualToString:@"hue"]) {
+      self.pendingChanges[@"hue"] = self.hue;
+      self.pendingChanges[@"sat"] = self.saturation;
+    }
   
-  // colorMode is set by the bulb itself
-  // whichever color value you sent it last determines the mode
-  if ([self.colorMode isEqualToString:@"hue"]) {
-    self.pendingChanges[@"hue"] = self.hue;
-    self.pendingChanges[@"sat"] = self.saturation;
-  }
+    if ([self.colorMode isEqualToString:@"xy"]) {
+      self.pendingChanges[@"xy"] = self.xy;
+    }
   
-  if ([self.colorMode isEqualToString:@"xy"]) {
-    self.pendingChanges[@"xy"] = self.xy;
-  }
+    if ([self.colorMode isEqualToString:@"ct"]) {
+      self.pendingChanges[@"ct"] = self.colorTemperature;
+    }
   
-  if ([self.colorMode isEqualToString:@"ct"]) {
-    self.pendingChanges[@"ct"] = self.colorTemperature;
+    return [self writeWithCompletionHandler:completion];
   }
-  
-  [self writeWithCompletionHandler:completion];
 }
 
 - (void)writeAll {
     [self writeAllWithCompletionHandler:nil];
 }
 
-- (void)writeWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))completion
+- (DPHueRequest *)writeWithCompletionHandler:(void(^ _Nullable )(NSError* _Nullable error))completion
 {
-  if (!self.pendingChanges.count)
-    return;
-  
-  // This needs to be set each time you send an update, or else it uses a default
-  // value of 4 (400ms):
-  // http://www.developers.meethue.com/watch-transition-time
-  if (self.transitionTime)
-  {
-    self.pendingChanges[@"transitiontime"] = self.transitionTime;
+  NSURLRequest *request;
+  // Setters may be called on other threads meanwhile
+  @synchronized(self) {
+    if (!self.pendingChanges.count)
+      return nil;
+    
+    // This needs to be set each time you send an update, or else it uses a default
+    // value of 4 (400ms):
+    // http://www.developers.meethue.com/watch-transition-time
+    if (self.transitionTime)
+    {
+      self.pendingChanges[@"transitiontime"] = self.transitionTime;
+    }
+    
+    request = [self requestForSettingGroupState:self.pendingChanges];
   }
-  
-  NSURLRequest *request = [self requestForSettingGroupState:self.pendingChanges];
-  
+
   DPJSONConnection *connection = [[DPJSONConnection alloc] initWithRequest:request sender:self];
+  connection.coalescingKey = [self coalescingKeyForSettingGroupState];
   connection.completionBlock = ^(DPHueLightGroup *sender, id json, NSError *err) {
     if ( err ) {
-      if (completion) {
-        completion(err);
-      }
+      [sender callCompletion:completion withError:err];
       return;
     }
 
     [sender parseGroupStateSet:json];
+    // The lights of the group show what the controller confirmed, without reading them
+    BOOL ambiguous = NO;
+    NSDictionary *action = [sender actionConfirmedByGroupStateSet:json ambiguous:&ambiguous];
+    [sender.bridge updateLightsOfGroup:sender withAction:action ambiguous:ambiguous];
 
     if (completion) {
       if (self.writeSuccess) {
-        completion(nil);
+        [sender callCompletion:completion withError:nil];
       }
       else {
-        completion([NSError errorWithDomain:@"DPHue" code:2 userInfo:@{NSLocalizedDescriptionKey: self.writeMessage}]);
+        [sender callCompletion:completion withError:[NSError errorWithDomain:@"DPHue" code:2 userInfo:@{NSLocalizedDescriptionKey: self.writeMessage}]];
       }
     }
   };
   
+    connection.priority = self.writePriority;
     if (_bridge) {
-        [_bridge queueCommand:connection maxPerSecond:1];
+        [_bridge queueCommand:connection maxPerSecond:DPHueGroupCommandsPerSecond];
     } else {
         [connection start];
     }
+    return [[DPHueRequest alloc] initWithConnections:@[connection]];
 }
 
 - (void)write {
     [self writeWithCompletionHandler:nil];
 }
 
+// Connections sent through the bridge complete on its private queue, others on the main queue
+- (void)callCompletion:(void (^)(NSError *))completion withError:(NSError *)err
+{
+  if (!completion)
+    return;
+  if (_bridge)
+    [_bridge performCallback:^{
+      completion(err);
+    }];
+  else
+    completion(err);
+}
+
 
 - (NSString *)description
 {
@@ -288,13 +366,36 @@
 
 - (NSURL *)baseURL
 {
-  NSAssert([self.host length], @"No host set");
-  NSAssert([self.username length], @"No username set");
-  NSAssert(self.number != nil, @"No light number set");
-  
-  NSString *basePath = [NSString stringWithFormat:@"http://%@/api/%@/groups/%@",
-                        self.host, self.username, self.number];
-  return [NSURL URLWithString:basePath];
+  @synchronized(self) {
+    if ( !_cachedBaseURL ) {
+      NSAssert([self.host length], @"No host set");
+      NSAssert([self.username length], @"No username set");
+      NSAssert(self.number != nil, @"No light number set");
+      
+      NSString *basePath = [NSString stringWithFormat:@"http://%@/api/%@/groups/%@",
+                            self.host, self.username, self.number];
+      _cachedBaseURL = [NSURL URLWithString:basePath];
+    }
+    return _cachedBaseURL;
+  }
+}
+
+- (NSURL *)actionURL
+{
+  @synchronized(self) {
+    if ( !_cachedActionURL )
+      _cachedActionURL = [[self baseURL] URLByAppendingPathComponent:@"action"];
+    return _cachedActionURL;
+  }
+}
+
+- (NSString *)coalescingKeyForSettingGroupState
+{
+  @synchronized(self) {
+    if ( !_cachedActionCoalescingKey )
+      _cachedActionCoalescingKey = [@"PUT " stringByAppendingString:[self actionURL].path];
+    return _cachedActionCoalescingKey;
+  }
 }
 
 - (NSURLRequest *)requestForCreatingWithName:(NSString *)groupName lightIds:(NSArray *)lightIds
@@ -308,8 +409,8 @@
   NSURL *url = [NSURL URLWithString:basePath];
   
   NSMutableArray *stringifiedLightIds = [NSMutableArray array];
-  for (NSNumber *lightId in lightIds) {
-    [stringifiedLightIds addObject:[lightId stringValue]];
+  for (id lightId in lightIds) {
+    [stringifiedLightIds addObject:[NSString stringWithFormat:@"%@", lightId]];
   }
   NSDictionary *groupDict = @{@"name": groupName, @"lights": stringifiedLightIds};
   // JPR TODO: pass and check error
@@ -326,8 +427,8 @@
   NSURL *url = [self baseURL];
   
   NSMutableArray *stringifiedLightIds = [NSMutableArray array];
-  for (NSNumber *lightId in lightIds) {
-    [stringifiedLightIds addObject:[lightId stringValue]];
+  for (id lightId in lightIds) {
+    [stringifiedLightIds addObject:[NSString stringWithFormat:@"%@", lightId]];
   }
   NSDictionary *groupDict = @{@"name": groupName, @"lights": stringifiedLightIds};
   // JPR TODO: pass and check error
@@ -349,15 +450,11 @@
 
 - (NSURLRequest *)requestForSettingGroupState:(NSDictionary *)state
 {
-  NSURL *url = [[self baseURL] URLByAppendingPathComponent:@"action"];
-  
-  // JPR TODO: pass and check error
-  NSData *json = [NSJSONSerialization dataWithJSONObject:state options:0 error:nil];
-  NSMutableURLRequest *request = [NSMutableURLRequest new];
-  request.URL = url;
+  NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[self actionURL]];
   request.HTTPMethod = @"PUT";
-  request.HTTPBody = json;
-  return [request copy];
+  request.HTTPBody = [DPHueStateEncoder dataWithState:state];
+  // Not copied; nothing changes it after this
+  return request;
 }
 
 
@@ -382,7 +479,7 @@
     {
       NSRange matchRange = [match rangeAtIndex:1];
       if ( matchRange.location != NSNotFound )
-        _number = @([[idStr substringWithRange:matchRange] integerValue]);
+        self.number = @([[idStr substringWithRange:matchRange] integerValue]);
     }
   }
   
@@ -398,25 +495,109 @@
 // GET /groups/{id}
 - (instancetype)parseGroupStateGet:(id)json
 {
-  // Set these via ivars to avoid the 'pendingUpdates' logic in the setters
-  _name = json[@"name"];
-  _brightness = json[@"action"][@"bri"];
-  _colorMode = json[@"action"][@"colormode"];
-  _hue = json[@"action"][@"hue"];
-  _on = [json[@"action"][@"on"] boolValue];
-  _xy = json[@"action"][@"xy"];
-  _colorTemperature = json[@"action"][@"ct"];
-  _alert = json[@"action"][@"alert"];
-  _saturation = json[@"action"][@"sat"];
+  [self updateWithGroupStateGet:json];
+  return self;
+}
+
+- (NSSet<NSString *> *)updateWithGroupStateGet:(id)json
+{
+  @synchronized(self) {
+    NSMutableSet<NSString *> *changed = [NSMutableSet new];
+    NSDictionary *action = json[@"action"];
   
-  NSMutableArray *tmpLights = [NSMutableArray new];
-  for ( NSString *lightId in json[@"lights"] )
-  {
-    [tmpLights addObject:@([lightId integerValue])];
+    // Set these via ivars to avoid the 'pendingUpdates' logic in the setters
+    if ( _value_changed(_name, json[@"name"]) ) {
+      _name = json[@"name"];
+      [changed addObject:@"name"];
+    }
+    if ( _value_changed(_colorMode, action[@"colormode"]) ) {
+      _colorMode = action[@"colormode"];
+      [changed addObject:@"colorMode"];
+    }
+  
+    // Values about to be written win over those of the controller
+    if ( !_pendingChanges[@"on"] && _on != [action[@"on"] boolValue] ) {
+      _on = [action[@"on"] boolValue];
+      [changed addObject:@"on"];
+    }
+    if ( !_pendingChanges[@"bri"] && _value_changed(_brightness, action[@"bri"]) ) {
+      _brightness = action[@"bri"];
+      [changed addObject:@"brightness"];
+    }
+    if ( !_pendingChanges[@"hue"] && _value_changed(_hue, action[@"hue"]) ) {
+      _hue = action[@"hue"];
+      [changed addObject:@"hue"];
+    }
+    if ( !_pendingChanges[@"sat"] && _value_changed(_saturation, action[@"sat"]) ) {
+      _saturation = action[@"sat"];
+      [changed addObject:@"saturation"];
+    }
+    if ( !_pendingChanges[@"xy"] && _value_changed(_xy, action[@"xy"]) ) {
+      _xy = action[@"xy"];
+      [changed addObject:@"xy"];
+    }
+    if ( !_pendingChanges[@"ct"] && _value_changed(_colorTemperature, action[@"ct"]) ) {
+      _colorTemperature = action[@"ct"];
+      [changed addObject:@"colorTemperature"];
+    }
+    if ( !_pendingChanges[@"alert"] && _value_changed(_alert, action[@"alert"]) ) {
+      _alert = action[@"alert"];
+      [changed addObject:@"alert"];
+    }
+  
+    NSMutableArray *tmpLights = [NSMutableArray new];
+    for ( NSString *lightId in json[@"lights"] )
+    {
+      [tmpLights addObject:@([lightId integerValue])];
+    }
+    if ( _value_changed(_lightIds, tmpLights) ) {
+      _lightIds = tmpLights;
+      [changed addObject:@"lightIds"];
+    }
+  
+    return changed;
   }
-  _lightIds = tmpLights;
+}
+
+- (NSSet<NSString *> *)updateWithGroupActionChanges:(NSDictionary *)action
+{
+  @synchronized(self) {
+    NSMutableSet<NSString *> *changed = [NSMutableSet new];
   
-  return self;
+    // Only keys present are applied; the rest of the action is left alone
+    if ( action[@"colormode"] && _value_changed(_colorMode, action[@"colormode"]) ) {
+      _colorMode = action[@"colormode"];
+      [changed addObject:@"colorMode"];
+    }
+  
+    // Values about to be written win over those of the controller
+    if ( action[@"on"] && !_pendingChanges[@"on"] && _on != [action[@"on"] boolValue] ) {
+      _on = [action[@"on"] boolValue];
+      [changed addObject:@"on"];
+    }
+    if ( action[@"bri"] && !_pendingChanges[@"bri"] && _value_changed(_brightness, action[@"bri"]) ) {
+      _brightness = action[@"bri"];
+      [changed addObject:@"brightness"];
+    }
+    if ( action[@"hue"] && !_pendingChanges[@"hue"] && _value_changed(_hue, action[@"hue"]) ) {
+      _hue = action[@"hue"];
+      [changed addObject:@"hue"];
+    }
+    if ( action[@"sat"] && !_pendingChanges[@"sat"] && _value_changed(_saturation, action[@"sat"]) ) {
+      _saturation = action[@"sat"];
+      [changed addObject:@"saturation"];
+    }
+    if ( action[@"xy"] && !_pendingChanges[@"xy"] && _value_changed(_xy, action[@"xy"]) ) {
+      _xy = action[@"xy"];
+      [changed addObject:@"xy"];
+    }
+    if ( action[@"ct"] && !_pendingChanges[@"ct"] && _value_changed(_colorTemperature, action[@"ct"]) ) {
+      _colorTemperature = action[@"ct"];
+      [changed addObject:@"colorTemperature"];
+    }
+  
+    return changed;
+  }
 }
 
 // PUT /groups/{id}/action
@@ -448,10 +629,49 @@
   {
     _writeSuccess = YES;
     // JPR TODO: should this be done unconditionally?
-    [_pendingChanges removeAllObjects];
+    @synchronized(self) {
+      [_pendingChanges removeAllObjects];
+    }
   }
   
   return self;
 }
 
+- (NSDictionary *)actionConfirmedByGroupStateSet:(id)json ambiguous:(BOOL *)ambiguous
+{
+  static NSSet *stateKeys = nil;
+  static NSSet *transientKeys = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    stateKeys = [NSSet setWithObjects:@"on", @"bri", @"hue", @"sat", @"xy", @"ct", nil];
+    transientKeys = [NSSet setWithObjects:@"transitiontime", @"alert", nil];
+  });
+  
+  NSMutableDictionary *action = [NSMutableDictionary new];
+  __block BOOL unclear = ![json isKindOfClass:[NSArray class]];
+  for ( NSDictionary *result in unclear ? nil : json )
+  {
+    // Errors say nothing about which lights were changed
+    NSDictionary *success = [result isKindOfClass:[NSDictionary class]] ? result[@"success"] : nil;
+    if ( ![success isKindOfClass:[NSDictionary class]] )
+    {
+      unclear = YES;
+      continue;
+    }
+    
+    // e.g. {"/groups/1/action/bri": 200}
+    [success enumerateKeysAndObjectsUsingBlock:^(id address, id value, BOOL *stop) {
+      NSString *key = [address isKindOfClass:[NSString class]] && [[address stringByDeletingLastPathComponent] hasSuffix:@"/action"] ? [address lastPathComponent] : nil;
+      if ( [stateKeys containsObject:key] )
+        action[key] = value;
+      else if ( ![transientKeys containsObject:key] )
+        unclear = YES;
+    }];
+  }
+  
+  if ( ambiguous )
+    *ambiguous = unclear;
+  return action;
+}
+
 @end
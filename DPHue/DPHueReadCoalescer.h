@@ -0,0 +1,48 @@
+//
+//  DPHueReadCoalescer.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueReadCoalescer makes identical GETs of a bridge share one request. The
+// first read of a URL goes out as usual; reads of the same URL arriving while
+// it is queued or in flight are joined to it, and get its response. Reads
+// completed less than @p freshness seconds ago are answered from memory, and
+// a read of the whole controller state also answers the reads of single
+// lights and groups still pending. Any write forgets what was remembered.
+
+#import <Foundation/Foundation.h>
+
+@class DPJSONConnection;
+
+@interface DPHueReadCoalescer : NSObject
+
+/// How long a completed read is answered from memory, in seconds. Defaults to 0, i.e. never.
+@property (atomic, assign) NSTimeInterval freshness;
+
+/// Number of reads that were joined to an identical one or answered from memory.
+@property (atomic, readonly) NSUInteger sharedCount;
+
+/**
+ Join @p aRead to an identical read that is queued or in flight, or complete it
+ from memory. Set its @p completionBlock and @p completionQueue first.
+
+ @return NO if @p aRead must be sent; it is then the read others are joined to.
+ */
+- (BOOL)shareRead:(DPJSONConnection *)aRead;
+
+/**
+ Complete the pending reads of single lights and groups below @p aBasePath, e.g.
+ "/api/{username}", with their part of @p aState, the JSON of GET @p aBasePath.
+ */
+- (void)answerReadsBelowPath:(NSString *)aBasePath withControllerState:(NSDictionary *)aState;
+
+/**
+ Forget all completed reads, and join no more reads to those already sent, e.g.
+ because a write is about to change the state of the controller.
+ */
+- (void)forgetReads;
+
+@end
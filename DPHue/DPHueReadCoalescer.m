@@ -0,0 +1,137 @@
+//
+//  DPHueReadCoalescer.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueReadCoalescer.h"
+#import "DPJSONConnection.h"
+
+// The response of a read, and when it arrived
+@interface DPHueCompletedRead : NSObject
+
+@property (nonatomic, strong) id json;
+@property (nonatomic, assign) NSTimeInterval completedAt;
+
+@end
+
+@implementation DPHueCompletedRead
+@end
+
+
+@interface DPHueReadCoalescer ()
+
+@property (atomic, readwrite) NSUInteger sharedCount;
+
+@end
+
+@implementation DPHueReadCoalescer {
+    // Reads that are queued or in flight, by URL path
+    NSMutableDictionary<NSString*, DPJSONConnection*>* pending;
+    NSMutableDictionary<NSString*, DPHueCompletedRead*>* completed;
+    // Bumped by forgetReads, so that reads sent before a write are not remembered
+    NSUInteger generation;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        pending = [NSMutableDictionary new];
+        completed = [NSMutableDictionary new];
+    }
+    return self;
+}
+
+- (BOOL)shareRead:(DPJSONConnection *)aRead {
+    NSString* aPath = aRead.request.URL.path;
+    if (!aPath.length)
+        return NO;
+    id aJson = nil;
+    @synchronized(self) {
+        NSTimeInterval aFreshness = self.freshness;
+        DPHueCompletedRead* aCompleted = completed[aPath];
+        if (aCompleted && aFreshness > 0 && [NSProcessInfo processInfo].systemUptime - aCompleted.completedAt <= aFreshness) {
+            aJson = aCompleted.json;
+        } else {
+            DPJSONConnection* aLeader = pending[aPath];
+            if (aLeader && [aLeader joinConnection:aRead]) {
+                self.sharedCount++;
+                return YES;
+            }
+            pending[aPath] = aRead;
+            [self watchRead:aRead path:aPath];
+            return NO;
+        }
+    }
+    self.sharedCount++;
+    [aRead completeWithJSON:aJson error:nil];
+    return YES;
+}
+
+- (void)answerReadsBelowPath:(NSString *)aBasePath withControllerState:(NSDictionary *)aState {
+    if (![aState isKindOfClass:[NSDictionary class]])
+        return;
+    NSMutableArray<DPJSONConnection*>* aReads = [NSMutableArray new];
+    NSMutableArray* aParts = [NSMutableArray new];
+    @synchronized(self) {
+        for (NSString* aPath in pending.allKeys) {
+            // e.g. /api/{username}/lights/3
+            NSString* aSection = aPath.stringByDeletingLastPathComponent;
+            if (![aSection.stringByDeletingLastPathComponent isEqualToString:aBasePath])
+                continue;
+            NSDictionary* aSectionState = aState[aSection.lastPathComponent];
+            if (![aSectionState isKindOfClass:[NSDictionary class]])
+                continue;
+            id aPart = aSectionState[aPath.lastPathComponent];
+            if (![aPart isKindOfClass:[NSDictionary class]])
+                continue;
+            [aReads addObject:pending[aPath]];
+            [aParts addObject:aPart];
+            [pending removeObjectForKey:aPath];
+        }
+    }
+    // Reads still in flight ignore their response once completed
+    for (NSUInteger i = 0; i < aReads.count; i++)
+        [aReads[i] completeWithJSON:aParts[i] error:nil];
+}
+
+- (void)forgetReads {
+    @synchronized(self) {
+        generation++;
+        [completed removeAllObjects];
+        [pending removeAllObjects];
+    }
+}
+
+#pragma mark - Private
+
+// Forget aRead when it completes, and remember its response
+- (void)watchRead:(DPJSONConnection*)aRead path:(NSString*)aPath {
+    NSUInteger aGeneration = generation;
+    void (^aCompletion)(id, id, NSError*) = aRead.completionBlock;
+    __weak typeof(self) wkSelf = self;
+    __weak DPJSONConnection* wkRead = aRead;
+    aRead.completionBlock = ^(id aSender, id aJson, NSError* anError) {
+        [wkSelf read:wkRead path:aPath generation:aGeneration completedWithJSON:anError ? nil : aJson];
+        if (aCompletion)
+            aCompletion(aSender, aJson, anError);
+    };
+}
+
+- (void)read:(DPJSONConnection*)aRead path:(NSString*)aPath generation:(NSUInteger)aGeneration completedWithJSON:(id)aJson {
+    @synchronized(self) {
+        if (aRead && pending[aPath] == aRead)
+            [pending removeObjectForKey:aPath];
+        // Arrays are error results, e.g. not authenticated
+        if (![aJson isKindOfClass:[NSDictionary class]] || self.freshness <= 0 || aGeneration != generation)
+            return;
+        DPHueCompletedRead* aCompleted = [DPHueCompletedRead new];
+        aCompleted.json = aJson;
+        aCompleted.completedAt = [NSProcessInfo processInfo].systemUptime;
+        completed[aPath] = aCompleted;
+    }
+}
+
+@end
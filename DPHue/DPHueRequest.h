@@ -0,0 +1,47 @@
+//
+//  DPHueRequest.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueRequest is returned by reads and writes of DPHueBridge, DPHueLight and
+// DPHueLightGroup. It lets the caller take the request back while it is still
+// waiting in the bridge queue or in flight, and give it a deadline after which
+// it is dropped instead of being sent late.
+
+#import <Foundation/Foundation.h>
+
+@class DPJSONConnection;
+
+@interface DPHueRequest : NSObject
+
+/// A handle for the connections that together make up one read or write.
+- (instancetype)initWithConnections:(NSArray<DPJSONConnection *> *)aConnections;
+
+@property (nonatomic, readonly, copy) NSArray<DPJSONConnection *> *connections;
+
+/// YES once @p cancel was called.
+@property (readonly, getter=isCancelled) BOOL cancelled;
+
+/**
+ Time, as in @p [NSProcessInfo processInfo].systemUptime, after which connections of
+ the request that have not been sent yet are dropped and complete with error code 9.
+ 0, the default, means no deadline.
+ */
+@property (nonatomic, assign) NSTimeInterval deadline;
+
+/// Set @p deadline to @p aTimeout seconds from now.
+- (void)dropIfNotSentWithin:(NSTimeInterval)aTimeout;
+
+/**
+ Cancel the request. Waiting connections are not sent, those in flight are
+ aborted, and the completion handler is called with @p NSURLErrorCancelled.
+ Writes to the same target that were merged into one request are still sent
+ for the other handles, without the values of this one unless they were sent
+ already. Safe to call from any thread, and more than once.
+ */
+- (void)cancel;
+
+@end
@@ -0,0 +1,52 @@
+//
+//  DPHueRequest.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueRequest.h"
+#import "DPJSONConnection.h"
+
+@implementation DPHueRequest
+
+- (instancetype)initWithConnections:(NSArray<DPJSONConnection *> *)aConnections {
+    self = [super init];
+    if (self) {
+        _connections = [aConnections copy];
+    }
+    return self;
+}
+
+- (BOOL)isCancelled {
+    for (DPJSONConnection* aConnection in _connections)
+        if (!aConnection.cancelled)
+            return NO;
+    return _connections.count > 0;
+}
+
+- (NSTimeInterval)deadline {
+    return _connections.firstObject.deadline;
+}
+
+- (void)setDeadline:(NSTimeInterval)aDeadline {
+    for (DPJSONConnection* aConnection in _connections)
+        aConnection.deadline = aDeadline;
+}
+
+- (void)dropIfNotSentWithin:(NSTimeInterval)aTimeout {
+    self.deadline = [NSProcessInfo processInfo].systemUptime + aTimeout;
+}
+
+- (void)cancel {
+    for (DPJSONConnection* aConnection in _connections)
+        [aConnection cancel];
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p, %lu connections%@>", [self class], self,
+            (unsigned long)_connections.count, self.cancelled ? @", cancelled" : @""];
+}
+
+@end
@@ -6,22 +6,108 @@
 //
 //
 
+#import <Foundation/Foundation.h>
+
 @class DPHueBridge;
 
-@interface DPHueSchedule : NSObject<NSCoding>
+@interface DPHueSchedule : NSObject<NSCoding, NSCopying>
 
 - (instancetype)initWithBridge:(DPHueBridge*)aBridge;
 - (void)write;
 
+/**
+ Create the schedule on the controller, or update it if it has an @p identifier.
+ On success a new schedule's @p identifier is set. Calls back on the bridge's
+ @p callbackQueue.
+ */
+- (void)writeWithCompletion:(void (^)(DPHueSchedule *schedule, NSError *error))aCompletion;
+
+/// Delete the schedule with @p identifier from the controller.
+- (void)deleteWithCompletion:(void (^)(DPHueSchedule *schedule, NSError *error))aCompletion;
+
 @property (strong) NSString *identifier;
 @property (strong) NSString *name;
 @property (strong) NSString *scheduleDescription;
 @property (strong) NSDictionary *command;
 @property (strong) NSDate *date;
 
+/**
+ The body @p write sends: name, description, command and time, as the controller
+ stores them. A schedule read from a controller has the time it was read with, even
+ one @p date cannot express, e.g. a recurring one.
+ */
+@property (readonly) NSDictionary *attributes;
+
+/// The attributes of @p self that @p aSchedule does not have, or has other values for.
+- (NSDictionary *)attributesDifferingFrom:(DPHueSchedule *)aSchedule;
+
+/// Whether the last write or delete succeeded, and what the controller said about it.
+@property (readonly) BOOL writeSuccess;
+@property (readonly) NSString *writeMessage;
+
 @property (nonatomic, copy) NSString* username;
 @property (nonatomic, copy) NSString* host;
 @property (weak) DPHueBridge* bridge;
 
 @end
 
+
+@interface DPHueSchedule (HueAPIRequestGeneration)
+
+// POST /schedules, or PUT /schedules/{id} with an identifier
+- (NSURLRequest *)requestForSettingAttributes:(NSDictionary *)attributes;
+- (NSURLRequest *)requestForDeleting;
+
+@end
+
+
+@interface DPHueSchedule (HueAPIJsonParsing)
+
+// GET /schedules/{id}
+- (instancetype)parseScheduleGet:(id)json;
+
+/**
+ POST /schedules, PUT /schedules/{id} or DELETE /schedules/{id}; sets @p writeSuccess,
+ @p writeMessage, and the @p identifier of a new schedule.
+
+ @return nil, or an error with the controller's descriptions if anything failed.
+ */
+- (NSError *)parseScheduleSet:(id)json;
+
+@end
+
+
+// What DPHueBridge synchronizeSchedules:deletingOthers:completion: did
+@interface DPHueScheduleSyncResult : NSObject
+
+- (instancetype)initWithCreated:(NSArray<DPHueSchedule *> *)aCreated
+                        updated:(NSArray<DPHueSchedule *> *)anUpdated
+                      unchanged:(NSArray<DPHueSchedule *> *)anUnchanged
+                        deleted:(NSArray<DPHueSchedule *> *)aDeleted
+                         errors:(NSMapTable<DPHueSchedule *, NSError *> *)anErrors;
+
+/// Schedules that did not exist on the controller and were created.
+@property (nonatomic, readonly, copy) NSArray<DPHueSchedule *> *created;
+
+/// Schedules that existed with other attributes; only those were written.
+@property (nonatomic, readonly, copy) NSArray<DPHueSchedule *> *updated;
+
+/// Schedules that existed as they are; nothing was sent for them.
+@property (nonatomic, readonly, copy) NSArray<DPHueSchedule *> *unchanged;
+
+/// Schedules of the controller, as read, that were not wanted and were deleted.
+@property (nonatomic, readonly, copy) NSArray<DPHueSchedule *> *deleted;
+
+/// Schedules whose create, update or delete failed, in no particular order.
+@property (nonatomic, readonly, copy) NSArray<DPHueSchedule *> *failed;
+
+/// Why the request for @p aSchedule failed, or nil.
+- (NSError *)errorForSchedule:(DPHueSchedule *)aSchedule;
+
+/// Number of creates, updates and deletes sent.
+@property (nonatomic, readonly) NSUInteger requestCount;
+
+/// YES if nothing failed.
+@property (nonatomic, readonly) BOOL succeeded;
+
+@end
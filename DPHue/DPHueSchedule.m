@@ -10,7 +10,44 @@
 #import "DPHueBridge.h"
 #import "DPJSONConnection.h"
 
-@implementation DPHueSchedule
+#pragma mark - C functions
+
+// Formatters are costly to create; this one is shared by every schedule
+static NSDateFormatter* _TimeFormatter(void) {
+    static NSDateFormatter* aFormatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        aFormatter = [[NSDateFormatter alloc] init];
+        // Fixed format, whatever the user's calendar and 12/24-hour setting
+        [aFormatter setLocale:[NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"]];
+        [aFormatter setTimeZone:[NSTimeZone timeZoneWithAbbreviation:@"UTC"]];
+        [aFormatter setDateFormat:@"yyyy'-'MM'-'dd'T'HH':'mm':'ss"];
+    });
+    return aFormatter;
+}
+
+// Formatters are not thread-safe before iOS 7 and OS X 10.9
+static NSString* _StringFromDate(NSDate* aDate) {
+    NSDateFormatter* aFormatter = _TimeFormatter();
+    @synchronized(aFormatter) {
+        return [aFormatter stringFromDate:aDate];
+    }
+}
+
+static NSDate* _DateFromString(NSString* aString) {
+    if (![aString isKindOfClass:[NSString class]])
+        return nil;
+    NSDateFormatter* aFormatter = _TimeFormatter();
+    @synchronized(aFormatter) {
+        return [aFormatter dateFromString:aString];
+    }
+}
+
+
+@implementation DPHueSchedule {
+    // The time as read from the controller, which need not be a date, e.g. "W124/T10:00:00"
+    NSString* _time;
+}
 
 - (instancetype)initWithBridge:(DPHueBridge*)aBridge {
     self = [super init];
@@ -26,6 +63,23 @@
 - (void)performCommonInit {
 }
 
+#pragma mark - NSCopying
+
+// The outcome of the last write is not copied
+- (id)copyWithZone:(NSZone *)aZone {
+    DPHueSchedule* aCopy = [[[self class] allocWithZone:aZone] init];
+    aCopy->_identifier = _identifier;
+    aCopy->_name = _name;
+    aCopy->_scheduleDescription = _scheduleDescription;
+    aCopy->_command = _command;
+    aCopy->_date = _date;
+    aCopy->_time = _time;
+    aCopy->_username = _username;
+    aCopy->_host = _host;
+    aCopy->_bridge = _bridge;
+    return aCopy;
+}
+
 #pragma mark - NSCoding
 
 - (id)initWithCoder:(NSCoder *)coder
@@ -74,17 +128,22 @@
     return [NSURLRequest requestWithURL:[self baseURL]];;
 }
 
-- (NSURLRequest *)requestForSettingSchedule:(NSDictionary*)aData {
-    NSData *json = [NSJSONSerialization dataWithJSONObject:aData options:0 error:nil];
-    NSMutableURLRequest *request = [NSMutableURLRequest new];
-    request.URL = [self baseURL];
-    request.HTTPMethod = _identifier.length > 0 ? @"PUT" : @"POST";
-    request.HTTPBody = json;
-    return [request copy];
+- (NSURLRequest *)requestForSettingAttributes:(NSDictionary *)anAttributes {
+    BOOL anExisting = _identifier.length > 0;
+    NSURL* aURL = anExisting ? [[self baseURL] URLByAppendingPathComponent:_identifier] : [self baseURL];
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:aURL];
+    request.HTTPMethod = anExisting ? @"PUT" : @"POST";
+    request.HTTPBody = [NSJSONSerialization dataWithJSONObject:anAttributes options:0 error:nil];
+    return request;
 }
 
+- (NSURLRequest *)requestForDeleting {
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[[self baseURL] URLByAppendingPathComponent:_identifier]];
+    request.HTTPMethod = @"DELETE";
+    return request;
+}
 
-- (void)write {
+- (NSDictionary *)attributes {
     NSMutableDictionary *scheduleData = [NSMutableDictionary dictionary];
     
     if (_name.length > 0)
@@ -97,44 +156,144 @@
     if (_command.count > 0)
         scheduleData[@"command"] = _command;
     
-    if (_date != nil) {
-        NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
-        [formatter setTimeZone:[NSTimeZone timeZoneWithAbbreviation:@"UTC"]];
-        [formatter setDateFormat:@"yyyy'-'MM'-'dd'T'HH':'mm':'ss'"];
-        scheduleData[@"time"] = [formatter stringFromDate:_date];
-    }
+    NSString *time = _date ? _StringFromDate(_date) : _time;
+    if (time)
+        scheduleData[@"time"] = time;
     
-    DPJSONConnection *connection = [[DPJSONConnection alloc] initWithRequest:[self requestForSettingSchedule:[NSDictionary dictionaryWithDictionary:scheduleData]] sender:self];
+    return scheduleData;
+}
+
+- (NSDictionary *)attributesDifferingFrom:(DPHueSchedule *)aSchedule {
+    NSDictionary* theirAttributes = aSchedule.attributes;
+    NSMutableDictionary* aDifferences = [NSMutableDictionary dictionary];
+    [self.attributes enumerateKeysAndObjectsUsingBlock:^(NSString* aKey, id aValue, BOOL* aStop) {
+        if (![theirAttributes[aKey] isEqual:aValue])
+            aDifferences[aKey] = aValue;
+    }];
+    return aDifferences;
+}
+
+- (void)write {
+    [self writeWithCompletion:nil];
+}
+
+- (void)writeWithCompletion:(void (^)(DPHueSchedule *, NSError *))aCompletion {
+    [self sendRequest:[self requestForSettingAttributes:self.attributes] completion:aCompletion];
+}
+
+- (void)deleteWithCompletion:(void (^)(DPHueSchedule *, NSError *))aCompletion {
+    NSAssert([self.identifier length], @"No identifier set");
+    [self sendRequest:[self requestForDeleting] completion:aCompletion];
+}
+
+- (void)sendRequest:(NSURLRequest *)aRequest completion:(void (^)(DPHueSchedule *, NSError *))aCompletion {
+    DPHueBridge* aBridge = _bridge;
+    DPJSONConnection *connection = [[DPJSONConnection alloc] initWithRequest:aRequest sender:self];
     connection.completionBlock = ^(DPHueSchedule *sender, id json, NSError *err) {
-        if ( err )
+        NSError* anError = err ?: [sender parseScheduleSet:json];
+        if (!aCompletion)
             return;
-        [sender readFromJSONDictionary:json];
+        if (aBridge)
+            [aBridge performCallback:^{
+                aCompletion(sender, anError);
+            }];
+        else
+            aCompletion(sender, anError);
     };
     
-    if (_bridge) {
-        [_bridge queueCommand:connection maxPerSecond:10];
+    connection.priority = DPHueCommandPriorityMaintenance;
+    if (aBridge) {
+        [aBridge queueCommand:connection maxPerSecond:DPHueLightCommandsPerSecond];
     } else {
         [connection start];
     }
 }
 
-- (void)readFromJSONDictionary:(id)d {
-    if (![d respondsToSelector:@selector(objectForKeyedSubscript:)]) {
-        // We were given an array, not a dict, which means
-        // the Hue is telling us the result of a PUT
-        // Loop through all results, if any are not successful, error out
-        BOOL errorFound = NO;
-        
-        for (NSDictionary *result in d) {
-            if (result[@"error"]) {
-                errorFound = YES;
-                // NSLog(@"%@", result[@"error"]);
-            }
-            if (result[@"success"]) {
-                // NSLog(@"%@", result[@"success"]);
-            }
+#pragma mark - HueAPIJsonParsing
+
+- (instancetype)parseScheduleGet:(id)json {
+    if (![json isKindOfClass:[NSDictionary class]])
+        return self;
+    _name = json[@"name"];
+    _scheduleDescription = json[@"description"];
+    _command = json[@"command"];
+    // Bridges since API 1.2.1 also have "localtime"; "time" is what write sends
+    _time = json[@"time"] ?: json[@"localtime"];
+    _date = _time ? _DateFromString(_time) : nil;
+    return self;
+}
+
+- (NSError *)parseScheduleSet:(id)json {
+    // Loop through all results, if any are not successful, report the whole
+    // process as a failure
+    BOOL errorFound = ![json isKindOfClass:[NSArray class]];
+    NSMutableString *message = [NSMutableString new];
+    
+    for (NSDictionary *result in errorFound ? nil : json) {
+        if (![result isKindOfClass:[NSDictionary class]])
+            continue;
+        if (result[@"error"]) {
+            errorFound = YES;
+            [message appendFormat:@"%@\n", result[@"error"][@"description"] ?: result[@"error"]];
+        }
+        id success = result[@"success"];
+        if (success) {
+            [message appendFormat:@"%@\n", success];
+            // POST answers the id of the new schedule, DELETE "/schedules/{id} deleted"
+            if ([success isKindOfClass:[NSDictionary class]] && [success[@"id"] isKindOfClass:[NSString class]])
+                self.identifier = success[@"id"];
+            else if ([success isKindOfClass:[NSString class]] && [success hasSuffix:@" deleted"])
+                self.identifier = nil;
         }
     }
+    
+    _writeSuccess = !errorFound;
+    _writeMessage = message;
+    if (!errorFound)
+        return nil;
+    return [NSError errorWithDomain:@"DPHue" code:11 userInfo:@{NSLocalizedDescriptionKey: message.length ? message : @"Unexpected response"}];
+}
+
+@end
+
+
+@implementation DPHueScheduleSyncResult {
+    NSMapTable<DPHueSchedule*, NSError*>* errors;
+}
+
+- (instancetype)initWithCreated:(NSArray<DPHueSchedule *> *)aCreated
+                        updated:(NSArray<DPHueSchedule *> *)anUpdated
+                      unchanged:(NSArray<DPHueSchedule *> *)anUnchanged
+                        deleted:(NSArray<DPHueSchedule *> *)aDeleted
+                         errors:(NSMapTable<DPHueSchedule *, NSError *> *)anErrors {
+    self = [super init];
+    if (self) {
+        _created = [aCreated copy];
+        _updated = [anUpdated copy];
+        _unchanged = [anUnchanged copy];
+        _deleted = [aDeleted copy];
+        errors = [anErrors copy];
+        _failed = errors.keyEnumerator.allObjects;
+    }
+    return self;
+}
+
+- (NSError *)errorForSchedule:(DPHueSchedule *)aSchedule {
+    return [errors objectForKey:aSchedule];
+}
+
+- (NSUInteger)requestCount {
+    return _created.count + _updated.count + _deleted.count + _failed.count;
+}
+
+- (BOOL)succeeded {
+    return _failed.count == 0;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %lu created, %lu updated, %lu unchanged, %lu deleted, %lu failed>", NSStringFromClass([self class]),
+            (unsigned long)_created.count, (unsigned long)_updated.count, (unsigned long)_unchanged.count,
+            (unsigned long)_deleted.count, (unsigned long)_failed.count];
 }
 
-@end
\ No newline at end of file
+@end
@@ -0,0 +1,74 @@
+//
+//  DPHueSnapshot.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueSnapshot is a compact, versioned binary image of a bridge, its lights
+// and its groups, meant to be memory-mapped at launch instead of decoding an
+// NSKeyedArchiver archive. Strings such as model ids and firmware versions are
+// stored once, host and username once per bridge, and each light and group is
+// a fixed-size record. Light and group objects are only built from their
+// record when first accessed, so a bridge restored from a snapshot can send
+// writes right away, while a read of the controller reconciles its state.
+
+#import <Foundation/Foundation.h>
+
+@class DPHueBridge;
+@class DPHueSnapshotArray;
+
+/// The snapshot format written by this version of DPHue; other versions are refused.
+extern const uint16_t DPHueSnapshotVersion;
+
+@interface DPHueSnapshot : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/// A snapshot of the bridge as it is now. Pending changes are not included.
++ (NSData *)dataWithBridge:(DPHueBridge *)aBridge;
+
+/**
+ A snapshot backed by @p aData, which is not copied.
+
+ @return nil, with error code 10 in @p anError, if @p aData is not a valid snapshot of this version.
+ */
+- (instancetype)initWithData:(NSData *)aData error:(NSError **)anError;
+
+/// A snapshot memory-mapped from the file at @p aURL.
+- (instancetype)initWithContentsOfURL:(NSURL *)aURL error:(NSError **)anError;
+
+@property (nonatomic, readonly) NSUInteger lightCount;
+@property (nonatomic, readonly) NSUInteger groupCount;
+
+@property (nonatomic, readonly, copy) NSString *host;
+@property (nonatomic, readonly, copy) NSString *mac;
+@property (nonatomic, readonly, copy) NSString *generatedUsername;
+@property (nonatomic, readonly, copy) NSString *legacyUsername;
+@property (nonatomic, readonly, copy) NSString *deviceType;
+@property (nonatomic, readonly, copy) NSString *name;
+@property (nonatomic, readonly, copy) NSString *swversion;
+
+/**
+ The lights of the snapshot, connected to @p aBridge. The array builds each
+ DPHueLight from its record the first time it is accessed, and keeps it.
+ */
+- (DPHueSnapshotArray *)lightsForBridge:(DPHueBridge *)aBridge;
+
+/// Like @p lightsForBridge:, for DPHueLightGroup.
+- (DPHueSnapshotArray *)groupsForBridge:(DPHueBridge *)aBridge;
+
+@end
+
+
+/// The array returned by @p lightsForBridge: and @p groupsForBridge:, sorted by number.
+@interface DPHueSnapshotArray : NSArray
+
+/// The light or group with @p aNumber, found without building the others.
+- (id)objectWithNumber:(NSNumber *)aNumber;
+
+/// The number of lights or groups built so far.
+@property (readonly) NSUInteger builtCount;
+
+@end
@@ -0,0 +1,486 @@
+//
+//  DPHueSnapshot.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueSnapshot.h"
+#import "DPHueBridge.h"
+#import "DPHueLight.h"
+#import "DPHueLightGroup.h"
+
+// Integers are stored as they are in memory; every platform DPHue runs on is little-endian
+#if !__LITTLE_ENDIAN__
+#error DPHueSnapshot assumes a little-endian platform
+#endif
+
+const uint16_t DPHueSnapshotVersion = 1;
+
+static const uint32_t kNoString = UINT32_MAX;
+
+// Bits of present, for values the controller may leave out
+enum {
+    kHasBrightness = 1 << 0,
+    kHasHue = 1 << 1,
+    kHasSaturation = 1 << 2,
+    kHasColorTemperature = 1 << 3,
+    kHasXY = 1 << 4,
+};
+
+// The strings of the bridge, in bridgeStrings of the header
+enum {
+    kBridgeHost,
+    kBridgeMac,
+    kBridgeGeneratedUsername,
+    kBridgeLegacyUsername,
+    kBridgeDeviceType,
+    kBridgeName,
+    kBridgeSwversion,
+    kBridgeStringCount
+};
+
+/*
+ Layout, every part a multiple of 4 bytes:
+ header | string entries | light records | group records | light ids of groups | string bytes
+ */
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t stringCount;
+    uint32_t stringBytes;
+    uint32_t lightCount;
+    uint32_t groupCount;
+    uint32_t lightIdCount;
+    uint32_t bridgeStrings[kBridgeStringCount];
+} DPHueSnapshotHeader;
+
+// UTF-8, relative to the start of the string bytes
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} DPHueSnapshotString;
+
+typedef struct {
+    int32_t number;
+    uint32_t name, modelid, swversion, type, colorMode, alert;
+    float x, y;
+    uint16_t brightness, hue, saturation, colorTemperature;
+    uint16_t present;
+    uint8_t on, reachable;
+} DPHueSnapshotLight;
+
+typedef struct {
+    int32_t number;
+    uint32_t name, colorMode, alert;
+    uint32_t firstLightId, lightIdCount;
+    float x, y;
+    uint16_t brightness, hue, saturation, colorTemperature;
+    uint16_t present;
+    uint8_t on, reserved;
+} DPHueSnapshotGroup;
+
+_Static_assert(sizeof(DPHueSnapshotHeader) == 56, "snapshot header layout");
+_Static_assert(sizeof(DPHueSnapshotLight) == 48, "snapshot light layout");
+_Static_assert(sizeof(DPHueSnapshotGroup) == 44, "snapshot group layout");
+
+// deviceType is private to DPHueBridge
+@interface DPHueBridge (DPHueSnapshot)
+- (NSString *)deviceType;
+@end
+
+@interface DPHueSnapshot ()
+- (id)objectAtIndex:(NSUInteger)anIndex group:(BOOL)aGroup bridge:(DPHueBridge *)aBridge;
+- (int32_t)numberAtIndex:(NSUInteger)anIndex group:(BOOL)aGroup;
+@end
+
+#pragma mark - C functions
+
+// Index of aString in the string table, adding it the first time
+static uint32_t _StringIndex(id aString, NSMutableDictionary<NSString*, NSNumber*>* anIndex, NSMutableData* anEntries, NSMutableData* aBytes) {
+    if (![aString isKindOfClass:[NSString class]])
+        return kNoString;
+    NSNumber* anExisting = anIndex[aString];
+    if (anExisting)
+        return anExisting.unsignedIntValue;
+    NSData* anUTF8 = [aString dataUsingEncoding:NSUTF8StringEncoding];
+    DPHueSnapshotString anEntry = {(uint32_t)aBytes.length, (uint32_t)anUTF8.length};
+    [anEntries appendBytes:&anEntry length:sizeof(anEntry)];
+    [aBytes appendData:anUTF8];
+    uint32_t aResult = (uint32_t)anIndex.count;
+    anIndex[aString] = @(aResult);
+    return aResult;
+}
+
+static uint16_t _Store(NSNumber* aNumber, uint16_t aBit, uint16_t* aPresent) {
+    if (![aNumber isKindOfClass:[NSNumber class]])
+        return 0;
+    *aPresent |= aBit;
+    return (uint16_t)MIN(MAX(aNumber.integerValue, 0), UINT16_MAX);
+}
+
+static void _StoreXY(NSArray* anXY, float* anX, float* anY, uint16_t* aPresent) {
+    if (![anXY isKindOfClass:[NSArray class]] || anXY.count != 2)
+        return;
+    *anX = [anXY[0] floatValue];
+    *anY = [anXY[1] floatValue];
+    *aPresent |= kHasXY;
+}
+
+// The controller sends xy with 4 decimals; undo the float rounding so a refresh does not see a change
+static NSArray* _LoadXY(float anX, float anY) {
+    return @[@(round(anX * 10000.0) / 10000.0), @(round(anY * 10000.0) / 10000.0)];
+}
+
+// The state keys of GET /lights/{id} and /groups/{id} for the values of a record
+static void _LoadState(NSMutableDictionary* aState, uint16_t aPresent, uint16_t aBrightness, uint16_t aHue, uint16_t aSaturation, uint16_t aColorTemperature, float anX, float anY) {
+    if (aPresent & kHasBrightness)
+        aState[@"bri"] = @(aBrightness);
+    if (aPresent & kHasHue)
+        aState[@"hue"] = @(aHue);
+    if (aPresent & kHasSaturation)
+        aState[@"sat"] = @(aSaturation);
+    if (aPresent & kHasColorTemperature)
+        aState[@"ct"] = @(aColorTemperature);
+    if (aPresent & kHasXY)
+        aState[@"xy"] = _LoadXY(anX, anY);
+}
+
+#pragma mark - DPHueSnapshotArray
+
+@implementation DPHueSnapshotArray {
+    DPHueSnapshot* snapshot;
+    __weak DPHueBridge* bridge;
+    BOOL group;
+    NSUInteger count;
+    // NSNull until built
+    NSMutableArray* objects;
+    NSUInteger builtCount;
+}
+
+- (instancetype)initWithSnapshot:(DPHueSnapshot *)aSnapshot bridge:(DPHueBridge *)aBridge group:(BOOL)aGroup {
+    self = [super init];
+    if (self) {
+        snapshot = aSnapshot;
+        bridge = aBridge;
+        group = aGroup;
+        count = aGroup ? aSnapshot.groupCount : aSnapshot.lightCount;
+        objects = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++)
+            [objects addObject:[NSNull null]];
+    }
+    return self;
+}
+
+- (NSUInteger)count {
+    return count;
+}
+
+- (id)objectAtIndex:(NSUInteger)anIndex {
+    @synchronized(self) {
+        id anObject = objects[anIndex];
+        if (anObject == [NSNull null]) {
+            anObject = [snapshot objectAtIndex:anIndex group:group bridge:bridge];
+            objects[anIndex] = anObject;
+            builtCount++;
+        }
+        return anObject;
+    }
+}
+
+- (NSUInteger)builtCount {
+    @synchronized(self) {
+        return builtCount;
+    }
+}
+
+- (id)objectWithNumber:(NSNumber *)aNumber {
+    int32_t aWanted = aNumber.intValue;
+    NSUInteger aLow = 0;
+    NSUInteger aHigh = count;
+    while (aLow < aHigh) {
+        NSUInteger aMiddle = (aLow + aHigh) / 2;
+        int32_t aFound = [snapshot numberAtIndex:aMiddle group:group];
+        if (aFound == aWanted)
+            return [self objectAtIndex:aMiddle];
+        if (aFound < aWanted)
+            aLow = aMiddle + 1;
+        else
+            aHigh = aMiddle;
+    }
+    return nil;
+}
+
+// Immutable; a real copy would build every object
+- (id)copyWithZone:(NSZone *)aZone {
+    return self;
+}
+
+@end
+
+#pragma mark - DPHueSnapshot
+
+@implementation DPHueSnapshot {
+    NSData* data;
+    DPHueSnapshotHeader header;
+    const uint8_t* entries;
+    const uint8_t* lights;
+    const uint8_t* groups;
+    const uint8_t* lightIds;
+    const uint8_t* stringBytes;
+    NSMutableDictionary<NSNumber*, NSString*>* strings;
+}
+
++ (NSData *)dataWithBridge:(DPHueBridge *)aBridge {
+    NSMutableDictionary<NSString*, NSNumber*>* anIndex = [NSMutableDictionary new];
+    NSMutableData* anEntries = [NSMutableData new];
+    NSMutableData* aBytes = [NSMutableData new];
+    NSMutableData* aLightRecords = [NSMutableData new];
+    NSMutableData* aGroupRecords = [NSMutableData new];
+    NSMutableData* aLightIds = [NSMutableData new];
+
+    DPHueSnapshotHeader aHeader = {{'D', 'P', 'H', 'S'}, DPHueSnapshotVersion, 0};
+    aHeader.bridgeStrings[kBridgeHost] = _StringIndex(aBridge.host, anIndex, anEntries, aBytes);
+    aHeader.bridgeStrings[kBridgeMac] = _StringIndex(aBridge.mac, anIndex, anEntries, aBytes);
+    aHeader.bridgeStrings[kBridgeGeneratedUsername] = _StringIndex(aBridge.generatedUsername, anIndex, anEntries, aBytes);
+    aHeader.bridgeStrings[kBridgeLegacyUsername] = _StringIndex(aBridge.legacyUsername, anIndex, anEntries, aBytes);
+    aHeader.bridgeStrings[kBridgeDeviceType] = _StringIndex(aBridge.deviceType, anIndex, anEntries, aBytes);
+    aHeader.bridgeStrings[kBridgeName] = _StringIndex(aBridge.name, anIndex, anEntries, aBytes);
+    aHeader.bridgeStrings[kBridgeSwversion] = _StringIndex(aBridge.swversion, anIndex, anEntries, aBytes);
+
+    // Sorted by number, for objectWithNumber:
+    NSSortDescriptor* aByNumber = [NSSortDescriptor sortDescriptorWithKey:@"number" ascending:YES];
+    for (DPHueLight* aLight in [aBridge.lights sortedArrayUsingDescriptors:@[aByNumber]]) {
+        DPHueSnapshotLight aRecord = {0};
+        @synchronized(aLight) {
+            aRecord.number = aLight.number.intValue;
+            aRecord.name = _StringIndex(aLight.name, anIndex, anEntries, aBytes);
+            aRecord.modelid = _StringIndex(aLight.modelid, anIndex, anEntries, aBytes);
+            aRecord.swversion = _StringIndex(aLight.swversion, anIndex, anEntries, aBytes);
+            aRecord.type = _StringIndex(aLight.type, anIndex, anEntries, aBytes);
+            aRecord.colorMode = _StringIndex(aLight.colorMode, anIndex, anEntries, aBytes);
+            aRecord.alert = _StringIndex(aLight.alert, anIndex, anEntries, aBytes);
+            aRecord.brightness = _Store(aLight.brightness, kHasBrightness, &aRecord.present);
+            aRecord.hue = _Store(aLight.hue, kHasHue, &aRecord.present);
+            aRecord.saturation = _Store(aLight.saturation, kHasSaturation, &aRecord.present);
+            aRecord.colorTemperature = _Store(aLight.colorTemperature, kHasColorTemperature, &aRecord.present);
+            _StoreXY(aLight.xy, &aRecord.x, &aRecord.y, &aRecord.present);
+            aRecord.on = aLight.on;
+            aRecord.reachable = aLight.reachable;
+        }
+        [aLightRecords appendBytes:&aRecord length:sizeof(aRecord)];
+    }
+
+    for (DPHueLightGroup* aGroup in [aBridge.groups sortedArrayUsingDescriptors:@[aByNumber]]) {
+        DPHueSnapshotGroup aRecord = {0};
+        @synchronized(aGroup) {
+            aRecord.number = aGroup.number.intValue;
+            aRecord.name = _StringIndex(aGroup.name, anIndex, anEntries, aBytes);
+            aRecord.colorMode = _StringIndex(aGroup.colorMode, anIndex, anEntries, aBytes);
+            aRecord.alert = _StringIndex(aGroup.alert, anIndex, anEntries, aBytes);
+            aRecord.brightness = _Store(aGroup.brightness, kHasBrightness, &aRecord.present);
+            aRecord.hue = _Store(aGroup.hue, kHasHue, &aRecord.present);
+            aRecord.saturation = _Store(aGroup.saturation, kHasSaturation, &aRecord.present);
+            aRecord.colorTemperature = _Store(aGroup.colorTemperature, kHasColorTemperature, &aRecord.present);
+            _StoreXY(aGroup.xy, &aRecord.x, &aRecord.y, &aRecord.present);
+            aRecord.on = aGroup.on;
+            aRecord.firstLightId = (uint32_t)(aLightIds.length / sizeof(uint32_t));
+            for (NSNumber* aLightId in aGroup.lightIds) {
+                uint32_t anId = aLightId.unsignedIntValue;
+                [aLightIds appendBytes:&anId length:sizeof(anId)];
+            }
+            aRecord.lightIdCount = (uint32_t)(aLightIds.length / sizeof(uint32_t)) - aRecord.firstLightId;
+        }
+        [aGroupRecords appendBytes:&aRecord length:sizeof(aRecord)];
+    }
+
+    // Keep the parts aligned
+    if (aBytes.length % 4)
+        [aBytes increaseLengthBy:4 - aBytes.length % 4];
+
+    aHeader.stringCount = (uint32_t)anIndex.count;
+    aHeader.stringBytes = (uint32_t)aBytes.length;
+    aHeader.lightCount = (uint32_t)(aLightRecords.length / sizeof(DPHueSnapshotLight));
+    aHeader.groupCount = (uint32_t)(aGroupRecords.length / sizeof(DPHueSnapshotGroup));
+    aHeader.lightIdCount = (uint32_t)(aLightIds.length / sizeof(uint32_t));
+
+    NSMutableData* aData = [NSMutableData dataWithCapacity:sizeof(aHeader) + anEntries.length + aLightRecords.length + aGroupRecords.length + aLightIds.length + aBytes.length];
+    [aData appendBytes:&aHeader length:sizeof(aHeader)];
+    [aData appendData:anEntries];
+    [aData appendData:aLightRecords];
+    [aData appendData:aGroupRecords];
+    [aData appendData:aLightIds];
+    [aData appendData:aBytes];
+    return aData;
+}
+
+- (instancetype)initWithContentsOfURL:(NSURL *)aURL error:(NSError **)anError {
+    NSData* aData = [NSData dataWithContentsOfURL:aURL options:NSDataReadingMappedIfSafe error:anError];
+    if (!aData)
+        return nil;
+    return [self initWithData:aData error:anError];
+}
+
+- (instancetype)initWithData:(NSData *)aData error:(NSError **)anError {
+    self = [super init];
+    if (self) {
+        data = aData;
+        strings = [NSMutableDictionary new];
+        if (![self validate]) {
+            if (anError)
+                *anError = [NSError errorWithDomain:@"DPHue" code:10 userInfo:@{NSLocalizedDescriptionKey: @"Not a DPHue snapshot of this version"}];
+            return nil;
+        }
+    }
+    return self;
+}
+
+// Checks the header and that every part and string lies within data
+- (BOOL)validate {
+    if (data.length < sizeof(header))
+        return NO;
+    memcpy(&header, data.bytes, sizeof(header));
+    if (memcmp(header.magic, "DPHS", 4) || header.version != DPHueSnapshotVersion)
+        return NO;
+    uint64_t aLength = sizeof(header)
+        + (uint64_t)header.stringCount * sizeof(DPHueSnapshotString)
+        + (uint64_t)header.lightCount * sizeof(DPHueSnapshotLight)
+        + (uint64_t)header.groupCount * sizeof(DPHueSnapshotGroup)
+        + (uint64_t)header.lightIdCount * sizeof(uint32_t)
+        + header.stringBytes;
+    if (aLength != data.length)
+        return NO;
+    entries = (const uint8_t*)data.bytes + sizeof(header);
+    lights = entries + header.stringCount * sizeof(DPHueSnapshotString);
+    groups = lights + header.lightCount * sizeof(DPHueSnapshotLight);
+    lightIds = groups + header.groupCount * sizeof(DPHueSnapshotGroup);
+    stringBytes = lightIds + header.lightIdCount * sizeof(uint32_t);
+    for (uint32_t i = 0; i < header.stringCount; i++) {
+        DPHueSnapshotString anEntry;
+        memcpy(&anEntry, entries + i * sizeof(anEntry), sizeof(anEntry));
+        if ((uint64_t)anEntry.offset + anEntry.length > header.stringBytes)
+            return NO;
+    }
+    return YES;
+}
+
+- (NSUInteger)lightCount {
+    return header.lightCount;
+}
+
+- (NSUInteger)groupCount {
+    return header.groupCount;
+}
+
+- (NSString *)host {
+    return [self stringAtIndex:header.bridgeStrings[kBridgeHost]];
+}
+
+- (NSString *)mac {
+    return [self stringAtIndex:header.bridgeStrings[kBridgeMac]];
+}
+
+- (NSString *)generatedUsername {
+    return [self stringAtIndex:header.bridgeStrings[kBridgeGeneratedUsername]];
+}
+
+- (NSString *)legacyUsername {
+    return [self stringAtIndex:header.bridgeStrings[kBridgeLegacyUsername]];
+}
+
+- (NSString *)deviceType {
+    return [self stringAtIndex:header.bridgeStrings[kBridgeDeviceType]];
+}
+
+- (NSString *)name {
+    return [self stringAtIndex:header.bridgeStrings[kBridgeName]];
+}
+
+- (NSString *)swversion {
+    return [self stringAtIndex:header.bridgeStrings[kBridgeSwversion]];
+}
+
+- (DPHueSnapshotArray *)lightsForBridge:(DPHueBridge *)aBridge {
+    return [[DPHueSnapshotArray alloc] initWithSnapshot:self bridge:aBridge group:NO];
+}
+
+- (DPHueSnapshotArray *)groupsForBridge:(DPHueBridge *)aBridge {
+    return [[DPHueSnapshotArray alloc] initWithSnapshot:self bridge:aBridge group:YES];
+}
+
+#pragma mark - Private
+
+// Each string is decoded once, and shared by all lights using it
+- (NSString *)stringAtIndex:(uint32_t)anIndex {
+    if (anIndex >= header.stringCount)
+        return nil;
+    @synchronized(self) {
+        NSString* aString = strings[@(anIndex)];
+        if (!aString) {
+            DPHueSnapshotString anEntry;
+            memcpy(&anEntry, entries + anIndex * sizeof(anEntry), sizeof(anEntry));
+            aString = [[NSString alloc] initWithBytes:stringBytes + anEntry.offset length:anEntry.length encoding:NSUTF8StringEncoding] ?: @"";
+            strings[@(anIndex)] = aString;
+        }
+        return aString;
+    }
+}
+
+- (int32_t)numberAtIndex:(NSUInteger)anIndex group:(BOOL)aGroup {
+    int32_t aNumber;
+    // number is the first field of both records
+    const uint8_t* aRecord = aGroup ? groups + anIndex * sizeof(DPHueSnapshotGroup) : lights + anIndex * sizeof(DPHueSnapshotLight);
+    memcpy(&aNumber, aRecord, sizeof(aNumber));
+    return aNumber;
+}
+
+// Builds the object through the same parsing as a read of the controller
+- (id)objectAtIndex:(NSUInteger)anIndex group:(BOOL)aGroup bridge:(DPHueBridge *)aBridge {
+    NSMutableDictionary* aJson = [NSMutableDictionary new];
+    NSMutableDictionary* aState = [NSMutableDictionary new];
+    if (aGroup) {
+        DPHueSnapshotGroup aRecord;
+        memcpy(&aRecord, groups + anIndex * sizeof(aRecord), sizeof(aRecord));
+        aJson[@"name"] = [self stringAtIndex:aRecord.name];
+        aState[@"colormode"] = [self stringAtIndex:aRecord.colorMode];
+        aState[@"alert"] = [self stringAtIndex:aRecord.alert];
+        aState[@"on"] = @(aRecord.on != 0);
+        _LoadState(aState, aRecord.present, aRecord.brightness, aRecord.hue, aRecord.saturation, aRecord.colorTemperature, aRecord.x, aRecord.y);
+        NSMutableArray* aLights = [NSMutableArray new];
+        for (uint32_t i = aRecord.firstLightId; i < header.lightIdCount && i - aRecord.firstLightId < aRecord.lightIdCount; i++) {
+            uint32_t aLightId;
+            memcpy(&aLightId, lightIds + i * sizeof(aLightId), sizeof(aLightId));
+            [aLights addObject:[NSString stringWithFormat:@"%u", aLightId]];
+        }
+        aJson[@"lights"] = aLights;
+        aJson[@"action"] = aState;
+        DPHueLightGroup* aLightGroup = [[DPHueLightGroup alloc] initWithBridge:aBridge];
+        [aLightGroup parseGroupStateGet:aJson];
+        aLightGroup.number = @(aRecord.number);
+        aLightGroup.username = self.generatedUsername ?: @"";
+        aLightGroup.host = self.host ?: @"";
+        return aLightGroup;
+    }
+    DPHueSnapshotLight aRecord;
+    memcpy(&aRecord, lights + anIndex * sizeof(aRecord), sizeof(aRecord));
+    aJson[@"name"] = [self stringAtIndex:aRecord.name];
+    aJson[@"modelid"] = [self stringAtIndex:aRecord.modelid];
+    aJson[@"swversion"] = [self stringAtIndex:aRecord.swversion];
+    aJson[@"type"] = [self stringAtIndex:aRecord.type];
+    aState[@"colormode"] = [self stringAtIndex:aRecord.colorMode];
+    aState[@"alert"] = [self stringAtIndex:aRecord.alert];
+    aState[@"on"] = @(aRecord.on != 0);
+    aState[@"reachable"] = @(aRecord.reachable != 0);
+    _LoadState(aState, aRecord.present, aRecord.brightness, aRecord.hue, aRecord.saturation, aRecord.colorTemperature, aRecord.x, aRecord.y);
+    aJson[@"state"] = aState;
+    DPHueLight* aLight = [[DPHueLight alloc] initWithBridge:aBridge];
+    [aLight parseLightStateGet:aJson];
+    aLight.number = @(aRecord.number);
+    aLight.username = self.generatedUsername ?: @"";
+    aLight.host = self.host ?: @"";
+    return aLight;
+}
+
+@end
@@ -0,0 +1,31 @@
+//
+//  DPHueStateEncoder.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueStateEncoder writes the body of a light state or group action write,
+// e.g. {"on":true,"bri":254,"xy":[0.3127,0.329]}. It knows the keys DPHue
+// writes (on, bri, hue, sat, xy, ct, alert and transitiontime) and formats
+// them into a buffer on the stack, so the only object it allocates is the
+// resulting NSData. Bodies with other keys or values it does not expect are
+// passed on to NSJSONSerialization.
+
+#import <Foundation/Foundation.h>
+
+@interface DPHueStateEncoder : NSObject
+
+/// @p aState as JSON. xy is written with 4 decimals, the precision of the bridge.
++ (NSData *)dataWithState:(NSDictionary *)aState;
+
+/**
+ Write @p aState as JSON into @p aBuffer.
+
+ @return The number of bytes written, or 0 if @p aState has a key or value outside
+         of the fixed set, or does not fit into @p aCapacity bytes.
+ */
++ (NSUInteger)encodeState:(NSDictionary *)aState into:(char *)aBuffer capacity:(NSUInteger)aCapacity;
+
+@end
@@ -0,0 +1,164 @@
+//
+//  DPHueStateEncoder.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueStateEncoder.h"
+
+// Enough for every fixed key with the longest values the bridge accepts
+static const size_t kDPHueStateBufferSize = 256;
+
+typedef enum {
+    kDPHueStateBool,
+    kDPHueStateInteger,
+    kDPHueStateXY,
+    kDPHueStateString,
+} DPHueStateKind;
+
+// In the order they are written
+static const struct {
+    __unsafe_unretained NSString* key;
+    const char* json;
+    DPHueStateKind kind;
+} kDPHueStateKeys[] = {
+    {@"on", "\"on\":", kDPHueStateBool},
+    {@"bri", "\"bri\":", kDPHueStateInteger},
+    {@"hue", "\"hue\":", kDPHueStateInteger},
+    {@"sat", "\"sat\":", kDPHueStateInteger},
+    {@"xy", "\"xy\":", kDPHueStateXY},
+    {@"ct", "\"ct\":", kDPHueStateInteger},
+    {@"alert", "\"alert\":", kDPHueStateString},
+    {@"transitiontime", "\"transitiontime\":", kDPHueStateInteger},
+};
+
+typedef struct {
+    char* bytes;
+    size_t length;
+    size_t capacity;
+} DPHueStateBuffer;
+
+#pragma mark - C functions
+
+static BOOL _Append(DPHueStateBuffer* aBuffer, const char* aBytes, size_t aLength) {
+    if (aBuffer->length + aLength > aBuffer->capacity)
+        return NO;
+    memcpy(aBuffer->bytes + aBuffer->length, aBytes, aLength);
+    aBuffer->length += aLength;
+    return YES;
+}
+
+static BOOL _AppendFormatted(DPHueStateBuffer* aBuffer, const char* aFormat, double aValue) {
+    size_t aRemaining = aBuffer->capacity - aBuffer->length;
+    int aLength = snprintf(aBuffer->bytes + aBuffer->length, aRemaining, aFormat, aValue);
+    if (aLength < 0 || (size_t)aLength >= aRemaining)
+        return NO;
+    aBuffer->length += (size_t)aLength;
+    return YES;
+}
+
+static BOOL _IsBoolean(id aValue) {
+    return CFGetTypeID((__bridge CFTypeRef)aValue) == CFBooleanGetTypeID();
+}
+
+static BOOL _AppendInteger(DPHueStateBuffer* aBuffer, id aValue) {
+    // NSJSONSerialization would write true, false or a fraction
+    if (![aValue isKindOfClass:[NSNumber class]] || _IsBoolean(aValue))
+        return NO;
+    long long anInteger = [aValue longLongValue];
+    if ([aValue doubleValue] != (double)anInteger)
+        return NO;
+    char aDigits[24];
+    int aLength = snprintf(aDigits, sizeof(aDigits), "%lld", anInteger);
+    return aLength > 0 && _Append(aBuffer, aDigits, (size_t)aLength);
+}
+
+static BOOL _AppendXY(DPHueStateBuffer* aBuffer, id aValue) {
+    if (![aValue isKindOfClass:[NSArray class]] || [aValue count] != 2)
+        return NO;
+    id anX = aValue[0];
+    id aY = aValue[1];
+    if (![anX isKindOfClass:[NSNumber class]] || ![aY isKindOfClass:[NSNumber class]] || !isfinite([anX doubleValue]) || !isfinite([aY doubleValue]))
+        return NO;
+    return _Append(aBuffer, "[", 1) && _AppendFormatted(aBuffer, "%.4f", [anX doubleValue])
+        && _Append(aBuffer, ",", 1) && _AppendFormatted(aBuffer, "%.4f", [aY doubleValue])
+        && _Append(aBuffer, "]", 1);
+}
+
+static BOOL _AppendString(DPHueStateBuffer* aBuffer, id aValue) {
+    if (![aValue isKindOfClass:[NSString class]])
+        return NO;
+    char anUTF8[64];
+    if (!CFStringGetCString((__bridge CFStringRef)aValue, anUTF8, sizeof(anUTF8), kCFStringEncodingUTF8))
+        return NO;
+    if (!_Append(aBuffer, "\"", 1))
+        return NO;
+    for (const char* aChar = anUTF8; *aChar; aChar++) {
+        // Values like "lselect" never need more than these escapes
+        if ((unsigned char)*aChar < 0x20)
+            return NO;
+        if ((*aChar == '"' || *aChar == '\\') && !_Append(aBuffer, "\\", 1))
+            return NO;
+        if (!_Append(aBuffer, aChar, 1))
+            return NO;
+    }
+    return _Append(aBuffer, "\"", 1);
+}
+
+#pragma mark - DPHueStateEncoder
+
+@implementation DPHueStateEncoder
+
++ (NSData *)dataWithState:(NSDictionary *)aState {
+    char aBytes[kDPHueStateBufferSize];
+    NSUInteger aLength = [self encodeState:aState into:aBytes capacity:sizeof(aBytes)];
+    if (aLength)
+        return [NSData dataWithBytes:aBytes length:aLength];
+    return [NSJSONSerialization dataWithJSONObject:aState options:0 error:nil];
+}
+
++ (NSUInteger)encodeState:(NSDictionary *)aState into:(char *)aBytes capacity:(NSUInteger)aCapacity {
+    if (![aState isKindOfClass:[NSDictionary class]])
+        return 0;
+    DPHueStateBuffer aBuffer = {aBytes, 0, aCapacity};
+    NSUInteger aWritten = 0;
+    if (!_Append(&aBuffer, "{", 1))
+        return 0;
+    for (size_t i = 0; i < sizeof(kDPHueStateKeys) / sizeof(kDPHueStateKeys[0]); i++) {
+        id aValue = aState[kDPHueStateKeys[i].key];
+        if (!aValue)
+            continue;
+        if (aWritten++ && !_Append(&aBuffer, ",", 1))
+            return 0;
+        const char* aKey = kDPHueStateKeys[i].json;
+        if (!_Append(&aBuffer, aKey, strlen(aKey)))
+            return 0;
+        BOOL anAppended = NO;
+        switch (kDPHueStateKeys[i].kind) {
+            case kDPHueStateBool:
+                anAppended = [aValue isKindOfClass:[NSNumber class]] && ([aValue boolValue] ? _Append(&aBuffer, "true", 4) : _Append(&aBuffer, "false", 5));
+                break;
+            case kDPHueStateInteger:
+                anAppended = _AppendInteger(&aBuffer, aValue);
+                break;
+            case kDPHueStateXY:
+                anAppended = _AppendXY(&aBuffer, aValue);
+                break;
+            case kDPHueStateString:
+                anAppended = _AppendString(&aBuffer, aValue);
+                break;
+        }
+        if (!anAppended)
+            return 0;
+    }
+    // A key outside of the fixed set
+    if (aWritten != aState.count)
+        return 0;
+    if (!_Append(&aBuffer, "}", 1))
+        return 0;
+    return aBuffer.length;
+}
+
+@end
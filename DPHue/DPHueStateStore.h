@@ -0,0 +1,83 @@
+//
+//  DPHueStateStore.h
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+// DPHueStateStore indexes the lights and groups of a bridge: by number, by
+// name, and from each light to the groups it belongs to. The state of the
+// lights is also kept column by column (all brightnesses together, all hues
+// together, ...), so counting or filtering thousands of lights reads a few
+// small C arrays instead of visiting every DPHueLight.
+// A store is safe to use from any thread. Its indexes never change: DPHueBridge
+// builds a new store when lights or groups are added, removed or renamed, or
+// change membership. When only the state of lights changes, it updates their
+// rows in place instead; see @p stateStore.
+
+#import <Foundation/Foundation.h>
+
+@class DPHueLight;
+@class DPHueLightGroup;
+
+/// The values of one light in a DPHueStateStore; -1 where the controller did not report a value.
+typedef struct {
+    int32_t number;
+    BOOL on;
+    BOOL reachable;
+    int32_t brightness;
+    int32_t hue;
+    int32_t saturation;
+    int32_t colorTemperature;
+    /// NAN without a color in xy.
+    float x;
+    float y;
+} DPHueLightAttributes;
+
+@interface DPHueStateStore : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/// Index @p aLights and @p aGroups, in their current state.
+- (instancetype)initWithLights:(NSArray<DPHueLight *> *)aLights groups:(NSArray<DPHueLightGroup *> *)aGroups;
+
+@property (nonatomic, readonly) NSUInteger lightCount;
+@property (nonatomic, readonly) NSUInteger groupCount;
+
+- (DPHueLight *)lightWithId:(NSNumber *)aLightId;
+/// The light with the lowest number among those named @p aName.
+- (DPHueLight *)lightWithName:(NSString *)aName;
+- (DPHueLightGroup *)groupWithId:(NSNumber *)aGroupId;
+/// The group with the lowest number among those named @p aName.
+- (DPHueLightGroup *)groupWithName:(NSString *)aName;
+
+/// The groups whose @p lightIds contain @p aLightId, sorted by number.
+- (NSArray<DPHueLightGroup *> *)groupsContainingLightWithId:(NSNumber *)aLightId;
+
+/// The values of the light with @p aLightId; NO if there is none.
+- (BOOL)getAttributes:(DPHueLightAttributes *)anAttributes ofLightWithId:(NSNumber *)aLightId;
+
+/**
+ Read the values of the lights with @p aLightIds again, without rebuilding the
+ indexes. Their numbers and names must not have changed. Ids of other lights are
+ ignored.
+ */
+- (void)updateLightsWithIds:(id<NSFastEnumeration>)aLightIds;
+
+/// Number of lights that are on.
+- (NSUInteger)countOfLightsOn;
+
+/// Numbers of the lights that are on, or off, sorted.
+- (NSArray<NSNumber *> *)lightIdsWithOn:(BOOL)anOn;
+
+/// Numbers of the lights the controller cannot reach, sorted.
+- (NSArray<NSNumber *> *)unreachableLightIds;
+
+/// Numbers of the lights whose brightness is within @p aMinimum and @p aMaximum, inclusive, sorted.
+- (NSArray<NSNumber *> *)lightIdsWithBrightnessFrom:(NSInteger)aMinimum to:(NSInteger)aMaximum;
+
+/// Numbers of the lights for which @p aTest returns YES, sorted. No DPHueLight is touched.
+- (NSArray<NSNumber *> *)lightIdsPassingTest:(BOOL (^)(const DPHueLightAttributes *anAttributes))aTest;
+
+@end
@@ -0,0 +1,285 @@
+//
+//  DPHueStateStore.m
+//  DPHue
+//
+//  This class is in the public domain.
+//
+//  https://github.com/danparsons/DPHue
+
+#import "DPHueStateStore.h"
+#import "DPHueLight.h"
+#import "DPHueLightGroup.h"
+
+#pragma mark - C functions
+
+static int32_t _Value(NSNumber* aNumber) {
+    return [aNumber isKindOfClass:[NSNumber class]] ? (int32_t)aNumber.integerValue : -1;
+}
+
+// Call with aLight locked; reads and writes update lights under that lock
+static void _GetAttributes(DPHueLight* aLight, DPHueLightAttributes* anAttributes) {
+    anAttributes->number = _Value(aLight.number);
+    anAttributes->on = aLight.on;
+    anAttributes->reachable = aLight.reachable;
+    anAttributes->brightness = _Value(aLight.brightness);
+    anAttributes->hue = _Value(aLight.hue);
+    anAttributes->saturation = _Value(aLight.saturation);
+    anAttributes->colorTemperature = _Value(aLight.colorTemperature);
+    NSArray* anXY = aLight.xy;
+    BOOL aHasXY = [anXY isKindOfClass:[NSArray class]] && anXY.count == 2;
+    anAttributes->x = aHasXY ? [anXY[0] floatValue] : NAN;
+    anAttributes->y = aHasXY ? [anXY[1] floatValue] : NAN;
+}
+
+#pragma mark - DPHueStateStore
+
+@implementation DPHueStateStore {
+    NSArray<DPHueLight*>* lights;
+    NSArray<DPHueLightGroup*>* groups;
+    NSDictionary<NSNumber*, NSNumber*>* lightIndexById;
+    NSDictionary<NSString*, DPHueLight*>* lightsByName;
+    NSDictionary<NSNumber*, DPHueLightGroup*>* groupsById;
+    NSDictionary<NSString*, DPHueLightGroup*>* groupsByName;
+    NSDictionary<NSNumber*, NSArray<DPHueLightGroup*>*>* groupsByLightId;
+    // One column per attribute, indexed like lights; guarded by @synchronized(self)
+    int32_t* numbers;
+    uint8_t* on;
+    uint8_t* reachable;
+    int32_t* brightness;
+    int32_t* hue;
+    int32_t* saturation;
+    int32_t* colorTemperature;
+    float* x;
+    float* y;
+}
+
+- (instancetype)initWithLights:(NSArray<DPHueLight *> *)aLights groups:(NSArray<DPHueLightGroup *> *)aGroups {
+    self = [super init];
+    if (self) {
+        NSSortDescriptor* aByNumber = [NSSortDescriptor sortDescriptorWithKey:@"number" ascending:YES];
+        lights = [aLights sortedArrayUsingDescriptors:@[aByNumber]];
+        groups = [aGroups sortedArrayUsingDescriptors:@[aByNumber]];
+        [self indexLights];
+        [self indexGroups];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(numbers);
+    free(on);
+    free(reachable);
+    free(brightness);
+    free(hue);
+    free(saturation);
+    free(colorTemperature);
+    free(x);
+    free(y);
+}
+
+- (void)indexLights {
+    NSUInteger aCount = lights.count;
+    numbers = calloc(MAX(aCount, 1), sizeof(int32_t));
+    on = calloc(MAX(aCount, 1), sizeof(uint8_t));
+    reachable = calloc(MAX(aCount, 1), sizeof(uint8_t));
+    brightness = calloc(MAX(aCount, 1), sizeof(int32_t));
+    hue = calloc(MAX(aCount, 1), sizeof(int32_t));
+    saturation = calloc(MAX(aCount, 1), sizeof(int32_t));
+    colorTemperature = calloc(MAX(aCount, 1), sizeof(int32_t));
+    x = calloc(MAX(aCount, 1), sizeof(float));
+    y = calloc(MAX(aCount, 1), sizeof(float));
+    NSMutableDictionary<NSNumber*, NSNumber*>* anIndexById = [NSMutableDictionary dictionaryWithCapacity:aCount];
+    NSMutableDictionary<NSString*, DPHueLight*>* aByName = [NSMutableDictionary dictionaryWithCapacity:aCount];
+    DPHueLightAttributes anAttributes;
+    for (NSUInteger i = 0; i < aCount; i++) {
+        DPHueLight* aLight = lights[i];
+        @synchronized(aLight) {
+            _GetAttributes(aLight, &anAttributes);
+            [self setAttributes:&anAttributes atIndex:i];
+            if (aLight.number)
+                anIndexById[aLight.number] = @(i);
+            if (aLight.name && !aByName[aLight.name])
+                aByName[aLight.name] = aLight;
+        }
+    }
+    lightIndexById = anIndexById;
+    lightsByName = aByName;
+}
+
+// Called while synchronized, or before anyone else can see us
+- (void)setAttributes:(const DPHueLightAttributes*)anAttributes atIndex:(NSUInteger)i {
+    numbers[i] = anAttributes->number;
+    on[i] = anAttributes->on;
+    reachable[i] = anAttributes->reachable;
+    brightness[i] = anAttributes->brightness;
+    hue[i] = anAttributes->hue;
+    saturation[i] = anAttributes->saturation;
+    colorTemperature[i] = anAttributes->colorTemperature;
+    x[i] = anAttributes->x;
+    y[i] = anAttributes->y;
+}
+
+- (void)indexGroups {
+    NSMutableDictionary<NSNumber*, DPHueLightGroup*>* aById = [NSMutableDictionary dictionaryWithCapacity:groups.count];
+    NSMutableDictionary<NSString*, DPHueLightGroup*>* aByName = [NSMutableDictionary dictionaryWithCapacity:groups.count];
+    NSMutableDictionary<NSNumber*, NSMutableArray<DPHueLightGroup*>*>* aByLightId = [NSMutableDictionary new];
+    for (DPHueLightGroup* aGroup in groups) {
+        NSNumber* aNumber;
+        NSString* aName;
+        NSArray* aLightIds;
+        @synchronized(aGroup) {
+            aNumber = aGroup.number;
+            aName = aGroup.name;
+            aLightIds = aGroup.lightIds;
+        }
+        if (aNumber)
+            aById[aNumber] = aGroup;
+        if (aName && !aByName[aName])
+            aByName[aName] = aGroup;
+        for (NSNumber* aLightId in aLightIds) {
+            NSMutableArray<DPHueLightGroup*>* aMembership = aByLightId[aLightId];
+            if (!aMembership)
+                aByLightId[aLightId] = aMembership = [NSMutableArray new];
+            [aMembership addObject:aGroup];
+        }
+    }
+    groupsById = aById;
+    groupsByName = aByName;
+    groupsByLightId = aByLightId;
+}
+
+#pragma mark - Lookups
+
+- (NSUInteger)lightCount {
+    return lights.count;
+}
+
+- (NSUInteger)groupCount {
+    return groups.count;
+}
+
+- (DPHueLight *)lightWithId:(NSNumber *)aLightId {
+    NSNumber* anIndex = aLightId ? lightIndexById[aLightId] : nil;
+    return anIndex ? lights[anIndex.unsignedIntegerValue] : nil;
+}
+
+- (DPHueLight *)lightWithName:(NSString *)aName {
+    return aName ? lightsByName[aName] : nil;
+}
+
+- (DPHueLightGroup *)groupWithId:(NSNumber *)aGroupId {
+    return aGroupId ? groupsById[aGroupId] : nil;
+}
+
+- (DPHueLightGroup *)groupWithName:(NSString *)aName {
+    return aName ? groupsByName[aName] : nil;
+}
+
+- (NSArray<DPHueLightGroup *> *)groupsContainingLightWithId:(NSNumber *)aLightId {
+    return (aLightId ? groupsByLightId[aLightId] : nil) ?: @[];
+}
+
+#pragma mark - Updates
+
+- (void)updateLightsWithIds:(id<NSFastEnumeration>)aLightIds {
+    for (NSNumber* aLightId in aLightIds) {
+        NSNumber* anIndex = [aLightId isKindOfClass:[NSNumber class]] ? lightIndexById[aLightId] : nil;
+        if (!anIndex)
+            continue;
+        DPHueLight* aLight = lights[anIndex.unsignedIntegerValue];
+        // Never both locks at once, as scans call out while holding ours
+        DPHueLightAttributes anAttributes;
+        @synchronized(aLight) {
+            _GetAttributes(aLight, &anAttributes);
+        }
+        @synchronized(self) {
+            [self setAttributes:&anAttributes atIndex:anIndex.unsignedIntegerValue];
+        }
+    }
+}
+
+#pragma mark - Scans
+
+- (BOOL)getAttributes:(DPHueLightAttributes *)anAttributes ofLightWithId:(NSNumber *)aLightId {
+    NSNumber* anIndex = aLightId ? lightIndexById[aLightId] : nil;
+    if (!anIndex)
+        return NO;
+    if (anAttributes)
+        @synchronized(self) {
+            [self getAttributes:anAttributes atIndex:anIndex.unsignedIntegerValue];
+        }
+    return YES;
+}
+
+// Called while synchronized
+- (void)getAttributes:(DPHueLightAttributes *)anAttributes atIndex:(NSUInteger)i {
+    anAttributes->number = numbers[i];
+    anAttributes->on = on[i];
+    anAttributes->reachable = reachable[i];
+    anAttributes->brightness = brightness[i];
+    anAttributes->hue = hue[i];
+    anAttributes->saturation = saturation[i];
+    anAttributes->colorTemperature = colorTemperature[i];
+    anAttributes->x = x[i];
+    anAttributes->y = y[i];
+}
+
+- (NSUInteger)countOfLightsOn {
+    NSUInteger aCount = 0;
+    @synchronized(self) {
+        for (NSUInteger i = 0, n = lights.count; i < n; i++)
+            aCount += on[i];
+    }
+    return aCount;
+}
+
+- (NSArray<NSNumber *> *)lightIdsWithOn:(BOOL)anOn {
+    NSMutableArray<NSNumber*>* anIds = [NSMutableArray new];
+    uint8_t aWanted = anOn ? 1 : 0;
+    @synchronized(self) {
+        for (NSUInteger i = 0, n = lights.count; i < n; i++)
+            if (on[i] == aWanted)
+                [anIds addObject:@(numbers[i])];
+    }
+    return anIds;
+}
+
+- (NSArray<NSNumber *> *)unreachableLightIds {
+    NSMutableArray<NSNumber*>* anIds = [NSMutableArray new];
+    @synchronized(self) {
+        for (NSUInteger i = 0, n = lights.count; i < n; i++)
+            if (!reachable[i])
+                [anIds addObject:@(numbers[i])];
+    }
+    return anIds;
+}
+
+- (NSArray<NSNumber *> *)lightIdsWithBrightnessFrom:(NSInteger)aMinimum to:(NSInteger)aMaximum {
+    NSMutableArray<NSNumber*>* anIds = [NSMutableArray new];
+    @synchronized(self) {
+        for (NSUInteger i = 0, n = lights.count; i < n; i++)
+            if (brightness[i] >= 0 && brightness[i] >= aMinimum && brightness[i] <= aMaximum)
+                [anIds addObject:@(numbers[i])];
+    }
+    return anIds;
+}
+
+- (NSArray<NSNumber *> *)lightIdsPassingTest:(BOOL (^)(const DPHueLightAttributes *))aTest {
+    NSMutableArray<NSNumber*>* anIds = [NSMutableArray new];
+    DPHueLightAttributes anAttributes;
+    @synchronized(self) {
+        for (NSUInteger i = 0, n = lights.count; i < n; i++) {
+            [self getAttributes:&anAttributes atIndex:i];
+            if (aTest(&anAttributes))
+                [anIds addObject:@(numbers[i])];
+        }
+    }
+    return anIds;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p, %lu lights, %lu groups>", [self class], self,
+            (unsigned long)lights.count, (unsigned long)groups.count];
+}
+
+@end
@@ -13,16 +13,82 @@
 
 #import <Foundation/Foundation.h>
 
+@class DPHueBridgeMetrics;
+@class DPJSONConnectionRegistry;
+
 
 #define REQUEST_LOGGING_ENABLED 0
 
 
+/// userInfo key holding the HTTP status code of errors caused by an HTTP error status
+extern NSString * const DPJSONConnectionStatusCodeKey;
+
+
+/// The lane a connection waits in while queued by a DPHueBridge, from most to least urgent.
+typedef NS_ENUM(NSInteger, DPHueCommandPriority) {
+    /// Writes a user is waiting to see, e.g. DPHueLight and DPHueLightGroup writes.
+    DPHueCommandPriorityInteractive,
+    /// The default; writes nobody waits for one by one, e.g. animation frames.
+    DPHueCommandPriorityNormal,
+    /// Reads that refresh the model, e.g. DPHueLight and DPHueLightGroup reads.
+    DPHueCommandPriorityBackground,
+    /// Housekeeping, e.g. DPHueSchedule writes.
+    DPHueCommandPriorityMaintenance,
+};
+
+/// Number of DPHueCommandPriority lanes.
+#define DPHueCommandPriorityCount 4
+
+
 @interface DPJSONConnection : NSObject
 
 
 @property (nonatomic, readonly, copy) NSURLRequest *request;
 @property (nonatomic, readonly, strong) id sender;
 
+/// HTTP status code of the last response, or 0 if none was received.
+@property (nonatomic, readonly) NSInteger statusCode;
+
+/// Time from @p start until the last response was received, in seconds.
+@property (nonatomic, readonly) NSTimeInterval roundTripTime;
+
+/// Session the request is sent through by @p start; defaults to @p [NSURLSession sharedSession].
+@property (nonatomic, strong) NSURLSession *session;
+
+/// If set, @p start records the round trip, status code, parse time and bridge errors here.
+@property (nonatomic, strong) DPHueBridgeMetrics *metrics;
+
+/// Queue @p completionBlock is called on; defaults to the main queue.
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t completionQueue;
+#else
+@property (nonatomic, assign) dispatch_queue_t completionQueue;
+#endif
+
+/**
+ Holds on to the connection from the moment it is registered, queued or started,
+ until it completes. Defaults to @p [DPJSONConnectionRegistry sharedRegistry].
+ */
+@property (atomic, strong) DPJSONConnectionRegistry *registry;
+
+/**
+ Time, as in @p [NSProcessInfo processInfo].systemUptime, after which the connection
+ is no longer sent. It then completes with error code 9 instead. 0 means no deadline.
+ */
+@property (atomic, assign) NSTimeInterval deadline;
+
+/// YES once @p cancel was called.
+@property (atomic, readonly) BOOL cancelled;
+
+/// Number of times the connection has been retried by whoever started it.
+@property (nonatomic, assign) NSUInteger retryCount;
+
+/**
+ Lane of the connection while it waits in a @p DPHueBridge queue; defaults to
+ @p DPHueCommandPriorityNormal. Set it before the connection is queued.
+ */
+@property (atomic, assign) DPHueCommandPriority priority;
+
 
 /**
  Completion handler.
@@ -34,12 +100,36 @@
           The result from calling @p [NSJSONSerialization JSONObjectWithData]
           with the result of the request, or nil if unsuccessful.
  @param err
-          Error encountered during request/parsing, or nil if successful.
+          Error encountered during request/parsing, or nil if successful. HTTP error
+          statuses are reported with code 6 and @p DPJSONConnectionStatusCodeKey.
  
- @note Calls back on main queue
+ @note Calls back on @p completionQueue
  */
 @property (nonatomic, copy) void (^completionBlock)(id sender, id json, NSError *err);
 
+/**
+ Identifies the target of a write, e.g. @p "PUT /api/{username}/lights/1/state".
+
+ While a connection is waiting in a @p DPHueBridge queue, later connections with
+ the same key are merged into it instead of being queued separately. Only set this
+ for requests whose body is a JSON object.
+ */
+@property (nonatomic, copy) NSString *coalescingKey;
+
+/**
+ Decodes the response body instead of @p [NSJSONSerialization JSONObjectWithData:options:error:],
+ e.g. to skip parts of it. Called on a background queue.
+ */
+@property (nonatomic, copy) id (^dataDecoder)(NSData *data, NSError **error);
+
+/**
+ Called on a background queue when a response (or a transport error) is received,
+ before @p completionBlock. @p statusCode and @p roundTripTime are already updated,
+ and HTTP error statuses are reported in @p error. Return NO to suppress the
+ completion, e.g. because the connection will be started again.
+ */
+@property (nonatomic, copy) BOOL (^responseInterceptor)(DPJSONConnection *connection, NSError *error);
+
 
 /**
  Create a connection that is ready to go when you call @p start on it.
@@ -52,7 +142,85 @@
  */
 - (id)initWithRequest:(NSURLRequest *)request sender:(id)sender;
 
-/// Initiate the request
+/**
+ Initiate the request, unless it was cancelled or its @p deadline has passed. A
+ cancelled connection that other connections were coalesced into is still sent,
+ for them.
+ */
 - (void)start;
 
+/**
+ Abort the request if it is in flight, or make sure it is never started if it is
+ still waiting, and call @p completionBlock right away with @p NSURLErrorCancelled.
+ Only this connection is cancelled: its values are taken out of a merged body,
+ unless that was sent already, and connections coalesced into it or coalesced
+ together with it are still sent and complete as usual. Safe to call from any thread.
+ */
+- (void)cancel;
+
+/**
+ Complete the connection instead of starting it if it was cancelled or its
+ @p deadline has passed.
+
+ @return YES if the connection must not be started.
+ */
+- (BOOL)dropIfCancelledOrExpired;
+
+/**
+ Merge a later, not yet started connection into this one. The JSON object body of
+ @p aLater is merged into the request of @p self, with the later values winning per
+ key, and when @p self completes the completion blocks of both are called. Anything
+ coalesced into @p aLater comes along. If @p aLater is cancelled later on, the body
+ is merged again from the connections that are left.
+
+ @return NO if @p self has already completed, e.g. because it was cancelled, in
+         which case nothing is merged. YES, without merging anything, if @p aLater
+         was cancelled already.
+ */
+- (BOOL)coalesceConnection:(DPJSONConnection *)aLater;
+
+/**
+ Like @p coalesceConnection:, but for a connection that was created before @p self,
+ so the values of @p self win per key.
+ */
+- (BOOL)coalesceEarlierConnection:(DPJSONConnection *)anEarlier;
+
+/**
+ Let a later, not yet started connection for the same GET share the response of
+ this one: when @p self completes, the completion blocks of both are called with
+ the same JSON. The request of @p self is not changed.
+
+ @return NO if @p self has already completed, in which case nothing is joined.
+ */
+- (BOOL)joinConnection:(DPJSONConnection *)aLater;
+
+/**
+ Call @p completionBlock, and those of any coalesced connections, on @p completionQueue
+ as if the request had completed with @p json and @p err. Used when the response to
+ a connection is obtained without starting it. Does nothing if the connection has
+ already completed.
+ */
+- (void)completeWithJSON:(id)json error:(NSError *)err;
+
+@end
+
+
+/**
+ The connections of one bridge that are waiting or in flight. Adding and removing
+ take constant time, and each registry has its own lock, so bridges do not contend.
+ */
+@interface DPJSONConnectionRegistry : NSObject
+
+/// Registry of connections that are not given one of their own.
++ (instancetype)sharedRegistry;
+
+/// Number of connections waiting or in flight.
+@property (readonly) NSUInteger count;
+
+- (void)addConnection:(DPJSONConnection *)aConnection;
+- (void)removeConnection:(DPJSONConnection *)aConnection;
+
+/// Cancel every connection in the registry.
+- (void)cancelAllConnections;
+
 @end
@@ -8,26 +8,36 @@
 //  https://github.com/danparsons/DPHue
 
 #import "DPJSONConnection.h"
+#import "DPHueBridgeMetrics.h"
+#import "DPHueStateEncoder.h"
 #import "WSLog.h"
 
 
-static const NSObject *CONNECTION_LOCK = nil;
-static NSMutableArray *sharedConnectionList = nil;
+NSString * const DPJSONConnectionStatusCodeKey = @"DPJSONConnectionStatusCode";
 
 
 @interface DPJSONConnection () <NSURLConnectionDataDelegate, NSURLConnectionDelegate>
 
 @property (nonatomic, strong) NSURLSessionDataTask *internalTask;
+@property (nonatomic, strong) NSMutableArray<DPJSONConnection *> *coalescedConnections;
+// Connections whose bodies make up our request, the one winning per key last
+@property (nonatomic, strong) NSMutableArray<DPJSONConnection *> *bodyConnections;
+@property (atomic, readwrite) BOOL cancelled;
 
 @end
 
 
 @implementation DPJSONConnection
-
-+ (void)initialize
 {
-  [super initialize];
-  CONNECTION_LOCK = [NSObject new];
+  // Set once the completion has been reported; guarded by @synchronized(self)
+  BOOL finished;
+  // Set when we were cancelled while carrying coalesced connections that were not.
+  // The request is still sent for them, but our own completion has been reported
+  BOOL detached;
+  // The connection we were coalesced into, which sends our values; guarded by @synchronized(self)
+  __weak DPJSONConnection *carrier;
+  // The JSON object body of our own request, before anything was merged into it
+  NSDictionary *ownBody;
 }
 
 - (id)initWithRequest:(NSURLRequest *)request sender:(id)sender;
@@ -36,6 +46,7 @@ static NSMutableArray *sharedConnectionList = nil;
   {
     _request = request;
     _sender = sender;
+    _priority = DPHueCommandPriorityNormal;
   }
   
   return self;
@@ -43,39 +54,63 @@ static NSMutableArray *sharedConnectionList = nil;
 
 - (void)start
 {
-  // NSMutableArray is not thread-safe, so we need to take care we don't cause
-  // any invalid accesses
-  @synchronized(CONNECTION_LOCK) {
-    if (!sharedConnectionList)
-      sharedConnectionList = [NSMutableArray new];
-    [sharedConnectionList addObject:self];
+  // The registry keeps us alive until we complete. Added before checking, as a
+  // cancel in between would remove us before we were added and leave us there
+  if ( !self.registry )
+    self.registry = [DPJSONConnectionRegistry sharedRegistry];
+  [self.registry addConnection:self];
+
+  if ( [self dropIfCancelledOrExpired] )
+  {
+    [self.registry removeConnection:self];
+    return;
   }
-  
+
   // Avoid if-checks within the `internalTask` completion block
   __weak typeof(self)wkSelf = self;
   void (^innerCompletionBlock)(id, NSError *) = ^(id json, NSError *err) {
     __strong typeof(wkSelf)strongSelf = wkSelf;
-    if ( strongSelf.completionBlock )
+    [strongSelf completeWithJSON:json error:err];
+  };
+  
+  DPHueBridgeMetrics *metrics = self.metrics;
+  [metrics requestStarted];
+  NSTimeInterval startedAt = [NSProcessInfo processInfo].systemUptime;
+  NSURLSession *session = self.session ?: [NSURLSession sharedSession];
+  NSURLSessionDataTask *task = [session dataTaskWithRequest:self.request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+    [metrics requestFinished];
+    __strong typeof(wkSelf)strongSelf = wkSelf;
+    if ( !strongSelf )
+      return;
+    strongSelf->_roundTripTime = [NSProcessInfo processInfo].systemUptime - startedAt;
+    strongSelf->_statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+    [metrics recordRoundTrip:strongSelf.roundTripTime];
+    if ( strongSelf.statusCode )
+      [metrics recordStatusCode:strongSelf.statusCode];
+    else if ( error && !strongSelf.cancelled )
+      [metrics recordTransportError];
+    
+    if ( !error && strongSelf.statusCode >= 400 )
     {
-      dispatch_async(dispatch_get_main_queue(), ^{
-        strongSelf.completionBlock( strongSelf.sender, json, err );
-      });
+      error = [NSError errorWithDomain:@"DPHue" code:6 userInfo:@{NSLocalizedDescriptionKey: [NSHTTPURLResponse localizedStringForStatusCode:strongSelf.statusCode],
+                                                                   DPJSONConnectionStatusCodeKey: @(strongSelf.statusCode)}];
     }
     
-    @synchronized(CONNECTION_LOCK) {
-      [sharedConnectionList removeObject:strongSelf];
-    }
-  };
-  
-  NSURLSession *session = [NSURLSession sharedSession];
-  self.internalTask = [session dataTaskWithRequest:self.request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+    // The interceptor may decide to retry, in which case nothing is reported yet
+    // and the connection stays registered
+    if ( strongSelf.responseInterceptor && !strongSelf.responseInterceptor( strongSelf, error ) )
+      return;
+    
     if ( error )
     {
       innerCompletionBlock( nil, error );
       return;
     }
     
-    NSDictionary *json = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
+    NSTimeInterval parseStartedAt = [NSProcessInfo processInfo].systemUptime;
+    id json = strongSelf.dataDecoder ? strongSelf.dataDecoder( data, &error ) : [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
+    if ( metrics )
+      [[strongSelf class] recordJSON:json parseTime:[NSProcessInfo processInfo].systemUptime - parseStartedAt inMetrics:metrics];
     if ( error )
     {
       innerCompletionBlock( nil, error );
@@ -85,13 +120,284 @@ static NSMutableArray *sharedConnectionList = nil;
     innerCompletionBlock( json, nil );
   }];
   
+  // cancel may have been called on another thread meanwhile
+  @synchronized(self) {
+    if ( finished || (self.cancelled && !detached) )
+      return;
+    self.internalTask = task;
+  }
   [[self class] logPendingRequest:self.request];
-  [self.internalTask resume];
+  [task resume];
+}
+
+- (void)cancel
+{
+  NSURLSessionDataTask *task;
+  DPJSONConnection *current;
+  BOOL carrying;
+  @synchronized(self) {
+    if ( self.cancelled || finished )
+      return;
+    self.cancelled = YES;
+    task = self.internalTask;
+    current = carrier;
+    // What was coalesced into us is still sent, only without our values
+    carrying = self.coalescedConnections.count > 0;
+    if ( carrying )
+    {
+      detached = YES;
+      [self.bodyConnections removeObjectIdenticalTo:self];
+      if ( self.bodyConnections )
+        [self rebuildCoalescedBody];
+    }
+  }
+  
+  // Leave the connection we were coalesced into, so it no longer sends our values.
+  // It may hand us on to another one meanwhile, which then has us instead
+  while ( current && ![current detachConnection:self] )
+  {
+    DPJSONConnection *previous = current;
+    @synchronized(self) {
+      current = carrier;
+    }
+    if ( current == previous )
+      break;
+  }
+  
+  NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+  if ( carrying )
+  {
+    void (^completion)(id, id, NSError *) = self.completionBlock;
+    if ( completion )
+      dispatch_async(self.completionQueue ?: dispatch_get_main_queue(), ^{
+        completion( self.sender, nil, error );
+      });
+    return;
+  }
+  
+  // The task then completes with NSURLErrorCancelled too, which is ignored as we are finished
+  [task cancel];
+  [self completeWithJSON:nil error:error];
+}
+
+- (BOOL)dropIfCancelledOrExpired
+{
+  @synchronized(self) {
+    if ( finished || (self.cancelled && !detached) )
+      return YES;
+  }
+  
+  NSTimeInterval deadline = self.deadline;
+  if ( deadline <= 0 || [NSProcessInfo processInfo].systemUptime <= deadline )
+    return NO;
+  
+  [self completeWithJSON:nil error:[NSError errorWithDomain:@"DPHue" code:9 userInfo:@{NSLocalizedDescriptionKey: @"The deadline of the request passed before it was sent"}]];
+  return YES;
+}
+
+
+- (BOOL)coalesceConnection:(DPJSONConnection *)aLater
+{
+  // Later values win per key
+  return [self mergeConnection:aLater earlier:NO];
+}
+
+- (BOOL)coalesceEarlierConnection:(DPJSONConnection *)anEarlier
+{
+  // Our own values win per key
+  return [self mergeConnection:anEarlier earlier:YES];
+}
+
+- (BOOL)joinConnection:(DPJSONConnection *)aLater
+{
+  @synchronized(self) {
+    if ( finished )
+      return NO;
+    @synchronized(aLater) {
+      // It has reported being cancelled already, so there is nothing left to share
+      if ( aLater.cancelled )
+        return YES;
+      aLater->carrier = self;
+    }
+    if ( !self.coalescedConnections )
+      self.coalescedConnections = [NSMutableArray new];
+    [self.coalescedConnections addObject:aLater];
+    return YES;
+  }
+}
+
+- (BOOL)detachConnection:(DPJSONConnection *)aConnection
+{
+  NSURLSessionDataTask *task;
+  @synchronized(self) {
+    // Our response has been reported to it already
+    if ( finished )
+      return YES;
+    if ( [self.coalescedConnections indexOfObjectIdenticalTo:aConnection] == NSNotFound )
+      return NO;
+    [self.coalescedConnections removeObjectIdenticalTo:aConnection];
+    if ( self.bodyConnections )
+    {
+      [self.bodyConnections removeObjectIdenticalTo:aConnection];
+      [self rebuildCoalescedBody];
+    }
+    if ( !detached || self.coalescedConnections.count )
+      return YES;
+    
+    // We were cancelled ourselves, and nobody is left to send the request for
+    finished = YES;
+    task = self.internalTask;
+  }
+  
+  [task cancel];
+  [self.registry removeConnection:self];
+  return YES;
+}
+
+- (void)completeWithJSON:(id)json error:(NSError *)err
+{
+  NSArray *merged;
+  BOOL reportOwn;
+  @synchronized(self) {
+    if ( finished )
+      return;
+    finished = YES;
+    // Once cancelled, we only carry the coalesced connections
+    reportOwn = !detached;
+    merged = [self.coalescedConnections copy];
+  }
+  
+  // Coalesced connections that were cancelled on their own have already reported that
+  NSMutableArray *coalesced = [NSMutableArray new];
+  for ( DPJSONConnection *connection in merged )
+    if ( [connection markFinished] )
+      [coalesced addObject:connection];
+  
+  [self.registry removeConnection:self];
+  for ( DPJSONConnection *connection in coalesced )
+    [connection.registry removeConnection:connection];
+  
+  if ( !(reportOwn && self.completionBlock) && !coalesced.count )
+    return;
+  
+  dispatch_async(self.completionQueue ?: dispatch_get_main_queue(), ^{
+    if ( reportOwn && self.completionBlock )
+      self.completionBlock( self.sender, json, err );
+    for ( DPJSONConnection *connection in coalesced )
+      if ( connection.completionBlock )
+        connection.completionBlock( connection.sender, json, err );
+  });
 }
 
 
 #pragma mark - Helpers
 
+// Take over another connection together with whatever was coalesced into it
+- (BOOL)mergeConnection:(DPJSONConnection *)other earlier:(BOOL)earlier
+{
+  @synchronized(self) {
+    if ( finished )
+      return NO;
+    if ( !self.coalescedConnections )
+      self.coalescedConnections = [NSMutableArray new];
+    if ( !self.bodyConnections )
+    {
+      // Taken before our request is replaced
+      [self ownBody];
+      self.bodyConnections = [NSMutableArray arrayWithObject:self];
+    }
+    
+    NSArray<DPJSONConnection *> *handles;
+    NSArray<DPJSONConnection *> *bodies;
+    BOOL drop = NO;
+    @synchronized(other) {
+      // It has reported being cancelled already, so there is nothing left to merge
+      if ( other->finished || (other.cancelled && !other->detached) )
+        return YES;
+      [other ownBody];
+      bodies = other.bodyConnections ?: @[other];
+      handles = other.coalescedConnections ?: @[];
+      // Once cancelled, it only carried the others, which are ours now
+      if ( other->detached )
+        drop = other->finished = YES;
+      else
+        handles = [@[other] arrayByAddingObjectsFromArray:handles];
+      other.coalescedConnections = nil;
+      other.bodyConnections = nil;
+    }
+    // Those cancelling meanwhile look for us once they find they were handed on
+    for ( DPJSONConnection *connection in handles )
+      @synchronized(connection) {
+        connection->carrier = self;
+      }
+    
+    [self.coalescedConnections addObjectsFromArray:handles];
+    if ( earlier )
+      [self.bodyConnections replaceObjectsInRange:NSMakeRange(0, 0) withObjectsFromArray:bodies];
+    else
+      [self.bodyConnections addObjectsFromArray:bodies];
+    [self rebuildCoalescedBody];
+    if ( drop )
+      [other.registry removeConnection:other];
+    return YES;
+  }
+}
+
+// Called while synchronized
+- (void)rebuildCoalescedBody
+{
+  NSMutableDictionary *body = [NSMutableDictionary new];
+  for ( DPJSONConnection *connection in self.bodyConnections )
+    [body addEntriesFromDictionary:[connection ownBody]];
+  
+  NSMutableURLRequest *request = [self.request mutableCopy];
+  request.HTTPBody = [DPHueStateEncoder dataWithState:body];
+  _request = [request copy];
+}
+
+- (NSDictionary *)ownBody
+{
+  @synchronized(self) {
+    if ( !ownBody )
+      ownBody = [[[self class] JSONObjectBodyOfRequest:self.request] copy];
+    return ownBody;
+  }
+}
+
+// Returns NO if the completion was already reported
+- (BOOL)markFinished
+{
+  @synchronized(self) {
+    if ( finished )
+      return NO;
+    finished = YES;
+    return YES;
+  }
+}
+
++ (NSMutableDictionary *)JSONObjectBodyOfRequest:(NSURLRequest *)request
+{
+  NSData *data = request.HTTPBody;
+  id json = data ? [NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingMutableContainers error:nil] : nil;
+  return [json isKindOfClass:[NSMutableDictionary class]] ? json : [NSMutableDictionary new];
+}
+
+// The bridge answers writes with an array of results, failed ones as {"error": {"type": N, ...}}
++ (void)recordJSON:(id)json parseTime:(NSTimeInterval)parseTime inMetrics:(DPHueBridgeMetrics *)metrics
+{
+  [metrics recordParse:parseTime];
+  if ( ![json isKindOfClass:[NSArray class]] )
+    return;
+  for ( id result in json )
+  {
+    if ( ![result isKindOfClass:[NSDictionary class]] )
+      continue;
+    id error = result[@"error"];
+    if ( [error isKindOfClass:[NSDictionary class]] && [error[@"type"] isKindOfClass:[NSNumber class]] )
+      [metrics recordBridgeErrorType:[error[@"type"] integerValue]];
+  }
+}
+
 + (void)logPendingRequest:(NSURLRequest *)request
 {
 #if REQUEST_LOGGING_ENABLED
@@ -104,3 +410,63 @@ static NSMutableArray *sharedConnectionList = nil;
 }
 
 @end
+
+
+@implementation DPJSONConnectionRegistry
+{
+  NSMutableSet<DPJSONConnection *> *connections;
+}
+
++ (instancetype)sharedRegistry
+{
+  static DPJSONConnectionRegistry *shared = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    shared = [DPJSONConnectionRegistry new];
+  });
+  return shared;
+}
+
+- (instancetype)init
+{
+  if (self = [super init])
+  {
+    // Connections hash by identity, so this is a constant time set
+    connections = [NSMutableSet new];
+  }
+  return self;
+}
+
+- (NSUInteger)count
+{
+  @synchronized(self) {
+    return connections.count;
+  }
+}
+
+- (void)addConnection:(DPJSONConnection *)aConnection
+{
+  @synchronized(self) {
+    [connections addObject:aConnection];
+  }
+}
+
+- (void)removeConnection:(DPJSONConnection *)aConnection
+{
+  @synchronized(self) {
+    [connections removeObject:aConnection];
+  }
+}
+
+- (void)cancelAllConnections
+{
+  NSArray<DPJSONConnection *> *all;
+  @synchronized(self) {
+    all = connections.allObjects;
+  }
+  // Cancelling removes the connection, so not while holding the lock
+  for ( DPJSONConnection *connection in all )
+    [connection cancel];
+}
+
+@end